@@ -0,0 +1,349 @@
+#pragma once
+
+/*
+	Atomic counter buffer with no CPU-GPU synchronization in the frame loop (hot path)
+
+	Mapping the counter buffer to reset or read it (glMapNamedBufferRange) waits until every command using the buffer is done, every frame: the CPU cannot
+	prepare the next frame while the GPU draws the current one. Instead:
+	- Reset: the GPU clears the counters (glClearNamedBufferSubData), in order with the draws that use them
+	- Readback: the counters are copied into one slot of a ring (a persistently mapped buffer, one slot per frame in flight) and fenced; the slot is read when
+	  the ring comes back to it, frameCount frames later, only if its fence is already signaled (never waited for: a late slot is skipped)
+	- Debug mode: synchronous maps through Map() between BeginFrame() and EndFrame() are flagged with the time they blocked, and so are the performance
+	  warnings the driver reports meanwhile (KHR_debug; e.g. a buffer mapped while in use); a summary is printed once per second
+
+	FrameTimer measures the frame time (between successive frames) and the render time (CPU side, including any wait for the GPU) to compare both ways.
+*/
+
+#include "sb7.h"
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+class AtomicCounterRing
+{
+public:
+
+	/// <summary>
+	/// Counter buffer of counterCount unsigned ints (initial values, or zeros), read back frameCount frames later
+	/// Storage flags are the counter buffer ones (e.g. GL_MAP_READ_BIT | GL_MAP_WRITE_BIT to keep synchronous maps available)
+	/// </summary>
+	void Create(GLuint counterCount, const GLuint* initialValues = NULL, GLuint frameCount = 3, GLbitfield storageFlags = 0)
+	{
+		this->counterCount = counterCount;
+		this->frameCount = frameCount;
+
+		std::vector<GLuint> values(counterCount, 0);
+		if (initialValues != NULL)
+		{
+			values.assign(initialValues, initialValues + counterCount);
+		}
+		glCreateBuffers(1, &counterBuffer);
+		glNamedBufferStorage(counterBuffer, sizeof(GLuint) * counterCount, values.data(), storageFlags);
+
+		const GLbitfield kReadbackFlags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glCreateBuffers(1, &readbackBuffer);
+		glNamedBufferStorage(readbackBuffer, sizeof(GLuint) * counterCount * frameCount, NULL, kReadbackFlags);
+		readbackData = (const GLuint*)glMapNamedBufferRange(readbackBuffer, 0, sizeof(GLuint) * counterCount * frameCount, kReadbackFlags);
+
+		fences.assign(frameCount, (GLsync)0);
+		frame = 0;
+	}
+
+	void Destroy()
+	{
+		SetDebug(false);
+
+		for (GLsync fence : fences)
+		{
+			glDeleteSync(fence);
+		}
+		fences.clear();
+
+		glUnmapNamedBuffer(readbackBuffer);
+		glDeleteBuffers(1, &readbackBuffer);
+		glDeleteBuffers(1, &counterBuffer);
+	}
+
+	GLuint Buffer() const
+	{
+		return counterBuffer;
+	}
+
+	/// <summary>
+	/// Set count counters from first to a value on the GPU (no wait: ordered with the commands issued before and after)
+	/// </summary>
+	void Reset(GLuint first, GLuint count, GLuint value = 0)
+	{
+		glClearNamedBufferSubData(counterBuffer, GL_R32UI, sizeof(GLuint) * first, sizeof(GLuint) * count, GL_RED_INTEGER, GL_UNSIGNED_INT, &value);
+	}
+
+	void Reset()
+	{
+		Reset(0, counterCount);
+	}
+
+	/// <summary>
+	/// Copy the counters (as the commands issued so far leave them) into this frame slot, and fence it; once per frame
+	/// </summary>
+	void QueueReadback()
+	{
+		GLuint slot = frame % frameCount;
+
+		// Atomic counter writes are shader writes: visible to buffer copies after this barrier
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glCopyNamedBufferSubData(counterBuffer, readbackBuffer, 0, sizeof(GLuint) * counterCount * slot, sizeof(GLuint) * counterCount);
+
+		glDeleteSync(fences[slot]);
+		fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		frame++;
+	}
+
+	/// <summary>
+	/// Counters of frameCount frames ago (the slot next QueueReadback reuses) into values (counterCount), if the GPU already wrote them; never waits
+	/// Call before QueueReadback; returns false if there is nothing new to read
+	/// </summary>
+	bool Read(GLuint* values)
+	{
+		GLuint slot = frame % frameCount;
+		if (fences[slot] == 0)
+		{
+			return false;
+		}
+
+		GLenum status = glClientWaitSync(fences[slot], 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		{
+			lateReadbacks++;
+			return false;
+		}
+
+		glDeleteSync(fences[slot]);
+		fences[slot] = 0;
+
+		for (GLuint i = 0; i < counterCount; i++)
+		{
+			values[i] = readbackData[counterCount * slot + i];
+		}
+
+		return true;
+	}
+
+	/// <summary>
+	/// Synchronous map of the counter buffer (waits for the GPU): flagged in debug mode between BeginFrame and EndFrame
+	/// </summary>
+	void* Map(GLintptr offset, GLsizeiptr length, GLbitfield access)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		void* data = glMapNamedBufferRange(counterBuffer, offset, length, access);
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		if (debug && inFrame)
+		{
+			syncMaps++;
+			syncMapMilliseconds += milliseconds;
+			if (reportedMessages < kMaxReportedMessages)
+			{
+				reportedMessages++;
+				char output[256];
+				sprintf_s(output, sizeof(output), "Atomic counters: synchronous map on the hot path (%s, %lld bytes): blocked %.3f ms.\n",
+					(access & GL_MAP_READ_BIT) != 0 ? "read" : "write", (long long)length, milliseconds);
+				OutputDebugStringA(output);
+			}
+		}
+
+		return data;
+	}
+
+	void Unmap()
+	{
+		glUnmapNamedBuffer(counterBuffer);
+	}
+
+	/// <summary>
+	/// Hot path scope (the frame loop), checked in debug mode
+	/// </summary>
+	void BeginFrame()
+	{
+		inFrame = true;
+	}
+
+	void EndFrame()
+	{
+		inFrame = false;
+
+		if (!debug)
+		{
+			return;
+		}
+
+		std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+		if (std::chrono::duration<double>(now - reportStart).count() < kReportPeriod)
+		{
+			return;
+		}
+
+		char output[256];
+		sprintf_s(output, sizeof(output), "Atomic counters (debug): last %.0f s: %u synchronous maps on the hot path (%.3f ms blocked), %u driver performance warnings, %u late readbacks.\n",
+			kReportPeriod, syncMaps, syncMapMilliseconds, performanceWarnings, lateReadbacks);
+		OutputDebugStringA(output);
+
+		reportStart = now;
+		syncMaps = 0;
+		syncMapMilliseconds = 0.0;
+		performanceWarnings = 0;
+		lateReadbacks = 0;
+		reportedMessages = 0;
+	}
+
+	/// <summary>
+	/// Debug mode on / off; on, driver performance messages are routed here, and any other message to the debug callback installed before (e.g. sb7's)
+	/// </summary>
+	void SetDebug(bool enabled)
+	{
+		if (enabled == debug)
+		{
+			return;
+		}
+		debug = enabled;
+
+		if (debug)
+		{
+			glGetPointerv(GL_DEBUG_CALLBACK_FUNCTION, (void**)&previousCallback);
+			glGetPointerv(GL_DEBUG_CALLBACK_USER_PARAM, (void**)&previousUserParam);
+			previousDebugOutput = glIsEnabled(GL_DEBUG_OUTPUT);
+
+			glEnable(GL_DEBUG_OUTPUT);
+			glDebugMessageCallback(DebugMessage, this);
+			glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_PERFORMANCE, GL_DONT_CARE, 0, NULL, GL_TRUE);
+			reportStart = std::chrono::high_resolution_clock::now();
+		}
+		else
+		{
+			glDebugMessageCallback(previousCallback, previousUserParam);
+			if (!previousDebugOutput)
+			{
+				glDisable(GL_DEBUG_OUTPUT);
+			}
+			previousCallback = NULL;
+			previousUserParam = NULL;
+		}
+	}
+
+	bool Debug() const
+	{
+		return debug;
+	}
+
+private:
+
+	static void APIENTRY DebugMessage(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam)
+	{
+		AtomicCounterRing* ring = (AtomicCounterRing*)userParam;
+		if (type != GL_DEBUG_TYPE_PERFORMANCE || !ring->inFrame)
+		{
+			if (ring->previousCallback != NULL)
+			{
+				ring->previousCallback(source, type, id, severity, length, message, ring->previousUserParam);
+			}
+			return;
+		}
+
+		ring->performanceWarnings++;
+		if (ring->reportedMessages < kMaxReportedMessages)
+		{
+			ring->reportedMessages++;
+			OutputDebugStringA("Atomic counters: driver performance warning on the hot path: ");
+			OutputDebugStringA(message);
+			OutputDebugStringA("\n");
+		}
+	}
+
+	GLuint counterCount = 0;
+	GLuint counterBuffer = 0;
+
+	// Readback ring
+	GLuint frameCount = 0;
+	GLuint readbackBuffer = 0;
+	const GLuint* readbackData = NULL;  // Persistently mapped
+	std::vector<GLsync> fences;  // Per slot (0: nothing pending)
+	GLuint frame = 0;
+
+	// Debug mode
+	static const unsigned int kMaxReportedMessages = 4;  // Per report period
+	const double kReportPeriod = 1.0;  // Seconds
+	bool debug = false;
+	bool inFrame = false;
+	GLDEBUGPROC previousCallback = NULL;  // Installed before debug mode; restored when it ends
+	const void* previousUserParam = NULL;
+	GLboolean previousDebugOutput = GL_FALSE;
+	std::chrono::high_resolution_clock::time_point reportStart;
+	unsigned int syncMaps = 0;
+	double syncMapMilliseconds = 0.0;
+	unsigned int performanceWarnings = 0;
+	unsigned int lateReadbacks = 0;
+	unsigned int reportedMessages = 0;
+};
+
+/// <summary>
+/// Average frame time (start to start of successive frames) and render time (CPU side, from BeginFrame to EndFrame), printed once per second
+/// </summary>
+class FrameTimer
+{
+public:
+
+	void BeginFrame()
+	{
+		std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+		if (frameCount > 0)
+		{
+			frameMilliseconds += std::chrono::duration<double, std::milli>(now - frameStart).count();
+		}
+		else
+		{
+			reportStart = now;
+		}
+		frameStart = now;
+	}
+
+	/// <summary>
+	/// Label names the configuration measured (e.g. synchronous map / GPU reset)
+	/// </summary>
+	void EndFrame(const char* label)
+	{
+		std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+		renderMilliseconds += std::chrono::duration<double, std::milli>(now - frameStart).count();
+		frameCount++;
+
+		if (std::chrono::duration<double>(now - reportStart).count() < kReportPeriod || frameCount < 2)
+		{
+			return;
+		}
+
+		char output[256];
+		sprintf_s(output, sizeof(output), "Frame time (%s): %.3f ms; render (CPU) %.3f ms; %u frames.\n",
+			label, frameMilliseconds / (frameCount - 1), renderMilliseconds / frameCount, frameCount);
+		OutputDebugStringA(output);
+
+		frameCount = 0;
+		frameMilliseconds = 0.0;
+		renderMilliseconds = 0.0;
+	}
+
+	/// <summary>
+	/// Restart the averages (e.g. when the configuration changes)
+	/// </summary>
+	void Reset()
+	{
+		frameCount = 0;
+		frameMilliseconds = 0.0;
+		renderMilliseconds = 0.0;
+	}
+
+private:
+	const double kReportPeriod = 1.0;  // Seconds
+	std::chrono::high_resolution_clock::time_point frameStart;
+	std::chrono::high_resolution_clock::time_point reportStart;
+	unsigned int frameCount = 0;
+	double frameMilliseconds = 0.0;  // Between frame starts (frameCount - 1 intervals)
+	double renderMilliseconds = 0.0;
+};
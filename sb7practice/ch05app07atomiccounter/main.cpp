@@ -1,6 +1,8 @@
 // Include the "sb7.h" header file
 #include "sb7.h"
 #include "vmath.h"
+#include "atomiccounterring.h"
+#include <cstdio>
 
 // Derive my_application from sb7::application
 class my_application : public sb7::application
@@ -16,6 +18,9 @@ public:
 
 	void render(double currentTime)
 	{
+		frameTimer.BeginFrame();
+		counterRing.BeginFrame();
+
 		// Simply clear the window
 		static const GLfloat color[] = { 0.0f, 0.2f, 0.0f, 1.0f };
 		glClearBufferfv(GL_COLOR, 0, color);
@@ -26,12 +31,15 @@ public:
 		// Update objec model-view and camera projection matrices uniform values
 		UpdateUbo();
 
+		// Read the value of the counter as some previous frame left it (only when already available): only for checking purpose.
+		GLuint counters[5];
+		if (counterRing.Read(counters))
+		{
+			countedArea = counters[2];
+		}
+
 		// Clear the value of corresponding atomic counter within the buffer
-		GLuint* acboData = (GLuint*)glMapNamedBufferRange(acbo,
-															0, sizeof(GLuint) * 5,
-															GL_MAP_WRITE_BIT);
-		acboData[2] = 0;  // Offset qualifier 8 (position for third unsigned int atomic counter) specified in uniform declaration in shader code
-		glUnmapNamedBuffer(acbo);
+		ResetAreaCounter();
 
 		glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT);
 
@@ -40,11 +48,11 @@ public:
 		//glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);  // Note: If writting to the framebuffer is turned-off, atomic counter does not update the buffer
 		glDrawArrays(GL_TRIANGLES, 0, 36);  // Draw 6 faces of 2 triangles of 3 vertices each = 36 vertices
 
-		// Read the value of the counter from the buffer: only for checking purpose.
-		/*acboData = (GLuint*)glMapNamedBufferRange(acbo,
-													0, sizeof(GLuint) * 5,
-													GL_MAP_READ_BIT);
-		glUnmapNamedBuffer(acbo);*/
+		// Copy the value of the counter to be read some frames later (a map here would wait for the draw to complete)
+		counterRing.QueueReadback();
+
+		// Render program reads the counter as a uniform block
+		glMemoryBarrier(GL_UNIFORM_BARRIER_BIT);
 
 		// Use render program to display the object applying corresponding brightness (based on previously calculated used window area)
 		glUseProgram(programRender);
@@ -54,6 +62,13 @@ public:
 		glUniform1ui(0, (GLuint)info.windowWidth * info.windowHeight);
 
 		glDrawArrays(GL_TRIANGLES, 0, 36);
+
+		counterRing.EndFrame();
+
+		// Frame timer report (once per second) shows the area as last read back
+		char label[128];
+		sprintf_s(label, sizeof(label), "%s, counted area %u fragments", synchronousReset ? "synchronous map reset" : "GPU clear reset", countedArea);
+		frameTimer.EndFrame(label);
 	}
 
 	void shutdown()
@@ -74,6 +89,38 @@ public:
 		UpdateProjectionMatrix();
 	}
 
+	void onKey(int key, int action)
+	{
+		sb7::application::onKey(key, action);
+
+		// Check keyboard keys to...
+		// - switch the atomic counter reset: synchronous map (before) / GPU clear (after), to compare frame times
+		// - switch atomic counter debug mode (flags synchronous maps on the hot path)
+		char output[256];
+		switch (key)
+		{
+		case GLFW_KEY_S:
+			if (action)
+			{
+				synchronousReset = !synchronousReset;
+				frameTimer.Reset();
+				sprintf_s(output, sizeof(output), "Atomic counter reset: %s.\n", synchronousReset ? "synchronous map" : "GPU clear");
+				OutputDebugStringA(output);
+			}
+			break;
+		case GLFW_KEY_D:
+			if (action)
+			{
+				counterRing.SetDebug(!counterRing.Debug());
+				sprintf_s(output, sizeof(output), "Atomic counter debug mode: %s.\n", counterRing.Debug() ? "on" : "off");
+				OutputDebugStringA(output);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
 private:
 	void InitializeCamera()
 	{
@@ -317,11 +364,28 @@ private:
 			1, 2, 3, 4, 5
 		};
 
-		glCreateBuffers(1, &acbo);
-		glNamedBufferStorage(acbo, sizeof(GLuint) * 5, data, GL_MAP_READ_BIT | GL_MAP_WRITE_BIT);  // Because this buffer is aimed to store up to 5 unsigned int atomic counter
-		glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 3, acbo);  // Binding qualifier 3 specified in uniform declaration in shader code.
+		// Map access flags only to keep the synchronous map reset available (for comparison)
+		counterRing.Create(5, data, 3, GL_MAP_READ_BIT | GL_MAP_WRITE_BIT);  // Because this buffer is aimed to store up to 5 unsigned int atomic counter
+		glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 3, counterRing.Buffer());  // Binding qualifier 3 specified in uniform declaration in shader code.
 
-		glBindBufferBase(GL_UNIFORM_BUFFER, 1, acbo);  // Binding qualifier 1 specified in uniform declaration in shader code.
+		glBindBufferBase(GL_UNIFORM_BUFFER, 1, counterRing.Buffer());  // Binding qualifier 1 specified in uniform declaration in shader code.
+	}
+
+	void ResetAreaCounter()
+	{
+		// Offset qualifier 8 (position for third unsigned int atomic counter) specified in uniform declaration in shader code
+		if (synchronousReset)
+		{
+			// Map the buffer: waits until the GPU is done with the previous frame draws
+			GLuint* acboData = (GLuint*)counterRing.Map(0, sizeof(GLuint) * 5, GL_MAP_WRITE_BIT);
+			acboData[2] = 0;
+			counterRing.Unmap();
+		}
+		else
+		{
+			// Clear on the GPU, in order with the draws: no wait
+			counterRing.Reset(2, 1);
+		}
 	}
 
 	void DeleteObject()
@@ -356,7 +420,7 @@ private:
 
 	void DeleteAcbo()
 	{
-		glDeleteBuffers(1, &acbo);
+		counterRing.Destroy();
 	}
 
 	void SimulateObjectPose(double currentTime)
@@ -381,7 +445,10 @@ private:
 	GLuint vao;
 	GLuint vbo;
 	GLuint ubo;
-	GLuint acbo;
+	AtomicCounterRing counterRing;
+	GLuint countedArea = 0;  // Read back some frames later
+	bool synchronousReset = false;
+	FrameTimer frameTimer;
 	vmath::mat4 modelWorldMatrix;
 
 	vmath::vec3 cameraPosition;
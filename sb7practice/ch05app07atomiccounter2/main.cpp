@@ -1,5 +1,7 @@
 // Include the "sb7.h" header file
 #include "sb7.h"
+#include "../ch05app07atomiccounter/atomiccounterring.h"
+#include <cstdio>
 
 // Derive my_application from sb7::application
 class my_application : public sb7::application
@@ -16,35 +18,85 @@ public:
 	}
 	void render(double currentTime)
 	{
+		frameTimer.BeginFrame();
+		counterRing.BeginFrame();
+
 		// Simply clear the window with red
 		static const GLfloat red[] = { 1.0f, 0.0f, 0.0f, 1.0f };
 		glClearBufferfv(GL_COLOR, 0, red);
 
 		glUseProgram(program);
 
-		// Reset atomic counter
-		GLuint* acboData = (GLuint*)glMapNamedBufferRange(acbo,
-															0, sizeof(GLuint),
-															GL_MAP_WRITE_BIT);
-		*acboData = (GLuint)0;
-		glUnmapNamedBuffer(acbo);
+		if (synchronousCounter)
+		{
+			// Reset atomic counter: map waits until the GPU is done with the previous frame
+			GLuint* acboData = (GLuint*)counterRing.Map(0, sizeof(GLuint), GL_MAP_WRITE_BIT);
+			*acboData = (GLuint)0;
+			counterRing.Unmap();
+
+			glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT);
+
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+
+			// Read the value of the atomic counter: map waits until the GPU is done with this frame
+			acboData = (GLuint*)counterRing.Map(0, sizeof(GLuint), GL_MAP_READ_BIT);
+			counterValue = *acboData;
+			counterRing.Unmap();
+		}
+		else
+		{
+			// Read the value of the atomic counter some frames later (only when already available)
+			counterRing.Read(&counterValue);
 
-		glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT);
+			// Reset atomic counter on the GPU: no wait
+			counterRing.Reset();
 
-		glDrawArrays(GL_TRIANGLES, 0, 3);
+			glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT);
 
-		// Read the value of the atomic counter
-		acboData = (GLuint*)glMapNamedBufferRange(acbo,
-													0, sizeof(GLuint),
-													GL_MAP_READ_BIT);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
 
-		glUnmapNamedBuffer(acbo);
+			counterRing.QueueReadback();
+		}
+
+		counterRing.EndFrame();
+		frameTimer.EndFrame(synchronousCounter ? "synchronous map reset and read" : "GPU clear reset, ring read");
 	}
 	void shutdown()
 	{
 		glDeleteProgram(program);
 		glDeleteVertexArrays(1, &vao);
-		glDeleteBuffers(1, &acbo);
+		counterRing.Destroy();
+	}
+	void onKey(int key, int action)
+	{
+		sb7::application::onKey(key, action);
+
+		// Check keyboard keys to...
+		// - switch the atomic counter reset and read: synchronous maps (before) / GPU clear and readback ring (after), to compare frame times
+		// - switch atomic counter debug mode (flags synchronous maps on the hot path)
+		char output[256];
+		switch (key)
+		{
+		case GLFW_KEY_S:
+			if (action)
+			{
+				synchronousCounter = !synchronousCounter;
+				frameTimer.Reset();
+				sprintf_s(output, sizeof(output), "Atomic counter reset and read: %s (last value %u).\n", synchronousCounter ? "synchronous maps" : "GPU clear, readback ring", counterValue);
+				OutputDebugStringA(output);
+			}
+			break;
+		case GLFW_KEY_D:
+			if (action)
+			{
+				counterRing.SetDebug(!counterRing.Debug());
+				sprintf_s(output, sizeof(output), "Atomic counter debug mode: %s.\n", counterRing.Debug() ? "on" : "off");
+				OutputDebugStringA(output);
+			}
+			break;
+		default:
+			break;
+		}
 	}
 private:
 	void InitializeProgram()
@@ -99,14 +151,16 @@ private:
 	void InitializeAtomicCounter()
 	{
 		const GLuint data = (GLuint)3;  // Only to verify atomic counter is reset first rendering cycle
-		glCreateBuffers(1, &acbo);
-		glNamedBufferStorage(acbo, sizeof(GLuint), &data, GL_MAP_WRITE_BIT | GL_MAP_READ_BIT);
-		glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, acbo);
+		counterRing.Create(1, &data, 3, GL_MAP_WRITE_BIT | GL_MAP_READ_BIT);  // Map access flags only for the synchronous maps (comparison)
+		glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, counterRing.Buffer());
 	}
 private:
 	GLuint program;
 	GLuint vao;
-	GLuint acbo;
+	AtomicCounterRing counterRing;
+	GLuint counterValue = 0;
+	bool synchronousCounter = false;
+	FrameTimer frameTimer;
 };
 
 // Our one and only instance of DECLARE_MAIN
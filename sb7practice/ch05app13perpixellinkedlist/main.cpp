@@ -2,6 +2,23 @@
 #include "sb7.h"
 #include "vmath.h"
 #include "object.h"
+#include "../ch05app07atomiccounter/atomiccounterring.h"
+#include <cstdio>
+
+enum ListItemFormat
+{
+	kListItemWide,  // 12 bytes: float depth, int facing, uint prev
+	kListItemCompact,  // 8 bytes (uvec2): depth quantized to 31 bits and facing bit, uint prev
+	kListItemColor,  // 12 bytes: RGBA8 color, float depth, uint prev (order-independent transparency)
+	kListItemFormatTotal
+};
+
+enum TraversalMode
+{
+	kTraverseObject,  // Draw the object again: the list of a pixel is walked once per object fragment covering it
+	kTraverseFullscreen,  // Fullscreen triangle: the list of a pixel is walked once
+	kTraversalModeTotal
+};
 
 // Derive my_application from sb7::application
 class my_application : public sb7::application
@@ -19,28 +36,53 @@ public:
 
 	void render(double currentTime)
 	{
+		// Out of the timed frames
+		if (benchmarkListItems)
+		{
+			benchmarkListItems = false;
+			BenchmarkListItemFormats();
+			frameTimer.Reset();
+		}
+		if (benchmarkTraversal)
+		{
+			benchmarkTraversal = false;
+			BenchmarkTraversalModes();
+			frameTimer.Reset();
+		}
+		if (benchmarkTransparency)
+		{
+			benchmarkTransparency = false;
+			BenchmarkTransparencyModes();
+			frameTimer.Reset();
+		}
+
+		frameTimer.BeginFrame();
+		counterRing.BeginFrame();
+
 		// Clear color buffer
 		static const GLfloat color[] = { 0.0f, 0.0f, 0.0f, 1.0f };
 		glClearBufferfv(GL_COLOR, 0, color);
 
-		// *** Fill linked list
-
-		glUseProgram(fillingProgram);
-
-		ResetAtomicCounter();
-		glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT);
-		glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, acbo);
+		// *** Bounded k-buffer transparency: no linked list
+		if (kbufferConfig >= 0)
+		{
+			DrawKBuffer(kbufferConfig, kbufferBuffers, projectionMatrix);
+			EndFrame();
+			return;
+		}
 
-		ResetFramebuffer();
-		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-		glBindImageTexture(0, texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+		// Grow the linked list if a previous frame needed (almost) more items than it has room for (count read some frames later, never waited for)
+		GLuint fragmentCount;
+		if (counterRing.Read(&fragmentCount))
+		{
+			UpdateLinkedListCapacity(fragmentCount);
+		}
 
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssbo);
+		// *** Fill linked list
+		FillLinkedList(listItemFormat, texture, ssbo, itemCapacity, projectionMatrix);
 
-		glUniformMatrix4fv(0, 1, GL_FALSE, viewMatrix * modelWorldMatrix);
-		glUniformMatrix4fv(1, 1, GL_FALSE, projectionMatrix);
-
-		object.render();
+		// Copy the atomic counter to be read some frames later
+		counterRing.QueueReadback();
 
 		// Read the value of the atomic counter and save the highest value (just because curious) - in this case it depends on object orientation
 		//GLuint atomicCounter = CheckAtomicCounter();
@@ -49,22 +91,10 @@ public:
 		// Read the value of an item from the linked list (just because curious)
 		//CheckLinkedList();
 
-		// Barriers: atomic counter, texture image and shader storage block
-		glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT);
-		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-
 		// *** Traverse linked list
-		glUseProgram(traversingProgram);
-
-		glBindImageTexture(0, texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32UI);
+		TraverseLinkedList(listItemFormat, traversalMode, texture, ssbo, projectionMatrix);
 
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssbo);
-
-		glUniformMatrix4fv(0, 1, GL_FALSE, viewMatrix * modelWorldMatrix);
-		glUniformMatrix4fv(1, 1, GL_FALSE, projectionMatrix);
-
-		object.render();
+		EndFrame();
 	}
 
 	void shutdown()
@@ -74,6 +104,10 @@ public:
 		DestroyAtomicCounter();
 		DestroyFramebuffer();
 		DestroyLinkedList();
+		if (kbufferConfig >= 0)
+		{
+			DestroyKBuffer(kbufferBuffers);
+		}
 	}
 
 public:
@@ -84,6 +118,16 @@ public:
 		// Check keyboard arrows to...
 		// - move camera foward/backward
 		// - switch (left) texture sampling mode
+		// Check keyboard keys to...
+		// - switch the atomic counter reset: synchronous map (before) / GPU clear (after), to compare frame times
+		// - switch atomic counter debug mode (flags synchronous maps on the hot path)
+		// - switch the linked list item format (compact / wide / color: order-independent transparency)
+		// - benchmark both item formats (fill and traversal time, memory) at 1080p and 4K
+		// - switch the linked list traversal: object pass / fullscreen resolve
+		// - benchmark both traversal modes (invocations, time) at several object orientations
+		// - switch the bounded k-buffer transparency (off / every layer count)
+		// - benchmark transparency modes (time, memory): linked list / k-buffer
+		char output[256];
 		switch (key)
 		{
 		case GLFW_KEY_LEFT:
@@ -98,6 +142,90 @@ public:
 				RotateObject(1);
 			}
 			break;
+		case GLFW_KEY_S:
+			if (action)
+			{
+				synchronousReset = !synchronousReset;
+				frameTimer.Reset();
+				sprintf_s(output, sizeof(output), "Atomic counter reset: %s.\n", synchronousReset ? "synchronous map" : "GPU clear");
+				OutputDebugStringA(output);
+			}
+			break;
+		case GLFW_KEY_D:
+			if (action)
+			{
+				counterRing.SetDebug(!counterRing.Debug());
+				sprintf_s(output, sizeof(output), "Atomic counter debug mode: %s.\n", counterRing.Debug() ? "on" : "off");
+				OutputDebugStringA(output);
+			}
+			break;
+		case GLFW_KEY_F:
+			if (action)
+			{
+				listItemFormat = (ListItemFormat)((listItemFormat + 1) % kListItemFormatTotal);
+				frameTimer.Reset();
+
+				// Same item capacity in the new format
+				glDeleteBuffers(1, &ssbo);
+				CreateLinkedList(itemCapacity);
+
+				sprintf_s(output, sizeof(output), "Linked list items: %s (%u bytes); %u items (%.1f MB).\n",
+					listItemFormatNames[listItemFormat], ListItemSize(listItemFormat), itemCapacity, ListItemSize(listItemFormat) * itemCapacity / 1048576.0);
+				OutputDebugStringA(output);
+			}
+			break;
+		case GLFW_KEY_B:
+			if (action)
+			{
+				benchmarkListItems = true;
+			}
+			break;
+		case GLFW_KEY_R:
+			if (action)
+			{
+				traversalMode = traversalMode == kTraverseFullscreen ? kTraverseObject : kTraverseFullscreen;
+				frameTimer.Reset();
+				sprintf_s(output, sizeof(output), "Linked list traversal: %s.\n", traversalModeNames[traversalMode]);
+				OutputDebugStringA(output);
+			}
+			break;
+		case GLFW_KEY_T:
+			if (action)
+			{
+				benchmarkTraversal = true;
+			}
+			break;
+		case GLFW_KEY_K:
+			if (action)
+			{
+				if (kbufferConfig >= 0)
+				{
+					DestroyKBuffer(kbufferBuffers);
+				}
+
+				// Off, then every layer count
+				kbufferConfig = kbufferConfig + 1 < kKBufferConfigTotal ? kbufferConfig + 1 : -1;
+				frameTimer.Reset();
+
+				if (kbufferConfig >= 0)
+				{
+					CreateKBuffer(kKBufferLayerCounts[kbufferConfig], kbufferBuffers);
+					sprintf_s(output, sizeof(output), "Transparency: k-buffer, %u layers (%.1f MB).\n",
+						kKBufferLayerCounts[kbufferConfig], KBufferBytes(kKBufferLayerCounts[kbufferConfig]) / 1048576.0);
+				}
+				else
+				{
+					sprintf_s(output, sizeof(output), "Transparency: k-buffer off (linked list, %s items).\n", listItemFormatNames[listItemFormat]);
+				}
+				OutputDebugStringA(output);
+			}
+			break;
+		case GLFW_KEY_O:
+			if (action)
+			{
+				benchmarkTransparency = true;
+			}
+			break;
 		default:
 			break;
 		}
@@ -121,26 +249,69 @@ private:
 			"}																	\n"
 		};
 
-		GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertexShader, 1, vertexShaderSource, NULL);
-		glCompileShader(vertexShader);
+		GLuint vertexShader = CompileShader(GL_VERTEX_SHADER, 1, vertexShaderSource);
+
+		// Vertex shader: fullscreen resolve (no vertex attributes)
+		const GLchar* fullscreenVertexShaderSource[] = {
+			"#version 450 core													\n"
+			"																	\n"
+			"void main(void)													\n"
+			"{																	\n"
+			"	// One triangle covering the whole viewport						\n"
+			"	const vec4 vertices[3] = vec4[3](vec4(-1.0, -1.0, 0.0, 1.0),	\n"
+			"									 vec4( 3.0, -1.0, 0.0, 1.0),	\n"
+			"									 vec4(-1.0,  3.0, 0.0, 1.0));	\n"
+			"	gl_Position = vertices[gl_VertexID];							\n"
+			"}																	\n"
+		};
+
+		GLuint fullscreenVertexShader = CompileShader(GL_VERTEX_SHADER, 1, fullscreenVertexShaderSource);
+
+		glCreateVertexArrays(1, &fullscreenVao);
+
+		// Filling, traversing and resolving programs for every linked list item format (color items: see InitializeOitPrograms)
+		for (int format = 0; format < kListItemColor; format++)
+		{
+			InitializeListPrograms((ListItemFormat)format, vertexShader, fullscreenVertexShader);
+		}
+
+		InitializeOitPrograms(vertexShader, fullscreenVertexShader);
+
+		// Free resources
+		glDeleteShader(vertexShader);
+		glDeleteShader(fullscreenVertexShader);
+	}
+
+	void InitializeListPrograms(ListItemFormat format, GLuint vertexShader, GLuint fullscreenVertexShader)
+	{
+		// Item format is a compile-time switch of both fragment shaders
+		char defines[64];
+		sprintf_s(defines, sizeof(defines), "#version 450 core\n#define COMPACT_LIST_ITEM %d\n", format == kListItemCompact ? 1 : 0);
 
 		// Fragment shader: texturing
 		const GLchar* fillingFragmentShaderSource[] = {
-			"#version 450 core													\n"
+			defines,
 			"																	\n"
 			"// Atomic counter for filled size									\n"
 			"layout (binding = 0, offset = 0) uniform atomic_uint fill_counter;	\n"
 			"																	\n"
+			"// Items the linked list has room for								\n"
+			"layout (location = 2) uniform uint item_capacity;					\n"
+			"																	\n"
 			"// 2D image to store head pointers									\n"
 			"layout (binding = 0, r32ui) uniform uimage2D head_pointer;			\n"
 			"																	\n"
+			"#if COMPACT_LIST_ITEM												\n"
+			"// Compact item (8 bytes): x = depth quantized to 31 bits << 1 | facing bit; y = prev\n"
+			"#define list_item uvec2											\n"
+			"#else																\n"
 			"struct list_item													\n"
 			"{																	\n"
 			"	float depth;													\n"
 			"	int facing;														\n"
 			"	uint prev;														\n"
 			"};																	\n"
+			"#endif																\n"
 			"																	\n"
 			"// Linked list														\n"
 			"layout (binding = 0, std430) buffer list_item_block				\n"
@@ -155,38 +326,50 @@ private:
 			"	uint index = atomicCounterIncrement(fill_counter);				\n"
 			"	memoryBarrierAtomicCounter();									\n"
 			"																	\n"
+			"	// Linked list is full: fragment is dropped (overflow)			\n"
+			"	// Counter keeps counting, so it tells the CPU how many items were needed\n"
+			"	if (index >= item_capacity)										\n"
+			"	{																\n"
+			"		return;														\n"
+			"	}																\n"
+			"																	\n"
 			"	uint old_head = imageAtomicExchange(head_pointer, P, index);	\n"
 			"	memoryBarrierImage();											\n"
 			"																	\n"
+			"#if COMPACT_LIST_ITEM												\n"
+			"	// Depth 1.0 rounds up to 2^31 in float: clamped to the highest 31 bits value\n"
+			"	uint depth = min(uint(gl_FragCoord.z * 2147483647.0), 0x7FFFFFFFu);\n"
+			"	items[index] = uvec2(depth << 1 | (gl_FrontFacing ? 1u : 0u), old_head);\n"
+			"#else																\n"
 			"	items[index].depth = gl_FragCoord.z;							\n"
 			"	items[index].facing = gl_FrontFacing ? 1 : 0;					\n"
 			"	items[index].prev = old_head;									\n"
+			"#endif																\n"
 			"	memoryBarrierBuffer();											\n"
 			"}																	\n"
 		};
 
-		GLuint fillingFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fillingFragmentShader, 1, fillingFragmentShaderSource, NULL);
-		glCompileShader(fillingFragmentShader);
-
-		fillingProgram = glCreateProgram();
-		glAttachShader(fillingProgram, vertexShader);
-		glAttachShader(fillingProgram, fillingFragmentShader);
-		glLinkProgram(fillingProgram);
+		GLuint fillingFragmentShader = CompileShader(GL_FRAGMENT_SHADER, 2, fillingFragmentShaderSource);
+		fillingProgram[format] = LinkProgram(vertexShader, fillingFragmentShader);
 
 		// Fragment shader: rendering
 		const GLchar* traversingFragmentShaderSource[] = {
-			"#version 450 core													\n"
+			defines,
 			"																	\n"
 			"// 2D image storing head pointers									\n"
 			"layout (binding = 0, r32ui) readonly uniform uimage2D head_pointer;\n"
 			"																	\n"
+			"#if COMPACT_LIST_ITEM												\n"
+			"// Compact item (8 bytes): x = depth quantized to 31 bits << 1 | facing bit; y = prev\n"
+			"#define list_item uvec2											\n"
+			"#else																\n"
 			"struct list_item													\n"
 			"{																	\n"
 			"	float depth;													\n"
 			"	int facing;														\n"
 			"	uint prev;														\n"
 			"};																	\n"
+			"#endif																\n"
 			"																	\n"
 			"// Linked list														\n"
 			"layout (binding = 0, std430) readonly buffer list_item_block		\n"
@@ -206,20 +389,35 @@ private:
 			"																	\n"
 			"	uint index = imageLoad(head_pointer, P).x;						\n"
 			"																	\n"
+			"	// Empty list (no object fragment at this pixel, only in the fullscreen resolve): clear color is kept\n"
+			"	if (index == 0xFFFFFFFF)										\n"
+			"	{																\n"
+			"		discard;													\n"
+			"	}																\n"
+			"																	\n"
 			"	while (index != 0xFFFFFFFF && frag_count < max_fragments)		\n"
 			"	{																\n"
 			"		list_item this_item = items[index];							\n"
 			"																	\n"
-			"		if (this_item.facing == 1)									\n"
+			"#if COMPACT_LIST_ITEM												\n"
+			"		float depth = float(this_item.x >> 1) / 2147483647.0;		\n"
+			"		bool front_facing = (this_item.x & 1u) == 1u;				\n"
+			"		index = this_item.y;										\n"
+			"#else																\n"
+			"		float depth = this_item.depth;								\n"
+			"		bool front_facing = this_item.facing == 1;					\n"
+			"		index = this_item.prev;										\n"
+			"#endif																\n"
+			"																	\n"
+			"		if (front_facing)											\n"
 			"		{															\n"
-			"			depth_accum -= this_item.depth;							\n"
+			"			depth_accum -= depth;									\n"
 			"		}															\n"
 			"		else														\n"
 			"		{															\n"
-			"			depth_accum += this_item.depth;							\n"
+			"			depth_accum += depth;									\n"
 			"		}															\n"
 			"																	\n"
-			"		index = this_item.prev;										\n"
 			"		frag_count++;												\n"
 			"	}																\n"
 			"																	\n"
@@ -229,25 +427,421 @@ private:
 			"}																	\n"
 		};
 
-		GLuint traversingFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(traversingFragmentShader, 1, traversingFragmentShaderSource, NULL);
-		glCompileShader(traversingFragmentShader);
+		GLuint traversingFragmentShader = CompileShader(GL_FRAGMENT_SHADER, 2, traversingFragmentShaderSource);
+		traversingProgram[format] = LinkProgram(vertexShader, traversingFragmentShader);
 
-		traversingProgram = glCreateProgram();
-		glAttachShader(traversingProgram, vertexShader);
-		glAttachShader(traversingProgram, traversingFragmentShader);
-		glLinkProgram(traversingProgram);
+		// Same traversal, once per pixel
+		resolvingProgram[format] = LinkProgram(fullscreenVertexShader, traversingFragmentShader);
 
 		// Free resources
-		glDeleteShader(vertexShader);
 		glDeleteShader(fillingFragmentShader);
 		glDeleteShader(traversingFragmentShader);
 	}
 
+	/// <summary>
+	/// Order-independent transparency programs: color linked list items (kListItemColor), and the k-buffer ones (every layer count)
+	/// </summary>
+	void InitializeOitPrograms(GLuint vertexShader, GLuint fullscreenVertexShader)
+	{
+		// Vertex shader: normal for shading
+		const GLchar* oitVertexShaderSource[] = {
+			"#version 450 core													\n"
+			"																	\n"
+			"layout (location = 0) uniform mat4 mv;								\n"
+			"layout (location = 1) uniform mat4 proj;							\n"
+			"																	\n"
+			"layout (location = 0) in vec4 position;							\n"
+			"layout (location = 1) in vec3 normal;								\n"
+			"																	\n"
+			"out VS_OUT															\n"
+			"{																	\n"
+			"	vec3 normal;													\n"
+			"} vs_out;															\n"
+			"																	\n"
+			"// Same depth in every program using this shader (k-buffer passes compare depths)\n"
+			"invariant gl_Position;												\n"
+			"																	\n"
+			"void main(void)													\n"
+			"{																	\n"
+			"	vs_out.normal = mat3(mv) * normal;								\n"
+			"	gl_Position = proj * mv * position;								\n"
+			"}																	\n"
+		};
+
+		GLuint oitVertexShader = CompileShader(GL_VERTEX_SHADER, 1, oitVertexShaderSource);
+
+		// Fragment color, shared by the fragment shaders storing it
+		const GLchar* shadingSource =
+			"																	\n"
+			"layout (location = 3) uniform float oit_alpha;						\n"
+			"																	\n"
+			"in VS_OUT															\n"
+			"{																	\n"
+			"	vec3 normal;													\n"
+			"} fs_in;															\n"
+			"																	\n"
+			"// Fragment color: tint by facing, lit from the viewer				\n"
+			"vec4 shade(void)													\n"
+			"{																	\n"
+			"	vec3 base = gl_FrontFacing ? vec3(0.2, 0.6, 1.0) : vec3(1.0, 0.45, 0.2);\n"
+			"	float lambert = abs(normalize(fs_in.normal).z);					\n"
+			"	return vec4(base * (0.3 + 0.7 * lambert), oit_alpha);			\n"
+			"}																	\n";
+
+		// Fragment shader: filling (color items)
+		const GLchar* fillingFragmentShaderSource[] = {
+			"#version 450 core\n",
+			shadingSource,
+			"																	\n"
+			"// Atomic counter for filled size									\n"
+			"layout (binding = 0, offset = 0) uniform atomic_uint fill_counter;	\n"
+			"																	\n"
+			"// Items the linked list has room for								\n"
+			"layout (location = 2) uniform uint item_capacity;					\n"
+			"																	\n"
+			"// 2D image to store head pointers									\n"
+			"layout (binding = 0, r32ui) uniform uimage2D head_pointer;			\n"
+			"																	\n"
+			"struct list_item													\n"
+			"{																	\n"
+			"	uint color;  // RGBA8											\n"
+			"	float depth;													\n"
+			"	uint prev;														\n"
+			"};																	\n"
+			"																	\n"
+			"// Linked list														\n"
+			"layout (binding = 0, std430) buffer list_item_block				\n"
+			"{																	\n"
+			"	list_item items[];												\n"
+			"};																	\n"
+			"																	\n"
+			"void main(void)													\n"
+			"{																	\n"
+			"	ivec2 P = ivec2(gl_FragCoord.xy);								\n"
+			"																	\n"
+			"	uint index = atomicCounterIncrement(fill_counter);				\n"
+			"																	\n"
+			"	// Linked list is full: fragment is dropped (overflow)			\n"
+			"	if (index >= item_capacity)										\n"
+			"	{																\n"
+			"		return;														\n"
+			"	}																\n"
+			"																	\n"
+			"	uint old_head = imageAtomicExchange(head_pointer, P, index);	\n"
+			"																	\n"
+			"	items[index].color = packUnorm4x8(shade());						\n"
+			"	items[index].depth = gl_FragCoord.z;							\n"
+			"	items[index].prev = old_head;									\n"
+			"}																	\n"
+		};
+
+		GLuint fillingFragmentShader = CompileShader(GL_FRAGMENT_SHADER, 3, fillingFragmentShaderSource);
+		fillingProgram[kListItemColor] = LinkProgram(oitVertexShader, fillingFragmentShader);
+
+		// Fragment shader: sorting and compositing (the same for the object pass traversal and the fullscreen resolve)
+		const GLchar* sortingFragmentShaderSource[] = {
+			"#version 450 core\n",
+			"																	\n"
+			"// 2D image storing head pointers									\n"
+			"layout (binding = 0, r32ui) readonly uniform uimage2D head_pointer;\n"
+			"																	\n"
+			"struct list_item													\n"
+			"{																	\n"
+			"	uint color;  // RGBA8											\n"
+			"	float depth;													\n"
+			"	uint prev;														\n"
+			"};																	\n"
+			"																	\n"
+			"// Linked list														\n"
+			"layout (binding = 0, std430) readonly buffer list_item_block		\n"
+			"{																	\n"
+			"	list_item items[];												\n"
+			"};																	\n"
+			"																	\n"
+			"out vec4 color;													\n"
+			"																	\n"
+			"// Nearest fragments kept sorted in registers; farther ones are merged into an order-independent tail\n"
+			"const int max_sorted = 16;											\n"
+			"																	\n"
+			"// Tail: sum of alpha * color, sum of alpha, and sum of -ln(1 - alpha) (its transmittance is exp(-density))\n"
+			"void merge(uint item_color, inout vec3 tail_color, inout float tail_alpha, inout float tail_density)\n"
+			"{																	\n"
+			"	vec4 fragment_color = unpackUnorm4x8(item_color);				\n"
+			"	float alpha = min(fragment_color.a, 0.999);						\n"
+			"	tail_color += fragment_color.rgb * alpha;						\n"
+			"	tail_alpha += alpha;											\n"
+			"	tail_density -= log(1.0 - alpha);								\n"
+			"}																	\n"
+			"																	\n"
+			"void main(void)													\n"
+			"{																	\n"
+			"	ivec2 P = ivec2(gl_FragCoord.xy);								\n"
+			"																	\n"
+			"	uint index = imageLoad(head_pointer, P).x;						\n"
+			"																	\n"
+			"	// Empty list (no object fragment at this pixel, only in the fullscreen resolve): clear color is kept\n"
+			"	if (index == 0xFFFFFFFF)										\n"
+			"	{																\n"
+			"		discard;													\n"
+			"	}																\n"
+			"																	\n"
+			"	float depths[max_sorted];										\n"
+			"	uint colors[max_sorted];										\n"
+			"	int count = 0;													\n"
+			"																	\n"
+			"	vec3 tail_color = vec3(0.0);									\n"
+			"	float tail_alpha = 0.0;											\n"
+			"	float tail_density = 0.0;										\n"
+			"																	\n"
+			"	while (index != 0xFFFFFFFF)										\n"
+			"	{																\n"
+			"		list_item this_item = items[index];							\n"
+			"		index = this_item.prev;										\n"
+			"																	\n"
+			"		// Full: the farthest one (this one, or the last sorted one) goes to the tail\n"
+			"		if (count == max_sorted)									\n"
+			"		{															\n"
+			"			if (this_item.depth >= depths[max_sorted - 1])			\n"
+			"			{														\n"
+			"				merge(this_item.color, tail_color, tail_alpha, tail_density);\n"
+			"				continue;											\n"
+			"			}														\n"
+			"																	\n"
+			"			merge(colors[max_sorted - 1], tail_color, tail_alpha, tail_density);\n"
+			"			count--;												\n"
+			"		}															\n"
+			"																	\n"
+			"		// Insertion sort (nearest first)							\n"
+			"		int i = count;												\n"
+			"		while (i > 0 && depths[i - 1] > this_item.depth)			\n"
+			"		{															\n"
+			"			depths[i] = depths[i - 1];								\n"
+			"			colors[i] = colors[i - 1];								\n"
+			"			i--;													\n"
+			"		}															\n"
+			"		depths[i] = this_item.depth;								\n"
+			"		colors[i] = this_item.color;								\n"
+			"		count++;													\n"
+			"	}																\n"
+			"																	\n"
+			"	// Back to front over the clear color (black): tail first		\n"
+			"	vec3 result = tail_alpha > 0.0 ? tail_color / tail_alpha * (1.0 - exp(-tail_density)) : vec3(0.0);\n"
+			"	for (int i = count - 1; i >= 0; i--)							\n"
+			"	{																\n"
+			"		vec4 fragment_color = unpackUnorm4x8(colors[i]);			\n"
+			"		result = fragment_color.rgb * fragment_color.a + result * (1.0 - fragment_color.a);\n"
+			"	}																\n"
+			"																	\n"
+			"	color = vec4(result, 1.0);										\n"
+			"}																	\n"
+		};
+
+		GLuint sortingFragmentShader = CompileShader(GL_FRAGMENT_SHADER, 2, sortingFragmentShaderSource);
+		traversingProgram[kListItemColor] = LinkProgram(vertexShader, sortingFragmentShader);
+		resolvingProgram[kListItemColor] = LinkProgram(fullscreenVertexShader, sortingFragmentShader);
+
+		glDeleteShader(fillingFragmentShader);
+		glDeleteShader(sortingFragmentShader);
+
+		// K-buffer: layer count is a compile-time switch
+		for (int config = 0; config < kKBufferConfigTotal; config++)
+		{
+			char defines[128];
+			sprintf_s(defines, sizeof(defines), "#version 450 core\n#define KBUFFER_LAYERS %u\n#define TAIL_SCALE %.1f\n", kKBufferLayerCounts[config], kKBufferTailScale);
+
+			// Fragment shader: nearest depths
+			const GLchar* depthFragmentShaderSource[] = {
+				defines,
+				"																\n"
+				"layout (location = 4) uniform uint viewport_width;				\n"
+				"																\n"
+				"// KBUFFER_LAYERS nearest depths per pixel, sorted (0xFFFFFFFF: empty)\n"
+				"layout (binding = 1, std430) buffer kbuffer_depth_block		\n"
+				"{																\n"
+				"	uint depths[];												\n"
+				"};																\n"
+				"																\n"
+				"void main(void)												\n"
+				"{																\n"
+				"	uint base = (uint(gl_FragCoord.y) * viewport_width + uint(gl_FragCoord.x)) * KBUFFER_LAYERS;\n"
+				"																\n"
+				"	// Positive floats order as their bits: every layer keeps the nearest depth, the other one moves on to the next layer\n"
+				"	uint value = floatBitsToUint(gl_FragCoord.z);				\n"
+				"	for (int i = 0; i < KBUFFER_LAYERS; i++)					\n"
+				"	{															\n"
+				"		uint previous = atomicMin(depths[base + i], value);		\n"
+				"		if (previous == 0xFFFFFFFF)								\n"
+				"		{														\n"
+				"			break;												\n"
+				"		}														\n"
+				"		value = max(previous, value);							\n"
+				"	}															\n"
+				"}																\n"
+			};
+
+			// Fragment shader: colors of the nearest fragments, tail of the rest
+			const GLchar* colorFragmentShaderSource[] = {
+				defines,
+				shadingSource,
+				"																\n"
+				"layout (location = 4) uniform uint viewport_width;				\n"
+				"																\n"
+				"layout (binding = 1, std430) readonly buffer kbuffer_depth_block\n"
+				"{																\n"
+				"	uint depths[];												\n"
+				"};																\n"
+				"																\n"
+				"// RGBA8 color of every layer (0: not claimed yet)				\n"
+				"layout (binding = 2, std430) buffer kbuffer_color_block		\n"
+				"{																\n"
+				"	uint colors[];												\n"
+				"};																\n"
+				"																\n"
+				"// Tail of every pixel (fixed point, TAIL_SCALE units): sum of alpha * color (3), sum of alpha, sum of -ln(1 - alpha)\n"
+				"layout (binding = 3, std430) buffer kbuffer_tail_block			\n"
+				"{																\n"
+				"	uint tails[];												\n"
+				"};																\n"
+				"																\n"
+				"void main(void)												\n"
+				"{																\n"
+				"	uint pixel = uint(gl_FragCoord.y) * viewport_width + uint(gl_FragCoord.x);\n"
+				"	uint base = pixel * KBUFFER_LAYERS;							\n"
+				"																\n"
+				"	vec4 fragment_color = shade();								\n"
+				"																\n"
+				"	// One of the nearest: claims a free layer of its depth, so equal depths get one each (0 marks a free layer: transparent black is stored as 1)\n"
+				"	uint value = floatBitsToUint(gl_FragCoord.z);				\n"
+				"	uint packed = max(packUnorm4x8(fragment_color), 1u);		\n"
+				"	for (int i = 0; i < KBUFFER_LAYERS; i++)					\n"
+				"	{															\n"
+				"		if (depths[base + i] == value && atomicCompSwap(colors[base + i], 0u, packed) == 0u)\n"
+				"		{														\n"
+				"			return;												\n"
+				"		}														\n"
+				"	}															\n"
+				"																\n"
+				"	// Farther ones (and equal depth ones beyond the last layer) are merged into the tail (order independent)\n"
+				"	float alpha = min(fragment_color.a, 0.999);					\n"
+				"	uint tail = pixel * 5;										\n"
+				"	atomicAdd(tails[tail + 0], uint(fragment_color.r * alpha * TAIL_SCALE + 0.5));\n"
+				"	atomicAdd(tails[tail + 1], uint(fragment_color.g * alpha * TAIL_SCALE + 0.5));\n"
+				"	atomicAdd(tails[tail + 2], uint(fragment_color.b * alpha * TAIL_SCALE + 0.5));\n"
+				"	atomicAdd(tails[tail + 3], uint(alpha * TAIL_SCALE + 0.5));	\n"
+				"	atomicAdd(tails[tail + 4], uint(-log(1.0 - alpha) * TAIL_SCALE + 0.5));\n"
+				"}																\n"
+			};
+
+			// Fragment shader: compositing
+			const GLchar* resolvingFragmentShaderSource[] = {
+				defines,
+				"																\n"
+				"layout (location = 4) uniform uint viewport_width;				\n"
+				"																\n"
+				"layout (binding = 1, std430) readonly buffer kbuffer_depth_block\n"
+				"{																\n"
+				"	uint depths[];												\n"
+				"};																\n"
+				"																\n"
+				"layout (binding = 2, std430) readonly buffer kbuffer_color_block\n"
+				"{																\n"
+				"	uint colors[];												\n"
+				"};																\n"
+				"																\n"
+				"layout (binding = 3, std430) readonly buffer kbuffer_tail_block\n"
+				"{																\n"
+				"	uint tails[];												\n"
+				"};																\n"
+				"																\n"
+				"out vec4 color;												\n"
+				"																\n"
+				"void main(void)												\n"
+				"{																\n"
+				"	uint pixel = uint(gl_FragCoord.y) * viewport_width + uint(gl_FragCoord.x);\n"
+				"	uint base = pixel * KBUFFER_LAYERS;							\n"
+				"																\n"
+				"	// No object fragment at this pixel: clear color is kept	\n"
+				"	if (depths[base] == 0xFFFFFFFF)								\n"
+				"	{															\n"
+				"		discard;												\n"
+				"	}															\n"
+				"																\n"
+				"	// Back to front over the clear color (black): tail first	\n"
+				"	uint tail = pixel * 5;										\n"
+				"	vec3 result = vec3(0.0);									\n"
+				"	if (tails[tail + 3] > 0u)									\n"
+				"	{															\n"
+				"		vec3 tail_color = vec3(tails[tail + 0], tails[tail + 1], tails[tail + 2]) / TAIL_SCALE;\n"
+				"		float tail_alpha = float(tails[tail + 3]) / TAIL_SCALE;	\n"
+				"		float tail_density = float(tails[tail + 4]) / TAIL_SCALE;\n"
+				"		result = tail_color / tail_alpha * (1.0 - exp(-tail_density));\n"
+				"	}															\n"
+				"																\n"
+				"	for (int i = KBUFFER_LAYERS - 1; i >= 0; i--)				\n"
+				"	{															\n"
+				"		if (depths[base + i] != 0xFFFFFFFF)						\n"
+				"		{														\n"
+				"			vec4 fragment_color = unpackUnorm4x8(colors[base + i]);\n"
+				"			result = fragment_color.rgb * fragment_color.a + result * (1.0 - fragment_color.a);\n"
+				"		}														\n"
+				"	}															\n"
+				"																\n"
+				"	color = vec4(result, 1.0);									\n"
+				"}																\n"
+			};
+
+			GLuint depthFragmentShader = CompileShader(GL_FRAGMENT_SHADER, 2, depthFragmentShaderSource);
+			GLuint colorFragmentShader = CompileShader(GL_FRAGMENT_SHADER, 3, colorFragmentShaderSource);
+			GLuint resolvingFragmentShader = CompileShader(GL_FRAGMENT_SHADER, 2, resolvingFragmentShaderSource);
+
+			kbufferDepthProgram[config] = LinkProgram(oitVertexShader, depthFragmentShader);
+			kbufferColorProgram[config] = LinkProgram(oitVertexShader, colorFragmentShader);
+			kbufferResolvingProgram[config] = LinkProgram(fullscreenVertexShader, resolvingFragmentShader);
+
+			glDeleteShader(depthFragmentShader);
+			glDeleteShader(colorFragmentShader);
+			glDeleteShader(resolvingFragmentShader);
+		}
+
+		glDeleteShader(oitVertexShader);
+	}
+
+	GLuint CompileShader(GLenum type, GLsizei count, const GLchar** source)
+	{
+		GLuint shader = glCreateShader(type);
+		glShaderSource(shader, count, source, NULL);
+		glCompileShader(shader);
+
+		return shader;
+	}
+
+	GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader)
+	{
+		GLuint program = glCreateProgram();
+		glAttachShader(program, vertexShader);
+		glAttachShader(program, fragmentShader);
+		glLinkProgram(program);
+
+		return program;
+	}
+
 	void DestroyPrograms()
 	{
-		glDeleteProgram(fillingProgram);
-		glDeleteProgram(traversingProgram);
+		for (int format = 0; format < kListItemFormatTotal; format++)
+		{
+			glDeleteProgram(fillingProgram[format]);
+			glDeleteProgram(traversingProgram[format]);
+			glDeleteProgram(resolvingProgram[format]);
+		}
+
+		for (int config = 0; config < kKBufferConfigTotal; config++)
+		{
+			glDeleteProgram(kbufferDepthProgram[config]);
+			glDeleteProgram(kbufferColorProgram[config]);
+			glDeleteProgram(kbufferResolvingProgram[config]);
+		}
+
+		glDeleteVertexArrays(1, &fullscreenVao);
 	}
 
 	void InitializeCamera()
@@ -286,34 +880,43 @@ private:
 
 	void InitializeAtomicCounter()
 	{
+		// Fragment count read back some frames later (one slot per frame in flight, no CPU-GPU synchronization)
+		// Map access flags only for the synchronous reset and CheckAtomicCounter (comparison and checking purpose)
 		const GLuint data = (GLuint)3;  // Only to verify atomic counter is reset first rendering cycle
-		glCreateBuffers(1, &acbo);
-		glNamedBufferStorage(acbo, sizeof(GLuint), &data, GL_MAP_WRITE_BIT | GL_MAP_READ_BIT);
+		counterRing.Create(1, &data, readbackFrameCount, GL_MAP_WRITE_BIT | GL_MAP_READ_BIT);
 	}
 
 	void ResetAtomicCounter()
 	{
-		GLuint* acboData = (GLuint*)glMapNamedBufferRange(acbo,
-															0, sizeof(GLuint),
-															GL_MAP_WRITE_BIT);
-		*acboData = (GLuint)0;
-		glUnmapNamedBuffer(acbo);
+		if (synchronousReset)
+		{
+			// Map waits until the GPU is done with the previous frame
+			GLuint* acboData = (GLuint*)counterRing.Map(0, sizeof(GLuint), GL_MAP_WRITE_BIT);
+			*acboData = (GLuint)0;
+			counterRing.Unmap();
+		}
+		else
+		{
+			// Clear on the GPU, in order with the draws: no wait
+			counterRing.Reset();
+		}
 	}
 
+	/// <summary>
+	/// Synchronous read (waits until the GPU is done with this frame): only for checking purpose, flagged in debug mode
+	/// </summary>
 	GLuint CheckAtomicCounter()
 	{
-		GLuint* acboData = (GLuint*)glMapNamedBufferRange(acbo,
-															0, sizeof(GLuint),
-															GL_MAP_READ_BIT);
-
-		glUnmapNamedBuffer(acbo);
+		GLuint* acboData = (GLuint*)counterRing.Map(0, sizeof(GLuint), GL_MAP_READ_BIT);
+		GLuint value = *acboData;  // Pointer is no longer valid once unmapped
+		counterRing.Unmap();
 
-		return *acboData;
+		return value;
 	}
 
 	void DestroyAtomicCounter()
 	{
-		glDeleteBuffers(1, &acbo);
+		counterRing.Destroy();
 	}
 
 	void InitializeFramebuffer()
@@ -328,10 +931,11 @@ private:
 			info.windowWidth, info.windowHeight);
 	}
 
-	void ResetFramebuffer()
+	void ResetFramebuffer(GLuint headPointers)
 	{
+		// Head pointers are cleared on the GPU (no map, no wait)
 		const GLuint data[] = { 0xFFFFFFFF };  // Security value
-		glClearTexImage(texture, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, data);
+		glClearTexImage(headPointers, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, data);
 
 		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 	}
@@ -343,23 +947,67 @@ private:
 
 	void InitializeLinkedList()
 	{
-		// For current application setttings ...
+		// Highest number of generated fragments depends on ...
 		// - window size
 		// - camera pose (position and orientation)
 		// - object pose (position, orientation and scale)
-		// ... the highest number of generated fragments on a specific object orientation on Y axis is 258894.
-		// So, initializing a buffered shader storage block with space enough for 260000 items (linked list) would be enough
-
-		const unsigned int itemCount = 260000;
+		// ... so the linked list starts with room for one item per pixel, and grows when a frame gets close to that (see UpdateLinkedListCapacity)
+		CreateLinkedList(info.windowWidth * info.windowHeight);
+	}
 
-		linkedList = new LinkedListItem[itemCount];
+	void CreateLinkedList(GLuint capacity)
+	{
+		itemCapacity = capacity;
 
 		glCreateBuffers(1, &ssbo);
-		glNamedBufferStorage(ssbo, sizeof(LinkedListItem) * itemCount, &(linkedList[0]), /*GL_MAP_WRITE_BIT |*/ GL_MAP_READ_BIT);  // GL_MAP_WRITE_BIT access flag only if buffer reset required
+		glNamedBufferStorage(ssbo, ListItemSize(listItemFormat) * itemCapacity, NULL, /*GL_MAP_WRITE_BIT |*/ GL_MAP_READ_BIT);  // GL_MAP_WRITE_BIT access flag only if buffer reset required
+	}
+
+	/// <summary>
+	/// Keep track of the highest fragment count, and reallocate the linked list with headroom when a count reaches the high-water mark of its capacity
+	/// Overflowed frames (count above the capacity) drop fragments until the new linked list is used
+	/// </summary>
+	void UpdateLinkedListCapacity(GLuint fragmentCount)
+	{
+		char output[256];
+
+		if (fragmentCount > itemPeak)
+		{
+			itemPeak = fragmentCount;
+			sprintf_s(output, sizeof(output), "Linked list: peak length %u items (capacity %u; %u reallocations).\n", itemPeak, itemCapacity, reallocationCount);
+			OutputDebugStringA(output);
+		}
+
+		if (fragmentCount >= (GLuint)(itemCapacity * itemHighWaterMark))
+		{
+			GLuint previousCapacity = itemCapacity;
+
+			glDeleteBuffers(1, &ssbo);
+			CreateLinkedList((GLuint)(fragmentCount * itemHeadroom));
+			reallocationCount++;
+
+			sprintf_s(output, sizeof(output), "Linked list: %u items needed (%s), reallocated from %u to %u items (%.1f MB); %u reallocations.\n",
+				fragmentCount, fragmentCount > previousCapacity ? "overflow" : "high-water mark", previousCapacity, itemCapacity,
+				ListItemSize(listItemFormat) * itemCapacity / 1048576.0, reallocationCount);
+			OutputDebugStringA(output);
+		}
+	}
+
+	static GLuint ListItemSize(ListItemFormat format)
+	{
+		switch (format)
+		{
+		case kListItemCompact:
+			return (GLuint)sizeof(CompactLinkedListItem);
+		case kListItemColor:
+			return (GLuint)sizeof(ColorLinkedListItem);
+		default:
+			return (GLuint)sizeof(LinkedListItem);
+		}
 	}
 
 	/// <summary>
-	/// An example of how to map a shader storage block buffer for writing
+	/// An example of how to map a shader storage block buffer for writing (wide items)
 	/// Corresponding access flag (GL_MAP_WRITE_BIT) is required on buffer memory allocation
 	/// </summary>
 	void ResetLinkedList()
@@ -375,7 +1023,7 @@ private:
 	}
 
 	/// <summary>
-	/// An example of how to map a shader storage block buffer for reading
+	/// An example of how to map a shader storage block buffer for reading (wide items)
 	/// Find the first item linking occurrence, i.e. the first time a fragment instance occurs for a position that already happended
 	/// Notice this may change between drawing commands as the order of shader instaces execution is unknown (parallel execution)
 	/// </summary>
@@ -400,7 +1048,420 @@ private:
 	void DestroyLinkedList()
 	{
 		glDeleteBuffers(1, &ssbo);
-		delete[] linkedList;
+	}
+
+	/// <summary>
+	/// Fill a linked list (items of a format) with the object fragments; head pointer image sized as the viewport
+	/// </summary>
+	void FillLinkedList(ListItemFormat format, GLuint headPointers, GLuint listBuffer, GLuint capacity, const vmath::mat4& projection)
+	{
+		glUseProgram(fillingProgram[format]);
+
+		ResetAtomicCounter();
+		glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT);
+		glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, counterRing.Buffer());
+
+		ResetFramebuffer(headPointers);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		glBindImageTexture(0, headPointers, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, listBuffer);
+
+		glUniformMatrix4fv(0, 1, GL_FALSE, viewMatrix * modelWorldMatrix);
+		glUniformMatrix4fv(1, 1, GL_FALSE, projection);
+		glUniform1ui(2, capacity);
+		if (format == kListItemColor)
+		{
+			glUniform1f(3, oitAlpha);
+		}
+
+		object.render();
+	}
+
+	void TraverseLinkedList(ListItemFormat format, TraversalMode mode, GLuint headPointers, GLuint listBuffer, const vmath::mat4& projection)
+	{
+		// Barriers: atomic counter, texture image and shader storage block
+		glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		glBindImageTexture(0, headPointers, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32UI);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, listBuffer);
+
+		if (mode == kTraverseFullscreen)
+		{
+			glUseProgram(resolvingProgram[format]);
+			glBindVertexArray(fullscreenVao);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+			return;
+		}
+
+		glUseProgram(traversingProgram[format]);
+
+		glUniformMatrix4fv(0, 1, GL_FALSE, viewMatrix * modelWorldMatrix);
+		glUniformMatrix4fv(1, 1, GL_FALSE, projection);
+
+		object.render();
+	}
+
+	/// <summary>
+	/// Fill and traversal GPU time, and memory, of both item formats at 1080p and 4K (offscreen, current object pose)
+	/// The linked list is sized to the exact fragment count of the pose (counted by a first fill with no room)
+	/// </summary>
+	void BenchmarkListItemFormats()
+	{
+		const int kRuns = 16;  // Frames timed per format (after a warm-up one)
+		const GLsizei kResolutions[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+
+		GLuint queries[2];
+		glCreateQueries(GL_TIME_ELAPSED, 2, queries);
+
+		char output[256];
+		for (const GLsizei* resolution : kResolutions)
+		{
+			GLsizei width = resolution[0];
+			GLsizei height = resolution[1];
+
+			// Offscreen target: color and head pointers
+			GLuint colorTexture;
+			glCreateTextures(GL_TEXTURE_2D, 1, &colorTexture);
+			glTextureStorage2D(colorTexture, 1, GL_RGBA8, width, height);
+
+			GLuint framebuffer;
+			glCreateFramebuffers(1, &framebuffer);
+			glNamedFramebufferTexture(framebuffer, GL_COLOR_ATTACHMENT0, colorTexture, 0);
+
+			GLuint headPointers;
+			glCreateTextures(GL_TEXTURE_2D, 1, &headPointers);
+			glTextureStorage2D(headPointers, 1, GL_R32UI, width, height);
+
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			glViewport(0, 0, width, height);
+
+			vmath::mat4 projection = vmath::perspective(45.0f, (float)width / (float)height, 0.1f, 1000.0f);
+
+			// Fragment count: every fragment is counted, even the ones dropped (no room)
+			GLuint listBuffer;
+			glCreateBuffers(1, &listBuffer);
+			glNamedBufferStorage(listBuffer, ListItemSize(kListItemWide), NULL, 0);
+			FillLinkedList(kListItemWide, headPointers, listBuffer, 0, projection);
+			glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+			GLuint fragmentCount = CheckAtomicCounter();
+			glDeleteBuffers(1, &listBuffer);
+
+			// Object out of view: still a valid (1 item) buffer
+			GLuint itemCount = fragmentCount > 0 ? fragmentCount : 1;
+
+			for (int format = 0; format < kListItemFormatTotal; format++)
+			{
+				glCreateBuffers(1, &listBuffer);
+				glNamedBufferStorage(listBuffer, (GLsizeiptr)ListItemSize((ListItemFormat)format) * itemCount, NULL, 0);
+
+				double milliseconds[2] = { 0.0, 0.0 };  // Fill, traversal
+				for (int run = 0; run <= kRuns; run++)
+				{
+					glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+					FillLinkedList((ListItemFormat)format, headPointers, listBuffer, fragmentCount, projection);
+					glEndQuery(GL_TIME_ELAPSED);
+
+					glBeginQuery(GL_TIME_ELAPSED, queries[1]);
+					TraverseLinkedList((ListItemFormat)format, traversalMode, headPointers, listBuffer, projection);
+					glEndQuery(GL_TIME_ELAPSED);
+
+					// Warm-up run is not timed
+					for (int pass = 0; pass < 2 && run > 0; pass++)
+					{
+						GLuint64 nanoseconds = 0;
+						glGetQueryObjectui64v(queries[pass], GL_QUERY_RESULT, &nanoseconds);
+						milliseconds[pass] += nanoseconds / (1.0e6 * kRuns);
+					}
+				}
+
+				glDeleteBuffers(1, &listBuffer);
+
+				double listMegabytes = (double)ListItemSize((ListItemFormat)format) * fragmentCount / 1048576.0;
+				double headMegabytes = sizeof(GLuint) * (double)width * height / 1048576.0;
+				sprintf_s(output, sizeof(output), "Linked list %dx%d, %s items (%u bytes): fill %.3f ms, traversal %.3f ms GPU; %u items: %.1f MB (+ %.1f MB head pointers).\n",
+					width, height, listItemFormatNames[format], ListItemSize((ListItemFormat)format), milliseconds[0], milliseconds[1],
+					fragmentCount, listMegabytes, headMegabytes);
+				OutputDebugStringA(output);
+			}
+
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			glDeleteFramebuffers(1, &framebuffer);
+			glDeleteTextures(1, &colorTexture);
+			glDeleteTextures(1, &headPointers);
+		}
+
+		glDeleteQueries(2, queries);
+		glViewport(0, 0, info.windowWidth, info.windowHeight);
+	}
+
+	/// <summary>
+	/// Traversal fragment shader invocations, lists walked (pixels not discarded) and GPU time of both traversal modes, at several object orientations
+	/// (around Y from the current pose); window framebuffer, current item format
+	/// The linked list is sized to the exact fragment count of each orientation (counted by a first fill with no room)
+	/// </summary>
+	void BenchmarkTraversalModes()
+	{
+		const int kRuns = 16;  // Frames timed per mode (after a warm-up one)
+		const int kOrientations = 8;
+
+		// Traversal: time, fragment shader invocations, samples passed (lists walked); fill + traversal: time
+		GLuint queries[4];
+		glCreateQueries(GL_TIME_ELAPSED, 1, &queries[0]);
+		glCreateQueries(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, 1, &queries[1]);
+		glCreateQueries(GL_SAMPLES_PASSED, 1, &queries[2]);
+		glCreateQueries(GL_TIME_ELAPSED, 1, &queries[3]);
+
+		vmath::mat4 pose = modelWorldMatrix;
+
+		char output[256];
+		for (int orientation = 0; orientation < kOrientations; orientation++)
+		{
+			float degrees = 360.0f * orientation / kOrientations;
+			modelWorldMatrix = vmath::rotate(0.0f, degrees, 0.0f) * pose;
+
+			// Fragment count: every fragment is counted, even the ones dropped (no room)
+			GLuint listBuffer;
+			glCreateBuffers(1, &listBuffer);
+			glNamedBufferStorage(listBuffer, ListItemSize(listItemFormat), NULL, 0);
+			FillLinkedList(listItemFormat, texture, listBuffer, 0, projectionMatrix);
+			glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+			GLuint fragmentCount = CheckAtomicCounter();
+			glDeleteBuffers(1, &listBuffer);
+
+			// Object out of view: still a valid (1 item) buffer
+			glCreateBuffers(1, &listBuffer);
+			glNamedBufferStorage(listBuffer, (GLsizeiptr)ListItemSize(listItemFormat) * (fragmentCount > 0 ? fragmentCount : 1), NULL, 0);
+
+			GLuint64 invocations[kTraversalModeTotal];
+			GLuint64 lists[kTraversalModeTotal];
+			double traversalMilliseconds[kTraversalModeTotal];
+			double frameMilliseconds[kTraversalModeTotal];
+			for (int mode = 0; mode < kTraversalModeTotal; mode++)
+			{
+				traversalMilliseconds[mode] = 0.0;
+				frameMilliseconds[mode] = 0.0;
+
+				for (int run = 0; run <= kRuns; run++)
+				{
+					glBeginQuery(GL_TIME_ELAPSED, queries[3]);
+					FillLinkedList(listItemFormat, texture, listBuffer, fragmentCount, projectionMatrix);
+					glEndQuery(GL_TIME_ELAPSED);
+
+					glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+					glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, queries[1]);
+					glBeginQuery(GL_SAMPLES_PASSED, queries[2]);
+					TraverseLinkedList(listItemFormat, (TraversalMode)mode, texture, listBuffer, projectionMatrix);
+					glEndQuery(GL_SAMPLES_PASSED);
+					glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+					glEndQuery(GL_TIME_ELAPSED);
+
+					// Warm-up run is not timed; counts are the same every run
+					if (run > 0)
+					{
+						GLuint64 fillNanoseconds = 0;
+						GLuint64 traversalNanoseconds = 0;
+						glGetQueryObjectui64v(queries[3], GL_QUERY_RESULT, &fillNanoseconds);
+						glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &traversalNanoseconds);
+						traversalMilliseconds[mode] += traversalNanoseconds / (1.0e6 * kRuns);
+						frameMilliseconds[mode] += (fillNanoseconds + traversalNanoseconds) / (1.0e6 * kRuns);
+					}
+				}
+
+				glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &invocations[mode]);
+				glGetQueryObjectui64v(queries[2], GL_QUERY_RESULT, &lists[mode]);
+			}
+
+			glDeleteBuffers(1, &listBuffer);
+
+			sprintf_s(output, sizeof(output), "Linked list traversal at %.0f deg (%u items): object pass: %llu invocations, %.3f ms (frame %.3f ms) GPU.\n",
+				degrees, fragmentCount, (unsigned long long)invocations[kTraverseObject], traversalMilliseconds[kTraverseObject], frameMilliseconds[kTraverseObject]);
+			OutputDebugStringA(output);
+
+			sprintf_s(output, sizeof(output), "Linked list traversal at %.0f deg: fullscreen resolve: %llu invocations, %llu lists walked, %.3f ms (frame %.3f ms) GPU; %.2fx fewer lists walked.\n",
+				degrees, (unsigned long long)invocations[kTraverseFullscreen], (unsigned long long)lists[kTraverseFullscreen],
+				traversalMilliseconds[kTraverseFullscreen], frameMilliseconds[kTraverseFullscreen],
+				lists[kTraverseFullscreen] > 0 ? (double)invocations[kTraverseObject] / lists[kTraverseFullscreen] : 0.0);
+			OutputDebugStringA(output);
+		}
+
+		modelWorldMatrix = pose;
+		glDeleteQueries(4, queries);
+	}
+
+	/// <summary>
+	/// Frame timer report, labelled with the configuration measured
+	/// </summary>
+	void EndFrame()
+	{
+		counterRing.EndFrame();
+
+		char label[128];
+		if (kbufferConfig >= 0)
+		{
+			sprintf_s(label, sizeof(label), "k-buffer, %u layers", kKBufferLayerCounts[kbufferConfig]);
+		}
+		else
+		{
+			sprintf_s(label, sizeof(label), "%s, %s items, %s", synchronousReset ? "synchronous map reset" : "GPU clear reset", listItemFormatNames[listItemFormat],
+				traversalModeNames[traversalMode]);
+		}
+		frameTimer.EndFrame(label);
+	}
+
+	/// <summary>
+	/// K-buffer of the window (one per pixel): depths and colors of the nearest layers, and the tail (5 uints) merging the rest
+	/// </summary>
+	void CreateKBuffer(GLuint layers, GLuint* buffers)
+	{
+		GLsizeiptr pixels = (GLsizeiptr)info.windowWidth * info.windowHeight;
+
+		glCreateBuffers(3, buffers);
+		glNamedBufferStorage(buffers[0], sizeof(GLuint) * layers * pixels, NULL, GL_DYNAMIC_STORAGE_BIT);
+		glNamedBufferStorage(buffers[1], sizeof(GLuint) * layers * pixels, NULL, GL_DYNAMIC_STORAGE_BIT);
+		glNamedBufferStorage(buffers[2], sizeof(GLuint) * 5 * pixels, NULL, GL_DYNAMIC_STORAGE_BIT);
+	}
+
+	double KBufferBytes(GLuint layers)
+	{
+		return (sizeof(GLuint) * 2.0 * layers + sizeof(GLuint) * 5.0) * info.windowWidth * info.windowHeight;
+	}
+
+	void DestroyKBuffer(GLuint* buffers)
+	{
+		glDeleteBuffers(3, buffers);
+	}
+
+	/// <summary>
+	/// Order-independent transparency with a bounded k-buffer: the nearest layers of every pixel (sorted) and an order-independent tail for the rest
+	/// Two object passes (nearest depths; then colors and tail) and a fullscreen resolve; memory does not depend on the depth complexity
+	/// </summary>
+	void DrawKBuffer(int config, const GLuint* buffers, const vmath::mat4& projection)
+	{
+		// Empty layers, unclaimed colors, empty tail
+		const GLuint empty = 0xFFFFFFFF;
+		const GLuint zero = 0;
+		glClearNamedBufferData(buffers[0], GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &empty);
+		glClearNamedBufferData(buffers[1], GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+		glClearNamedBufferData(buffers[2], GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, buffers[0]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, buffers[1]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, buffers[2]);
+
+		// Nearest depths
+		glUseProgram(kbufferDepthProgram[config]);
+		glUniformMatrix4fv(0, 1, GL_FALSE, viewMatrix * modelWorldMatrix);
+		glUniformMatrix4fv(1, 1, GL_FALSE, projection);
+		glUniform1ui(4, info.windowWidth);
+
+		object.render();
+
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		// Colors of the nearest fragments, tail of the rest
+		glUseProgram(kbufferColorProgram[config]);
+		glUniformMatrix4fv(0, 1, GL_FALSE, viewMatrix * modelWorldMatrix);
+		glUniformMatrix4fv(1, 1, GL_FALSE, projection);
+		glUniform1f(3, oitAlpha);
+		glUniform1ui(4, info.windowWidth);
+
+		object.render();
+
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		// Compositing, once per pixel
+		glUseProgram(kbufferResolvingProgram[config]);
+		glUniform1ui(4, info.windowWidth);
+		glBindVertexArray(fullscreenVao);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+
+	/// <summary>
+	/// Order-independent transparency GPU time (whole technique) and memory: linked list (every fragment stored; nearest sorted in registers) against
+	/// the k-buffer for every layer count (fixed memory); window framebuffer, current object pose
+	/// </summary>
+	void BenchmarkTransparencyModes()
+	{
+		const int kRuns = 16;  // Frames timed per mode (after a warm-up one)
+
+		GLuint query;
+		glCreateQueries(GL_TIME_ELAPSED, 1, &query);
+
+		char output[256];
+
+		// Linked list sized to the exact fragment count (counted by a first fill with no room)
+		GLuint listBuffer;
+		glCreateBuffers(1, &listBuffer);
+		glNamedBufferStorage(listBuffer, ListItemSize(kListItemColor), NULL, 0);
+		FillLinkedList(kListItemColor, texture, listBuffer, 0, projectionMatrix);
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		GLuint fragmentCount = CheckAtomicCounter();
+		glDeleteBuffers(1, &listBuffer);
+
+		GLuint itemCount = fragmentCount > 0 ? fragmentCount : 1;
+		glCreateBuffers(1, &listBuffer);
+		glNamedBufferStorage(listBuffer, (GLsizeiptr)ListItemSize(kListItemColor) * itemCount, NULL, 0);
+
+		double milliseconds = 0.0;
+		for (int run = 0; run <= kRuns; run++)
+		{
+			glBeginQuery(GL_TIME_ELAPSED, query);
+			FillLinkedList(kListItemColor, texture, listBuffer, itemCount, projectionMatrix);
+			TraverseLinkedList(kListItemColor, kTraverseFullscreen, texture, listBuffer, projectionMatrix);
+			glEndQuery(GL_TIME_ELAPSED);
+
+			// Warm-up run is not timed
+			if (run > 0)
+			{
+				GLuint64 nanoseconds = 0;
+				glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+				milliseconds += nanoseconds / (1.0e6 * kRuns);
+			}
+		}
+
+		glDeleteBuffers(1, &listBuffer);
+
+		double listMegabytes = (double)ListItemSize(kListItemColor) * fragmentCount / 1048576.0;
+		double headMegabytes = sizeof(GLuint) * (double)info.windowWidth * info.windowHeight / 1048576.0;
+		sprintf_s(output, sizeof(output), "Transparency %dx%d, linked list (all fragments, up to 16 sorted): %.3f ms GPU; %u fragments: %.1f MB (+ %.1f MB head pointers).\n",
+			info.windowWidth, info.windowHeight, milliseconds, fragmentCount, listMegabytes, headMegabytes);
+		OutputDebugStringA(output);
+
+		// K-buffer, every layer count
+		for (int config = 0; config < kKBufferConfigTotal; config++)
+		{
+			GLuint buffers[3];
+			CreateKBuffer(kKBufferLayerCounts[config], buffers);
+
+			milliseconds = 0.0;
+			for (int run = 0; run <= kRuns; run++)
+			{
+				glBeginQuery(GL_TIME_ELAPSED, query);
+				DrawKBuffer(config, buffers, projectionMatrix);
+				glEndQuery(GL_TIME_ELAPSED);
+
+				if (run > 0)
+				{
+					GLuint64 nanoseconds = 0;
+					glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+					milliseconds += nanoseconds / (1.0e6 * kRuns);
+				}
+			}
+
+			DestroyKBuffer(buffers);
+
+			sprintf_s(output, sizeof(output), "Transparency %dx%d, k-buffer (%u nearest sorted, rest merged): %.3f ms GPU; %.1f MB (%u bytes per pixel, any fragment count).\n",
+				info.windowWidth, info.windowHeight, kKBufferLayerCounts[config], milliseconds, KBufferBytes(kKBufferLayerCounts[config]) / 1048576.0,
+				(GLuint)(sizeof(GLuint) * (2 * kKBufferLayerCounts[config] + 5)));
+			OutputDebugStringA(output);
+		}
+
+		glDeleteQueries(1, &query);
 	}
 
 private:
@@ -411,9 +1472,36 @@ private:
 			GLuint prev;
 		};
 
+		struct CompactLinkedListItem
+		{
+			GLuint depthFacing;  // Depth quantized to 31 bits << 1 | facing bit
+			GLuint prev;
+		};
+
+		struct ColorLinkedListItem
+		{
+			GLuint color;  // RGBA8
+			GLfloat depth;
+			GLuint prev;
+		};
+
 private:
-	GLuint fillingProgram;
-	GLuint traversingProgram;
+	GLuint fillingProgram[kListItemFormatTotal];
+	GLuint traversingProgram[kListItemFormatTotal];
+	GLuint resolvingProgram[kListItemFormatTotal];
+	GLuint fullscreenVao;
+
+	// Order-independent transparency
+	const float oitAlpha = 0.4f;
+	static const int kKBufferConfigTotal = 3;
+	const GLuint kKBufferLayerCounts[kKBufferConfigTotal] = { 2, 4, 8 };
+	const float kKBufferTailScale = 1024.0f;  // Fixed point units of the k-buffer tail
+	GLuint kbufferDepthProgram[kKBufferConfigTotal];
+	GLuint kbufferColorProgram[kKBufferConfigTotal];
+	GLuint kbufferResolvingProgram[kKBufferConfigTotal];
+	int kbufferConfig = -1;  // Layer count index (-1: off, linked list)
+	GLuint kbufferBuffers[3];  // Depths, colors, tails
+	bool benchmarkTransparency = false;
 
 	sb7::object object;
 	vmath::mat4 modelWorldMatrix;
@@ -422,13 +1510,26 @@ private:
 	vmath::mat4 viewMatrix;
 	vmath::mat4 projectionMatrix;
 
-	GLuint acbo;
+	AtomicCounterRing counterRing;
+	static const int readbackFrameCount = 3;  // Frames the fragment count is read back later
 	GLuint atomicCounterMaxValue = 0;
+	bool synchronousReset = false;
+	FrameTimer frameTimer;
 
 	GLuint texture;
 
 	GLuint ssbo;
-	LinkedListItem* linkedList;
+	ListItemFormat listItemFormat = kListItemCompact;
+	const char* listItemFormatNames[kListItemFormatTotal] = { "wide", "compact", "color" };
+	bool benchmarkListItems = false;
+	TraversalMode traversalMode = kTraverseFullscreen;
+	const char* traversalModeNames[kTraversalModeTotal] = { "object pass traversal", "fullscreen resolve" };
+	bool benchmarkTraversal = false;
+	GLuint itemCapacity = 0;
+	GLuint itemPeak = 0;  // Highest fragment count read back (high-water mark)
+	GLuint reallocationCount = 0;
+	const float itemHighWaterMark = 0.9f;  // Share of the capacity that triggers a reallocation
+	const float itemHeadroom = 1.5f;  // New capacity, relative to the fragment count that triggered the reallocation
 };
 
 // Our one and only instance of DECLARE_MAIN
@@ -455,6 +1556,10 @@ For the same position, there may be more than one fragment that has an entry in
 Hence, regardless of the fragment instance that is executed, the one whose index is in the texture image variable is always searched in the list
 So, for all fragment instances in the same position, the same index will always be taken (the one in the texture image variable) and the same number of linked elements in the list will always be iterated in the same order
 As they will all produce the same output (the alpha is the same, because the purpose of this shader is that OpenGL does not have to do depth test or geometry discarding - culling - in the vertex post-processing stage), it is a loss of efficiency to process the n fragments of the same position; only one would be enough
+That is what the fullscreen resolve (kTraverseFullscreen) does: one triangle covering the viewport, so one fragment shader invocation per pixel walks its list once; pixels with an empty list discard (T key compares both ways)
+
+Order-independent transparency (color items, kListItemColor) needs every fragment of a pixel sorted, so the traversal has no max_fragments cap: the nearest 16 are insertion sorted in registers and farther ones are merged into a tail (weighted average color, exact transmittance)
+The k-buffer (K key) keeps only the nearest K per pixel with the same tail for the rest: fixed memory whatever the depth complexity, but two object passes (depths first, then colors) because a 32-bit atomic cannot sort depth and color together (O key compares both ways)
 
 The initialization value of the framebuffer could be, as in the example, the maximum value of a uint type variable (32 bits for values): 0xFFFFFFFFFFFFFFFF
 Here, we would run the risk that if the atomic counter (also uint) reached its maximum value (0xFFFFFFFFFFFF), we would not be able to distinguish between a framebuffer initialization value and the index itself
@@ -0,0 +1,136 @@
+#pragma once
+
+/*
+	Counter-based RNG (Random Number Generator): PCG hash
+	Stateless: number i of stream key is CounterRandom(key, i), so numbers can be drawn in any order and in parallel (any blade, texel or particle uses its own index as counter).
+	Compare with xorshift* (see xorshiftp.h): each number is the seed of the next one, so number n of a chain needs the n - 1 previous ones.
+
+	PCG hash is the output permutation of a PCG (Permuted Congruential Generator) step applied to the input: one LCG step followed by a random xorshift (shift amount picked by the 4 MSBs) and a multiply-xorshift.
+	Counter-based numbers add one more xorshift-multiply round: plain PCG hash mixes some counter bits poorly into the low output bits (avalanche bias about 0.08, e.g. input bit 21 to output bit 10; see ch07app04rngtests), and low bits are the ones grass offsets use.
+	Every function here has a GLSL counterpart in kCounterRngGlsl, bit-identical on 32 bit unsigned integers; shaders include it as one more source string, right after "#version".
+*/
+
+#include "xorshiftp.h"
+
+const char kCounterRngGlsl[] =
+	"// Counter-based RNG (Random Number Generator): PCG hash\n"
+	"uint pcgHash(uint value)\n"
+	"{\n"
+	"	uint state = value * 747796405u + 2891336453u;\n"
+	"	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;\n"
+	"	return (word >> 22u) ^ word;\n"
+	"}\n"
+	"\n"
+	"// Number 'counter' of stream 'key'\n"
+	"uint counterRandom(uint key, uint counter)\n"
+	"{\n"
+	"	uint value = pcgHash(counter + pcgHash(key));\n"
+	"	value = (value ^ (value >> 16u)) * 0x7FEB352Du;\n"
+	"	return value ^ (value >> 15u);\n"
+	"}\n"
+	"\n"
+	"// Same number as a float in [0, 1) (24 MSBs)\n"
+	"float counterRandomFloat(uint key, uint counter)\n"
+	"{\n"
+	"	return float(counterRandom(key, counter) >> 8u) / 16777216.0;\n"
+	"}\n";
+
+inline uint32_t PcgHash(uint32_t value)
+{
+	uint32_t state = value * 747796405u + 2891336453u;
+	uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+/// <summary>
+/// Number 'counter' of stream 'key'
+/// Note: Key is hashed once, so keys only need to be distinct (e.g. blade index, texel index)
+/// </summary>
+inline uint32_t CounterRandom(uint32_t key, uint32_t counter)
+{
+	uint32_t value = PcgHash(counter + PcgHash(key));
+	value = (value ^ (value >> 16)) * 0x7FEB352Du;
+	return value ^ (value >> 15);
+}
+
+/// <summary>
+/// Same number as a float in [0, 1) (24 MSBs)
+/// </summary>
+inline float CounterRandomFloat(uint32_t key, uint32_t counter)
+{
+	return (CounterRandom(key, counter) >> 8) / 16777216.0f;
+}
+
+#pragma region Batch kernels
+
+/// <summary>
+/// output[i] = CounterRandom(key, first + i), for i in [0, count)
+/// </summary>
+inline void CounterRandomBatchScalar(uint32_t key, size_t first, uint32_t* output, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		output[i] = CounterRandom(key, (uint32_t)(first + i));
+	}
+}
+
+XORSHIFTP_TARGET_AVX2 inline void CounterRandomBatchAvx2(uint32_t key, size_t first, uint32_t* output, size_t count)
+{
+	const __m256i kMultiplier = _mm256_set1_epi32((int)747796405u);
+	const __m256i kIncrement = _mm256_set1_epi32((int)2891336453u);
+	const __m256i kWordMultiplier = _mm256_set1_epi32((int)277803737u);
+	const __m256i kFinalMultiplier = _mm256_set1_epi32((int)0x7FEB352Du);
+	const __m256i kFour = _mm256_set1_epi32(4);
+	const __m256i kStep = _mm256_set1_epi32(8);
+	__m256i counters = _mm256_add_epi32(_mm256_set1_epi32((int)(PcgHash(key) + (uint32_t)first)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i state = _mm256_add_epi32(_mm256_mullo_epi32(counters, kMultiplier), kIncrement);
+		__m256i shift = _mm256_add_epi32(_mm256_srli_epi32(state, 28), kFour);  // Per lane shift amount (AVX2 variable shift)
+		__m256i word = _mm256_mullo_epi32(_mm256_xor_si256(_mm256_srlv_epi32(state, shift), state), kWordMultiplier);
+		__m256i value = _mm256_xor_si256(_mm256_srli_epi32(word, 22), word);
+		value = _mm256_mullo_epi32(_mm256_xor_si256(value, _mm256_srli_epi32(value, 16)), kFinalMultiplier);
+		_mm256_storeu_si256((__m256i*)(output + i), _mm256_xor_si256(value, _mm256_srli_epi32(value, 15)));
+		counters = _mm256_add_epi32(counters, kStep);
+	}
+
+	// Remainder
+	CounterRandomBatchScalar(key, first + i, output + i, count - i);
+}
+
+/// <summary>
+/// output[i] = CounterRandom(key, first + i), for i in [0, count), with the given kernel (falls back to a supported one)
+/// Note: No SSE4.1 kernel, as variable shifts require AVX2 (SSE4.1 falls back to scalar)
+/// </summary>
+inline void CounterRandomBatch(uint32_t key, size_t first, uint32_t* output, size_t count, XorshiftpKernel kernel = kXorshiftpKernelTotal)
+{
+	XorshiftpKernel best = XorshiftpBestKernel();
+	if (kernel > best)
+	{
+		kernel = best;
+	}
+
+	if (kernel == kXorshiftpAvx2)
+	{
+		CounterRandomBatchAvx2(key, first, output, count);
+	}
+	else
+	{
+		CounterRandomBatchScalar(key, first, output, count);
+	}
+}
+
+/// <summary>
+/// Threaded batch: ranges of [0, count) split among the threads of the pool
+/// </summary>
+inline void CounterRandomBatch(XorshiftpThreadPool& pool, uint32_t key, uint32_t* output, size_t count, XorshiftpKernel kernel = kXorshiftpKernelTotal)
+{
+	pool.Run(count, [=](size_t first, size_t rangeCount)
+	{
+		CounterRandomBatch(key, first, output + first, rangeCount, kernel);
+	});
+}
+
+#pragma endregion
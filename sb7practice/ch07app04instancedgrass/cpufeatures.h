@@ -0,0 +1,48 @@
+#pragma once
+
+/*
+	Instruction sets supported by the CPU (and enabled by the OS), for kernels selected at runtime (xorshiftp.h, ch08 terrainheightfield.h).
+
+	AVX2 needs the OS to save the YMM registers on context switches: CPUID OSXSAVE bit, then XCR0 (xgetbv) bits 1 and 2 (SSE and AVX state).
+*/
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+struct CpuFeatures
+{
+	bool sse41;
+	bool avx2;
+};
+
+/// <summary>
+/// Instruction sets supported by the CPU (checked once)
+/// </summary>
+inline const CpuFeatures& GetCpuFeatures()
+{
+	static const CpuFeatures features = []()
+	{
+		CpuFeatures result = {};
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+		__cpuid(info, 1);
+		result.sse41 = (info[2] & (1 << 19)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		if (maxLeaf >= 7 && osxsave && (_xgetbv(0) & 0x6) == 0x6)
+		{
+			__cpuidex(info, 7, 0);
+			result.avx2 = (info[1] & (1 << 5)) != 0;
+		}
+#else
+		__builtin_cpu_init();
+		result.sse41 = __builtin_cpu_supports("sse4.1");
+		result.avx2 = __builtin_cpu_supports("avx2");
+#endif
+		return result;
+	}();
+
+	return features;
+}
@@ -1,6 +1,41 @@
 // Include the "sb7.h" header file
 #include "sb7.h"
+#include "sb7ktx.h"
 #include "vmath.h"
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <chrono>
+#include "xorshiftp.h"
+#include "counterrng.h"
+#include "streamcompaction.h"
+
+enum GrassRenderMode
+{
+	kBruteForce,  // Draw every blade of the grassland
+	kGpuCulled,  // Draw only the blades surviving the compute pre-pass (frustum and distance culling)
+	kGpuCulledLod,  // As previous one, but visible blades are binned by distance into LOD meshes (multi-draw indirect)
+	kGpuCulledLodImpostors,  // As previous one, but tiles beyond impostor distance are drawn as textured cards (cached atlas) instead of blades
+	kGrassRenderModeTotal
+};
+
+enum GrassLod
+{
+	kGrassLod0,  // Full blade: 6 vertices
+	kGrassLod1,  // 4 vertices
+	kGrassLod2,  // 3 vertices (single triangle)
+	kGrassLodFarField,  // 3 vertices; thinned out (1 out of 4 blades) and widened to keep field coverage
+	kGrassLodTotal
+};
+
+// Resident grass tile (std430 layout; same as grass_tile in the shader code)
+struct GrassTile
+{
+	GLint originX;
+	GLint originZ;
+	GLuint seed;
+	GLuint valid;
+};
 
 // Derive my_application from sb7::application
 class my_application : public sb7::application
@@ -13,10 +48,19 @@ public:
 		InitializeGround();
 		InitializeGrassProgram();
 		InitializeGrass();
-		InitializeGrassParameterTexture2D(0);
+		InitializeGrassParameterTexture2D(2);
 		InitializeGrassColorTexture1D(0);
+		InitializeGrassCullingProgram();
+		InitializeGrassCulling();
+		InitializeGrassTiles();
+		InitializeGrassBakeProgram();
+		InitializeGrassWind();
+		InitializeGrassImpostors();
+		InitializeGrassPlacement();
 		//TestXorshiftp();
 		//TestPairsXorshiftp();
+		//TestCounterRng();
+		//TestStreamCompaction();
 	}
 
 	void render(double currentTime)
@@ -39,19 +83,61 @@ public:
 			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 		}
 
+		if (grassParamRegeneration && grassParamPbo != 0)
+		{
+			RegenerateGrassParameterTile();
+		}
+
 		// Draw - Grass
-		glUseProgram(grassProgram);
-		glBindVertexArray(grassVao);
-		glUniformMatrix4fv(0, 1, GL_FALSE, cameraProjectionMatrix * cameraViewMatrix);
-		glBindTextureUnit(0, grassParamTexture2D);
-		glBindTextureUnit(1, grassColorTexture1D);
-		glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 6, pow(2, 20));  // 1024 x 1024 grassland; it would be usefull to send this value into the vertex shader stage for use in randomization functions
+		if (grassRenderMode != kBruteForce)
+		{
+			// Compute pass: update (a share of) the wind field
+			UpdateGrassWind(currentTime);
+
+			if (grassRenderMode == kGpuCulledLodImpostors || grassImpostorComparison)
+			{
+				UpdateGrassImpostorAtlas();
+			}
+
+			if (grassImpostorComparison)
+			{
+				// Visual comparison: full geometry on the left half of the window, impostors on the right half
+				glEnable(GL_SCISSOR_TEST);
+				glScissor(0, 0, info.windowWidth / 2, info.windowHeight);
+				DrawCulledGrass(kGpuCulledLod);
+				glScissor(info.windowWidth / 2, 0, info.windowWidth - info.windowWidth / 2, info.windowHeight);
+				DrawCulledGrass(kGpuCulledLodImpostors);
+				glDisable(GL_SCISSOR_TEST);
+			}
+			else
+			{
+				DrawCulledGrass(grassRenderMode);
+			}
+		}
+		else
+		{
+			glUseProgram(grassProgram);
+			glBindVertexArray(grassVao);
+			glUniformMatrix4fv(0, 1, GL_FALSE, cameraProjectionMatrix * cameraViewMatrix);
+			glBindTextureUnit(0, grassParamTexture2D);
+			glBindTextureUnit(1, grassColorTexture1D);
+			glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 6, kGrassBladeTotal);  // 1024 x 1024 grassland; it would be usefull to send this value into the vertex shader stage for use in randomization functions
+		}
+
+		ReportGrassStats(currentTime);
 	}
 
 	void shutdown()
 	{
 		RemoveGround();
 		RemoveGrass();
+		RemoveGrassCulling();
+		RemoveGrassTiles();
+		RemoveGrassBake();
+		RemoveGrassMultiParameterTexture2D();
+		RemoveGrassWind();
+		RemoveGrassImpostors();
+		RemoveGrassPlacement();
 	}
 
 public:
@@ -66,6 +152,94 @@ public:
 		UpdateCameraProjectionMatrix((float)info.windowWidth, (float)info.windowHeight);
 	}
 
+	void onKey(int key, int action)
+	{
+		sb7::application::onKey(key, action);
+
+		switch (key)
+		{
+		case GLFW_KEY_C:
+			if (action)
+			{
+				// Cycle brute-force, GPU culled, GPU culled + LOD and GPU culled + LOD + impostors grass rendering
+				grassRenderMode = (GrassRenderMode)((grassRenderMode + 1) % kGrassRenderModeTotal);
+			}
+			break;
+		case GLFW_KEY_1:
+		case GLFW_KEY_2:
+		case GLFW_KEY_3:
+			if (action)
+			{
+				// Select LOD bin threshold to tune (LOD0-LOD1, LOD1-LOD2 or LOD2-far field)
+				grassLodThresholdIndex = key - GLFW_KEY_1;
+			}
+			break;
+		case GLFW_KEY_UP:
+			if (action)
+			{
+				TuneGrassLodThreshold(kGrassLodThresholdStep);
+			}
+			break;
+		case GLFW_KEY_DOWN:
+			if (action)
+			{
+				TuneGrassLodThreshold(-kGrassLodThresholdStep);
+			}
+			break;
+		case GLFW_KEY_B:
+			if (action)
+			{
+				// Switch between baked and on-the-fly per-blade attributes (vertex shader)
+				grassBakedAttributes = !grassBakedAttributes;
+			}
+			break;
+		case GLFW_KEY_S:
+			if (action)
+			{
+				// New grassland seed: every resident tile is re-seeded (and re-baked) on next frame
+				ReseedGrassTiles(Xorshiftp(grassWorldSeed, 1));
+			}
+			break;
+		case GLFW_KEY_V:
+			if (action)
+			{
+				BenchmarkGrassVertexStage();
+			}
+			break;
+		case GLFW_KEY_W:
+			if (action)
+			{
+				// Wind field update period (frames): 1 - 2 - 4 - 8
+				SetGrassWindUpdatePeriod(grassWindUpdatePeriod < kGrassWindMaxUpdatePeriod ? grassWindUpdatePeriod * 2 : 1);
+			}
+			break;
+		case GLFW_KEY_P:
+			if (action)
+			{
+				// Switch runtime regeneration of parameters texture tiles on / off
+				grassParamRegeneration = !grassParamRegeneration;
+			}
+			break;
+		case GLFW_KEY_I:
+			if (action)
+			{
+				// Switch split-screen comparison of far-field grass on / off (left: full geometry; right: impostors)
+				grassImpostorComparison = !grassImpostorComparison;
+			}
+			break;
+		case GLFW_KEY_D:
+			if (action)
+			{
+				// Switch density map driven placement on / off: every resident tile is placed (and baked) again on next frame
+				grassDensityPlacement = !grassDensityPlacement;
+				ReseedGrassTiles(grassWorldSeed);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
 private:
 
 #pragma region Camera
@@ -83,6 +257,7 @@ private:
 		float height = 25.0f;
 		vmath::vec3 newPosition(vmath::vec3(sinf(scaledElapsedTime) * radius, height, cosf(scaledElapsedTime) * radius));  // Circular motion
 		UpdateCameraViewMatrix(newPosition);
+		cameraPosition = newPosition;
 	}
 
 	void UpdateCameraViewMatrix(vmath::vec3 position)
@@ -101,6 +276,33 @@ private:
 		cameraProjectionMatrix = vmath::perspective(fov, aspect, n, f);
 	}
 
+	/// <summary>
+	/// Extract the six clipping planes (left, right, bottom, top, near, far) of the view frustum from a view-projection matrix
+	/// Planes are normalized so the dot product with a world position is its signed distance (positive inside)
+	/// </summary>
+	void ExtractFrustumPlanes(const vmath::mat4& vpMatrix, vmath::vec4 planes[6])
+	{
+		// Note: vmath matrices are column-major, so row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+		vmath::vec4 rows[4];
+		for (int i = 0; i < 4; i++)
+		{
+			rows[i] = vmath::vec4(vpMatrix[0][i], vpMatrix[1][i], vpMatrix[2][i], vpMatrix[3][i]);
+		}
+
+		planes[0] = rows[3] + rows[0];
+		planes[1] = rows[3] - rows[0];
+		planes[2] = rows[3] + rows[1];
+		planes[3] = rows[3] - rows[1];
+		planes[4] = rows[3] + rows[2];
+		planes[5] = rows[3] - rows[2];
+
+		for (int i = 0; i < 6; i++)
+		{
+			float length = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+			planes[i] = planes[i] / length;
+		}
+	}
+
 #pragma endregion
 
 #pragma region Object - Ground (earth)
@@ -458,10 +660,204 @@ private:
 			"}																	\n"
 		};
 
+		// Culled colored perturbed grassland
+		/*
+			Same as previous one, but the blade index is not gl_InstanceID: it is sourced (as an instanced vertex attribute) from the buffer filled by the culling compute pre-pass.
+			Only the blades surviving the frustum and distance tests are instanced, so the vertex stage does not process any blade out of sight.
+
+			Blades do not come from the fixed 1024x1024 bit-packed grid either, but from the tiled grassland: blade index selects a resident tile (origin and seed) and a blade within it.
+			Tile side is not required to be a power of 2, as the local grid coordinate is obtained with division and modulo (not bit extraction).
+
+			Each blade also gets its own height, lean and bend (from parameters texture channels). All per-blade attributes are generated on the fly: every vertex of the blade repeats the same work (and so does every frame).
+		*/
+		const char* vertexShaderSource_04CulledColoredPerturbedGrassland[] =
+		{
+			"#version 450 core													\n"
+			"																	\n"
+			"layout (location = 0) uniform mat4 vp_matrix;						\n"
+			"layout (location = 2) uniform uint tile_side;						\n"
+			"layout (binding = 0) uniform sampler2D grassparam_tex;				\n"
+			"layout (binding = 1) uniform sampler1D grasscolor_tex;				\n"
+			"layout (binding = 2) uniform sampler2D grasswind_tex;				\n"
+			"																	\n"
+			"layout (location = 0) in vec3 position;							\n"
+			"layout (location = 1) in int blade_index;  // 28 LSBs: resident blade index (tile slot * tile blades + local index); 4 MSBs: LOD bin\n"
+			"																	\n"
+			"out vec4 fs_color;													\n"
+			"																	\n"
+			"struct grass_tile													\n"
+			"{																	\n"
+			"	ivec2 origin;													\n"
+			"	uint seed;														\n"
+			"	uint valid;														\n"
+			"};																	\n"
+			"																	\n"
+			"// Resident tiles (ring around the camera)							\n"
+			"layout (binding = 2, std430) readonly buffer tile_block			\n"
+			"{																	\n"
+			"	grass_tile tiles[];												\n"
+			"};																	\n"
+			"																	\n"
+			"// Non-linear xorshift RNG (Random Number Generator): xorshift*	\n"
+			"int random(int seed, uint iterations)								\n"
+			"{																	\n"
+			"	int value = seed;												\n"
+			"	int i;															\n"
+			"																	\n"
+			"	// Iterate over to increase randomness							\n"
+			"	for (i = 0; i < iterations; i++)								\n"
+			"	{																\n"
+			"		// Multiply by a great number to generate a random number	\n"
+			"		value = ((value >> 7) ^ (value << 9)) * 15485863;			\n"
+			"	}																\n"
+			"																	\n"
+			"	return value;													\n"
+			"}																	\n"
+			"																	\n"
+			"// Blade shape: scale height, lean (along X-axis) and push by the wind (along XZ plane) the tip more than the root; bend sets the profile (0: straight; 1: curved)\n"
+			"vec3 shapeBlade(vec3 position, float height, float lean, float bend, vec2 wind)\n"
+			"{																	\n"
+			"	vec3 p = position * vec3(1.0, height, 1.0);						\n"
+			"	float t = position.y / 3.3;										\n"
+			"	float profile = pow(t, 1.0 + 2.0 * bend);						\n"
+			"	p.x += lean * profile;											\n"
+			"	p.xz += wind * profile;											\n"
+			"	return p;														\n"
+			"}																	\n"
+			"																	\n"
+			"void main(void)													\n"
+			"{																	\n"
+			"	uint resident = uint(blade_index & 0x0FFFFFFF);					\n"
+			"	uint tile_blades = tile_side * tile_side;						\n"
+			"	grass_tile tile = tiles[resident / tile_blades];				\n"
+			"	uint local = resident % tile_blades;							\n"
+			"																	\n"
+			"	// Perturbed grid coordinate: 3 + 2 xorshift iterations (same bit selection as the bake pass)\n"
+			"	int number1 = random(int(tile.seed + local), 3);				\n"
+			"	int number2 = random(number1, 2);								\n"
+			"	vec2 p_grid = vec2(tile.origin) + vec2(float(local % tile_side), float(local / tile_side));\n"
+			"	vec2 p_rgrid = p_grid + vec2(float(number1 & 0xFF), float(number2 & 0xFF)) / 256.0;\n"
+			"																	\n"
+			"	// Per-blade parameters from parameters texture (at blade root): height (red), lean (green), bend (blue) and color palette index (alpha)\n"
+			"	vec4 params = texture(grassparam_tex, (p_rgrid / 1024.0) + vec2(0.5));\n"
+			"	float height = 0.75 + 0.5 * params.r;							\n"
+			"	float lean = params.g - 0.5;									\n"
+			"	float bend = params.b;											\n"
+			"	float palette = params.a;										\n"
+			"																	\n"
+			"	// Wind displacement at blade root (same texel for every vertex of the blade)\n"
+			"	vec2 wind = texture(grasswind_tex, (p_rgrid / 1024.0) + vec2(0.5)).xy;\n"
+			"																	\n"
+			"	// Far-field blades (LOD bin 3) are thinned out, so widen them to keep field coverage\n"
+			"	int lod = blade_index >> 28;									\n"
+			"	vec3 p_blade = shapeBlade(lod == 3 ? position * vec3(2.0, 1.0, 1.0) : position, height, lean, bend, wind);\n"
+			"																	\n"
+			"	// Offset vertex position along XZ plane						\n"
+			"	vec3 p_offset = p_blade + vec3(p_rgrid.x, 0.0, p_rgrid.y);		\n"
+			"																	\n"
+			"	// Output position												\n"
+			"	gl_Position = vp_matrix * vec4(p_offset, 1.0);					\n"
+			"																	\n"
+			"	// Output color													\n"
+			"	fs_color = texture(grasscolor_tex, palette);					\n"
+			"}																	\n"
+		};
+
+		// Baked colored perturbed grassland
+		/*
+			Same output as previous one, but per-blade attributes are not generated: they are fetched (a single packed uint) from the buffer written by the bake pass.
+			Bake pass only runs when a tile becomes resident (or grassland seed changes), so the RNG is not evaluated per vertex nor per frame.
+		*/
+		const char* vertexShaderSource_05BakedColoredPerturbedGrassland[] =
+		{
+			"#version 450 core													\n"
+			"																	\n"
+			"layout (location = 0) uniform mat4 vp_matrix;						\n"
+			"layout (location = 2) uniform uint tile_side;						\n"
+			"layout (binding = 1) uniform sampler1D grasscolor_tex;				\n"
+			"layout (binding = 2) uniform sampler2D grasswind_tex;				\n"
+			"																	\n"
+			"layout (location = 0) in vec3 position;							\n"
+			"layout (location = 1) in int blade_index;  // 28 LSBs: resident blade index (tile slot * tile blades + local index); 4 MSBs: LOD bin\n"
+			"																	\n"
+			"out vec4 fs_color;													\n"
+			"																	\n"
+			"struct grass_tile													\n"
+			"{																	\n"
+			"	ivec2 origin;													\n"
+			"	uint seed;														\n"
+			"	uint valid;														\n"
+			"};																	\n"
+			"																	\n"
+			"// Resident tiles (ring around the camera)							\n"
+			"layout (binding = 2, std430) readonly buffer tile_block			\n"
+			"{																	\n"
+			"	grass_tile tiles[];												\n"
+			"};																	\n"
+			"																	\n"
+			"// Baked per-blade attributes (one packed uint per resident blade)	\n"
+			"layout (binding = 4, std430) readonly buffer blade_block			\n"
+			"{																	\n"
+			"	uint blades[];													\n"
+			"};																	\n"
+			"																	\n"
+			"// Blade shape: scale height, lean (along X-axis) and push by the wind (along XZ plane) the tip more than the root; bend sets the profile (0: straight; 1: curved)\n"
+			"vec3 shapeBlade(vec3 position, float height, float lean, float bend, vec2 wind)\n"
+			"{																	\n"
+			"	vec3 p = position * vec3(1.0, height, 1.0);						\n"
+			"	float t = position.y / 3.3;										\n"
+			"	float profile = pow(t, 1.0 + 2.0 * bend);						\n"
+			"	p.x += lean * profile;											\n"
+			"	p.xz += wind * profile;											\n"
+			"	return p;														\n"
+			"}																	\n"
+			"																	\n"
+			"void main(void)													\n"
+			"{																	\n"
+			"	uint resident = uint(blade_index & 0x0FFFFFFF);					\n"
+			"	uint tile_blades = tile_side * tile_side;						\n"
+			"	grass_tile tile = tiles[resident / tile_blades];				\n"
+			"	uint local = resident % tile_blades;							\n"
+			"																	\n"
+			"	// Per-blade attributes: unpack (x offset 8 bits, z offset 8 bits, palette 6 bits, height 4 bits, lean 4 bits, bend 2 bits)\n"
+			"	uint attributes = blades[resident];								\n"
+			"	vec2 p_grid = vec2(tile.origin) + vec2(float(local % tile_side), float(local / tile_side));\n"
+			"	vec2 p_rgrid = p_grid + vec2(float(attributes & 0xFFu), float((attributes >> 8) & 0xFFu)) / 256.0;\n"
+			"	float palette = float((attributes >> 16) & 0x3Fu) / 63.0;		\n"
+			"	float height = 0.75 + 0.5 * float((attributes >> 22) & 0xFu) / 15.0;\n"
+			"	float lean = float((attributes >> 26) & 0xFu) / 15.0 - 0.5;		\n"
+			"	float bend = float(attributes >> 30) / 3.0;						\n"
+			"																	\n"
+			"	// Wind displacement at blade root (same texel for every vertex of the blade)\n"
+			"	vec2 wind = texture(grasswind_tex, (p_rgrid / 1024.0) + vec2(0.5)).xy;\n"
+			"																	\n"
+			"	// Far-field blades (LOD bin 3) are thinned out, so widen them to keep field coverage\n"
+			"	int lod = blade_index >> 28;									\n"
+			"	vec3 p_blade = shapeBlade(lod == 3 ? position * vec3(2.0, 1.0, 1.0) : position, height, lean, bend, wind);\n"
+			"																	\n"
+			"	// Offset vertex position along XZ plane						\n"
+			"	vec3 p_offset = p_blade + vec3(p_rgrid.x, 0.0, p_rgrid.y);		\n"
+			"																	\n"
+			"	// Output position												\n"
+			"	gl_Position = vp_matrix * vec4(p_offset, 1.0);					\n"
+			"																	\n"
+			"	// Output color													\n"
+			"	fs_color = texture(grasscolor_tex, palette);					\n"
+			"}																	\n"
+		};
+
 		GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
 		glShaderSource(vertexShader, 1, vertexShaderSource_03ColoredPerturbedGrassland, NULL);
 		glCompileShader(vertexShader);
 
+		GLuint culledVertexShader = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(culledVertexShader, 1, vertexShaderSource_04CulledColoredPerturbedGrassland, NULL);
+		glCompileShader(culledVertexShader);
+
+		GLuint bakedVertexShader = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(bakedVertexShader, 1, vertexShaderSource_05BakedColoredPerturbedGrassland, NULL);
+		glCompileShader(bakedVertexShader);
+
 		// Fragment shader
 		const char* fragmentShaderSource[] =
 		{
@@ -481,15 +877,53 @@ private:
 		glShaderSource(fragmentShader, 1, fragmentShaderSource, NULL);
 		glCompileShader(fragmentShader);
 
+		// Fragment shader - Impostor atlas: coverage only (color comes from the palette when the card is drawn)
+		const char* coverageFragmentShaderSource[] =
+		{
+			"#version 450 core													\n"
+			"																	\n"
+			"out vec4 color;													\n"
+			"																	\n"
+			"void main(void)													\n"
+			"{																	\n"
+			"	color = vec4(1.0);												\n"
+			"}																	\n"
+		};
+
+		GLuint coverageFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(coverageFragmentShader, 1, coverageFragmentShaderSource, NULL);
+		glCompileShader(coverageFragmentShader);
+
 		// Program
 		grassProgram = glCreateProgram();
 		glAttachShader(grassProgram, vertexShader);
 		glAttachShader(grassProgram, fragmentShader);
 		glLinkProgram(grassProgram);
 
+		// Program - Culled
+		grassCulledProgram = glCreateProgram();
+		glAttachShader(grassCulledProgram, culledVertexShader);
+		glAttachShader(grassCulledProgram, fragmentShader);
+		glLinkProgram(grassCulledProgram);
+
+		// Program - Culled (baked attributes)
+		grassCulledBakedProgram = glCreateProgram();
+		glAttachShader(grassCulledBakedProgram, bakedVertexShader);
+		glAttachShader(grassCulledBakedProgram, fragmentShader);
+		glLinkProgram(grassCulledBakedProgram);
+
+		// Program - Impostor atlas (on-the-fly attributes, so patches need no bake)
+		grassImpostorAtlasProgram = glCreateProgram();
+		glAttachShader(grassImpostorAtlasProgram, culledVertexShader);
+		glAttachShader(grassImpostorAtlasProgram, coverageFragmentShader);
+		glLinkProgram(grassImpostorAtlasProgram);
+
 		// Free resources
 		glDeleteShader(vertexShader);
+		glDeleteShader(culledVertexShader);
+		glDeleteShader(bakedVertexShader);
 		glDeleteShader(fragmentShader);
+		glDeleteShader(coverageFragmentShader);
 	}
 
 	void InitializeGrass()
@@ -500,13 +934,26 @@ private:
 		// Vertex buffer object - VBO
 
 		// Vertex attribute values - Position (triangle stripe)
+		// Note: Lower LOD meshes are stored right after the full blade; see first vertex of the LOD indirect drawing commands
 		const GLfloat positions[] =
 		{
+			// LOD 0 - 6 vertices
 			-0.3f, 0.0f,
 			 0.3f, 0.0f,
 			-0.20f, 1.0f,
 			 0.1f, 1.3f,
 			-0.05f, 2.3f,
+			 0.0f, 3.3f,
+
+			// LOD 1 - 4 vertices
+			-0.3f, 0.0f,
+			 0.3f, 0.0f,
+			-0.1f, 1.6f,
+			 0.0f, 3.3f,
+
+			// LOD 2 (and far field) - 3 vertices
+			-0.3f, 0.0f,
+			 0.3f, 0.0f,
 			 0.0f, 3.3f
 		};
 
@@ -531,6 +978,9 @@ private:
 		case 1:
 			InitializeGrassSymmetricParameterTexture2D();
 			break;
+		case 2:
+			InitializeGrassMultiParameterTexture2D();
+			break;
 		default:
 			break;
 		}
@@ -773,35 +1223,232 @@ private:
 	void RemoveGrass()
 	{
 		glDeleteProgram(grassProgram);
+		glDeleteProgram(grassCulledProgram);
+		glDeleteProgram(grassCulledBakedProgram);
 		glDeleteVertexArrays(1, &grassVao);
 		glDeleteBuffers(1, &grassVbo);
 		glDeleteTextures(1, &grassParamTexture2D);
 		glDeleteTextures(1, &grassColorTexture1D);
 	}
 
+	/// <summary>
+	/// Check that every CPU path of the xorshift* RNG (scalar, SIMD and threaded) generates the same numbers as GLSL random() for 1M seeds
+	/// Results are printed to Output (on Debug mode)
+	/// </summary>
 	void TestXorshiftp()
 	{
-		// Declare input and output buffers and allocate required memory
+		// Declare output buffers and allocate required memory
 		const unsigned int kInputNumber = 1024*1024;
-		int* input = new int[kInputNumber];
-		int* output = new int[kInputNumber];
+		const unsigned int kIterations = 3;
+		const int kSeed = 0;
+		int* scalar = new int[kInputNumber];
+		int* simd = new int[kInputNumber];
+		int* threaded = new int[kInputNumber];
+		int* glsl = new int[kInputNumber];
+
+		// CPU: seeds are kSeed + i
+		XorshiftpBatch(kSeed, 0, kIterations, scalar, kInputNumber, kXorshiftpScalar);
+		XorshiftpBatch(kSeed, 0, kIterations, simd, kInputNumber);
+		XorshiftpThreadPool pool;
+		pool.Batch(kSeed, kIterations, threaded, kInputNumber);
+
+		// GPU: same random() function as grass shaders
+		const char* computeShaderSource[] =
+		{
+			"#version 450 core													\n"
+			"																	\n"
+			"layout (local_size_x = 256) in;									\n"
+			"																	\n"
+			"layout (location = 0) uniform int seed;							\n"
+			"layout (location = 1) uniform uint iterations;						\n"
+			"																	\n"
+			"layout (binding = 0, std430) writeonly buffer output_block			\n"
+			"{																	\n"
+			"	int numbers[];													\n"
+			"};																	\n"
+			"																	\n"
+			"// Non-linear xorshift RNG (Random Number Generator): xorshift*	\n"
+			"int random(int seed, uint iterations)								\n"
+			"{																	\n"
+			"	int value = seed;												\n"
+			"	int i;															\n"
+			"																	\n"
+			"	// Iterate over to increase randomness							\n"
+			"	for (i = 0; i < iterations; i++)								\n"
+			"	{																\n"
+			"		// Multiply by a great number to generate a random number	\n"
+			"		value = ((value >> 7) ^ (value << 9)) * 15485863;			\n"
+			"	}																\n"
+			"																	\n"
+			"	return value;													\n"
+			"}																	\n"
+			"																	\n"
+			"void main(void)													\n"
+			"{																	\n"
+			"	numbers[gl_GlobalInvocationID.x] = random(seed + int(gl_GlobalInvocationID.x), iterations);\n"
+			"}																	\n"
+		};
+
+		GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(computeShader, 1, computeShaderSource, NULL);
+		glCompileShader(computeShader);
+
+		GLuint program = glCreateProgram();
+		glAttachShader(program, computeShader);
+		glLinkProgram(program);
+		glDeleteShader(computeShader);
+
+		GLuint buffer;
+		glCreateBuffers(1, &buffer);
+		glNamedBufferStorage(buffer, sizeof(int) * kInputNumber, NULL, NULL);
+
+		glUseProgram(program);
+		glUniform1i(0, kSeed);
+		glUniform1ui(1, kIterations);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffer);
+		glDispatchCompute(kInputNumber / 256, 1, 1);
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glGetNamedBufferSubData(buffer, 0, sizeof(int) * kInputNumber, glsl);
+
+		glDeleteBuffers(1, &buffer);
+		glDeleteProgram(program);
 
-		// Initialize input buffer with some data
+		// Compare
+		unsigned int mismatches[3] = { 0, 0, 0 };
 		for (unsigned int i = 0; i < kInputNumber; i++)
 		{
-			input[i] = i;
+			mismatches[0] += simd[i] != scalar[i];
+			mismatches[1] += threaded[i] != scalar[i];
+			mismatches[2] += glsl[i] != scalar[i];
 		}
 
-		// Call RNG xorshiftp algorithm with input buffer content and save return value in output buffer
-		const unsigned int kIterations = 1;
-		for (unsigned int i = 0; i < kInputNumber; i++)
+		char output[256];
+		sprintf_s(output, sizeof(output), "Xorshiftp test: %u numbers, kernel %d, %u threads; mismatches vs scalar: SIMD %u, threaded %u, GLSL %u.\n",
+			kInputNumber, (int)XorshiftpBestKernel(), pool.ThreadCount(), mismatches[0], mismatches[1], mismatches[2]);
+		OutputDebugStringA(output);
+
+		// Free output buffers memory allocation
+		delete[] scalar;
+		delete[] simd;
+		delete[] threaded;
+		delete[] glsl;
+	}
+
+	/// <summary>
+	/// Check that GLSL counterRandom() generates the same numbers as CPU CounterRandom(), and compare GPU throughput with xorshift* random()
+	/// Statistical quality tests are run on the CPU (see ch07app04rngtests); results are printed to Output (on Debug mode)
+	/// </summary>
+	void TestCounterRng()
+	{
+		const unsigned int kNumberTotal = 8 * 1024 * 1024;  // 32768 work groups (at least 65535 are supported)
+		const unsigned int kKey = 0x5EED;
+		const int kRuns = 5;
+
+		// Counter-based RNG is shared as a separate source string (after "#version")
+		const char* computeShaderSource[] =
+		{
+			"#version 450 core						\n",
+			kCounterRngGlsl,
+			"layout (local_size_x = 256) in;									\n"
+			"																	\n"
+			"layout (location = 0) uniform uint key;							\n"
+			"layout (location = 1) uniform int generator;  // 0: counter-based; 1: xorshift* (3 iterations)\n"
+			"																	\n"
+			"layout (binding = 0, std430) writeonly buffer output_block			\n"
+			"{																	\n"
+			"	uint numbers[];													\n"
+			"};																	\n"
+			"																	\n"
+			"// Non-linear xorshift RNG (Random Number Generator): xorshift*	\n"
+			"int random(int seed, uint iterations)								\n"
+			"{																	\n"
+			"	int value = seed;												\n"
+			"	int i;															\n"
+			"																	\n"
+			"	// Iterate over to increase randomness							\n"
+			"	for (i = 0; i < iterations; i++)								\n"
+			"	{																\n"
+			"		// Multiply by a great number to generate a random number	\n"
+			"		value = ((value >> 7) ^ (value << 9)) * 15485863;			\n"
+			"	}																\n"
+			"																	\n"
+			"	return value;													\n"
+			"}																	\n"
+			"																	\n"
+			"void main(void)													\n"
+			"{																	\n"
+			"	uint i = gl_GlobalInvocationID.x;								\n"
+			"	numbers[i] = generator == 0 ? counterRandom(key, i) : uint(random(int(key + i), 3));\n"
+			"}																	\n"
+		};
+
+		GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(computeShader, sizeof(computeShaderSource) / sizeof(computeShaderSource[0]), computeShaderSource, NULL);
+		glCompileShader(computeShader);
+
+		GLuint program = glCreateProgram();
+		glAttachShader(program, computeShader);
+		glLinkProgram(program);
+		glDeleteShader(computeShader);
+
+		GLuint buffer;
+		glCreateBuffers(1, &buffer);
+		glNamedBufferStorage(buffer, sizeof(GLuint) * kNumberTotal, NULL, NULL);
+
+		GLuint query;
+		glCreateQueries(GL_TIME_ELAPSED, 1, &query);
+		GLuint64 elapsed;
+
+		glUseProgram(program);
+		glUniform1ui(0, kKey);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffer);
+
+		// Throughput: counter-based vs xorshift* (warm up once, then average)
+		const char* generatorNames[] = { "counter RNG", "xorshift*" };
+		char output[256];
+		for (int generator = 1; generator >= 0; generator--)
 		{
-			output[i] = Xorshiftp(input[i], kIterations);
+			glUniform1i(1, generator);
+			glDispatchCompute(kNumberTotal / 256, 1, 1);
+
+			double time = 0.0;
+			for (int run = 0; run < kRuns; run++)
+			{
+				glBeginQuery(GL_TIME_ELAPSED, query);
+				glDispatchCompute(kNumberTotal / 256, 1, 1);
+				glEndQuery(GL_TIME_ELAPSED);
+				glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+				time += elapsed / 1.0e9 / kRuns;
+			}
+
+			sprintf_s(output, sizeof(output), "Counter RNG test: GPU %s: %.3f ms (%.1f M numbers/s).\n",
+				generatorNames[generator], time * 1.0e3, time > 0.0 ? kNumberTotal / time / 1.0e6 : 0.0);
+			OutputDebugStringA(output);
 		}
 
-		// Free input and output buffers memory allocation
-		delete[] input;
-		delete[] output;
+		// Bit-identical check: last dispatch ran the counter-based RNG
+		GLuint* glsl = new GLuint[kNumberTotal];
+		GLuint* cpu = new GLuint[kNumberTotal];
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glGetNamedBufferSubData(buffer, 0, sizeof(GLuint) * kNumberTotal, glsl);
+
+		XorshiftpThreadPool pool;
+		CounterRandomBatch(pool, kKey, cpu, kNumberTotal);
+
+		unsigned int mismatches = 0;
+		for (unsigned int i = 0; i < kNumberTotal; i++)
+		{
+			mismatches += glsl[i] != cpu[i];
+		}
+
+		sprintf_s(output, sizeof(output), "Counter RNG test: %u numbers; mismatches GLSL vs CPU: %u.\n", kNumberTotal, mismatches);
+		OutputDebugStringA(output);
+
+		delete[] glsl;
+		delete[] cpu;
+		glDeleteQueries(1, &query);
+		glDeleteBuffers(1, &buffer);
+		glDeleteProgram(program);
 	}
 
 	void TestPairsXorshiftp()
@@ -820,40 +1467,2042 @@ private:
 		}
 	}
 
-	int Xorshiftp(int seed, unsigned int iterations)
-	{
-		int value = seed;
-
-		for (unsigned int i = 0; i < iterations; i++)
-		{
-			// Generated number overflows 32 bit (e.g. seed=999999 and iterations=1 generate a 53 bit number)
-			// 32 LSBs represent a random number that seem not to follow any sequence between function calls (even when using very close value seeds)
-			value = ((value >> 7) ^ (value << 9)) * 15485863;
-		}
-
-		return value;
-	}
-
 #pragma endregion	
 
-private:
-	// Ground
-	GLuint groundProgram;
-	GLuint groundVao;
-	GLuint groundVbo;
-	vmath::mat4 groundModelWorldMatrix;
-	const float kGroundSide = 512.0f;
-	const bool kDrawGround = true;
+#pragma region Grass culling (compute pre-pass)
 
-	// Grass
-	GLuint grassProgram;
-	GLuint grassVao;
-	GLuint grassVbo;
-	const int kGrassParamSeed = 0x23103;  // See used to generate random grass parameters
+	void InitializeGrassCullingProgram()
+	{
+		// Compute shader
+		/*
+			One work group per visible tile (see UpdateGrassTiles) and one invocation per placed blade (see PlaceGrassBlades): blade position is unpacked from baked attributes, exactly as in the vertex shader (so culling matches drawing).
+			A bounding sphere around the blade is tested against the view frustum planes and the max distance to the camera.
+			Survivors are appended (compacted) into the instance buffer; the slot is reserved by incrementing the instance count of the indirect drawing command.
+
+			Survivors are also sorted into LOD bins by distance to the camera. Each bin has its own indirect drawing command and its own segment of the instance buffer (see UpdateGrassInstanceSegments).
+			LOD bin is packed into the 4 MSBs of the stored blade index so the vertex shader can tell far-field blades apart.
+			Setting all the LOD distances beyond max distance puts every survivor into bin 0 (i.e. plain culling).
+		*/
+		const char* computeShaderSource[] =
+		{
+			"#version 450 core													\n"
+			"																	\n"
+			"// One work group per visible tile; each invocation processes several blades of the tile\n"
+			"layout (local_size_x = 256) in;									\n"
+			"																	\n"
+			"layout (location = 0) uniform vec4 frustum_planes[6];				\n"
+			"layout (location = 6) uniform vec3 camera_position;				\n"
+			"layout (location = 7) uniform float max_distance;					\n"
+			"layout (location = 8) uniform uvec4 segment_bases;					\n"
+			"layout (location = 9) uniform vec3 lod_distances;					\n"
+			"layout (location = 10) uniform uint tile_side;						\n"
+			"																	\n"
+			"struct draw_arrays_indirect_command								\n"
+			"{																	\n"
+			"	uint count;														\n"
+			"	uint instance_count;											\n"
+			"	uint first;														\n"
+			"	uint base_instance;												\n"
+			"};																	\n"
+			"																	\n"
+			"// Indirect drawing commands (one per LOD bin): instance count is written here\n"
+			"layout (binding = 0, std430) buffer indirect_block					\n"
+			"{																	\n"
+			"	draw_arrays_indirect_command commands[4];						\n"
+			"};																	\n"
+			"																	\n"
+			"// Compacted indices of visible blades								\n"
+			"layout (binding = 1, std430) writeonly buffer instance_block		\n"
+			"{																	\n"
+			"	int visible_blades[];											\n"
+			"};																	\n"
+			"																	\n"
+			"struct grass_tile													\n"
+			"{																	\n"
+			"	ivec2 origin;													\n"
+			"	uint seed;														\n"
+			"	uint valid;														\n"
+			"};																	\n"
+			"																	\n"
+			"// Resident tiles (ring around the camera)							\n"
+			"layout (binding = 2, std430) readonly buffer tile_block			\n"
+			"{																	\n"
+			"	grass_tile tiles[];												\n"
+			"};																	\n"
+			"																	\n"
+			"// Slots of the resident tiles which passed the (CPU) tile culling	\n"
+			"layout (binding = 3, std430) readonly buffer visible_tile_block	\n"
+			"{																	\n"
+			"	uint visible_tiles[];											\n"
+			"};																	\n"
+			"																	\n"
+			"// Blade bounding sphere: center height and radius (blade is 0.6 x 3.3; up to x1.25 height, 0.5 lean and 1.2 wind displacement)\n"
+			"const float blade_center_height = 2.1;								\n"
+			"const float blade_radius = 2.8;									\n"
+			"																	\n"
+			"// Baked per-blade attributes (one packed uint per resident blade)	\n"
+			"layout (binding = 4, std430) readonly buffer blade_block			\n"
+			"{																	\n"
+			"	uint blades[];													\n"
+			"};																	\n"
+			"																	\n"
+			"void cullBlade(uint slot, grass_tile tile, uint local)				\n"
+			"{																	\n"
+			"	// Perturbed grid coordinate: offset from baked attributes		\n"
+			"	uint attributes = blades[slot * tile_side * tile_side + local];	\n"
+			"	vec2 p_grid = vec2(tile.origin) + vec2(float(local % tile_side), float(local / tile_side));\n"
+			"	vec2 p_rgrid = p_grid + vec2(float(attributes & 0xFFu), float((attributes >> 8) & 0xFFu)) / 256.0;\n"
+			"	vec3 center = vec3(p_rgrid.x, blade_center_height, p_rgrid.y);	\n"
+			"																	\n"
+			"	// Distance test												\n"
+			"	float dist = distance(center, camera_position);					\n"
+			"	if (dist > max_distance + blade_radius)							\n"
+			"	{																\n"
+			"		return;														\n"
+			"	}																\n"
+			"																	\n"
+			"	// Frustum test: discard if fully behind any plane				\n"
+			"	for (int i = 0; i < 6; i++)										\n"
+			"	{																\n"
+			"		if (dot(frustum_planes[i].xyz, center) + frustum_planes[i].w < -blade_radius)\n"
+			"		{															\n"
+			"			return;													\n"
+			"		}															\n"
+			"	}																\n"
+			"																	\n"
+			"	// LOD bin by distance											\n"
+			"	int lod = dist < lod_distances.x ? 0 : (dist < lod_distances.y ? 1 : (dist < lod_distances.z ? 2 : 3));\n"
+			"																	\n"
+			"	// Far field: keep only 1 out of 4 blades						\n"
+			"	if (lod == 3 && (attributes & 0x3u) != 0u)						\n"
+			"	{																\n"
+			"		return;														\n"
+			"	}																\n"
+			"																	\n"
+			"	// Append visible blade into its LOD bin segment				\n"
+			"	uint tile_blades = tile_side * tile_side;						\n"
+			"	uint index = atomicAdd(commands[lod].instance_count, 1u);		\n"
+			"	visible_blades[segment_bases[lod] + index] = int(slot * tile_blades + local) | (lod << 28);\n"
+			"}																	\n"
+			"																	\n"
+			"// Placed blades of each resident tile: local indices compacted at the start of the tile segment, and their count (see PlaceGrassBlades)\n"
+			"layout (binding = 5, std430) readonly buffer placed_block			\n"
+			"{																	\n"
+			"	uint placed[];													\n"
+			"};																	\n"
+			"																	\n"
+			"layout (binding = 6, std430) readonly buffer placed_count_block	\n"
+			"{																	\n"
+			"	uint placed_counts[];											\n"
+			"};																	\n"
+			"																	\n"
+			"void main(void)													\n"
+			"{																	\n"
+			"	uint slot = visible_tiles[gl_WorkGroupID.x];					\n"
+			"	grass_tile tile = tiles[slot];									\n"
+			"	uint tile_blades = tile_side * tile_side;						\n"
+			"	uint placed_count = placed_counts[slot];						\n"
+			"																	\n"
+			"	// Only placed blades are processed: sparse tiles cost (almost) nothing\n"
+			"	for (uint i = gl_LocalInvocationID.x; i < placed_count; i += gl_WorkGroupSize.x)\n"
+			"	{																\n"
+			"		cullBlade(slot, tile, placed[slot * tile_blades + i]);		\n"
+			"	}																\n"
+			"}																	\n"
+		};
+
+		GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(computeShader, 1, computeShaderSource, NULL);
+		glCompileShader(computeShader);
+
+		// Program
+		grassCullingProgram = glCreateProgram();
+		glAttachShader(grassCullingProgram, computeShader);
+		glLinkProgram(grassCullingProgram);
+
+		// Free resources
+		glDeleteShader(computeShader);
+	}
+
+	void InitializeGrassCulling()
+	{
+		// Indirect drawing command buffer object (one command per LOD bin) - instance counts are reset every frame and written by the GPU
+		glCreateBuffers(1, &grassIndirectBuffer);
+		glNamedBufferStorage(grassIndirectBuffer, sizeof(kGrassLodCommands), kGrassLodCommands, GL_DYNAMIC_STORAGE_BIT);
+
+		// Setup vertex attribute - Blade index (one per instance)
+		// Note: Attribute is not consumed by the brute-force program, so it can stay enabled on the same VAO
+		glVertexArrayAttribIFormat(grassVao, 1, 1, GL_INT, 0);
+		glVertexArrayAttribBinding(grassVao, 1, 1);
+		glVertexArrayBindingDivisor(grassVao, 1, 1);
+		glEnableVertexArrayAttrib(grassVao, 1);
+
+		// Instance buffer object (one segment per LOD bin): laid out for the initial thresholds
+		vmath::vec3 lodDistances(grassLodDistances[0], grassLodDistances[1], grassLodDistances[2]);
+		UpdateGrassInstanceSegments(lodDistances);
+	}
+
+	/// <summary>
+	/// Lay out the instance buffer segments of the LOD bins for the given thresholds: each bin has room for every blade of the resident tiles which can hold
+	/// a blade closer than its upper threshold (worst case: all of them visible in that bin), instead of the whole ring each
+	/// The instance buffer is recreated only when it has to grow; nothing is done while thresholds stay the same
+	/// </summary>
+	void UpdateGrassInstanceSegments(const vmath::vec3& lodDistances)
+	{
+		if (grassInstanceBuffer != 0 && memcmp(&lodDistances[0], grassSegmentLodDistances, sizeof(grassSegmentLodDistances)) == 0)
+		{
+			return;
+		}
+		memcpy(grassSegmentLodDistances, &lodDistances[0], sizeof(grassSegmentLodDistances));
+
+		// Blade bounding sphere centers lie in their tile, so the tile margin covers the culling radius too
+		const float kReach = kGrassMaxDistance + kGrassTileMargin;
+		GLuint base = 0;
+		for (int lod = 0; lod < kGrassLodTotal; lod++)
+		{
+			float lower = lod > 0 ? lodDistances[lod - 1] : 0.0f;
+			float upper = lod < kGrassLodFarField ? fminf(lodDistances[lod], kReach) : kReach;
+
+			grassLodCommands[lod] = kGrassLodCommands[lod];
+			grassLodCommands[lod].baseInstance = base;
+			grassLodSegmentBases[lod] = base;
+			base += lower < kReach ? CountGrassTilesWithin(upper) * kGrassTileSide * kGrassTileSide : 0;
+		}
+
+		if (base > grassInstanceCapacity)
+		{
+			glDeleteBuffers(1, &grassInstanceBuffer);
+			glCreateBuffers(1, &grassInstanceBuffer);
+			glNamedBufferStorage(grassInstanceBuffer, sizeof(GLint) * base, NULL, NULL);
+			glVertexArrayVertexBuffer(grassVao, 1, grassInstanceBuffer, 0, sizeof(GLint));
+			grassInstanceCapacity = base;
+		}
+	}
+
+	/// <summary>
+	/// Upper bound of the resident tiles closer than a (horizontal) distance to the camera, wherever the camera is within its tile
+	/// </summary>
+	GLuint CountGrassTilesWithin(float distance)
+	{
+		const GLint kRingRadius = (GLint)kGrassTileRingReach / 2;
+
+		GLuint count = 0;
+		for (GLint dz = -kRingRadius; dz <= kRingRadius; dz++)
+		{
+			for (GLint dx = -kRingRadius; dx <= kRingRadius; dx++)
+			{
+				// Closest point of the tile: the camera may be anywhere in its own tile, so neighbours can be touching
+				float x = (float)(abs(dx) > 0 ? abs(dx) - 1 : 0) * kGrassTileSide;
+				float z = (float)(abs(dz) > 0 ? abs(dz) - 1 : 0) * kGrassTileSide;
+				count += x * x + z * z <= distance * distance ? 1 : 0;
+			}
+		}
+
+		return count < kGrassTileSlotCount ? count : kGrassTileSlotCount;
+	}
+
+	void CullGrass(GrassRenderMode mode)
+	{
+		// Without LOD, every visible blade falls into bin 0
+		const float kNoLod = 1.0e9f;
+		vmath::vec3 lodDistances(kNoLod, kNoLod, kNoLod);
+		if (mode == kGpuCulledLod || mode == kGpuCulledLodImpostors)
+		{
+			lodDistances = vmath::vec3(grassLodDistances[0], grassLodDistances[1], grassLodDistances[2]);
+		}
+		UpdateGrassInstanceSegments(lodDistances);
+
+		// Reset instance counts (GPU-side update; no CPU-GPU synchronization)
+		glNamedBufferSubData(grassIndirectBuffer, 0, sizeof(grassLodCommands), grassLodCommands);
+
+		vmath::vec4 planes[6];
+		ExtractFrustumPlanes(cameraProjectionMatrix * cameraViewMatrix, planes);
+
+		// Recycle tiles leaving the ring and list the visible ones (and the ones drawn as impostors)
+		GLuint visibleTileCount = UpdateGrassTiles(planes, mode == kGpuCulledLodImpostors);
+
+		// Bake attributes of the blades of recycled tiles (culling reads them)
+		if (grassBakeTileCount > 0)
+		{
+			glNamedBufferSubData(grassBakeTileBuffer, 0, sizeof(GLuint) * grassBakeTileCount, grassBakeTiles);
+			BakeGrassBlades(grassTileBuffer, grassBakeTileBuffer, grassBladeBuffer, grassBakeTileCount);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+			// Place them by density (culling only reads placed blades)
+			PlaceGrassBlades();
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		}
+
+		glUseProgram(grassCullingProgram);
+		glUniform4fv(0, 6, &planes[0][0]);
+		glUniform3fv(6, 1, cameraPosition);
+		glUniform1f(7, kGrassMaxDistance);
+		glUniform4uiv(8, 1, grassLodSegmentBases);
+		glUniform3fv(9, 1, lodDistances);
+		glUniform1ui(10, kGrassTileSide);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, grassIndirectBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, grassInstanceBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, grassTileBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, grassVisibleTileBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, grassBladeBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, grassPlacedBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, grassPlacedCountBuffer);
+		if (visibleTileCount > 0)
+		{
+			glDispatchCompute(visibleTileCount, 1, 1);
+		}
+
+		// Indirect command and instanced vertex attribute are sourced from buffers written by the compute shader (baked attributes are read as shader storage)
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	/// <summary>
+	/// Cull (compute pre-pass) and draw the tiled grassland with the given (non brute-force) mode
+	/// </summary>
+	void DrawCulledGrass(GrassRenderMode mode)
+	{
+		// Compute pre-pass: fill the instance buffer (and the instance counts of the indirect commands) with visible blades
+		CullGrass(mode);
+
+		// Impostor cards first: they are farther than any blade (no depth test)
+		if (mode == kGpuCulledLodImpostors)
+		{
+			DrawGrassImpostors();
+		}
+
+		glUseProgram(grassBakedAttributes ? grassCulledBakedProgram : grassCulledProgram);
+		glBindVertexArray(grassVao);
+		glUniformMatrix4fv(0, 1, GL_FALSE, cameraProjectionMatrix * cameraViewMatrix);
+		glUniform1ui(2, kGrassTileSide);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, grassTileBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, grassBladeBuffer);
+		glBindTextureUnit(0, grassParamTexture2D);
+		glBindTextureUnit(1, grassColorTexture1D);
+		glBindTextureUnit(2, grassWindTexture2D);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, grassIndirectBuffer);
+
+		if (mode == kGpuCulledLod || mode == kGpuCulledLodImpostors)
+		{
+			// One command per LOD bin: each one sources its own mesh (first vertex) and instance buffer segment (base instance)
+			glMultiDrawArraysIndirect(GL_TRIANGLE_STRIP, 0, kGrassLodTotal, sizeof(DrawArraysIndirectCommand));
+		}
+		else
+		{
+			glDrawArraysIndirect(GL_TRIANGLE_STRIP, 0);  // Instance count written by the GPU
+		}
+	}
+
+	void TuneGrassLodThreshold(float step)
+	{
+		// Keep thresholds sorted: each one is bounded by its neighbours
+		int i = grassLodThresholdIndex;
+		float lower = i > 0 ? grassLodDistances[i - 1] : 0.0f;
+		float upper = i < 2 ? grassLodDistances[i + 1] : kGrassMaxDistance;
+		float value = grassLodDistances[i] + step;
+		grassLodDistances[i] = value < lower ? lower : (value > upper ? upper : value);
+
+		char output[256];
+		sprintf_s(output, sizeof(output), "Grass LOD thresholds: %.0f / %.0f / %.0f.\n", grassLodDistances[0], grassLodDistances[1], grassLodDistances[2]);
+		OutputDebugStringA(output);
+	}
+
+	/// <summary>
+	/// Print (to Output on Debug mode) the number of drawn blades (and processed vertices) against the grassland size, once per report period
+	/// Warning! Reading back the GPU-written instance counts forces a CPU-GPU synchronization, so it is only done once per period (not every frame)
+	/// </summary>
+	void ReportGrassStats(double currentTime)
+	{
+		grassStatsFrameCount++;
+		if (currentTime - grassStatsLastReportTime < kGrassStatsReportPeriod)
+		{
+			return;
+		}
+		double frameTime = 1.0e3 * (currentTime - grassStatsLastReportTime) / grassStatsFrameCount;
+		grassStatsLastReportTime = currentTime;
+		grassStatsFrameCount = 0;
+
+		// Brute force draws the fixed 1024 x 1024 grassland; culled modes draw the tiled grassland (resident ring)
+		GLuint total = kGrassBladeTotal;
+		DrawArraysIndirectCommand commands[kGrassLodTotal];
+		memcpy(commands, grassLodCommands, sizeof(commands));
+		commands[kGrassLod0].instanceCount = kGrassBladeTotal;
+		if (grassRenderMode != kBruteForce)
+		{
+			glGetNamedBufferSubData(grassIndirectBuffer, 0, sizeof(commands), commands);
+			total = grassResidentTileCount * kGrassTileSide * kGrassTileSide;
+		}
+
+		GLuint visible = 0;
+		GLuint vertices = 0;
+		for (int i = 0; i < kGrassLodTotal; i++)
+		{
+			visible += commands[i].instanceCount;
+			vertices += commands[i].instanceCount * commands[i].count;
+		}
+
+		// No tile resident yet: report zero rather than divide by zero
+		double visiblePercent = total == 0 ? 0.0 : 100.0 * visible / total;
+		double vertexPercent = total == 0 ? 0.0 : 100.0 * vertices / (total * 6.0);
+
+		const char* modeNames[] = { "brute force", "GPU culled", "GPU culled + LOD", "GPU culled + LOD + impostors" };
+		char output[256];
+		sprintf_s(output, sizeof(output), "Grass (%s%s): %u / %u blades drawn (%.1f%%) [LOD %u / %u / %u / %u]; %u / %u vertices (%.1f%%); frame time %.2f ms.\n",
+			grassImpostorComparison ? "split screen: full geometry | " : "", grassImpostorComparison ? modeNames[kGpuCulledLodImpostors] : modeNames[grassRenderMode],
+			visible, total, visiblePercent,
+			commands[kGrassLod0].instanceCount, commands[kGrassLod1].instanceCount, commands[kGrassLod2].instanceCount, commands[kGrassLodFarField].instanceCount,
+			vertices, total * 6, vertexPercent, frameTime);
+		OutputDebugStringA(output);
+
+		if (grassRenderMode != kBruteForce)
+		{
+			sprintf_s(output, sizeof(output), "Grass tiles: %u resident (ring %u x %u) / %u world (%u x %u); %u visible; tile table %u KB, instance buffer %u KB.\n",
+				grassResidentTileCount, kGrassTileRingColumns, kGrassTileRingRows,
+				kGrassWorldTileRows * kGrassWorldTileColumns, kGrassWorldTileRows, kGrassWorldTileColumns,
+				grassVisibleTileCount,
+				(GLuint)(sizeof(GrassTile) * kGrassTileSlotCount / 1024),
+				(GLuint)(sizeof(GLint) * grassInstanceCapacity / 1024));
+			OutputDebugStringA(output);
+
+			sprintf_s(output, sizeof(output), "Grass wind: %u x %u field; update period %u frame(s), %u texels per frame.\n",
+				kGrassWindTextureSide, kGrassWindTextureSide, grassWindUpdatePeriod,
+				kGrassWindTextureSide * ((kGrassWindTextureSide + grassWindUpdatePeriod - 1) / grassWindUpdatePeriod));
+			OutputDebugStringA(output);
+
+			if (grassRenderMode == kGpuCulledLodImpostors || grassImpostorComparison)
+			{
+				sprintf_s(output, sizeof(output), "Grass impostors: %u cards (%u vertices) for tiles beyond %.0f units; atlas %u x %u (%u KB), %u refreshes (last one %.3f ms).\n",
+					grassImpostorTileCount, grassImpostorTileCount * 4, kGrassImpostorDistance,
+					kGrassImpostorCellWidth * kGrassImpostorVariants, kGrassImpostorCellHeight,
+					kGrassImpostorCellWidth * kGrassImpostorVariants * kGrassImpostorCellHeight * 4 / 3 / 1024,
+					grassImpostorRefreshCount, grassImpostorRefreshTime);
+				OutputDebugStringA(output);
+			}
+
+			GLuint placed = CountPlacedGrassBlades();
+			sprintf_s(output, sizeof(output), "Grass placement (%s): %u / %u resident blades placed (%.1f%%); culling processes placed blades only.\n",
+				grassDensityPlacement ? grassDensitySource : "off", placed, total, total == 0 ? 0.0 : 100.0 * placed / total);
+			OutputDebugStringA(output);
+
+			if (grassParamRegeneration)
+			{
+				sprintf_s(output, sizeof(output), "Grass parameters: regenerating %u x %u texel tiles (seed %u); last one generated in %.3f ms.\n",
+					kGrassParamTileSide, kGrassParamTileSide, grassParamSeed, grassParamTileTime);
+				OutputDebugStringA(output);
+			}
+		}
+	}
+
+	void RemoveGrassCulling()
+	{
+		glDeleteProgram(grassCullingProgram);
+		glDeleteBuffers(1, &grassIndirectBuffer);
+		glDeleteBuffers(1, &grassInstanceBuffer);
+	}
+
+#pragma endregion
+
+#pragma region Grass tiles (streaming)
+
+	/*
+		Tiled grassland: the world is split into rows x columns fixed-size tiles (any count; not required to be a power of 2), each one with its own origin and seed.
+		Only a square ring of tiles around the camera (view distance radius) is resident. Tiles are mapped to ring slots with toroidal addressing (tile coordinate modulo ring side),
+		so when the camera crosses a tile border only the slots of the row/column leaving the ring are recycled (re-seeded and uploaded); the rest keep their slot.
+		Per-frame cost and memory depend on view distance (ring side), not on world size; a world narrower than the ring clamps it, so that ring axis holds the whole world axis instead.
+	*/
+
+	void InitializeGrassTiles()
+	{
+		const GLuint kSlotCount = kGrassTileSlotCount;
+
+		// Resident tile table (one entry per ring slot) - start with invalid tiles, so the first update fills every slot
+		grassTiles = new GrassTile[kSlotCount];
+		grassTileCoords = new GLint[kSlotCount * 2];
+		for (GLuint i = 0; i < kSlotCount; i++)
+		{
+			grassTiles[i] = { 0, 0, 0, 0 };
+			grassTileCoords[i * 2] = INT_MIN;
+			grassTileCoords[i * 2 + 1] = INT_MIN;
+		}
+
+		glCreateBuffers(1, &grassTileBuffer);
+		glNamedBufferStorage(grassTileBuffer, sizeof(GrassTile) * kSlotCount, grassTiles, GL_DYNAMIC_STORAGE_BIT);
+
+		// Visible tile slots list (filled every frame)
+		grassVisibleTiles = new GLuint[kSlotCount];
+		glCreateBuffers(1, &grassVisibleTileBuffer);
+		glNamedBufferStorage(grassVisibleTileBuffer, sizeof(GLuint) * kSlotCount, NULL, GL_DYNAMIC_STORAGE_BIT);
+
+		// Recycled tile slots list (filled only when tiles are recycled)
+		grassBakeTiles = new GLuint[kSlotCount];
+		glCreateBuffers(1, &grassBakeTileBuffer);
+		glNamedBufferStorage(grassBakeTileBuffer, sizeof(GLuint) * kSlotCount, NULL, GL_DYNAMIC_STORAGE_BIT);
+
+		// Baked blade attributes - one packed uint per resident blade
+		glCreateBuffers(1, &grassBladeBuffer);
+		glNamedBufferStorage(grassBladeBuffer, sizeof(GLuint) * kGrassResidentBladeCapacity, NULL, NULL);
+	}
+
+	/// <summary>
+	/// Update the ring of resident tiles around the camera and build the list of visible tile slots
+	/// With impostors, visible tiles entirely beyond impostor distance are listed apart (drawn as cards, not culled blade by blade)
+	/// Returns the number of visible tiles (one compute work group each)
+	/// </summary>
+	GLuint UpdateGrassTiles(const vmath::vec4 planes[6], bool impostors)
+	{
+		const GLint kRingColumns = (GLint)kGrassTileRingColumns;
+		const GLint kRingRows = (GLint)kGrassTileRingRows;
+		const float kWorldMinX = -0.5f * kGrassTileSide * kGrassWorldTileColumns;
+		const float kWorldMinZ = -0.5f * kGrassTileSide * kGrassWorldTileRows;
+
+		// Tile below the camera (may be outside the world)
+		GLint cameraTileX = (GLint)floorf((cameraPosition[0] - kWorldMinX) / kGrassTileSide);
+		GLint cameraTileZ = (GLint)floorf((cameraPosition[2] - kWorldMinZ) / kGrassTileSide);
+
+		grassResidentTileCount = 0;
+		grassVisibleTileCount = 0;
+		grassBakeTileCount = 0;
+		grassImpostorTileCount = 0;
+
+		// Tiles of each ring axis: centered on the camera tile, or the whole world axis if the ring is clamped to it
+		GLint firstTileX = kGrassTileRingColumns < kGrassTileRingReach ? 0 : cameraTileX - kRingColumns / 2;
+		GLint firstTileZ = kGrassTileRingRows < kGrassTileRingReach ? 0 : cameraTileZ - kRingRows / 2;
+
+		for (GLint tileZ = firstTileZ; tileZ < firstTileZ + kRingRows; tileZ++)
+		{
+			for (GLint tileX = firstTileX; tileX < firstTileX + kRingColumns; tileX++)
+			{
+				// Toroidal addressing: a tile keeps its slot while it stays within the ring
+				GLuint slot = (GLuint)(((tileZ % kRingRows) + kRingRows) % kRingRows * kRingColumns + ((tileX % kRingColumns) + kRingColumns) % kRingColumns);
+
+				if (grassTileCoords[slot * 2] != tileX || grassTileCoords[slot * 2 + 1] != tileZ)
+				{
+					// Recycle slot
+					grassTileCoords[slot * 2] = tileX;
+					grassTileCoords[slot * 2 + 1] = tileZ;
+
+					GrassTile& tile = grassTiles[slot];
+					tile.originX = (GLint)(kWorldMinX + tileX * kGrassTileSide);
+					tile.originZ = (GLint)(kWorldMinZ + tileZ * kGrassTileSide);
+					tile.seed = GrassTileSeed(tileX, tileZ);
+					tile.valid = tileX >= 0 && tileX < (GLint)kGrassWorldTileColumns && tileZ >= 0 && tileZ < (GLint)kGrassWorldTileRows;
+
+					glNamedBufferSubData(grassTileBuffer, sizeof(GrassTile) * slot, sizeof(GrassTile), &tile);
+
+					// New seed: blade attributes must be baked again
+					if (tile.valid)
+					{
+						grassBakeTiles[grassBakeTileCount++] = slot;
+					}
+				}
+
+				const GrassTile& tile = grassTiles[slot];
+				if (!tile.valid)
+				{
+					continue;
+				}
+				grassResidentTileCount++;
+
+				if (!IsGrassTileVisible(tile, planes))
+				{
+					continue;
+				}
+
+				if (impostors && GrassTileDistance(tile) > kGrassImpostorDistance)
+				{
+					grassImpostorTiles[grassImpostorTileCount++] = slot;
+				}
+				else
+				{
+					grassVisibleTiles[grassVisibleTileCount++] = slot;
+				}
+			}
+		}
+
+		if (grassVisibleTileCount > 0)
+		{
+			glNamedBufferSubData(grassVisibleTileBuffer, 0, sizeof(GLuint) * grassVisibleTileCount, grassVisibleTiles);
+		}
+
+		if (grassImpostorTileCount > 0)
+		{
+			glNamedBufferSubData(grassImpostorTileBuffer, 0, sizeof(GLuint) * grassImpostorTileCount, grassImpostorTiles);
+		}
+
+		return grassVisibleTileCount;
+	}
+
+	/// <summary>
+	/// Coarse (per tile) culling: tile bounding box against max distance and view frustum planes
+	/// </summary>
+	bool IsGrassTileVisible(const GrassTile& tile, const vmath::vec4 planes[6])
+	{
+		if (GrassTileDistance(tile) > kGrassMaxDistance)
+		{
+			return false;
+		}
+
+		// Frustum: box is out if its most positive vertex (along plane normal) is behind any plane
+		float minX = tile.originX - kGrassTileMargin, maxX = tile.originX + (GLint)kGrassTileSide + kGrassTileMargin;
+		float minZ = tile.originZ - kGrassTileMargin, maxZ = tile.originZ + (GLint)kGrassTileSide + kGrassTileMargin;
+		for (int i = 0; i < 6; i++)
+		{
+			float x = planes[i][0] >= 0.0f ? maxX : minX;
+			float y = planes[i][1] >= 0.0f ? kGrassTileHeight : 0.0f;
+			float z = planes[i][2] >= 0.0f ? maxZ : minZ;
+			if (planes[i][0] * x + planes[i][1] * y + planes[i][2] * z + planes[i][3] < 0.0f)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/// <summary>
+	/// Distance from camera to the closest point of the tile bounding box (expanded by the perturbation offset, blade width, lean and wind)
+	/// </summary>
+	float GrassTileDistance(const GrassTile& tile)
+	{
+		float minX = tile.originX - kGrassTileMargin, maxX = tile.originX + (GLint)kGrassTileSide + kGrassTileMargin;
+		float minZ = tile.originZ - kGrassTileMargin, maxZ = tile.originZ + (GLint)kGrassTileSide + kGrassTileMargin;
+		float dx = fmaxf(fmaxf(minX - cameraPosition[0], 0.0f), cameraPosition[0] - maxX);
+		float dz = fmaxf(fmaxf(minZ - cameraPosition[2], 0.0f), cameraPosition[2] - maxZ);
+		float dy = fmaxf(fmaxf(0.0f - cameraPosition[1], 0.0f), cameraPosition[1] - kGrassTileHeight);
+		return sqrtf(dx * dx + dy * dy + dz * dz);
+	}
+
+	/// <summary>
+	/// Per-tile seed: hash of world seed and tile coordinate, so a tile always gets the same blades when it becomes resident again
+	/// </summary>
+	GLuint GrassTileSeed(GLint tileX, GLint tileZ)
+	{
+		GLuint hash = (GLuint)grassWorldSeed;
+		hash ^= (GLuint)tileX * 73856093u;
+		hash ^= (GLuint)tileZ * 19349663u;
+		hash = (hash ^ (hash >> 16)) * 0x45d9f3bu;
+		hash = hash ^ (hash >> 16);
+		return hash;
+	}
+
+	void ReseedGrassTiles(int seed)
+	{
+		grassWorldSeed = seed;
+		grassImpostorAtlasDirty = true;  // Impostor patches are seeded from the world seed too
+
+		// Forget the tile held by every slot, so all of them are recycled
+		for (GLuint i = 0; i < kGrassTileSlotCount; i++)
+		{
+			grassTileCoords[i * 2] = INT_MIN;
+			grassTileCoords[i * 2 + 1] = INT_MIN;
+		}
+	}
+
+	void RemoveGrassTiles()
+	{
+		glDeleteBuffers(1, &grassTileBuffer);
+		glDeleteBuffers(1, &grassVisibleTileBuffer);
+		glDeleteBuffers(1, &grassBakeTileBuffer);
+		glDeleteBuffers(1, &grassBladeBuffer);
+		delete[] grassTiles;
+		delete[] grassTileCoords;
+		delete[] grassVisibleTiles;
+		delete[] grassBakeTiles;
+	}
+
+#pragma endregion
+
+#pragma region Grass parameters (parallel generation)
+
+	/*
+		Multi-parameter texture: N x N RGBA8 (or RGBA16), one independent parameter per channel: height (red), lean (green), bend (blue) and color palette index (alpha).
+		Each channel is smooth value noise: counter-based random values (counterrng.h) at lattice points, interpolated in between. Every texel is computed on its own (no RNG chain), so rows are split among all cores.
+		Lattice spacing is given in world units, so the look of the grassland does not depend on texture side (texture covers 1024 x 1024 world units, as before).
+
+		Upload goes through a persistently mapped pixel unpack buffer: texels are written straight into it and glTextureSubImage2D only queues the copy (CPU does not wait for it).
+		At runtime, tiles of the texture can be regenerated (new seed) one per frame: each one goes through its own slot of a small pixel buffer ring, guarded by a fence, so the CPU never waits on a copy still in flight.
+	*/
+
+	template <typename Channel>
+	void GenerateGrassParameters(Channel* texels, GLuint x0, GLuint y0, GLuint width, GLuint height, GLuint seed)
+	{
+		const float kScale = (float)(Channel)~0u / 4294967295.0f;
+		const GLuint side = kGrassParamTextureSide;
+
+		// Lattice cells across the texture per channel: a whole number, so the noise wraps seamlessly as the texture repeats (spacing is side / count texels)
+		GLuint lattices[4];
+		for (int c = 0; c < 4; c++)
+		{
+			lattices[c] = (GLuint)(1024.0f / kGrassParamCellSizes[c] + 0.5f);
+			lattices[c] = lattices[c] < 1 ? 1 : lattices[c];
+		}
+
+		grassParamPool.Run(height, [=](size_t firstRow, size_t rowCount)
+		{
+			// Rows are built in (cached) local memory and copied whole: texels may point to write-combined (mapped) memory
+			std::vector<Channel> row(width * 4);
+
+			for (GLuint y = y0 + (GLuint)firstRow; y < y0 + firstRow + rowCount; y++)
+			{
+				for (int c = 0; c < 4; c++)
+				{
+					// Lattice row and smoothstep weight (lattice wraps around, as the texture repeats); texel y is at y * lattice / side cells
+					GLuint lattice = lattices[c];
+					GLuint cz = y * lattice / side;
+					GLuint cz0 = cz * lattice, cz1 = ((cz + 1) % lattice) * lattice;
+					float fz = (float)(y * lattice % side) / side;
+					fz = fz * fz * (3.0f - 2.0f * fz);
+					GLuint key = seed * 4 + c;
+
+					// Lattice values are only hashed when entering a new cell
+					GLuint cx = UINT_MAX;
+					float v0 = 0.0f, v1 = 0.0f;
+					for (GLuint x = x0; x < x0 + width; x++)
+					{
+						if (x * lattice / side != cx)
+						{
+							cx = x * lattice / side;
+							GLuint cx1 = (cx + 1) % lattice;
+							float v00 = (float)CounterRandom(key, cz0 + cx), v10 = (float)CounterRandom(key, cz0 + cx1);
+							float v01 = (float)CounterRandom(key, cz1 + cx), v11 = (float)CounterRandom(key, cz1 + cx1);
+							v0 = v00 + (v01 - v00) * fz;
+							v1 = v10 + (v11 - v10) * fz;
+						}
+
+						float fx = (float)(x * lattice % side) / side;
+						fx = fx * fx * (3.0f - 2.0f * fx);
+						row[(x - x0) * 4 + c] = (Channel)((v0 + (v1 - v0) * fx) * kScale + 0.5f);
+					}
+				}
+
+				memcpy(texels + (size_t)(y - y0) * width * 4, row.data(), sizeof(Channel) * width * 4);
+			}
+		});
+	}
+
+	void GenerateGrassParameters(void* texels, GLuint x0, GLuint y0, GLuint width, GLuint height, GLuint seed)
+	{
+		if (kGrassParamTextureFormat == GL_RGBA16)
+		{
+			GenerateGrassParameters((GLushort*)texels, x0, y0, width, height, seed);
+		}
+		else
+		{
+			GenerateGrassParameters((GLubyte*)texels, x0, y0, width, height, seed);
+		}
+	}
+
+	void InitializeGrassMultiParameterTexture2D()
+	{
+		const GLuint side = kGrassParamTextureSide;
+		const GLenum type = kGrassParamTextureFormat == GL_RGBA16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+		const GLsizeiptr texelSize = kGrassParamTextureFormat == GL_RGBA16 ? 8 : 4;
+		const GLsizeiptr textureSize = texelSize * side * side;
+		const GLsizeiptr slotSize = texelSize * kGrassParamTileSide * kGrassParamTileSide;
+
+		glCreateTextures(GL_TEXTURE_2D, 1, &grassParamTexture2D);
+		glTextureStorage2D(grassParamTexture2D, 1, kGrassParamTextureFormat, side, side);
+
+		// Pixel unpack buffer: whole texture (startup) followed by the ring of tile slots (runtime regeneration)
+		const GLbitfield kMapFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glCreateBuffers(1, &grassParamPbo);
+		glNamedBufferStorage(grassParamPbo, textureSize + slotSize * kGrassParamPboSlots, NULL, kMapFlags);
+		grassParamPboData = (GLubyte*)glMapNamedBufferRange(grassParamPbo, 0, textureSize + slotSize * kGrassParamPboSlots, kMapFlags);
+
+		// Generate straight into the pixel buffer (all cores) and queue the copy
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		GenerateGrassParameters(grassParamPboData, 0, 0, side, side, grassParamSeed);
+		grassParamGenerationTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, grassParamPbo);
+		glTextureSubImage2D(grassParamTexture2D, 0, 0, 0, side, side, GL_RGBA, type, (const void*)0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		for (GLuint i = 0; i < kGrassParamPboSlots; i++)
+		{
+			grassParamPboFences[i] = 0;
+		}
+
+		char output[256];
+		sprintf_s(output, sizeof(output), "Grass parameters: %u x %u %s texture generated in %.2f ms (%u threads).\n",
+			side, side, kGrassParamTextureFormat == GL_RGBA16 ? "RGBA16" : "RGBA8", grassParamGenerationTime, grassParamPool.ThreadCount());
+		OutputDebugStringA(output);
+
+		// Wrapping
+		glTextureParameteri(grassParamTexture2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTextureParameteri(grassParamTexture2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+		// Filtering
+		glTextureParameteri(grassParamTexture2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTextureParameteri(grassParamTexture2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	}
+
+	/// <summary>
+	/// Regenerate (new seed) next tile of the parameters texture, in scan order
+	/// Grass tiles whose blades sample the regenerated texels are recycled, so their attributes are baked again
+	/// </summary>
+	void RegenerateGrassParameterTile()
+	{
+		const GLuint side = kGrassParamTextureSide;
+		const GLuint tilesPerSide = side / kGrassParamTileSide;
+		const GLenum type = kGrassParamTextureFormat == GL_RGBA16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+		const GLsizeiptr texelSize = kGrassParamTextureFormat == GL_RGBA16 ? 8 : 4;
+		const GLsizeiptr slotOffset = texelSize * side * side + texelSize * kGrassParamTileSide * kGrassParamTileSide * grassParamPboSlot;
+
+		// Slot must not be written while a copy from it is still in flight: poll, and if the GPU is behind, skip this frame (same tile retried next frame)
+		GLsync& fence = grassParamPboFences[grassParamPboSlot];
+		if (fence != 0)
+		{
+			GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			{
+				return;
+			}
+			glDeleteSync(fence);
+			fence = 0;
+		}
+
+		// Next tile; a new seed once every tile has been regenerated
+		GLuint x0 = (grassParamTileIndex % tilesPerSide) * kGrassParamTileSide;
+		GLuint y0 = (grassParamTileIndex / tilesPerSide) * kGrassParamTileSide;
+		if (grassParamTileIndex == 0)
+		{
+			grassParamSeed++;
+		}
+		grassParamTileIndex = (grassParamTileIndex + 1) % (tilesPerSide * tilesPerSide);
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		GenerateGrassParameters(grassParamPboData + slotOffset, x0, y0, kGrassParamTileSide, kGrassParamTileSide, grassParamSeed);
+		grassParamTileTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, grassParamPbo);
+		glTextureSubImage2D(grassParamTexture2D, 0, x0, y0, kGrassParamTileSide, kGrassParamTileSide, GL_RGBA, type, (const void*)slotOffset);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		grassParamPboSlot = (grassParamPboSlot + 1) % kGrassParamPboSlots;
+
+		// Grass tiles sampling the regenerated texels (texture repeats every 1024 world units; one extra texel for offsets and filtering)
+		const GLint kTextureWorldSide = 1024;
+		GLint tileTexels = (GLint)(kGrassTileSide * side / kTextureWorldSide) + 2;
+		for (GLuint slot = 0; slot < kGrassTileSlotCount; slot++)
+		{
+			if (grassTileCoords[slot * 2] == INT_MIN || !grassTiles[slot].valid)
+			{
+				continue;
+			}
+
+			GLint tx = (GLint)floorf(((float)grassTiles[slot].originX / kTextureWorldSide + 0.5f) * side) - 1;
+			GLint tz = (GLint)floorf(((float)grassTiles[slot].originZ / kTextureWorldSide + 0.5f) * side) - 1;
+			if (RangesOverlapModulo(tx, tileTexels, (GLint)x0, (GLint)kGrassParamTileSide, (GLint)side) &&
+				RangesOverlapModulo(tz, tileTexels, (GLint)y0, (GLint)kGrassParamTileSide, (GLint)side))
+			{
+				grassTileCoords[slot * 2] = INT_MIN;
+				grassTileCoords[slot * 2 + 1] = INT_MIN;
+			}
+		}
+	}
+
+	/// <summary>
+	/// Do ranges [a, a + aLength) and [b, b + bLength) overlap, modulo n?
+	/// </summary>
+	static bool RangesOverlapModulo(GLint a, GLint aLength, GLint b, GLint bLength, GLint n)
+	{
+		GLint ab = ((a - b) % n + n) % n;
+		GLint ba = ((b - a) % n + n) % n;
+		return ab < bLength || ba < aLength;
+	}
+
+	void RemoveGrassMultiParameterTexture2D()
+	{
+		if (grassParamPbo == 0)
+		{
+			return;
+		}
+
+		for (GLuint i = 0; i < kGrassParamPboSlots; i++)
+		{
+			if (grassParamPboFences[i] != 0)
+			{
+				glDeleteSync(grassParamPboFences[i]);
+			}
+		}
+		glUnmapNamedBuffer(grassParamPbo);
+		glDeleteBuffers(1, &grassParamPbo);
+	}
+
+#pragma endregion
+
+#pragma region Grass wind (vector field)
+
+	/*
+		Wind is a low resolution vector field (RG16F: tip displacement along X and Z, in world units), covering the same 1024 x 1024 world units as the parameters texture (and repeating like it).
+		A compute shader updates it; blades only sample it at their root, so its cost does not depend on blade count (just on field resolution).
+		Temporal amortization: with update period N, every frame updates only 1/N of the rows (interleaved), so each texel is refreshed every N frames.
+
+		Field is not set to the target wind directly, but eased towards it (exponential smoothing over the time elapsed since the texel was last updated), so blades sway with some inertia whatever the update period.
+		Target wind: gusts travelling along wind direction plus a crosswise sway; wave vectors are whole multiples of the field period, so the field repeats without seams.
+	*/
+
+	void InitializeGrassWind()
+	{
+		// Compute shader
+		const char* computeShaderSource[] =
+		{
+			"#version 450 core													\n"
+			"																	\n"
+			"layout (local_size_x = 8, local_size_y = 8) in;					\n"
+			"																	\n"
+			"layout (binding = 0, rg16f) uniform image2D wind_image;			\n"
+			"																	\n"
+			"layout (location = 0) uniform float time;							\n"
+			"layout (location = 1) uniform float blend;  // Exponential smoothing factor for the time elapsed since last update\n"
+			"layout (location = 2) uniform uint row_period;  // Rows updated: row % row_period == row_phase\n"
+			"layout (location = 3) uniform uint row_phase;						\n"
+			"layout (location = 4) uniform float max_displacement;				\n"
+			"																	\n"
+			"const float world_side = 1024.0;									\n"
+			"const float two_pi = 6.2831853;									\n"
+			"																	\n"
+			"// Wave vectors: whole number of periods along field side			\n"
+			"const vec2 gust_wave = vec2(3.0, 1.0) * two_pi / world_side;		\n"
+			"const vec2 gust_wave2 = vec2(11.0, 2.0) * two_pi / world_side;		\n"
+			"const vec2 sway_wave = vec2(-5.0, 17.0) * two_pi / world_side;		\n"
+			"																	\n"
+			"void main(void)													\n"
+			"{																	\n"
+			"	ivec2 size = imageSize(wind_image);								\n"
+			"	ivec2 texel = ivec2(gl_GlobalInvocationID.x, gl_GlobalInvocationID.y * row_period + row_phase);\n"
+			"	if (texel.x >= size.x || texel.y >= size.y)						\n"
+			"	{																\n"
+			"		return;														\n"
+			"	}																\n"
+			"																	\n"
+			"	// World position (relative to field origin)					\n"
+			"	vec2 p = (vec2(texel) + vec2(0.5)) / vec2(size) * world_side;	\n"
+			"																	\n"
+			"	// Target wind: gusts along wind direction and crosswise sway	\n"
+			"	vec2 direction = normalize(gust_wave);							\n"
+			"	float gust = 0.55 + 0.3 * sin(dot(p, gust_wave) - time * 1.3) + 0.15 * sin(dot(p, gust_wave2) - time * 2.9);\n"
+			"	float sway = 0.25 * sin(dot(p, sway_wave) + time * 2.1);		\n"
+			"	vec2 target = (direction * gust + vec2(-direction.y, direction.x) * sway) * max_displacement;\n"
+			"	float len = length(target);										\n"
+			"	target *= len > max_displacement ? max_displacement / len : 1.0;\n"
+			"																	\n"
+			"	vec2 current = imageLoad(wind_image, texel).xy;					\n"
+			"	imageStore(wind_image, texel, vec4(mix(current, target, blend), 0.0, 0.0));\n"
+			"}																	\n"
+		};
+
+		GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(computeShader, 1, computeShaderSource, NULL);
+		glCompileShader(computeShader);
+
+		// Program
+		grassWindProgram = glCreateProgram();
+		glAttachShader(grassWindProgram, computeShader);
+		glLinkProgram(grassWindProgram);
+
+		// Free resources
+		glDeleteShader(computeShader);
+
+		// Wind field (calm to begin with)
+		glCreateTextures(GL_TEXTURE_2D, 1, &grassWindTexture2D);
+		glTextureStorage2D(grassWindTexture2D, 1, GL_RG16F, kGrassWindTextureSide, kGrassWindTextureSide);
+		const GLfloat calm[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		glClearTexImage(grassWindTexture2D, 0, GL_RG, GL_FLOAT, calm);
+
+		glTextureParameteri(grassWindTexture2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTextureParameteri(grassWindTexture2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTextureParameteri(grassWindTexture2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTextureParameteri(grassWindTexture2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+		for (GLuint i = 0; i < kGrassWindMaxUpdatePeriod; i++)
+		{
+			grassWindUpdateTimes[i] = -1.0e6;
+		}
+	}
+
+	/// <summary>
+	/// Update the share of wind field rows due this frame
+	/// </summary>
+	void UpdateGrassWind(double currentTime)
+	{
+		GLuint phase = grassWindFrame % grassWindUpdatePeriod;
+		grassWindFrame++;
+
+		// Time elapsed since these rows were last updated (first update snaps to target)
+		double elapsed = currentTime - grassWindUpdateTimes[phase];
+		grassWindUpdateTimes[phase] = currentTime;
+		float blend = 1.0f - expf(-(float)elapsed / kGrassWindResponseTime);
+
+		glUseProgram(grassWindProgram);
+		glUniform1f(0, (float)currentTime);
+		glUniform1f(1, blend);
+		glUniform1ui(2, grassWindUpdatePeriod);
+		glUniform1ui(3, phase);
+		glUniform1f(4, kGrassWindMaxDisplacement);
+		glBindImageTexture(0, grassWindTexture2D, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RG16F);
+
+		GLuint rows = (kGrassWindTextureSide + grassWindUpdatePeriod - 1) / grassWindUpdatePeriod;
+		glDispatchCompute((kGrassWindTextureSide + 7) / 8, (rows + 7) / 8, 1);
+
+		// Blades sample the field as a texture
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+
+	/// <summary>
+	/// Change the update period: phases cover other rows from now on, so their last update times are restarted
+	/// (every row was updated at least as recently as the oldest phase of the previous period)
+	/// </summary>
+	void SetGrassWindUpdatePeriod(GLuint period)
+	{
+		double oldest = grassWindUpdateTimes[0];
+		for (GLuint i = 1; i < grassWindUpdatePeriod; i++)
+		{
+			oldest = grassWindUpdateTimes[i] < oldest ? grassWindUpdateTimes[i] : oldest;
+		}
+
+		for (GLuint i = 0; i < kGrassWindMaxUpdatePeriod; i++)
+		{
+			grassWindUpdateTimes[i] = oldest;
+		}
+		grassWindFrame = 0;
+		grassWindUpdatePeriod = period;
+	}
+
+	void RemoveGrassWind()
+	{
+		glDeleteProgram(grassWindProgram);
+		glDeleteTextures(1, &grassWindTexture2D);
+	}
+
+#pragma endregion
+
+#pragma region Grass blade attributes (bake)
+
+	void InitializeGrassBakeProgram()
+	{
+		// Compute shader
+		/*
+			One work group per recycled tile; one invocation per blade.
+			Runs the xorshift* RNG and samples the parameters texture once per blade (instead of once per vertex and frame) and packs every per-blade attribute into a single uint:
+			- bits [0, 8): X-coordinate offset (8 LSBs of first random number)
+			- bits [8, 16): Z-coordinate offset (8 LSBs of second random number)
+			- bits [16, 22): color palette index (alpha channel of grass parameters texture at blade root)
+			- bits [22, 26): height (red channel)
+			- bits [26, 30): lean (green channel)
+			- bits [30, 32): bend (blue channel)
+		*/
+		const char* computeShaderSource[] =
+		{
+			"#version 450 core													\n"
+			"																	\n"
+			"layout (local_size_x = 256) in;									\n"
+			"																	\n"
+			"layout (location = 0) uniform uint tile_side;						\n"
+			"layout (binding = 0) uniform sampler2D grassparam_tex;				\n"
+			"																	\n"
+			"struct grass_tile													\n"
+			"{																	\n"
+			"	ivec2 origin;													\n"
+			"	uint seed;														\n"
+			"	uint valid;														\n"
+			"};																	\n"
+			"																	\n"
+			"// Resident tiles (ring around the camera)							\n"
+			"layout (binding = 2, std430) readonly buffer tile_block			\n"
+			"{																	\n"
+			"	grass_tile tiles[];												\n"
+			"};																	\n"
+			"																	\n"
+			"// Slots of the tiles to bake										\n"
+			"layout (binding = 3, std430) readonly buffer bake_tile_block		\n"
+			"{																	\n"
+			"	uint bake_tiles[];												\n"
+			"};																	\n"
+			"																	\n"
+			"// Baked per-blade attributes (one packed uint per resident blade)	\n"
+			"layout (binding = 4, std430) writeonly buffer blade_block			\n"
+			"{																	\n"
+			"	uint blades[];													\n"
+			"};																	\n"
+			"																	\n"
+			"// Non-linear xorshift RNG (Random Number Generator): xorshift*	\n"
+			"int random(int seed, uint iterations)								\n"
+			"{																	\n"
+			"	int value = seed;												\n"
+			"	int i;															\n"
+			"																	\n"
+			"	// Iterate over to increase randomness							\n"
+			"	for (i = 0; i < iterations; i++)								\n"
+			"	{																\n"
+			"		// Multiply by a great number to generate a random number	\n"
+			"		value = ((value >> 7) ^ (value << 9)) * 15485863;			\n"
+			"	}																\n"
+			"																	\n"
+			"	return value;													\n"
+			"}																	\n"
+			"																	\n"
+			"void main(void)													\n"
+			"{																	\n"
+			"	uint slot = bake_tiles[gl_WorkGroupID.x];						\n"
+			"	grass_tile tile = tiles[slot];									\n"
+			"	uint tile_blades = tile_side * tile_side;						\n"
+			"																	\n"
+			"	for (uint local = gl_LocalInvocationID.x; local < tile_blades; local += gl_WorkGroupSize.x)\n"
+			"	{																\n"
+			"		int number1 = random(int(tile.seed + local), 3);			\n"
+			"		int number2 = random(number1, 2);							\n"
+			"																	\n"
+			"		vec2 p_grid = vec2(tile.origin) + vec2(float(local % tile_side), float(local / tile_side));\n"
+			"		vec2 p_rgrid = p_grid + vec2(float(number1 & 0xFF), float(number2 & 0xFF)) / 256.0;\n"
+			"		vec4 params = textureLod(grassparam_tex, (p_rgrid / 1024.0) + vec2(0.5), 0.0);\n"
+			"		uvec4 quantized = uvec4(params * vec4(15.0, 15.0, 3.0, 63.0) + vec4(0.5));\n"
+			"																	\n"
+			"		uint attributes = uint(number1 & 0xFF)						\n"
+			"					| (uint(number2 & 0xFF) << 8)					\n"
+			"					| (quantized.a << 16)							\n"
+			"					| (quantized.r << 22)							\n"
+			"					| (quantized.g << 26)							\n"
+			"					| (quantized.b << 30);							\n"
+			"																	\n"
+			"		blades[slot * tile_blades + local] = attributes;			\n"
+			"	}																\n"
+			"}																	\n"
+		};
+
+		GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(computeShader, 1, computeShaderSource, NULL);
+		glCompileShader(computeShader);
+
+		// Program
+		grassBakeProgram = glCreateProgram();
+		glAttachShader(grassBakeProgram, computeShader);
+		glLinkProgram(grassBakeProgram);
+
+		// Free resources
+		glDeleteShader(computeShader);
+	}
+
+	/// <summary>
+	/// Bake the attributes of every blade of the listed tiles (slots) into the blade buffer
+	/// Note: Buffers are parameters so the vertex stage benchmark can bake a grassland of its own
+	/// </summary>
+	void BakeGrassBlades(GLuint tileBuffer, GLuint bakeTileBuffer, GLuint bladeBuffer, GLuint tileCount)
+	{
+		glUseProgram(grassBakeProgram);
+		glUniform1ui(0, kGrassTileSide);
+		glBindTextureUnit(0, grassParamTexture2D);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, tileBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, bakeTileBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, bladeBuffer);
+		glDispatchCompute(tileCount, 1, 1);
+	}
+
+	/// <summary>
+	/// Compare vertex stage time of on-the-fly and baked per-blade attributes at 2**20 and 2**22 blades
+	/// Rasterization is discarded, so only vertex processing is measured (GPU timer queries, plus wall-clock time up to glFinish as a cross-check); results are printed to Output (on Debug mode)
+	/// </summary>
+	void BenchmarkGrassVertexStage()
+	{
+		const GLuint kTileBlades = kGrassTileSide * kGrassTileSide;
+		const GLuint kBladeCounts[] = { 1u << 20, 1u << 22 };
+		const GLuint kMaxBlades = 1u << 22;
+		const GLuint kTileCount = kMaxBlades / kTileBlades;
+		const GLuint kTileColumns = 64;
+		const int kRuns = 5;
+
+		// Grassland of its own: every tile resident and every blade instanced in order (resident blade index == instance)
+		GrassTile* tiles = new GrassTile[kTileCount];
+		GLuint* slots = new GLuint[kTileCount];
+		for (GLuint i = 0; i < kTileCount; i++)
+		{
+			GLint tileX = (GLint)(i % kTileColumns);
+			GLint tileZ = (GLint)(i / kTileColumns);
+			tiles[i] = { (GLint)((tileX - (GLint)kTileColumns / 2) * kGrassTileSide), (GLint)((tileZ - (GLint)(kTileCount / kTileColumns) / 2) * kGrassTileSide), GrassTileSeed(tileX, tileZ), 1 };
+			slots[i] = i;
+		}
+
+		GLint* indices = new GLint[kMaxBlades];
+		for (GLuint i = 0; i < kMaxBlades; i++)
+		{
+			indices[i] = (GLint)i;
+		}
+
+		GLuint buffers[4];
+		glCreateBuffers(4, buffers);
+		glNamedBufferStorage(buffers[0], sizeof(GrassTile) * kTileCount, tiles, NULL);
+		glNamedBufferStorage(buffers[1], sizeof(GLuint) * kTileCount, slots, NULL);
+		glNamedBufferStorage(buffers[2], sizeof(GLuint) * kMaxBlades, NULL, NULL);
+		glNamedBufferStorage(buffers[3], sizeof(GLint) * kMaxBlades, indices, NULL);
+
+		delete[] tiles;
+		delete[] slots;
+		delete[] indices;
+
+		GLuint vao;
+		glCreateVertexArrays(1, &vao);
+		glVertexArrayAttribFormat(vao, 0, 2, GL_FLOAT, GL_FALSE, 0);
+		glVertexArrayAttribBinding(vao, 0, 0);
+		glVertexArrayVertexBuffer(vao, 0, grassVbo, 0, sizeof(GLfloat) * 2);
+		glEnableVertexArrayAttrib(vao, 0);
+		glVertexArrayAttribIFormat(vao, 1, 1, GL_INT, 0);
+		glVertexArrayAttribBinding(vao, 1, 1);
+		glVertexArrayVertexBuffer(vao, 1, buffers[3], 0, sizeof(GLint));
+		glVertexArrayBindingDivisor(vao, 1, 1);
+		glEnableVertexArrayAttrib(vao, 1);
+
+		GLuint query;
+		glCreateQueries(GL_TIME_ELAPSED, 1, &query);
+		GLuint64 elapsed;
+		char output[256];
+
+		// One-time cost: bake
+		glBeginQuery(GL_TIME_ELAPSED, query);
+		BakeGrassBlades(buffers[0], buffers[1], buffers[2], kTileCount);
+		glEndQuery(GL_TIME_ELAPSED);
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		sprintf_s(output, sizeof(output), "Grass benchmark: bake %u blades: %.3f ms.\n", kMaxBlades, elapsed / 1.0e6);
+		OutputDebugStringA(output);
+
+		// Vertex stage: on-the-fly vs baked
+		const GLuint programs[] = { grassCulledProgram, grassCulledBakedProgram };
+		const char* programNames[] = { "on-the-fly", "baked" };
+
+		glEnable(GL_RASTERIZER_DISCARD);
+		glBindVertexArray(vao);
+		glBindTextureUnit(0, grassParamTexture2D);
+		glBindTextureUnit(1, grassColorTexture1D);
+		glBindTextureUnit(2, grassWindTexture2D);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, buffers[0]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, buffers[2]);
+
+		for (GLuint bladeCount : kBladeCounts)
+		{
+			double times[2];
+			double wallTimes[2];
+			for (int p = 0; p < 2; p++)
+			{
+				glUseProgram(programs[p]);
+				glUniformMatrix4fv(0, 1, GL_FALSE, cameraProjectionMatrix * cameraViewMatrix);
+				glUniform1ui(2, kGrassTileSide);
+
+				// Warm up
+				glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 6, bladeCount);
+				glFinish();
+
+				times[p] = 0.0;
+				std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+				for (int run = 0; run < kRuns; run++)
+				{
+					glBeginQuery(GL_TIME_ELAPSED, query);
+					glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 6, bladeCount);
+					glEndQuery(GL_TIME_ELAPSED);
+					glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+					times[p] += elapsed / 1.0e6 / kRuns;
+				}
+				glFinish();
+				wallTimes[p] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / kRuns;
+
+				sprintf_s(output, sizeof(output), "Grass benchmark: %u blades, %s attributes: %.3f ms (%.2f ns/blade); wall-clock %.3f ms.\n",
+					bladeCount, programNames[p], times[p], times[p] * 1.0e6 / bladeCount, wallTimes[p]);
+				OutputDebugStringA(output);
+			}
+
+			sprintf_s(output, sizeof(output), "Grass benchmark: %u blades, baked speedup x%.2f (wall-clock x%.2f).\n", bladeCount, times[0] / times[1], wallTimes[0] / wallTimes[1]);
+			OutputDebugStringA(output);
+		}
+
+		glDisable(GL_RASTERIZER_DISCARD);
+
+		glDeleteQueries(1, &query);
+		glDeleteVertexArrays(1, &vao);
+		glDeleteBuffers(4, buffers);
+	}
+
+	void RemoveGrassBake()
+	{
+		glDeleteProgram(grassBakeProgram);
+	}
+
+#pragma endregion
+
+#pragma region Grass impostors (far field)
+
+	/*
+		Beyond impostor distance a tile covers a few pixels and its blades are sub-pixel triangles: the whole tile is drawn as a single textured card instead.
+		Card texture comes from an atlas of a few grass patches (tile-sized, seeded apart), rendered with the regular blade program through an orthographic view.
+		Atlas stores coverage only: card color is picked from the palette index at the ground below, so far-field color patches match the blades.
+
+		Atlas view direction is the camera heading at the elevation of the impostor range; cards face the camera, with the same extents as the atlas view.
+		Atlas is cached: it is only rendered again when that direction turns more than the refresh angle (or the grassland is re-seeded).
+	*/
+
+	void InitializeGrassImpostors()
+	{
+		// Vertex shader
+		const char* vertexShaderSource[] =
+		{
+			"#version 450 core													\n"
+			"																	\n"
+			"layout (location = 0) uniform mat4 vp_matrix;						\n"
+			"layout (location = 1) uniform vec3 camera_position;				\n"
+			"layout (location = 2) uniform uint tile_side;						\n"
+			"layout (location = 3) uniform vec3 card_extents;  // Half width, bottom and top (atlas view space)\n"
+			"layout (location = 4) uniform uint variant_count;					\n"
+			"																	\n"
+			"out vec2 fs_atlas_coord;											\n"
+			"out vec2 fs_ground;												\n"
+			"																	\n"
+			"struct grass_tile													\n"
+			"{																	\n"
+			"	ivec2 origin;													\n"
+			"	uint seed;														\n"
+			"	uint valid;														\n"
+			"};																	\n"
+			"																	\n"
+			"// Resident tiles (ring around the camera)							\n"
+			"layout (binding = 2, std430) readonly buffer tile_block			\n"
+			"{																	\n"
+			"	grass_tile tiles[];												\n"
+			"};																	\n"
+			"																	\n"
+			"// Slots of the visible tiles beyond impostor distance (one card each)\n"
+			"layout (binding = 3, std430) readonly buffer impostor_tile_block	\n"
+			"{																	\n"
+			"	uint impostor_tiles[];											\n"
+			"};																	\n"
+			"																	\n"
+			"void main(void)													\n"
+			"{																	\n"
+			"	grass_tile tile = tiles[impostor_tiles[gl_InstanceID]];			\n"
+			"	vec3 center = vec3(float(tile.origin.x), 0.0, float(tile.origin.y)) + vec3(0.5 * float(tile_side), 0.0, 0.5 * float(tile_side));\n"
+			"																	\n"
+			"	// Card faces the camera: same right and up vectors as the atlas view (see lookat)\n"
+			"	vec3 view = normalize(center - camera_position);				\n"
+			"	vec3 right = normalize(cross(view, vec3(0.0, 1.0, 0.0)));		\n"
+			"	vec3 up = cross(right, view);									\n"
+			"																	\n"
+			"	// Corner of the card (triangle strip: 4 vertices)				\n"
+			"	vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));\n"
+			"	vec2 p_card = vec2(mix(-card_extents.x, card_extents.x, corner.x), mix(card_extents.y, card_extents.z, corner.y));\n"
+			"	gl_Position = vp_matrix * vec4(center + right * p_card.x + up * p_card.y, 1.0);\n"
+			"																	\n"
+			"	// Atlas cell of the patch variant picked by the tile seed		\n"
+			"	uint variant = tile.seed % variant_count;						\n"
+			"	fs_atlas_coord = vec2((float(variant) + corner.x) / float(variant_count), corner.y);\n"
+			"																	\n"
+			"	// Ground below the card point (blades rooted there get their palette index from it)\n"
+			"	fs_ground = center.xz + right.xz * p_card.x;					\n"
+			"}																	\n"
+		};
+
+		GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(vertexShader, 1, vertexShaderSource, NULL);
+		glCompileShader(vertexShader);
+
+		// Fragment shader
+		const char* fragmentShaderSource[] =
+		{
+			"#version 450 core													\n"
+			"																	\n"
+			"layout (binding = 0) uniform sampler2D grassparam_tex;				\n"
+			"layout (binding = 1) uniform sampler1D grasscolor_tex;				\n"
+			"layout (binding = 3) uniform sampler2D impostor_tex;				\n"
+			"layout (binding = 4) uniform sampler2D grassdensity_tex;			\n"
+			"layout (location = 5) uniform bool use_density;					\n"
+			"																	\n"
+			"in vec2 fs_atlas_coord;											\n"
+			"in vec2 fs_ground;													\n"
+			"																	\n"
+			"out vec4 color;													\n"
+			"																	\n"
+			"void main(void)													\n"
+			"{																	\n"
+			"	// Coverage from the atlas (mipmapped, so sub-pixel blades blend instead of aliasing)\n"
+			"	float coverage = texture(impostor_tex, fs_atlas_coord).r;		\n"
+			"	if (coverage == 0.0)											\n"
+			"	{																\n"
+			"		discard;													\n"
+			"	}																\n"
+			"																	\n"
+			"	// Thinned out as the blades below (density map placement)		\n"
+			"	if (use_density)												\n"
+			"	{																\n"
+			"		coverage *= texture(grassdensity_tex, (fs_ground / 1024.0) + vec2(0.5)).r;\n"
+			"	}																\n"
+			"																	\n"
+			"	// Color from the palette index at the ground below (as the blades would have)\n"
+			"	float palette = texture(grassparam_tex, (fs_ground / 1024.0) + vec2(0.5)).a;\n"
+			"	color = vec4(texture(grasscolor_tex, palette).rgb, coverage);	\n"
+			"}																	\n"
+		};
+
+		GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(fragmentShader, 1, fragmentShaderSource, NULL);
+		glCompileShader(fragmentShader);
+
+		// Program
+		grassImpostorProgram = glCreateProgram();
+		glAttachShader(grassImpostorProgram, vertexShader);
+		glAttachShader(grassImpostorProgram, fragmentShader);
+		glLinkProgram(grassImpostorProgram);
+
+		// Free resources
+		glDeleteShader(vertexShader);
+		glDeleteShader(fragmentShader);
+
+		// Card VAO: no vertex attributes (corners come from vertex ID)
+		glCreateVertexArrays(1, &grassImpostorVao);
+
+		// Impostor tile slots list (filled every frame)
+		const GLuint kSlotCount = kGrassTileSlotCount;
+		grassImpostorTiles = new GLuint[kSlotCount];
+		glCreateBuffers(1, &grassImpostorTileBuffer);
+		glNamedBufferStorage(grassImpostorTileBuffer, sizeof(GLuint) * kSlotCount, NULL, GL_DYNAMIC_STORAGE_BIT);
+
+		// Atlas patches: tiles of their own (one per variant), side by side, seeded out of the world tile range
+		const GLuint kTileBlades = kGrassTileSide * kGrassTileSide;
+		GrassTile patches[kGrassImpostorVariants];
+		for (GLuint i = 0; i < kGrassImpostorVariants; i++)
+		{
+			patches[i] = { (GLint)(i * kGrassTileSide), 0, GrassTileSeed(-1 - (GLint)i, -1), 1 };
+		}
+		glCreateBuffers(1, &grassImpostorPatchBuffer);
+		glNamedBufferStorage(grassImpostorPatchBuffer, sizeof(patches), patches, GL_DYNAMIC_STORAGE_BIT);
+
+		// Every blade of every patch, in order (full blade: LOD bin 0)
+		GLint* indices = new GLint[kTileBlades * kGrassImpostorVariants];
+		for (GLuint i = 0; i < kTileBlades * kGrassImpostorVariants; i++)
+		{
+			indices[i] = (GLint)i;
+		}
+		glCreateBuffers(1, &grassImpostorIndexBuffer);
+		glNamedBufferStorage(grassImpostorIndexBuffer, sizeof(GLint) * kTileBlades * kGrassImpostorVariants, indices, NULL);
+		delete[] indices;
+
+		glCreateVertexArrays(1, &grassImpostorAtlasVao);
+		glVertexArrayAttribFormat(grassImpostorAtlasVao, 0, 2, GL_FLOAT, GL_FALSE, 0);
+		glVertexArrayAttribBinding(grassImpostorAtlasVao, 0, 0);
+		glVertexArrayVertexBuffer(grassImpostorAtlasVao, 0, grassVbo, 0, sizeof(GLfloat) * 2);
+		glEnableVertexArrayAttrib(grassImpostorAtlasVao, 0);
+		glVertexArrayAttribIFormat(grassImpostorAtlasVao, 1, 1, GL_INT, 0);
+		glVertexArrayAttribBinding(grassImpostorAtlasVao, 1, 1);
+		glVertexArrayVertexBuffer(grassImpostorAtlasVao, 1, grassImpostorIndexBuffer, 0, sizeof(GLint));
+		glVertexArrayBindingDivisor(grassImpostorAtlasVao, 1, 1);
+		glEnableVertexArrayAttrib(grassImpostorAtlasVao, 1);
+
+		// Atlas: one cell per variant (in a row); coverage only, with mipmaps
+		glCreateTextures(GL_TEXTURE_2D, 1, &grassImpostorAtlasTexture2D);
+		glTextureStorage2D(grassImpostorAtlasTexture2D, kGrassImpostorAtlasLevels, GL_R8, kGrassImpostorCellWidth * kGrassImpostorVariants, kGrassImpostorCellHeight);
+		glTextureParameteri(grassImpostorAtlasTexture2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(grassImpostorAtlasTexture2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(grassImpostorAtlasTexture2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTextureParameteri(grassImpostorAtlasTexture2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+		glCreateFramebuffers(1, &grassImpostorFbo);
+		glNamedFramebufferTexture(grassImpostorFbo, GL_COLOR_ATTACHMENT0, grassImpostorAtlasTexture2D, 0);
+
+		// Calm wind field (1 texel): patches are rendered still
+		const GLushort kCalm[2] = { 0, 0 };  // Half floats: +0.0
+		glCreateTextures(GL_TEXTURE_2D, 1, &grassImpostorCalmWindTexture2D);
+		glTextureStorage2D(grassImpostorCalmWindTexture2D, 1, GL_RG16F, 1, 1);
+		glTextureSubImage2D(grassImpostorCalmWindTexture2D, 0, 0, 0, 1, 1, GL_RG, GL_HALF_FLOAT, kCalm);
+	}
+
+	/// <summary>
+	/// Render the atlas again if the view direction turned more than the refresh angle since last time
+	/// Note: Call outside any scissor test (atlas cells are rendered with their own viewport)
+	/// </summary>
+	void UpdateGrassImpostorAtlas()
+	{
+		// Camera heading (horizontal part of the view direction; see view matrix row 2)
+		vmath::vec3 heading(-cameraViewMatrix[0][2], 0.0f, -cameraViewMatrix[2][2]);
+		if (vmath::length(heading) < 1.0e-3f)
+		{
+			return;  // Looking straight down: keep the last atlas
+		}
+		heading = vmath::normalize(heading);
+
+		// Elevation of the middle of the impostor range
+		float range = 0.5f * (kGrassImpostorDistance + kGrassMaxDistance);
+		vmath::vec3 direction = vmath::normalize(heading * range - vmath::vec3(0.0f, cameraPosition[1], 0.0f));
+
+		if (!grassImpostorAtlasDirty && vmath::dot(direction, grassImpostorDirection) > cosf(vmath::radians(kGrassImpostorRefreshAngle)))
+		{
+			return;
+		}
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		RenderGrassImpostorAtlas(direction);
+		grassImpostorRefreshTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		grassImpostorDirection = direction;
+		grassImpostorAtlasDirty = false;
+		grassImpostorRefreshCount++;
+	}
+
+	/// <summary>
+	/// Render every patch into its atlas cell through an orthographic view along the given direction, then build the atlas mipmaps
+	/// </summary>
+	void RenderGrassImpostorAtlas(const vmath::vec3& direction)
+	{
+		// Patch bounding cylinder (tile half diagonal, blade height) seen along the direction: its extents make the view volume (and the card)
+		float radius = 0.5f * kGrassTileSide * 1.41421356f + kGrassTileMargin;
+		float sinElevation = -direction[1];
+		float cosElevation = sqrtf(1.0f - sinElevation * sinElevation);
+		grassImpostorCardExtents = vmath::vec3(radius, -radius * sinElevation, kGrassTileHeight * cosElevation + radius * sinElevation);
+
+		// Symmetric depth range around the patch center (eye at the center)
+		vmath::mat4 projection = vmath::ortho(-radius, radius, grassImpostorCardExtents[1], grassImpostorCardExtents[2], -2.0f * radius, 2.0f * radius);
+
+		static const GLfloat kNoCoverage[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		glBindFramebuffer(GL_FRAMEBUFFER, grassImpostorFbo);
+		glClearBufferfv(GL_COLOR, 0, kNoCoverage);
+
+		glUseProgram(grassImpostorAtlasProgram);
+		glBindVertexArray(grassImpostorAtlasVao);
+		glUniform1ui(2, kGrassTileSide);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, grassImpostorPatchBuffer);
+		glBindTextureUnit(0, grassParamTexture2D);
+		glBindTextureUnit(1, grassColorTexture1D);
+		glBindTextureUnit(2, grassImpostorCalmWindTexture2D);
+
+		const GLuint kTileBlades = kGrassTileSide * kGrassTileSide;
+		for (GLuint i = 0; i < kGrassImpostorVariants; i++)
+		{
+			vmath::vec3 center((i + 0.5f) * kGrassTileSide, 0.0f, 0.5f * kGrassTileSide);
+			glViewport(i * kGrassImpostorCellWidth, 0, kGrassImpostorCellWidth, kGrassImpostorCellHeight);
+			glUniformMatrix4fv(0, 1, GL_FALSE, projection * vmath::lookat(center - direction, center, vmath::vec3(0.0f, 1.0f, 0.0f)));
+			glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 6, kTileBlades, i * kTileBlades);
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, info.windowWidth, info.windowHeight);
+
+		glGenerateTextureMipmap(grassImpostorAtlasTexture2D);
+	}
+
+	/// <summary>
+	/// Draw one card per tile listed as impostor (see UpdateGrassTiles)
+	/// </summary>
+	void DrawGrassImpostors()
+	{
+		if (grassImpostorTileCount == 0)
+		{
+			return;
+		}
+
+		glUseProgram(grassImpostorProgram);
+		glBindVertexArray(grassImpostorVao);
+		glUniformMatrix4fv(0, 1, GL_FALSE, cameraProjectionMatrix * cameraViewMatrix);
+		glUniform3fv(1, 1, cameraPosition);
+		glUniform1ui(2, kGrassTileSide);
+		glUniform3fv(3, 1, grassImpostorCardExtents);
+		glUniform1ui(4, kGrassImpostorVariants);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, grassTileBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, grassImpostorTileBuffer);
+		glBindTextureUnit(0, grassParamTexture2D);
+		glBindTextureUnit(1, grassColorTexture1D);
+		glBindTextureUnit(3, grassImpostorAtlasTexture2D);
+		glBindTextureUnit(4, grassDensityTexture2D);
+		glUniform1i(5, grassDensityPlacement);
+
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, grassImpostorTileCount);
+		glDisable(GL_BLEND);
+	}
+
+	void RemoveGrassImpostors()
+	{
+		glDeleteProgram(grassImpostorProgram);
+		glDeleteProgram(grassImpostorAtlasProgram);
+		glDeleteVertexArrays(1, &grassImpostorVao);
+		glDeleteVertexArrays(1, &grassImpostorAtlasVao);
+		glDeleteBuffers(1, &grassImpostorTileBuffer);
+		glDeleteBuffers(1, &grassImpostorPatchBuffer);
+		glDeleteBuffers(1, &grassImpostorIndexBuffer);
+		glDeleteFramebuffers(1, &grassImpostorFbo);
+		glDeleteTextures(1, &grassImpostorAtlasTexture2D);
+		glDeleteTextures(1, &grassImpostorCalmWindTexture2D);
+		delete[] grassImpostorTiles;
+	}
+
+#pragma endregion
+
+#pragma region Grass placement (density map)
+
+	/*
+		Blades are placed by a density map: every blade of a recycled tile is a candidate, kept with probability == density at its root, and the kept ones are compacted (parallel prefix sum; see streamcompaction.h) at the start of the tile segment.
+		Culling then loops over placed blades only, so sparse areas cost (almost) nothing: no work per rejected blade after placement, and placement only runs when a tile is recycled.
+		Density map is the green-ness of terragen_color.ktx (the terrain color map) or, if it can not be loaded, a painted mask (value noise meadows and clearings).
+	*/
+
+	void InitializeGrassPlacement()
+	{
+		// Compute shader: one work group per recycled tile; one invocation per candidate blade
+		const char* computeShaderSource[] =
+		{
+			"#version 450 core						\n",
+			kCounterRngGlsl,
+			"layout (local_size_x = 256) in;									\n"
+			"																	\n"
+			"layout (location = 0) uniform uint tile_side;						\n"
+			"layout (location = 1) uniform bool use_density;					\n"
+			"layout (binding = 4) uniform sampler2D grassdensity_tex;			\n"
+			"																	\n"
+			"struct grass_tile													\n"
+			"{																	\n"
+			"	ivec2 origin;													\n"
+			"	uint seed;														\n"
+			"	uint valid;														\n"
+			"};																	\n"
+			"																	\n"
+			"// Resident tiles (ring around the camera)							\n"
+			"layout (binding = 2, std430) readonly buffer tile_block			\n"
+			"{																	\n"
+			"	grass_tile tiles[];												\n"
+			"};																	\n"
+			"																	\n"
+			"// Slots of the tiles to place (the recycled ones)					\n"
+			"layout (binding = 3, std430) readonly buffer bake_tile_block		\n"
+			"{																	\n"
+			"	uint bake_tiles[];												\n"
+			"};																	\n"
+			"																	\n"
+			"// Baked per-blade attributes (see InitializeGrassBakeProgram)		\n"
+			"layout (binding = 4, std430) readonly buffer blade_block			\n"
+			"{																	\n"
+			"	uint blades[];													\n"
+			"};																	\n"
+			"																	\n"
+			"// Placement candidates: blade local index if kept, reject otherwise (compacted afterwards)\n"
+			"layout (binding = 5, std430) writeonly buffer candidate_block		\n"
+			"{																	\n"
+			"	uint candidates[];												\n"
+			"};																	\n"
+			"																	\n"
+			"void main(void)													\n"
+			"{																	\n"
+			"	uint slot = bake_tiles[gl_WorkGroupID.x];						\n"
+			"	grass_tile tile = tiles[slot];									\n"
+			"	uint tile_blades = tile_side * tile_side;						\n"
+			"																	\n"
+			"	for (uint local = gl_LocalInvocationID.x; local < tile_blades; local += gl_WorkGroupSize.x)\n"
+			"	{																\n"
+			"		// Blade root, exactly as in the vertex shader (8 bit offsets)\n"
+			"		uint attributes = blades[slot * tile_blades + local];		\n"
+			"		vec2 p_grid = vec2(tile.origin) + vec2(float(local % tile_side), float(local / tile_side));\n"
+			"		vec2 p_rgrid = p_grid + vec2(float(attributes & 0xFFu), float((attributes >> 8u) & 0xFFu)) / 256.0;\n"
+			"																	\n"
+			"		// Keep the blade with probability == density (own RNG stream: counter-based, keyed by tile seed)\n"
+			"		float density = use_density ? textureLod(grassdensity_tex, (p_rgrid / 1024.0) + vec2(0.5), 0.0).r : 1.0;\n"
+			"		bool keep = counterRandomFloat(tile.seed, local) < density;	\n"
+			"		candidates[slot * tile_blades + local] = keep ? local : 0xFFFFFFFFu;\n"
+			"	}																\n"
+			"}																	\n"
+		};
+
+		GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(computeShader, sizeof(computeShaderSource) / sizeof(computeShaderSource[0]), computeShaderSource, NULL);
+		glCompileShader(computeShader);
+
+		// Program
+		grassPlacementProgram = glCreateProgram();
+		glAttachShader(grassPlacementProgram, computeShader);
+		glLinkProgram(grassPlacementProgram);
+
+		// Free resources
+		glDeleteShader(computeShader);
+
+		InitializeGrassDensityTexture2D();
+
+		// Placed blades (one segment per resident tile, as the blade buffer) and placed count per resident tile
+		const GLuint kSlotCount = kGrassTileSlotCount;
+		glCreateBuffers(1, &grassPlacedBuffer);
+		glNamedBufferStorage(grassPlacedBuffer, sizeof(GLuint) * kGrassResidentBladeCapacity, NULL, NULL);
+		glCreateBuffers(1, &grassPlacedCountBuffer);
+		glNamedBufferStorage(grassPlacedCountBuffer, sizeof(GLuint) * kSlotCount, NULL, NULL);
+		grassPlacedCounts = new GLuint[kSlotCount];
+
+		// Tiles are compacted one segment each (tile blades == compaction block size), so no scratch memory is needed
+		grassCompaction.Initialize(0);
+	}
+
+	/// <summary>
+	/// Density map (R8, repeats every 1024 world units as the parameters texture): green-ness of the terrain color map, or a painted mask if it can not be loaded
+	/// </summary>
+	void InitializeGrassDensityTexture2D()
+	{
+		GLubyte* density = NULL;
+		GLint width = 0;
+		GLint height = 0;
+
+		GLuint colorTexture = sb7::ktx::file::load("C:/workspace/sb7tutorials/resources/media/textures/terragen_color.ktx");
+		if (colorTexture != 0)
+		{
+			glGetTextureLevelParameteriv(colorTexture, 0, GL_TEXTURE_WIDTH, &width);
+			glGetTextureLevelParameteriv(colorTexture, 0, GL_TEXTURE_HEIGHT, &height);
+			GLubyte* texels = new GLubyte[width * height * 4];
+			glGetTextureImage(colorTexture, 0, GL_RGBA, GL_UNSIGNED_BYTE, width * height * 4, texels);
+			glDeleteTextures(1, &colorTexture);
+
+			// Green-ness: green share of the color (1/3 for grays, snow and rock); grass grows from a slight green dominance up
+			density = new GLubyte[width * height];
+			for (GLint i = 0; i < width * height; i++)
+			{
+				float sum = (float)texels[i * 4] + texels[i * 4 + 1] + texels[i * 4 + 2];
+				float greenness = sum > 0.0f ? texels[i * 4 + 1] / sum : 0.0f;
+				float t = (greenness - 0.36f) / (0.45f - 0.36f);
+				t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+				density[i] = (GLubyte)(255.0f * t * t * (3.0f - 2.0f * t) + 0.5f);
+			}
+			delete[] texels;
+			grassDensitySource = "terragen_color.ktx";
+		}
+		else
+		{
+			// Painted mask: value noise (lattice values from counter-based RNG, smoothstep interpolation; wraps around) thresholded into meadows and clearings
+			width = height = kGrassDensityMaskSide;
+			density = new GLubyte[width * height];
+			const GLuint kCells = kGrassDensityMaskSide / kGrassDensityMaskCellSize;
+			for (GLint y = 0; y < height; y++)
+			{
+				for (GLint x = 0; x < width; x++)
+				{
+					GLuint cellX = x / kGrassDensityMaskCellSize;
+					GLuint cellY = y / kGrassDensityMaskCellSize;
+					float fx = (float)(x % kGrassDensityMaskCellSize) / kGrassDensityMaskCellSize;
+					float fy = (float)(y % kGrassDensityMaskCellSize) / kGrassDensityMaskCellSize;
+					fx = fx * fx * (3.0f - 2.0f * fx);
+					fy = fy * fy * (3.0f - 2.0f * fy);
+
+					float v00 = CounterRandomFloat(kGrassDensityMaskSeed, cellY * kCells + cellX);
+					float v10 = CounterRandomFloat(kGrassDensityMaskSeed, cellY * kCells + (cellX + 1) % kCells);
+					float v01 = CounterRandomFloat(kGrassDensityMaskSeed, ((cellY + 1) % kCells) * kCells + cellX);
+					float v11 = CounterRandomFloat(kGrassDensityMaskSeed, ((cellY + 1) % kCells) * kCells + (cellX + 1) % kCells);
+					float v = (v00 * (1.0f - fx) + v10 * fx) * (1.0f - fy) + (v01 * (1.0f - fx) + v11 * fx) * fy;
+
+					float t = (v - 0.3f) / (0.7f - 0.3f);
+					t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+					density[y * width + x] = (GLubyte)(255.0f * t * t * (3.0f - 2.0f * t) + 0.5f);
+				}
+			}
+			grassDensitySource = "painted mask";
+		}
+
+		glCreateTextures(GL_TEXTURE_2D, 1, &grassDensityTexture2D);
+		glTextureStorage2D(grassDensityTexture2D, 1, GL_R8, width, height);
+		glTextureSubImage2D(grassDensityTexture2D, 0, 0, 0, width, height, GL_RED, GL_UNSIGNED_BYTE, density);
+		glTextureParameteri(grassDensityTexture2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTextureParameteri(grassDensityTexture2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTextureParameteri(grassDensityTexture2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTextureParameteri(grassDensityTexture2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		delete[] density;
+	}
+
+	/// <summary>
+	/// Place the blades of recycled tiles (listed in the bake tile buffer): reject candidates by density, then compact every tile segment in place
+	/// Note: Call after baking (blade roots are read from baked attributes)
+	/// </summary>
+	void PlaceGrassBlades()
+	{
+		glUseProgram(grassPlacementProgram);
+		glUniform1ui(0, kGrassTileSide);
+		glUniform1i(1, grassDensityPlacement);
+		glBindTextureUnit(4, grassDensityTexture2D);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, grassTileBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, grassBakeTileBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, grassBladeBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, grassPlacedBuffer);
+		glDispatchCompute(grassBakeTileCount, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		grassCompaction.CompactSegments(grassPlacedBuffer, grassPlacedBuffer, grassPlacedCountBuffer, grassBakeTileBuffer, grassBakeTileCount, kGrassTileSide * kGrassTileSide);
+	}
+
+	/// <summary>
+	/// Sum of the placed blades of resident tiles
+	/// Warning! Reading back the placed counts forces a CPU-GPU synchronization: stats only
+	/// </summary>
+	GLuint CountPlacedGrassBlades()
+	{
+		const GLuint kSlotCount = kGrassTileSlotCount;
+		glGetNamedBufferSubData(grassPlacedCountBuffer, 0, sizeof(GLuint) * kSlotCount, grassPlacedCounts);
+
+		GLuint placed = 0;
+		for (GLuint i = 0; i < kSlotCount; i++)
+		{
+			placed += grassTiles[i].valid ? grassPlacedCounts[i] : 0;
+		}
+
+		return placed;
+	}
+
+	/// <summary>
+	/// Check GPU stream compaction against a CPU reference (whole stream and in place segments) and time it; results are printed to Output (on Debug mode)
+	/// </summary>
+	void TestStreamCompaction()
+	{
+		const GLuint kElementTotal = 4 * 1024 * 1024;
+		const GLuint kSegmentTotal = kElementTotal / kStreamCompactionBlockSize;
+		const float kKeepRatios[] = { 0.0f, 0.05f, 0.5f, 1.0f };
+		const GLuint kKey = 0xC0FFEE;
+
+		StreamCompaction compaction;
+		compaction.Initialize(kElementTotal);
+
+		GLuint buffers[3];  // Input, output, counts
+		glCreateBuffers(3, buffers);
+		glNamedBufferStorage(buffers[0], sizeof(GLuint) * kElementTotal, NULL, GL_DYNAMIC_STORAGE_BIT);
+		glNamedBufferStorage(buffers[1], sizeof(GLuint) * kElementTotal, NULL, GL_DYNAMIC_STORAGE_BIT);
+		glNamedBufferStorage(buffers[2], sizeof(GLuint) * kSegmentTotal, NULL, NULL);
+
+		GLuint query;
+		glCreateQueries(GL_TIME_ELAPSED, 1, &query);
+		GLuint64 elapsed;
+
+		GLuint* input = new GLuint[kElementTotal];
+		GLuint* expected = new GLuint[kElementTotal];
+		GLuint* result = new GLuint[kElementTotal];
+		GLuint* counts = new GLuint[kSegmentTotal];
+		char output[256];
+
+		for (float keepRatio : kKeepRatios)
+		{
+			// Candidates: element index, rejected with probability 1 - keep ratio
+			GLuint expectedCount = 0;
+			for (GLuint i = 0; i < kElementTotal; i++)
+			{
+				input[i] = CounterRandomFloat(kKey, i) < keepRatio ? i : kStreamCompactionReject;
+				if (input[i] != kStreamCompactionReject)
+				{
+					expected[expectedCount++] = i;
+				}
+			}
+			glNamedBufferSubData(buffers[0], 0, sizeof(GLuint) * kElementTotal, input);
+
+			// Whole stream
+			glBeginQuery(GL_TIME_ELAPSED, query);
+			compaction.Compact(buffers[0], kElementTotal, buffers[1], buffers[2], 0);
+			glEndQuery(GL_TIME_ELAPSED);
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+
+			glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+			GLuint count;
+			glGetNamedBufferSubData(buffers[2], 0, sizeof(GLuint), &count);
+			glGetNamedBufferSubData(buffers[1], 0, sizeof(GLuint) * count, result);
+			bool pass = count == expectedCount && memcmp(result, expected, sizeof(GLuint) * count) == 0;
+
+			sprintf_s(output, sizeof(output), "Stream compaction test: keep %3.0f%%: %u / %u elements kept in %.3f ms  %s\n",
+				keepRatio * 100.0f, count, kElementTotal, elapsed / 1.0e6, pass ? "PASS" : "FAIL");
+			OutputDebugStringA(output);
+
+			// Segments, in place (every block compacted on its own)
+			glBeginQuery(GL_TIME_ELAPSED, query);
+			compaction.CompactSegments(buffers[0], buffers[0], buffers[2], 0, kSegmentTotal, kStreamCompactionBlockSize);
+			glEndQuery(GL_TIME_ELAPSED);
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+
+			glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+			glGetNamedBufferSubData(buffers[0], 0, sizeof(GLuint) * kElementTotal, result);
+			glGetNamedBufferSubData(buffers[2], 0, sizeof(GLuint) * kSegmentTotal, counts);
+			pass = true;
+			for (GLuint segment = 0; segment < kSegmentTotal; segment++)
+			{
+				GLuint base = segment * kStreamCompactionBlockSize;
+				GLuint kept = 0;
+				for (GLuint i = base; i < base + kStreamCompactionBlockSize; i++)
+				{
+					if (input[i] != kStreamCompactionReject)
+					{
+						pass = pass && result[base + kept] == input[i];
+						kept++;
+					}
+				}
+				pass = pass && counts[segment] == kept;
+			}
+
+			sprintf_s(output, sizeof(output), "Stream compaction test: keep %3.0f%%: %u segments compacted in place in %.3f ms  %s\n",
+				keepRatio * 100.0f, kSegmentTotal, elapsed / 1.0e6, pass ? "PASS" : "FAIL");
+			OutputDebugStringA(output);
+		}
+
+		delete[] input;
+		delete[] expected;
+		delete[] result;
+		delete[] counts;
+		glDeleteQueries(1, &query);
+		glDeleteBuffers(3, buffers);
+		compaction.Remove();
+	}
+
+	void RemoveGrassPlacement()
+	{
+		glDeleteProgram(grassPlacementProgram);
+		glDeleteTextures(1, &grassDensityTexture2D);
+		glDeleteBuffers(1, &grassPlacedBuffer);
+		glDeleteBuffers(1, &grassPlacedCountBuffer);
+		delete[] grassPlacedCounts;
+		grassCompaction.Remove();
+	}
+
+#pragma endregion
+
+private:
+	typedef struct {
+		GLuint count;
+		GLuint instanceCount;
+		GLuint first;
+		GLuint baseInstance;
+	} DrawArraysIndirectCommand;
+
+private:
+	// Ground
+	GLuint groundProgram;
+	GLuint groundVao;
+	GLuint groundVbo;
+	vmath::mat4 groundModelWorldMatrix;
+	const float kGroundSide = 512.0f;
+	const bool kDrawGround = true;
+
+	// Grass
+	GLuint grassProgram;
+	GLuint grassVao;
+	GLuint grassVbo;
+	const int kGrassParamSeed = 0x23103;  // See used to generate random grass parameters
 	GLuint grassParamTexture2D;
 	GLuint grassColorTexture1D;
+	const GLuint kGrassBladeTotal = 1024 * 1024;  // 2**20 blades
+
+	// Grass parameters (parallel generation)
+	const GLuint kGrassParamTextureSide = 1024;  // N x N texels
+	const GLenum kGrassParamTextureFormat = GL_RGBA8;  // GL_RGBA8 - GL_RGBA16
+	const float kGrassParamCellSizes[4] = { 32.0f, 24.0f, 48.0f, 16.0f };  // Value noise lattice spacing (world units) per channel: height, lean, bend, palette; rounded to whole cells per texture
+	const GLuint kGrassParamTileSide = 128;  // Runtime regeneration tile (texels)
+	static const GLuint kGrassParamPboSlots = 3;
+	XorshiftpThreadPool grassParamPool;
+	GLuint grassParamSeed = kGrassParamSeed;
+	GLuint grassParamPbo = 0;
+	GLubyte* grassParamPboData;
+	GLsync grassParamPboFences[kGrassParamPboSlots];
+	GLuint grassParamPboSlot = 0;
+	GLuint grassParamTileIndex = 0;
+	bool grassParamRegeneration = false;
+	double grassParamGenerationTime = 0.0;  // Milliseconds
+	double grassParamTileTime = 0.0;
+
+	// Grass culling
+	GLuint grassCulledProgram;
+	GLuint grassCullingProgram;
+	GLuint grassIndirectBuffer;
+	GLuint grassInstanceBuffer = 0;
+	GLuint grassInstanceCapacity = 0;  // Blades, all LOD segments
+	GrassRenderMode grassRenderMode = kGpuCulledLod;
+	const float kGrassMaxDistance = 800.0f;
+	float grassLodDistances[3] = { 60.0f, 150.0f, 350.0f };  // LOD bin thresholds: LOD0-LOD1, LOD1-LOD2, LOD2-far field
+	int grassLodThresholdIndex = 0;  // Threshold tuned with keyboard arrows
+	const float kGrassLodThresholdStep = 10.0f;
+
+	// Grass tiles
+	const GLuint kGrassTileSide = 32;  // Blades per tile side (1 unit apart); 32 x 32 blades per tile
+	const GLuint kGrassWorldTileRows = 32;  // World size in tiles: any rows x columns count (32 x 32 tiles == former 1024 x 1024 grassland)
+	const GLuint kGrassWorldTileColumns = 32;
+	int grassWorldSeed = 0x5EED;
+	const GLuint kGrassTileRingReach = 2 * (GLuint)ceilf(kGrassMaxDistance / kGrassTileSide) + 1;  // Tiles within view distance along an axis: odd, centered on camera tile
+	const GLuint kGrassTileRingColumns = kGrassTileRingReach < kGrassWorldTileColumns ? kGrassTileRingReach : kGrassWorldTileColumns;  // Resident tiles ring, clamped to the world
+	const GLuint kGrassTileRingRows = kGrassTileRingReach < kGrassWorldTileRows ? kGrassTileRingReach : kGrassWorldTileRows;
+	const GLuint kGrassTileSlotCount = kGrassTileRingColumns * kGrassTileRingRows;
+	const GLuint kGrassResidentBladeCapacity = kGrassTileSlotCount * kGrassTileSide * kGrassTileSide;
+	GrassTile* grassTiles;
+	GLint* grassTileCoords;  // World tile coordinate (x, z) currently held by each ring slot
+	GLuint* grassVisibleTiles;
+	GLuint grassTileBuffer;
+	GLuint grassVisibleTileBuffer;
+	GLuint grassResidentTileCount = 0;
+	GLuint grassVisibleTileCount = 0;
+	const float kGrassTileMargin = 3.2f;  // Tile bounding box: expanded by the perturbation offset, blade width, lean and wind
+	const float kGrassTileHeight = 4.2f;
+
+	// Grass wind
+	GLuint grassWindProgram;
+	GLuint grassWindTexture2D;
+	const GLuint kGrassWindTextureSide = 64;  // 16 world units per texel
+	const float kGrassWindMaxDisplacement = 1.2f;  // Blade tip (world units); culling bounds account for it
+	const float kGrassWindResponseTime = 0.25f;  // Seconds
+	static const GLuint kGrassWindMaxUpdatePeriod = 8;
+	GLuint grassWindUpdatePeriod = 1;  // Frames
+	GLuint grassWindFrame = 0;
+	double grassWindUpdateTimes[kGrassWindMaxUpdatePeriod];  // Last update time of each row phase
+
+	// Grass blade attributes (bake)
+	GLuint grassBakeProgram;
+	GLuint grassCulledBakedProgram;
+	GLuint* grassBakeTiles;  // Slots of recycled tiles (to bake)
+	GLuint grassBakeTileBuffer;
+	GLuint grassBakeTileCount = 0;
+	GLuint grassBladeBuffer;
+	bool grassBakedAttributes = true;
+
+	// Grass impostors (far field)
+	GLuint grassImpostorProgram;
+	GLuint grassImpostorAtlasProgram;
+	GLuint grassImpostorVao;
+	GLuint grassImpostorAtlasVao;
+	const float kGrassImpostorDistance = 400.0f;  // Tiles entirely beyond it are drawn as cards
+	static const GLuint kGrassImpostorVariants = 4;  // Atlas patches
+	const GLuint kGrassImpostorCellWidth = 256;  // Atlas cell (texels)
+	const GLuint kGrassImpostorCellHeight = 128;
+	const GLuint kGrassImpostorAtlasLevels = 8;  // Down to 1 texel high
+	const float kGrassImpostorRefreshAngle = 5.0f;  // Degrees
+	GLuint* grassImpostorTiles;  // Slots of the visible tiles drawn as cards
+	GLuint grassImpostorTileBuffer;
+	GLuint grassImpostorTileCount = 0;
+	GLuint grassImpostorPatchBuffer;
+	GLuint grassImpostorIndexBuffer;
+	GLuint grassImpostorAtlasTexture2D;
+	GLuint grassImpostorCalmWindTexture2D;
+	GLuint grassImpostorFbo;
+	vmath::vec3 grassImpostorDirection;  // Atlas view direction
+	vmath::vec3 grassImpostorCardExtents;  // Half width, bottom and top
+	bool grassImpostorAtlasDirty = true;
+	GLuint grassImpostorRefreshCount = 0;
+	double grassImpostorRefreshTime = 0.0;  // Milliseconds (CPU side)
+	bool grassImpostorComparison = false;
+
+	// Grass placement (density map)
+	GLuint grassPlacementProgram;
+	GLuint grassDensityTexture2D;
+	const char* grassDensitySource = "";
+	const GLuint kGrassDensityMaskSide = 256;  // Painted mask: 4 world units per texel
+	const GLuint kGrassDensityMaskCellSize = 32;  // Texels (128 world units)
+	const GLuint kGrassDensityMaskSeed = 0xD3A5;
+	StreamCompaction grassCompaction;
+	GLuint grassPlacedBuffer;  // Local indices of placed blades, compacted at the start of each tile segment
+	GLuint grassPlacedCountBuffer;  // Placed blades per resident tile
+	GLuint* grassPlacedCounts;
+	bool grassDensityPlacement = true;
+
+	// Indirect drawing commands template (instance count is written by the GPU; base instance is the start of the bin segment, see UpdateGrassInstanceSegments)
+	const DrawArraysIndirectCommand kGrassLodCommands[kGrassLodTotal] =
+	{
+		{ 6, 0, 0, 0 },  // LOD 0: vertices [0, 6)
+		{ 4, 0, 6, 0 },  // LOD 1: vertices [6, 10)
+		{ 3, 0, 10, 0 },  // LOD 2: vertices [10, 13)
+		{ 3, 0, 10, 0 }  // Far field: same mesh as LOD 2
+	};
+	DrawArraysIndirectCommand grassLodCommands[kGrassLodTotal];  // Template with the current segment layout
+	GLuint grassLodSegmentBases[kGrassLodTotal];
+	float grassSegmentLodDistances[3];  // Thresholds the layout was made for
+	const double kGrassStatsReportPeriod = 1.0;  // Seconds
+	double grassStatsLastReportTime = 0.0;
+	GLuint grassStatsFrameCount = 0;
 
 	// Camera
+	vmath::vec3 cameraPosition;
 	vmath::mat4 cameraViewMatrix;
 	vmath::mat4 cameraProjectionMatrix;
 	const bool kSimulateCameraMotion = true;
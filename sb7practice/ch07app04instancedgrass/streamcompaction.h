@@ -0,0 +1,313 @@
+#pragma once
+
+/*
+	GPU stream compaction: keep the elements of a uint stream that are not kStreamCompactionReject, in order, packed at the start of the output.
+	Output positions come from a parallel prefix sum (exclusive scan) of the keep flags, so no atomic counter is involved and the order of the kept elements is preserved.
+	Include it after "sb7.h" (OpenGL 4.5 functions; DSA). Any app can use it: candidates are written by its own compute pass, either as a value or as kStreamCompactionReject.
+
+	Two flavours:
+	- Compact: whole stream (up to capacity elements), in three compute passes (reduce - scan - scatter):
+		1. Each work group counts the kept elements of its block (kStreamCompactionBlockSize elements)
+		2. A single work group scans the block counts (chunk by chunk, carrying the running total) into block offsets, and writes the total kept count
+		3. Each work group scans its block again and writes every kept element at block offset + local offset
+	  Total kept count is written into a uint of a buffer: e.g. the instance count of an indirect drawing command or the group count of an indirect dispatch.
+	- CompactSegments: independent segments (up to kStreamCompactionBlockSize elements each; e.g. the blades of a tile), each one compacted by a single work group in one pass, with its kept count.
+	  Segments can be compacted in place (input == output): every element of a segment is read before any of them is written.
+
+	Note: Memory barriers between passes are issued here; the caller issues the one needed to consume the output (e.g. GL_COMMAND_BARRIER_BIT for an indirect command).
+*/
+
+#include <cstdio>
+
+const GLuint kStreamCompactionReject = 0xFFFFFFFFu;
+const GLuint kStreamCompactionBlockSize = 1024;  // Elements per work group: 256 invocations x 4 elements
+
+const char kStreamCompactionScanGlsl[] =
+	"// Stream compaction: work group scan (256 invocations, 4 elements each)\n"
+	"layout (local_size_x = 256) in;\n"
+	"\n"
+	"const uint reject = 0xFFFFFFFFu;\n"
+	"\n"
+	"shared uint scan_sums[256];\n"
+	"\n"
+	"// Exclusive prefix sum of one value per invocation; 'total' gets the sum of the whole work group (call from uniform control flow)\n"
+	"uint scanWorkGroup(uint value, out uint total)\n"
+	"{\n"
+	"	uint id = gl_LocalInvocationID.x;\n"
+	"	scan_sums[id] = value;\n"
+	"	barrier();\n"
+	"\n"
+	"	// Hillis-Steele inclusive scan: log2(256) steps\n"
+	"	for (uint offset = 1u; offset < 256u; offset <<= 1u)\n"
+	"	{\n"
+	"		uint previous = id >= offset ? scan_sums[id - offset] : 0u;\n"
+	"		barrier();\n"
+	"		scan_sums[id] += previous;\n"
+	"		barrier();\n"
+	"	}\n"
+	"\n"
+	"	total = scan_sums[255];\n"
+	"	uint inclusive = scan_sums[id];\n"
+	"	barrier();  // Shared memory can be reused by next call\n"
+	"	return inclusive - value;\n"
+	"}\n";
+
+class StreamCompaction
+{
+public:
+	/// <summary>
+	/// Build the programs and the block counts buffer (Compact handles up to 'capacity' elements; CompactSegments needs no scratch memory)
+	/// </summary>
+	void Initialize(GLuint capacity)
+	{
+		const char* reduceSource =
+			"// Pass 1: kept elements per block\n"
+			"layout (location = 0) uniform uint count;\n"
+			"\n"
+			"layout (binding = 0, std430) readonly buffer input_block { uint values[]; };\n"
+			"layout (binding = 2, std430) writeonly buffer block_count_block { uint block_counts[]; };\n"
+			"\n"
+			"void main(void)\n"
+			"{\n"
+			"	uint first = gl_WorkGroupID.x * 1024u + gl_LocalInvocationID.x * 4u;\n"
+			"	uint kept = 0u;\n"
+			"	for (uint i = first; i < first + 4u && i < count; i++)\n"
+			"	{\n"
+			"		kept += values[i] != reject ? 1u : 0u;\n"
+			"	}\n"
+			"\n"
+			"	uint total;\n"
+			"	scanWorkGroup(kept, total);\n"
+			"	if (gl_LocalInvocationID.x == 0u)\n"
+			"	{\n"
+			"		block_counts[gl_WorkGroupID.x] = total;\n"
+			"	}\n"
+			"}\n";
+
+		const char* scanSource =
+			"// Pass 2: block counts to block offsets (single work group), and total kept count\n"
+			"layout (location = 0) uniform uint block_total;\n"
+			"layout (location = 1) uniform uint count_index;\n"
+			"\n"
+			"layout (binding = 2, std430) buffer block_count_block { uint block_counts[]; };\n"
+			"layout (binding = 3, std430) writeonly buffer count_block { uint counts[]; };\n"
+			"\n"
+			"void main(void)\n"
+			"{\n"
+			"	uint carry = 0u;\n"
+			"	for (uint chunk = 0u; chunk < block_total; chunk += 1024u)\n"
+			"	{\n"
+			"		uint first = chunk + gl_LocalInvocationID.x * 4u;\n"
+			"		uint block[4];\n"
+			"		uint sum = 0u;\n"
+			"		for (uint i = 0u; i < 4u; i++)\n"
+			"		{\n"
+			"			block[i] = first + i < block_total ? block_counts[first + i] : 0u;\n"
+			"			sum += block[i];\n"
+			"		}\n"
+			"\n"
+			"		uint total;\n"
+			"		uint offset = carry + scanWorkGroup(sum, total);\n"
+			"		for (uint i = 0u; i < 4u && first + i < block_total; i++)\n"
+			"		{\n"
+			"			block_counts[first + i] = offset;\n"
+			"			offset += block[i];\n"
+			"		}\n"
+			"		carry += total;\n"
+			"	}\n"
+			"\n"
+			"	if (gl_LocalInvocationID.x == 0u)\n"
+			"	{\n"
+			"		counts[count_index] = carry;\n"
+			"	}\n"
+			"}\n";
+
+		const char* scatterSource =
+			"// Pass 3: kept elements written at block offset + local offset\n"
+			"layout (location = 0) uniform uint count;\n"
+			"\n"
+			"layout (binding = 0, std430) readonly buffer input_block { uint values[]; };\n"
+			"layout (binding = 1, std430) writeonly buffer output_block { uint compacted[]; };\n"
+			"layout (binding = 2, std430) readonly buffer block_count_block { uint block_offsets[]; };\n"
+			"\n"
+			"void main(void)\n"
+			"{\n"
+			"	uint first = gl_WorkGroupID.x * 1024u + gl_LocalInvocationID.x * 4u;\n"
+			"	uint element[4];\n"
+			"	uint kept = 0u;\n"
+			"	for (uint i = 0u; i < 4u; i++)\n"
+			"	{\n"
+			"		element[i] = first + i < count ? values[first + i] : reject;\n"
+			"		kept += element[i] != reject ? 1u : 0u;\n"
+			"	}\n"
+			"\n"
+			"	uint total;\n"
+			"	uint offset = block_offsets[gl_WorkGroupID.x] + scanWorkGroup(kept, total);\n"
+			"	for (uint i = 0u; i < 4u; i++)\n"
+			"	{\n"
+			"		if (element[i] != reject)\n"
+			"		{\n"
+			"			compacted[offset++] = element[i];\n"
+			"		}\n"
+			"	}\n"
+			"}\n";
+
+		const char* segmentSource =
+			"// Segments: one work group per segment (listed, or consecutive); kept elements written from the segment start, kept count per segment\n"
+			"layout (location = 0) uniform uint segment_size;\n"
+			"layout (location = 1) uniform bool use_segment_list;\n"
+			"\n"
+			"layout (binding = 0, std430) readonly buffer input_block { uint values[]; };\n"
+			"layout (binding = 1, std430) writeonly buffer output_block { uint compacted[]; };\n"
+			"layout (binding = 3, std430) writeonly buffer count_block { uint counts[]; };\n"
+			"layout (binding = 4, std430) readonly buffer segment_block { uint segments[]; };\n"
+			"\n"
+			"void main(void)\n"
+			"{\n"
+			"	uint segment = use_segment_list ? segments[gl_WorkGroupID.x] : gl_WorkGroupID.x;\n"
+			"	uint base = segment * segment_size;\n"
+			"	uint first = gl_LocalInvocationID.x * 4u;\n"
+			"	uint element[4];\n"
+			"	uint kept = 0u;\n"
+			"	for (uint i = 0u; i < 4u; i++)\n"
+			"	{\n"
+			"		element[i] = first + i < segment_size ? values[base + first + i] : reject;\n"
+			"		kept += element[i] != reject ? 1u : 0u;\n"
+			"	}\n"
+			"\n"
+			"	// Every element is read before any is written (in place compaction)\n"
+			"	uint total;\n"
+			"	uint offset = base + scanWorkGroup(kept, total);\n"
+			"	for (uint i = 0u; i < 4u; i++)\n"
+			"	{\n"
+			"		if (element[i] != reject)\n"
+			"		{\n"
+			"			compacted[offset++] = element[i];\n"
+			"		}\n"
+			"	}\n"
+			"\n"
+			"	if (gl_LocalInvocationID.x == 0u)\n"
+			"	{\n"
+			"		counts[segment] = total;\n"
+			"	}\n"
+			"}\n";
+
+		reduceProgram = CreateProgram(reduceSource);
+		scanProgram = CreateProgram(scanSource);
+		scatterProgram = CreateProgram(scatterSource);
+		segmentProgram = CreateProgram(segmentSource);
+
+		// Block counts (then offsets) - one per block of the largest stream
+		blockCapacity = (capacity + kStreamCompactionBlockSize - 1) / kStreamCompactionBlockSize;
+		glCreateBuffers(1, &blockCountBuffer);
+		glNamedBufferStorage(blockCountBuffer, sizeof(GLuint) * (blockCapacity > 0 ? blockCapacity : 1), NULL, NULL);
+	}
+
+	/// <summary>
+	/// Compact the first 'count' elements of inputBuffer into outputBuffer; total kept count is written into uint number 'countIndex' of countBuffer
+	/// Note: Input and output buffers must be different
+	/// </summary>
+	void Compact(GLuint inputBuffer, GLuint count, GLuint outputBuffer, GLuint countBuffer, GLuint countIndex)
+	{
+		GLuint blockTotal = (count + kStreamCompactionBlockSize - 1) / kStreamCompactionBlockSize;
+		if (blockTotal > blockCapacity)
+		{
+			char output[256];
+			sprintf_s(output, sizeof(output), "Stream compaction: %u elements exceed capacity (%u); stream truncated.\n", count, blockCapacity * kStreamCompactionBlockSize);
+			OutputDebugStringA(output);
+			blockTotal = blockCapacity;
+			count = blockCapacity * kStreamCompactionBlockSize;
+		}
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, inputBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, outputBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, blockCountBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, countBuffer);
+
+		if (blockTotal > 0)
+		{
+			glUseProgram(reduceProgram);
+			glUniform1ui(0, count);
+			glDispatchCompute(blockTotal, 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		}
+
+		// Also run for an empty stream: total kept count (0) is written anyway
+		glUseProgram(scanProgram);
+		glUniform1ui(0, blockTotal);
+		glUniform1ui(1, countIndex);
+		glDispatchCompute(1, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		if (blockTotal > 0)
+		{
+			glUseProgram(scatterProgram);
+			glUniform1ui(0, count);
+			glDispatchCompute(blockTotal, 1, 1);
+		}
+	}
+
+	/// <summary>
+	/// Compact 'segmentCount' segments of 'segmentSize' elements (segment i starts at element i * segmentSize); segmentSize is at most kStreamCompactionBlockSize
+	/// Segments are the ones listed in segmentListBuffer (one uint each), or the first 'segmentCount' ones if it is 0; kept count of segment i is written into uint number i of countsBuffer
+	/// </summary>
+	void CompactSegments(GLuint inputBuffer, GLuint outputBuffer, GLuint countsBuffer, GLuint segmentListBuffer, GLuint segmentCount, GLuint segmentSize)
+	{
+		if (segmentCount == 0)
+		{
+			return;
+		}
+
+		// One work group per segment: a bigger one cannot be compacted (and clamping its size would misplace every segment after the first)
+		if (segmentSize > kStreamCompactionBlockSize)
+		{
+			char output[256];
+			sprintf_s(output, sizeof(output), "Stream compaction: segments of %u elements exceed the work group size (%u); not compacted.\n", segmentSize, kStreamCompactionBlockSize);
+			OutputDebugStringA(output);
+			return;
+		}
+
+		glUseProgram(segmentProgram);
+		glUniform1ui(0, segmentSize);
+		glUniform1i(1, segmentListBuffer != 0);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, inputBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, outputBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, countsBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, segmentListBuffer != 0 ? segmentListBuffer : countsBuffer);  // Not read without a list
+		glDispatchCompute(segmentCount, 1, 1);
+	}
+
+	void Remove()
+	{
+		glDeleteProgram(reduceProgram);
+		glDeleteProgram(scanProgram);
+		glDeleteProgram(scatterProgram);
+		glDeleteProgram(segmentProgram);
+		glDeleteBuffers(1, &blockCountBuffer);
+	}
+
+private:
+	GLuint CreateProgram(const char* body)
+	{
+		const char* computeShaderSource[] = { "#version 450 core\n", kStreamCompactionScanGlsl, body };
+
+		GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(computeShader, 3, computeShaderSource, NULL);
+		glCompileShader(computeShader);
+
+		GLuint program = glCreateProgram();
+		glAttachShader(program, computeShader);
+		glLinkProgram(program);
+
+		glDeleteShader(computeShader);
+
+		return program;
+	}
+
+	GLuint reduceProgram = 0;
+	GLuint scanProgram = 0;
+	GLuint scatterProgram = 0;
+	GLuint segmentProgram = 0;
+	GLuint blockCountBuffer = 0;
+	GLuint blockCapacity = 0;
+};
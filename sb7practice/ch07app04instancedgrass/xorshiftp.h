@@ -0,0 +1,300 @@
+#pragma once
+
+/*
+	Non-linear xorshift RNG (Random Number Generator): xorshift*
+	Bit-identical to GLSL random() function used in grass shaders:
+
+		value = ((value >> 7) ^ (value << 9)) * 15485863;
+
+	Right shift is arithmetic (signed int in GLSL) and both left shift and multiplication wrap around (32 bit); C++ version works on unsigned integers where overflow is defined.
+
+	Three ways to generate numbers for a batch of seeds (seed + i, same as blade index based seeds in shaders):
+	- Scalar: one number at a time
+	- SIMD: 8 (AVX2) or 4 (SSE4.1) numbers at a time; best instruction set supported by the CPU is selected at runtime
+	- Threaded: batch split among the threads of a pool, each running the SIMD kernel
+
+	Note: Numbers generated by chaining (value = Xorshiftp(value, n)) depend on each other, so they cannot be batched; batches always use independent seeds.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <immintrin.h>
+#include "cpufeatures.h"
+
+// Intrinsics for an instruction set not enabled at compile time (MSVC allows them anywhere)
+#if defined(_MSC_VER)
+#define XORSHIFTP_TARGET_SSE41
+#define XORSHIFTP_TARGET_AVX2
+#else
+#define XORSHIFTP_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define XORSHIFTP_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+const uint32_t kXorshiftpMultiplier = 15485863u;
+
+enum XorshiftpKernel { kXorshiftpScalar, kXorshiftpSse41, kXorshiftpAvx2, kXorshiftpKernelTotal };
+
+inline int Xorshiftp(int seed, unsigned int iterations)
+{
+	uint32_t value = (uint32_t)seed;
+
+	for (unsigned int i = 0; i < iterations; i++)
+	{
+		// Generated number overflows 32 bit (e.g. seed=999999 and iterations=1 generate a 53 bit number)
+		// 32 LSBs represent a random number that seem not to follow any sequence between function calls (even when using very close value seeds)
+		value = ((uint32_t)((int32_t)value >> 7) ^ (value << 9)) * kXorshiftpMultiplier;
+	}
+
+	return (int32_t)value;
+}
+
+#pragma region Batch kernels
+
+/// <summary>
+/// output[i] = Xorshiftp(seed + first + i, iterations), for i in [0, count)
+/// </summary>
+inline void XorshiftpBatchScalar(int seed, size_t first, unsigned int iterations, int* output, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		output[i] = Xorshiftp((int)((uint32_t)seed + (uint32_t)(first + i)), iterations);
+	}
+}
+
+XORSHIFTP_TARGET_SSE41 inline void XorshiftpBatchSse41(int seed, size_t first, unsigned int iterations, int* output, size_t count)
+{
+	const __m128i kMultiplier = _mm_set1_epi32((int)kXorshiftpMultiplier);
+	const __m128i kStep = _mm_set1_epi32(4);
+	__m128i seeds = _mm_add_epi32(_mm_set1_epi32((int)((uint32_t)seed + (uint32_t)first)), _mm_setr_epi32(0, 1, 2, 3));
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i value = seeds;
+		for (unsigned int j = 0; j < iterations; j++)
+		{
+			value = _mm_mullo_epi32(_mm_xor_si128(_mm_srai_epi32(value, 7), _mm_slli_epi32(value, 9)), kMultiplier);
+		}
+		_mm_storeu_si128((__m128i*)(output + i), value);
+		seeds = _mm_add_epi32(seeds, kStep);
+	}
+
+	// Remainder
+	XorshiftpBatchScalar(seed, first + i, iterations, output + i, count - i);
+}
+
+XORSHIFTP_TARGET_AVX2 inline void XorshiftpBatchAvx2(int seed, size_t first, unsigned int iterations, int* output, size_t count)
+{
+	const __m256i kMultiplier = _mm256_set1_epi32((int)kXorshiftpMultiplier);
+	const __m256i kStep = _mm256_set1_epi32(8);
+	__m256i seeds = _mm256_add_epi32(_mm256_set1_epi32((int)((uint32_t)seed + (uint32_t)first)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i value = seeds;
+		for (unsigned int j = 0; j < iterations; j++)
+		{
+			value = _mm256_mullo_epi32(_mm256_xor_si256(_mm256_srai_epi32(value, 7), _mm256_slli_epi32(value, 9)), kMultiplier);
+		}
+		_mm256_storeu_si256((__m256i*)(output + i), value);
+		seeds = _mm256_add_epi32(seeds, kStep);
+	}
+
+	// Remainder
+	XorshiftpBatchScalar(seed, first + i, iterations, output + i, count - i);
+}
+
+/// <summary>
+/// Best kernel supported by the CPU (checked once)
+/// </summary>
+inline XorshiftpKernel XorshiftpBestKernel()
+{
+	const CpuFeatures& cpu = GetCpuFeatures();
+	return cpu.avx2 ? kXorshiftpAvx2 : (cpu.sse41 ? kXorshiftpSse41 : kXorshiftpScalar);
+}
+
+/// <summary>
+/// output[i] = Xorshiftp(seed + first + i, iterations), for i in [0, count), with the given kernel (falls back to a supported one)
+/// </summary>
+inline void XorshiftpBatch(int seed, size_t first, unsigned int iterations, int* output, size_t count, XorshiftpKernel kernel = kXorshiftpKernelTotal)
+{
+	XorshiftpKernel best = XorshiftpBestKernel();
+	if (kernel > best)
+	{
+		kernel = best;
+	}
+
+	switch (kernel)
+	{
+	case kXorshiftpAvx2:
+		XorshiftpBatchAvx2(seed, first, iterations, output, count);
+		break;
+	case kXorshiftpSse41:
+		XorshiftpBatchSse41(seed, first, iterations, output, count);
+		break;
+	default:
+		XorshiftpBatchScalar(seed, first, iterations, output, count);
+		break;
+	}
+}
+
+/// <summary>
+/// output[i] = Xorshiftp(seed + first + i, iterations) & 0xFF (8 LSBs, as selected in shaders), for i in [0, count)
+/// Note: Generated in small blocks on the stack, so byte outputs (e.g. texture data) need no intermediate int buffer
+/// </summary>
+inline void XorshiftpBatchBytes(int seed, size_t first, unsigned int iterations, unsigned char* output, size_t count, XorshiftpKernel kernel = kXorshiftpKernelTotal)
+{
+	const size_t kBlock = 1024;
+	int block[kBlock];
+
+	for (size_t i = 0; i < count; i += kBlock)
+	{
+		size_t blockCount = count - i < kBlock ? count - i : kBlock;
+		XorshiftpBatch(seed, first + i, iterations, block, blockCount, kernel);
+		for (size_t j = 0; j < blockCount; j++)
+		{
+			output[i + j] = (unsigned char)(block[j] & 0xFF);
+		}
+	}
+}
+
+#pragma endregion
+
+#pragma region Thread pool
+
+/// <summary>
+/// Fixed set of worker threads that split batches in contiguous ranges (calling thread takes a range too)
+/// </summary>
+class XorshiftpThreadPool
+{
+public:
+	explicit XorshiftpThreadPool(unsigned int threadCount = std::thread::hardware_concurrency())
+	{
+		if (threadCount == 0)
+		{
+			threadCount = 1;
+		}
+
+		// Calling thread is one of them
+		for (unsigned int i = 1; i < threadCount; i++)
+		{
+			workers.emplace_back(&XorshiftpThreadPool::Work, this, i);
+		}
+	}
+
+	~XorshiftpThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		start.notify_all();
+
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	XorshiftpThreadPool(const XorshiftpThreadPool&) = delete;
+	XorshiftpThreadPool& operator=(const XorshiftpThreadPool&) = delete;
+
+	unsigned int ThreadCount() const
+	{
+		return (unsigned int)workers.size() + 1;
+	}
+
+	void Batch(int seed, unsigned int iterations, int* output, size_t count, XorshiftpKernel kernel = kXorshiftpKernelTotal)
+	{
+		Run(count, [=](size_t first, size_t rangeCount)
+		{
+			XorshiftpBatch(seed, first, iterations, output + first, rangeCount, kernel);
+		});
+	}
+
+	void BatchBytes(int seed, unsigned int iterations, unsigned char* output, size_t count, XorshiftpKernel kernel = kXorshiftpKernelTotal)
+	{
+		Run(count, [=](size_t first, size_t rangeCount)
+		{
+			XorshiftpBatchBytes(seed, first, iterations, output + first, rangeCount, kernel);
+		});
+	}
+
+	/// <summary>
+	/// Call task(first, count) once per thread over contiguous ranges covering [0, count); returns when all of them are done
+	/// </summary>
+	void Run(size_t count, const std::function<void(size_t, size_t)>& task)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		currentTask = &task;
+		currentCount = count;
+		pending = (unsigned int)workers.size();
+		generation++;
+		lock.unlock();
+		start.notify_all();
+
+		RunRange(0, task, count);
+
+		lock.lock();
+		done.wait(lock, [this]() { return pending == 0; });
+		currentTask = nullptr;
+	}
+
+private:
+	void Work(unsigned int index)
+	{
+		unsigned long long seenGeneration = 0;
+
+		for (;;)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			start.wait(lock, [&]() { return quit || generation != seenGeneration; });
+			if (quit)
+			{
+				return;
+			}
+			seenGeneration = generation;
+			const std::function<void(size_t, size_t)>* task = currentTask;
+			size_t count = currentCount;
+			lock.unlock();
+
+			RunRange(index, *task, count);
+
+			lock.lock();
+			if (--pending == 0)
+			{
+				done.notify_one();
+			}
+		}
+	}
+
+	void RunRange(unsigned int index, const std::function<void(size_t, size_t)>& task, size_t count)
+	{
+		// Ranges are multiple of 8 (AVX2 lanes), so only the last one runs a scalar remainder
+		size_t threads = ThreadCount();
+		size_t range = ((count + threads - 1) / threads + 7) & ~(size_t)7;
+		size_t first = range * index;
+		if (first < count)
+		{
+			task(first, count - first < range ? count - first : range);
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable start;
+	std::condition_variable done;
+	const std::function<void(size_t, size_t)>* currentTask = nullptr;
+	size_t currentCount = 0;
+	unsigned int pending = 0;
+	unsigned long long generation = 0;
+	bool quit = false;
+};
+
+#pragma endregion
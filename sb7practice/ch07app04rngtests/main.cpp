@@ -0,0 +1,282 @@
+// Statistical quality and throughput tests of the RNGs used by the instanced grass sample (console application, no window)
+// xorshift* (xorshiftp.h) and plain PCG hash are measured for reference; counter-based RNG (counterrng.h) must pass every test
+#include "../ch07app04instancedgrass/xorshiftp.h"
+#include "../ch07app04instancedgrass/counterrng.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+
+const uint32_t kSampleTotal = 1024 * 1024;
+const uint32_t kCounterKey = 0x5EED;
+
+// Chi-square critical value for 255 degrees of freedom (256 bins) at 1% significance
+const double kChiSquareCritical = 310.457;
+// Worst tolerated avalanche bias (|flip probability - 0.5|): about 7 standard deviations for the sample size used
+const double kAvalancheMaxBias = 0.03;
+// Worst tolerated correlation coefficient
+const double kCorrelationMax = 0.01;
+
+#pragma region Generators
+
+// Blade offsets (8 LSBs of each number) as generated in grass shaders: number2 is chained from number1
+void XorshiftpPair(uint32_t seed, uint32_t& x, uint32_t& y)
+{
+	int number1 = Xorshiftp((int)seed, 3);
+	int number2 = Xorshiftp(number1, 2);
+	x = (uint32_t)number1;
+	y = (uint32_t)number2;
+}
+
+// Same pair drawn from counter-based RNG: both numbers come from the blade stream (counters 0 and 1)
+void CounterPair(uint32_t seed, uint32_t& x, uint32_t& y)
+{
+	x = CounterRandom(seed, 0);
+	y = CounterRandom(seed, 1);
+}
+
+uint32_t XorshiftpSingle(uint32_t seed)
+{
+	return (uint32_t)Xorshiftp((int)seed, 3);
+}
+
+uint32_t CounterSingle(uint32_t seed)
+{
+	return CounterRandom(kCounterKey, seed);
+}
+
+// Plain PCG hash of the counter (no final round), for reference
+uint32_t PcgHashSingle(uint32_t seed)
+{
+	return PcgHash(seed + PcgHash(kCounterKey));
+}
+
+void PcgHashPair(uint32_t seed, uint32_t& x, uint32_t& y)
+{
+	x = PcgHash(PcgHash(seed));
+	y = PcgHash(1 + PcgHash(seed));
+}
+
+#pragma endregion
+
+#pragma region Tests
+
+/// <summary>
+/// Chi-square of 256 bins filled with 8 bits (starting at bit 'shift') of consecutive numbers
+/// </summary>
+double ChiSquare(uint32_t (*generate)(uint32_t), int shift)
+{
+	double bins[256] = {};
+	for (uint32_t i = 0; i < kSampleTotal; i++)
+	{
+		bins[(generate(i) >> shift) & 0xFF] += 1.0;
+	}
+
+	double expected = kSampleTotal / 256.0;
+	double chiSquare = 0.0;
+	for (double count : bins)
+	{
+		chiSquare += (count - expected) * (count - expected) / expected;
+	}
+
+	return chiSquare;
+}
+
+/// <summary>
+/// Flip every input bit of random inputs and count how often every output bit flips (strict avalanche criterion: 0.5)
+/// Returns worst bias (|probability - 0.5|) among the 32x32 input/output bit combinations; mean probability is returned in 'mean'
+/// </summary>
+double Avalanche(uint32_t (*generate)(uint32_t), double& mean)
+{
+	const uint32_t kInputTotal = 16384;
+	static uint32_t flips[32][32];
+	memset(flips, 0, sizeof(flips));
+
+	for (uint32_t i = 0; i < kInputTotal; i++)
+	{
+		uint32_t input = CounterRandom(0xA5A5A5A5u, i);
+		uint32_t output = generate(input);
+		for (int inBit = 0; inBit < 32; inBit++)
+		{
+			uint32_t difference = output ^ generate(input ^ (1u << inBit));
+			for (int outBit = 0; outBit < 32; outBit++)
+			{
+				flips[inBit][outBit] += (difference >> outBit) & 1u;
+			}
+		}
+	}
+
+	double worst = 0.0;
+	mean = 0.0;
+	for (int inBit = 0; inBit < 32; inBit++)
+	{
+		for (int outBit = 0; outBit < 32; outBit++)
+		{
+			double probability = (double)flips[inBit][outBit] / kInputTotal;
+			mean += probability / (32 * 32);
+			worst = fabs(probability - 0.5) > worst ? fabs(probability - 0.5) : worst;
+		}
+	}
+
+	return worst;
+}
+
+/// <summary>
+/// Pearson correlation coefficient of two samples
+/// </summary>
+double Correlation(const double* a, const double* b, uint32_t count)
+{
+	double meanA = 0.0, meanB = 0.0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		meanA += a[i] / count;
+		meanB += b[i] / count;
+	}
+
+	double covariance = 0.0, varianceA = 0.0, varianceB = 0.0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		covariance += (a[i] - meanA) * (b[i] - meanB);
+		varianceA += (a[i] - meanA) * (a[i] - meanA);
+		varianceB += (b[i] - meanB) * (b[i] - meanB);
+	}
+
+	return covariance / sqrt(varianceA * varianceB);
+}
+
+/// <summary>
+/// Blade offset pairs (8 LSBs of number1 and number2, as in TestPairsXorshiftp and grass shaders):
+/// - correlation between X and Z offsets of the same blade
+/// - correlation between X offsets of neighbor blades (consecutive seeds)
+/// - 2D chi-square over a 16x16 grid of offset cells (is the blade footprint uniformly covered?)
+/// </summary>
+bool PairCorrelation(const char* name, void (*generate)(uint32_t, uint32_t&, uint32_t&))
+{
+	double* x = new double[kSampleTotal];
+	double* y = new double[kSampleTotal];
+	double cells[256] = {};
+
+	for (uint32_t i = 0; i < kSampleTotal; i++)
+	{
+		uint32_t number1, number2;
+		generate(i, number1, number2);
+		x[i] = number1 & 0xFF;
+		y[i] = number2 & 0xFF;
+		cells[((number1 & 0xFF) >> 4) * 16 + ((number2 & 0xFF) >> 4)] += 1.0;
+	}
+
+	double sameBlade = Correlation(x, y, kSampleTotal);
+	double neighbors = Correlation(x, x + 1, kSampleTotal - 1);
+
+	double expected = kSampleTotal / 256.0;
+	double chiSquare = 0.0;
+	for (double count : cells)
+	{
+		chiSquare += (count - expected) * (count - expected) / expected;
+	}
+
+	bool pass = fabs(sameBlade) < kCorrelationMax && fabs(neighbors) < kCorrelationMax && chiSquare < kChiSquareCritical;
+	printf("%-12s pairs: r(x, z) %+.5f, r(x[i], x[i+1]) %+.5f, 2D chi-square %9.1f  %s\n", name, sameBlade, neighbors, chiSquare, pass ? "PASS" : "FAIL");
+
+	delete[] x;
+	delete[] y;
+
+	return pass;
+}
+
+bool Quality(const char* name, uint32_t (*generate)(uint32_t), void (*generatePair)(uint32_t, uint32_t&, uint32_t&))
+{
+	double chiSquareLow = ChiSquare(generate, 0);
+	double chiSquareHigh = ChiSquare(generate, 24);
+	bool chiSquarePass = chiSquareLow < kChiSquareCritical && chiSquareHigh < kChiSquareCritical;
+	printf("%-12s chi-square (8 LSBs) %9.1f, (8 MSBs) %9.1f  %s\n", name, chiSquareLow, chiSquareHigh, chiSquarePass ? "PASS" : "FAIL");
+
+	double mean;
+	double bias = Avalanche(generate, mean);
+	bool avalanchePass = bias < kAvalancheMaxBias;
+	printf("%-12s avalanche: mean flip probability %.4f, worst bias %.4f  %s\n", name, mean, bias, avalanchePass ? "PASS" : "FAIL");
+
+	bool pairPass = PairCorrelation(name, generatePair);
+
+	return chiSquarePass && avalanchePass && pairPass;
+}
+
+#pragma endregion
+
+#pragma region Throughput
+
+template <typename Function>
+double Measure(Function function)
+{
+	double best = 1.0e9;
+
+	for (int run = 0; run < 5; run++)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		function();
+		double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		best = elapsed < best ? elapsed : best;
+	}
+
+	return best;
+}
+
+void Throughput()
+{
+	const size_t kNumberTotal = 16 * 1024 * 1024;
+	uint32_t* numbers = new uint32_t[kNumberTotal];
+	XorshiftpThreadPool pool;
+	const char* kernelNames[] = { "scalar", "SSE4.1", "AVX2" };
+
+	printf("\nCPU throughput: %zu numbers, best kernel %s, %u threads (M numbers/s)\n", kNumberTotal, kernelNames[XorshiftpBestKernel()], pool.ThreadCount());
+
+	double xorshiftpScalar = Measure([&]() { XorshiftpBatch(0, 0, 3, (int*)numbers, kNumberTotal, kXorshiftpScalar); });
+	double xorshiftpSimd = Measure([&]() { XorshiftpBatch(0, 0, 3, (int*)numbers, kNumberTotal); });
+	double xorshiftpThreaded = Measure([&]() { pool.Batch(0, 3, (int*)numbers, kNumberTotal); });
+	printf("xorshift*    scalar %8.1f  SIMD %8.1f  threaded %8.1f\n", kNumberTotal / xorshiftpScalar / 1.0e6, kNumberTotal / xorshiftpSimd / 1.0e6, kNumberTotal / xorshiftpThreaded / 1.0e6);
+
+	double counterScalar = Measure([&]() { CounterRandomBatch(kCounterKey, 0, numbers, kNumberTotal, kXorshiftpScalar); });
+	double counterSimd = Measure([&]() { CounterRandomBatch(kCounterKey, 0, numbers, kNumberTotal); });
+	double counterThreaded = Measure([&]() { CounterRandomBatch(pool, kCounterKey, numbers, kNumberTotal); });
+	printf("counter RNG  scalar %8.1f  SIMD %8.1f  threaded %8.1f\n", kNumberTotal / counterScalar / 1.0e6, kNumberTotal / counterSimd / 1.0e6, kNumberTotal / counterThreaded / 1.0e6);
+
+	delete[] numbers;
+}
+
+#pragma endregion
+
+int main()
+{
+	printf("RNG tests: %u samples; chi-square critical value %.1f (255 dof, 1%%)\n\n", kSampleTotal, kChiSquareCritical);
+
+	// Same seeds as TestPairsXorshiftp
+	const uint32_t seeds[] = { 0, 58575, 999999, 1048575 };
+	for (uint32_t seed : seeds)
+	{
+		uint32_t x1, y1, x2, y2;
+		XorshiftpPair(seed, x1, y1);
+		CounterPair(seed, x2, y2);
+		printf("seed %7u: xorshift* offsets (%3u, %3u), counter RNG offsets (%3u, %3u)\n", seed, x1 & 0xFF, y1 & 0xFF, x2 & 0xFF, y2 & 0xFF);
+	}
+	printf("\n");
+
+	Quality("xorshift*", XorshiftpSingle, XorshiftpPair);
+	Quality("PCG hash", PcgHashSingle, PcgHashPair);
+	bool counterPass = Quality("counter RNG", CounterSingle, CounterPair);
+
+	// Batch kernels must match the scalar function
+	const size_t kCheckTotal = 100003;
+	uint32_t* batch = new uint32_t[kCheckTotal];
+	CounterRandomBatch(kCounterKey, 7, batch, kCheckTotal);
+	bool batchPass = true;
+	for (size_t i = 0; i < kCheckTotal; i++)
+	{
+		batchPass = batchPass && batch[i] == CounterRandom(kCounterKey, (uint32_t)(7 + i));
+	}
+	delete[] batch;
+	printf("counter RNG  batch kernel matches scalar  %s\n", batchPass ? "PASS" : "FAIL");
+
+	Throughput();
+
+	return counterPass && batchPass ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+// Throughput benchmark of the xorshift* RNG module used by the instanced grass sample (console application, no window)
+#include "../ch07app04instancedgrass/xorshiftp.h"
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+
+const size_t kNumberTotal = 16 * 1024 * 1024;
+const unsigned int kIterations = 3;  // Same as first random number of each grass blade
+const int kRuns = 5;
+const int kSeed = 0x5EED;
+
+/// <summary>
+/// Best time (in seconds) out of kRuns calls to function
+/// </summary>
+template <typename Function>
+double Measure(Function function)
+{
+	double best = 1.0e9;
+
+	for (int run = 0; run < kRuns; run++)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		function();
+		double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		best = elapsed < best ? elapsed : best;
+	}
+
+	return best;
+}
+
+void Report(const char* name, double seconds, size_t count, double reference)
+{
+	printf("%-28s %9.3f ms %10.1f M numbers/s  x%.2f\n", name, seconds * 1.0e3, count / seconds / 1.0e6, reference / seconds);
+}
+
+int main()
+{
+	const char* kernelNames[] = { "scalar", "SIMD (SSE4.1)", "SIMD (AVX2)" };
+	XorshiftpThreadPool pool;
+
+	printf("Xorshiftp benchmark: %zu numbers, %u iterations, best of %d runs\n", kNumberTotal, kIterations, kRuns);
+	printf("Best kernel: %s; thread pool: %u threads\n\n", kernelNames[XorshiftpBestKernel()], pool.ThreadCount());
+
+	// Numbers (int)
+	int* reference = new int[kNumberTotal];
+	int* numbers = new int[kNumberTotal];
+
+	double scalar = Measure([&]() { XorshiftpBatch(kSeed, 0, kIterations, reference, kNumberTotal, kXorshiftpScalar); });
+	Report(kernelNames[kXorshiftpScalar], scalar, kNumberTotal, scalar);
+
+	for (int kernel = kXorshiftpSse41; kernel <= XorshiftpBestKernel(); kernel++)
+	{
+		double simd = Measure([&]() { XorshiftpBatch(kSeed, 0, kIterations, numbers, kNumberTotal, (XorshiftpKernel)kernel); });
+		Report(kernelNames[kernel], simd, kNumberTotal, scalar);
+
+		if (memcmp(numbers, reference, sizeof(int) * kNumberTotal) != 0)
+		{
+			printf("ERROR: %s output differs from scalar\n", kernelNames[kernel]);
+			return 1;
+		}
+	}
+
+	memset(numbers, 0, sizeof(int) * kNumberTotal);
+	double threaded = Measure([&]() { pool.Batch(kSeed, kIterations, numbers, kNumberTotal); });
+	Report("threaded + best SIMD", threaded, kNumberTotal, scalar);
+
+	if (memcmp(numbers, reference, sizeof(int) * kNumberTotal) != 0)
+	{
+		printf("ERROR: threaded output differs from scalar\n");
+		return 1;
+	}
+
+	delete[] reference;
+	delete[] numbers;
+
+	// Parameter texture data: 4096x4096 RGBA8 (one number - 8 LSBs - per channel)
+	const size_t kTextureSide = 4096;
+	const size_t kTextureBytes = kTextureSide * kTextureSide * 4;
+	unsigned char* texelsReference = new unsigned char[kTextureBytes];
+	unsigned char* texels = new unsigned char[kTextureBytes];
+
+	printf("\n%zux%zu RGBA8 parameter texture (%zu numbers)\n", kTextureSide, kTextureSide, kTextureBytes);
+
+	double textureScalar = Measure([&]() { XorshiftpBatchBytes(kSeed, 0, kIterations, texelsReference, kTextureBytes, kXorshiftpScalar); });
+	Report(kernelNames[kXorshiftpScalar], textureScalar, kTextureBytes, textureScalar);
+
+	double textureSimd = Measure([&]() { XorshiftpBatchBytes(kSeed, 0, kIterations, texels, kTextureBytes); });
+	Report(kernelNames[XorshiftpBestKernel()], textureSimd, kTextureBytes, textureScalar);
+
+	memset(texels, 0, kTextureBytes);
+	double textureThreaded = Measure([&]() { pool.BatchBytes(kSeed, kIterations, texels, kTextureBytes); });
+	Report("threaded + best SIMD", textureThreaded, kTextureBytes, textureScalar);
+
+	if (memcmp(texels, texelsReference, kTextureBytes) != 0)
+	{
+		printf("ERROR: threaded texture data differs from scalar\n");
+		return 1;
+	}
+
+	delete[] texelsReference;
+	delete[] texels;
+
+	return 0;
+}
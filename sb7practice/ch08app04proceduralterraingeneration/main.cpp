@@ -3,6 +3,16 @@
 #include "vmath.h"
 #include "sb7ktx.h"
 #include "shader.h"
+#include "terrainquadtree.h"
+#include "terrainclipmap.h"
+#include "terrainnormalmap.h"
+#include "terrainheightfield.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <random>
 
 enum Grid
 {
@@ -11,18 +21,186 @@ enum Grid
 	kPatchTotal = kGridSide * kGridSide  // Square grid 64 * 64 == 2**6 * 2**6 == 2**12 == 4096
 };
 
+enum TerrainMode
+{
+	kFixedGrid,  // 64 x 64 patches over a single heightmap
+	kClipmap,  // Nested rings of patches around the camera, over a world streamed from disk
+	kProcedural,  // 64 x 64 patches displaced by noise evaluated in the TES (no heightmap nor color map)
+	kTerrainModeTotal
+};
+
 enum RenderProgram
 {
 	kBookSample,
-	kDistanceToCamera
+	kDistanceToCamera,
+	kScreenSpaceError,
+	kCdlod,  // Instanced grid meshes over quadtree nodes, morphed in the vertex shader (no tessellation)
+	kRenderProgramTotal
 };
 
+// Tess control shader function (included right after the uniforms and the input block): true if the patch box lies fully outside clip space
+// The box spans the patch quad and the height bounds of the patch (scaled by max_height), so it encloses the displaced surface the TES would emit
+const char kPatchFrustumCullingGlsl[] =
+	"bool patchOutsideFrustum(void)																		\n"
+	"{																									\n"
+	"	vec2 heights = in_vdata[0].height_bounds * max_height;											\n"
+	"	float y0 = min(heights.x, heights.y);															\n"
+	"	float y1 = max(heights.x, heights.y);															\n"
+	"																									\n"
+	"	// Corners outside each clip plane (left, right, bottom, top, near and far)						\n"
+	"	int outside[6] = int[6](0, 0, 0, 0, 0, 0);														\n"
+	"	for (int i = 0; i < 8; i++)																		\n"
+	"	{																								\n"
+	"		vec4 corner = gl_in[i & 3].gl_Position + vec4(0.0, i < 4 ? y0 : y1, 0.0, 0.0);				\n"
+	"		vec4 p = p_matrix * mv_matrix * corner;														\n"
+	"		outside[0] += p.x < -p.w ? 1 : 0;															\n"
+	"		outside[1] += p.x > p.w ? 1 : 0;															\n"
+	"		outside[2] += p.y < -p.w ? 1 : 0;															\n"
+	"		outside[3] += p.y > p.w ? 1 : 0;															\n"
+	"		outside[4] += p.z < -p.w ? 1 : 0;															\n"
+	"		outside[5] += p.z > p.w ? 1 : 0;															\n"
+	"	}																								\n"
+	"																									\n"
+	"	// Rejected if all 8 corners are outside the same plane											\n"
+	"	for (int i = 0; i < 6; i++)																		\n"
+	"	{																								\n"
+	"		if (outside[i] == 8)																		\n"
+	"		{																							\n"
+	"			return true;																			\n"
+	"		}																							\n"
+	"	}																								\n"
+	"																									\n"
+	"	return false;																					\n"
+	"}																									\n"
+	"																									\n";
+
+// Tess control shader lookup of the precomputed edge levels (included right after kPatchFrustumCullingGlsl)
+const char kPrecomputedEdgeLevelsGlsl[] =
+	"layout (location = 6) uniform bool precomputed_levels;												\n"
+	"																									\n"
+	"// Level of every grid edge, computed once per draw (see ComputeEdgeLevels): edges along X first (65 rows of 64), then edges along Z (64 rows of 65)\n"
+	"layout (binding = 1, std430) readonly buffer edge_levels_block										\n"
+	"{																									\n"
+	"	float edge_levels[];																			\n"
+	"};																									\n"
+	"																									\n"
+	"// Outer levels of the patch (edges 0-2, 1-0, 3-1 and 2-3), looked up instead of computed: a shared edge reads the same value from both patches\n"
+	"vec4 precomputedOuterLevels(void)																	\n"
+	"{																									\n"
+	"	ivec2 patch_coord = ivec2(round(in_vdata[2].tc * 64.0));  // Vertex 2 is the (0, 0) corner of the patch\n"
+	"	const int z_edges = 65 * 64;																	\n"
+	"	return vec4(edge_levels[z_edges + patch_coord.y * 65 + patch_coord.x],							\n"
+	"				edge_levels[(patch_coord.y + 1) * 64 + patch_coord.x],								\n"
+	"				edge_levels[z_edges + patch_coord.y * 65 + patch_coord.x + 1],						\n"
+	"				edge_levels[patch_coord.y * 64 + patch_coord.x]);									\n"
+	"}																									\n"
+	"																									\n";
+
+// Fragment shader function of the heightmap based programs (included right after the uniforms; reads max_height): albedo lit by a fixed sun,
+// with the normal rebuilt from the height gradient map
+const char kTerrainLightingGlsl[] =
+	"// Height gradient of the heightmap, with its mip chain (see InitializeNormalMap)					\n"
+	"layout (binding = 3) uniform sampler2D tex_normal;													\n"
+	"																									\n"
+	"vec3 terrainLighting(vec3 albedo, vec2 tc)															\n"
+	"{																									\n"
+	"	// Normal for the current height scale: a single extra fetch									\n"
+	"	vec2 gradient = texture(tex_normal, tc).rg * max_height;										\n"
+	"	vec3 normal = normalize(vec3(-gradient.x, 1.0, -gradient.y));									\n"
+	"																									\n"
+	"	// Fixed sun (diffuse plus ambient)																\n"
+	"	float diffuse = max(dot(normal, normalize(vec3(0.4, 0.8, 0.3))), 0.0);							\n"
+	"	return albedo * (0.3 + 0.7 * diffuse);															\n"
+	"}																									\n"
+	"																									\n";
+
+// Outputs of the texture based tess evaluation shaders captured by the tessellation cache (interleaved: clip space position, texture coordinate)
+const char* const kTerrainCacheVaryings[] = { "gl_Position", "VERTEX_DATA.tc" };
+
+// Tess evaluation shader functions of the procedural terrain: hashed gradient noise, fBm and ridged multifractal, evaluated at every vertex
+// instead of fetching a heightmap (nothing in GPU memory but the program)
+const char kProceduralNoiseGlsl[] =
+	"// Integer hash (PCG permutation): same lattice value on every invocation, no texture behind it	\n"
+	"uint hashUint(uint v)																				\n"
+	"{																									\n"
+	"	uint state = v * 747796405u + 2891336453u;														\n"
+	"	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;							\n"
+	"	return (word >> 22u) ^ word;																	\n"
+	"}																									\n"
+	"																									\n"
+	"// Unit gradient of a lattice point																\n"
+	"vec2 latticeGradient(ivec2 cell)																	\n"
+	"{																									\n"
+	"	float angle = float(hashUint(uint(cell.x) ^ hashUint(uint(cell.y)))) * (6.2831853 / 4294967296.0);\n"
+	"	return vec2(cos(angle), sin(angle));															\n"
+	"}																									\n"
+	"																									\n"
+	"// Gradient noise, range about [-1, 1]																\n"
+	"float gradientNoise(vec2 p)																		\n"
+	"{																									\n"
+	"	ivec2 cell = ivec2(floor(p));																	\n"
+	"	vec2 f = fract(p);																				\n"
+	"	vec2 u = f * f * f * (f * (f * 6.0 - 15.0) + 10.0);  // Quintic fade: continuous normals		\n"
+	"																									\n"
+	"	float n00 = dot(latticeGradient(cell), f);														\n"
+	"	float n10 = dot(latticeGradient(cell + ivec2(1, 0)), f - vec2(1.0, 0.0));						\n"
+	"	float n01 = dot(latticeGradient(cell + ivec2(0, 1)), f - vec2(0.0, 1.0));						\n"
+	"	float n11 = dot(latticeGradient(cell + ivec2(1, 1)), f - vec2(1.0, 1.0));						\n"
+	"	return 1.4142 * mix(mix(n00, n10, u.x), mix(n01, n11, u.x), u.y);								\n"
+	"}																									\n"
+	"																									\n"
+	"// Octaves are rotated so lattice artifacts do not line up											\n"
+	"const mat2 octave_rotation = mat2(1.6, 1.2, -1.2, 1.6);  // 2x scale, ~37 degrees					\n"
+	"																									\n"
+	"// Fractional Brownian motion: rolling hills, range about [-1, 1]									\n"
+	"float fbm(vec2 p, int octaves)																		\n"
+	"{																									\n"
+	"	float sum = 0.0;																				\n"
+	"	float amplitude = 0.5;																			\n"
+	"	for (int i = 0; i < octaves; i++)																\n"
+	"	{																								\n"
+	"		sum += amplitude * gradientNoise(p);														\n"
+	"		p = octave_rotation * p;																	\n"
+	"		amplitude *= 0.5;																			\n"
+	"	}																								\n"
+	"	return sum / (1.0 - 2.0 * amplitude);  // Sum of the amplitudes: 1 - 0.5^octaves				\n"
+	"}																									\n"
+	"																									\n"
+	"// Ridged multifractal: sharp crests, each octave weighted by the previous one (detail gathers on ridges), range [0, 1]\n"
+	"float ridged(vec2 p, int octaves)																	\n"
+	"{																									\n"
+	"	float sum = 0.0;																				\n"
+	"	float amplitude = 0.5;																			\n"
+	"	float weight = 1.0;																				\n"
+	"	for (int i = 0; i < octaves; i++)																\n"
+	"	{																								\n"
+	"		float n = 1.0 - abs(gradientNoise(p));														\n"
+	"		n *= n;																						\n"
+	"		sum += amplitude * n * weight;																\n"
+	"		weight = clamp(n * 2.0, 0.0, 1.0);															\n"
+	"		p = octave_rotation * p;																	\n"
+	"		amplitude *= 0.5;																			\n"
+	"	}																								\n"
+	"	return clamp(sum, 0.0, 1.0);																	\n"
+	"}																									\n"
+	"																									\n"
+	"// Normalized height [0, 1] at a world position (XZ): hills and ridged mountains, blended by a low frequency mask\n"
+	"float terrainHeight(vec2 position)																	\n"
+	"{																									\n"
+	"	vec2 p = position / 24.0;																		\n"
+	"	float hills = fbm(p, 6) * 0.5 + 0.5;															\n"
+	"	float mountains = ridged(p * 0.75 + vec2(17.3, -9.1), 6);										\n"
+	"	float mask = smoothstep(0.4, 0.6, fbm(p * 0.25 + vec2(-31.7, 5.3), 3) * 0.5 + 0.5);				\n"
+	"	return clamp(mix(hills * 0.45, mountains, mask), 0.0, 1.0);										\n"
+	"}																									\n"
+	"																									\n";
+
 // Derive my_application from sb7::application
 class my_application : public sb7::application
 {
 public:
 
-	my_application() : max_height_(6.0f), height_step_(0.15f), wireframe_mode_(true), render_program_index_(1)
+	my_application() : max_height_(6.0f), height_step_(0.15f), wireframe_mode_(true), render_program_index_(1), patch_culling_(true), tcs_culling_(false)
 	{
 	}
 
@@ -32,8 +210,18 @@ public:
 	{
 		InitializeCamera();
 		InitializeObject();
+		InitializeNormalMap();
+		InitializeHeightField();
+		InitializePatchCulling();
 		InitializeProgram();
 		InitializeProgram2();
+		InitializePatchErrorTexture();
+		InitializeProgram3();
+		InitializeEdgeLevels();
+		InitializeCdlod();
+		InitializeClipmap();
+		InitializeProcedural();
+		InitializeTerrainCache();
 
 		glEnable(GL_CULL_FACE);
 	}
@@ -44,16 +232,6 @@ public:
 		static const GLfloat color[] = { 0.0f, 0.0f, 0.0f, 1.0f };
 		glClearBufferfv(GL_COLOR, 0, color);
 
-		glUseProgram(render_program_[render_program_index_ & 1]);
-
-		glBindVertexArray(vao_);
-
-		glUniformMatrix4fv(0, 1, GL_FALSE, camera_view_matrix_);
-		glUniformMatrix4fv(1, 1, GL_FALSE, camera_projection_matrix_);
-		glUniform1f(2, max_height_);
-		glBindTextureUnit(0, texture_2d_heightmap);
-		glBindTextureUnit(1, texture_2d_color);
-
 		if (wireframe_mode_)
 		{
 			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
@@ -63,9 +241,71 @@ public:
 			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 		}
 
-		glPatchParameteri(GL_PATCH_VERTICES, kPatchSize);
+		if (compare_terrain_sources_)
+		{
+			compare_terrain_sources_ = false;
+			CompareTerrainSources();
+			glClearBufferfv(GL_COLOR, 0, color);
+		}
+
+		if (benchmark_height_field_)
+		{
+			benchmark_height_field_ = false;
+			BenchmarkHeightField();
+		}
+
+		if (terrain_mode_ == kClipmap)
+		{
+			RenderClipmap(currentTime);
+			return;
+		}
+
+		if (terrain_mode_ == kProcedural)
+		{
+			RenderProcedural(currentTime);
+			return;
+		}
+
+		if (benchmark_camera_path_)
+		{
+			benchmark_camera_path_ = false;
+			BenchmarkCameraPath();
+			glClearBufferfv(GL_COLOR, 0, color);
+		}
 
-		glDrawArraysInstanced(GL_PATCHES, 0, kPatchSize, kPatchTotal);
+		// Nothing changed since the capture: draw the tessellated triangles of a previous frame
+		if (terrain_cache_ && render_program_index_ % kRenderProgramTotal != kCdlod && !compare_render_programs_ && !benchmark_edge_levels_ && UpdateTerrainCache())
+		{
+			BeginTessellationQueries();
+			DrawTerrainCache();
+			EndTessellationQueries();
+
+			ReportPatchCulling(currentTime);
+			return;
+		}
+
+		// Only patches inside the view frustum are drawn (one instance each)
+		GLuint visible_patch_count = CullPatches();
+
+		if (compare_render_programs_)
+		{
+			compare_render_programs_ = false;
+			CompareRenderPrograms(visible_patch_count);
+			glPolygonMode(GL_FRONT_AND_BACK, wireframe_mode_ ? GL_LINE : GL_FILL);
+		}
+
+		if (benchmark_edge_levels_)
+		{
+			benchmark_edge_levels_ = false;
+			BenchmarkEdgeLevels(visible_patch_count);
+			glClearBufferfv(GL_COLOR, 0, color);
+		}
+
+		BeginTessellationQueries();
+		DrawTerrain(render_program_index_ % kRenderProgramTotal, pixel_error_, visible_patch_count, terrain_cache_ && cache_state_ == kCacheCapture);
+		EndTessellationQueries();
+
+		ReportPatchCulling(currentTime);
 	}
 
 	void shutdown()
@@ -73,8 +313,25 @@ public:
 		glDeleteVertexArrays(1, &vao_);
 		glDeleteProgram(render_program_[kBookSample]);
 		glDeleteProgram(render_program_[kDistanceToCamera]);
+		glDeleteProgram(render_program_[kScreenSpaceError]);
+		glDeleteProgram(render_program_[kCdlod]);
+		glDeleteTextures(1, &texture_2d_patch_error_);
 		glDeleteTextures(1, &texture_2d_heightmap);
 		glDeleteTextures(1, &texture_2d_color);
+		glDeleteTextures(1, &texture_2d_normal_);
+		glDeleteProgram(normal_map_program_);
+		glDeleteBuffers(1, &patch_buffer_);
+		glDeleteBuffers(1, &patch_bounds_buffer_);
+		delete[] visible_patches_;
+		glDeleteQueries(kQueryRingSize, tcs_patch_queries_);
+		glDeleteQueries(kQueryRingSize, tes_invocation_queries_);
+		glDeleteQueries(kQueryRingSize, primitive_queries_);
+		glDeleteQueries(kQueryRingSize, time_queries_);
+		RemoveClipmap();
+		glDeleteProgram(procedural_program_);
+		RemoveTerrainCache();
+		RemoveEdgeLevels();
+		RemoveCdlod();
 	}
 
 public:
@@ -100,14 +357,14 @@ public:
 			if (action)
 			{
 				// Forward
-				MoveCamera(-0.15f);
+				MoveCamera(-0.15f * (terrain_mode_ == kClipmap ? kClipmapCameraSpeed : 1.0f));
 			}
 			break;
 		case GLFW_KEY_DOWN:
 			if (action)
 			{
 				// Backward
-				MoveCamera(0.15f);
+				MoveCamera(0.15f * (terrain_mode_ == kClipmap ? kClipmapCameraSpeed : 1.0f));
 			}
 			break;
 		case GLFW_KEY_H:
@@ -115,6 +372,7 @@ public:
 			{
 				// Add height step
 				max_height_ += height_step_;
+				terrain_height_field_.SetMaxHeight(max_height_);
 			}
 			else
 			{
@@ -134,6 +392,92 @@ public:
 				render_program_index_++;
 			}
 			break;
+		case GLFW_KEY_C:
+			if (action)
+			{
+				// Switch patch culling on / off (off draws every patch, as the book sample)
+				patch_culling_ = !patch_culling_;
+			}
+			break;
+		case GLFW_KEY_G:
+			if (action)
+			{
+				// Next terrain mode: fixed grid / clipmap / procedural
+				terrain_mode_ = (terrain_mode_ + 1) % kTerrainModeTotal;
+			}
+			break;
+		case GLFW_KEY_E:
+			if (action)
+			{
+				// Next target pixel error (screen-space error program)
+				pixel_error_index_ = (pixel_error_index_ + 1) % (sizeof(kPixelErrors) / sizeof(kPixelErrors[0]));
+				pixel_error_ = kPixelErrors[pixel_error_index_];
+			}
+			break;
+		case GLFW_KEY_M:
+			if (action)
+			{
+				// Measure triangles and image error of every program on next frame
+				compare_render_programs_ = true;
+			}
+			break;
+		case GLFW_KEY_P:
+			if (action)
+			{
+				// Measure GPU time and memory of the texture and procedural sources on next frame
+				compare_terrain_sources_ = true;
+			}
+			break;
+		case GLFW_KEY_F:
+			if (action)
+			{
+				// Switch the tessellation cache (transform feedback) on / off
+				terrain_cache_ = !terrain_cache_;
+				cache_state_ = kCacheStale;
+			}
+			break;
+		case GLFW_KEY_L:
+			if (action)
+			{
+				// Switch edge levels precomputed in a compute pass / computed in the tess control shader
+				precomputed_levels_ = !precomputed_levels_;
+			}
+			break;
+		case GLFW_KEY_B:
+			if (action)
+			{
+				// Measure GPU time of both edge level paths on next frame
+				benchmark_edge_levels_ = true;
+			}
+			break;
+		case GLFW_KEY_N:
+			if (action)
+			{
+				// Switch lighting (normal map) on / off
+				lighting_ = !lighting_;
+			}
+			break;
+		case GLFW_KEY_Q:
+			if (action)
+			{
+				// Measure CPU height queries and ray casts (height field) on next frame
+				benchmark_height_field_ = true;
+			}
+			break;
+		case GLFW_KEY_V:
+			if (action)
+			{
+				// Measure every program along a fixed camera path on next frame
+				benchmark_camera_path_ = true;
+			}
+			break;
+		case GLFW_KEY_T:
+			if (action)
+			{
+				// Switch frustum rejection in the tess control shader on / off (GPU only alternative to patch culling)
+				tcs_culling_ = !tcs_culling_;
+			}
+			break;
 		default:
 			break;
 		}
@@ -174,12 +518,2190 @@ private:
 
 #pragma region Object - Terrain
 
-	void InitializeObject()
-	{
-		glCreateVertexArrays(1, &vao_);
+	void InitializeObject()
+	{
+		glCreateVertexArrays(1, &vao_);
+
+		texture_2d_heightmap = sb7::ktx::file::load("C:/workspace/sb7tutorials/resources/media/textures/terragen1.ktx");
+		texture_2d_color = sb7::ktx::file::load("C:/workspace/sb7tutorials/resources/media/textures/terragen_color.ktx");
+
+		// CPU copy of the heightmap (normalized heights, as sampled by the TES)
+		glGetTextureLevelParameteriv(texture_2d_heightmap, 0, GL_TEXTURE_WIDTH, &heightmap_width_);
+		glGetTextureLevelParameteriv(texture_2d_heightmap, 0, GL_TEXTURE_HEIGHT, &heightmap_height_);
+		heightmap_.resize(heightmap_width_ * heightmap_height_);
+		glGetTextureImage(texture_2d_heightmap, 0, GL_RED, GL_FLOAT, (GLsizei)(sizeof(float) * heightmap_.size()), heightmap_.data());
+	}
+
+	/// <summary>
+	/// Normalized height at a texture coordinate, filtered as the TES samples it (bilinear, repeat)
+	/// </summary>
+	float SampleHeightmap(float s, float t) const
+	{
+		float u = s * heightmap_width_ - 0.5f;
+		float v = t * heightmap_height_ - 0.5f;
+		float u0 = floorf(u);
+		float v0 = floorf(v);
+		float fu = u - u0;
+		float fv = v - v0;
+
+		int x0 = (((int)u0 % heightmap_width_) + heightmap_width_) % heightmap_width_;
+		int y0 = (((int)v0 % heightmap_height_) + heightmap_height_) % heightmap_height_;
+		int x1 = (x0 + 1) % heightmap_width_;
+		int y1 = (y0 + 1) % heightmap_height_;
+
+		float h0 = heightmap_[y0 * heightmap_width_ + x0] * (1.0f - fu) + heightmap_[y0 * heightmap_width_ + x1] * fu;
+		float h1 = heightmap_[y1 * heightmap_width_ + x0] * (1.0f - fu) + heightmap_[y1 * heightmap_width_ + x1] * fu;
+		return h0 * (1.0f - fv) + h1 * fv;
+	}
+
+#pragma endregion
+
+#pragma region Normal map
+
+	void InitializeNormalMap()
+	{
+		// Height gradient per texel (see terrainnormalmap.h), full mip chain
+		GLsizei levels = 1;
+		while ((heightmap_width_ >> levels) > 0 || (heightmap_height_ >> levels) > 0)
+		{
+			levels++;
+		}
+		glCreateTextures(GL_TEXTURE_2D, 1, &texture_2d_normal_);
+		glTextureStorage2D(texture_2d_normal_, levels, GL_RG16F, heightmap_width_, heightmap_height_);
+		glTextureParameteri(texture_2d_normal_, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTextureParameteri(texture_2d_normal_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		// Compute shader
+		const char* compute_shader_source[] =
+		{
+			"#version 450 core																			\n"
+			"																							\n"
+			"layout (local_size_x = 16, local_size_y = 16) in;											\n"
+			"																							\n"
+			"layout (location = 0) uniform int level;  // Level written: 0 from the heightmap, otherwise from the previous level\n"
+			"layout (location = 1) uniform ivec4 region;  // Texels written (x, y, width, height) in the level; wraps around\n"
+			"layout (location = 2) uniform vec2 gradient_scale;  // Heightmap texels per world unit / 2 (X, Z)\n"
+			"																							\n"
+			"layout (binding = 0) uniform sampler2D tex_heightmap;										\n"
+			"																							\n"
+			"layout (binding = 0, rg16f) writeonly uniform image2D img_output;							\n"
+			"layout (binding = 1, rg16f) readonly uniform image2D img_finer;  // Level - 1				\n"
+			"																							\n"
+			"void main(void)																			\n"
+			"{																							\n"
+			"	if (any(greaterThanEqual(ivec2(gl_GlobalInvocationID.xy), region.zw)))					\n"
+			"	{																						\n"
+			"		return;																				\n"
+			"	}																						\n"
+			"																							\n"
+			"	ivec2 size = imageSize(img_output);														\n"
+			"	ivec2 texel = (region.xy + ivec2(gl_GlobalInvocationID.xy)) % size;						\n"
+			"																							\n"
+			"	vec2 gradient;																			\n"
+			"	if (level == 0)																			\n"
+			"	{																						\n"
+			"		// Central differences (the heightmap repeats), as the CPU reference (see TerrainGradient)\n"
+			"		float x0 = texelFetch(tex_heightmap, ivec2((texel.x + size.x - 1) % size.x, texel.y), 0).r;\n"
+			"		float x1 = texelFetch(tex_heightmap, ivec2((texel.x + 1) % size.x, texel.y), 0).r;	\n"
+			"		float y0 = texelFetch(tex_heightmap, ivec2(texel.x, (texel.y + size.y - 1) % size.y), 0).r;\n"
+			"		float y1 = texelFetch(tex_heightmap, ivec2(texel.x, (texel.y + 1) % size.y), 0).r;	\n"
+			"		gradient = vec2(x1 - x0, y1 - y0) * gradient_scale;									\n"
+			"	}																						\n"
+			"	else																					\n"
+			"	{																						\n"
+			"		// Average of the 2 x 2 finer texels (a 1 texel wide side repeats its texel)		\n"
+			"		ivec2 finer_max = imageSize(img_finer) - 1;											\n"
+			"		ivec2 finer = texel * 2;															\n"
+			"		gradient = (imageLoad(img_finer, min(finer, finer_max)).rg + imageLoad(img_finer, min(finer + ivec2(1, 0), finer_max)).rg +\n"
+			"					imageLoad(img_finer, min(finer + ivec2(0, 1), finer_max)).rg + imageLoad(img_finer, min(finer + ivec2(1, 1), finer_max)).rg) * 0.25;\n"
+			"	}																						\n"
+			"																							\n"
+			"	imageStore(img_output, texel, vec4(gradient, 0.0, 0.0));								\n"
+			"}																							\n"
+		};
+
+		GLuint compute_shader = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(compute_shader, 1, compute_shader_source, NULL);
+		glCompileShader(compute_shader);
+
+		// Program
+		normal_map_program_ = glCreateProgram();
+		glAttachShader(normal_map_program_, compute_shader);
+		glLinkProgram(normal_map_program_);
+
+		// Free resources
+		glDeleteShader(compute_shader);
+
+		// Whole map, once at load
+		GLuint query;
+		glCreateQueries(GL_TIME_ELAPSED, 1, &query);
+		glBeginQuery(GL_TIME_ELAPSED, query);
+		UpdateNormalMap(0, 0, heightmap_width_, heightmap_height_);
+		glEndQuery(GL_TIME_ELAPSED);
+
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+		glDeleteQueries(1, &query);
+
+		ValidateNormalMap(nanoseconds / 1.0e6);
+	}
+
+	/// <summary>
+	/// Regenerate the normal map where heights changed (heightmap texels; the rectangle may wrap around), and the texels of every mip level over it
+	/// </summary>
+	void UpdateNormalMap(int x, int y, int width, int height)
+	{
+		glUseProgram(normal_map_program_);
+		glBindTextureUnit(0, texture_2d_heightmap);
+		glUniform2f(2, heightmap_width_ / 128.0f, heightmap_height_ / 128.0f);  // The heightmap spans the 64 world units of the grid
+
+		// Gradients of the neighbour texels depend on the changed heights too
+		x -= 1;
+		y -= 1;
+		width += 2;
+		height += 2;
+
+		GLint level_width = heightmap_width_;
+		GLint level_height = heightmap_height_;
+		for (GLint level = 0; level_width > 0 || level_height > 0; level++)
+		{
+			level_width = level_width > 0 ? level_width : 1;
+			level_height = level_height > 0 ? level_height : 1;
+			width = width < level_width ? width : level_width;
+			height = height < level_height ? height : level_height;
+			x = (x % level_width + level_width) % level_width;  // Non-negative (the shader wraps with %)
+			y = (y % level_height + level_height) % level_height;
+
+			glUniform1i(0, level);
+			glUniform4i(1, x, y, width, height);
+			glBindImageTexture(0, texture_2d_normal_, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16F);
+			if (level > 0)
+			{
+				glBindImageTexture(1, texture_2d_normal_, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_RG16F);
+			}
+			glDispatchCompute((width + 15) / 16, (height + 15) / 16, 1);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+			// Coarser texels covering the rectangle (arithmetic shift rounds negative coordinates down too)
+			int x_end = (x + width - 1) >> 1;
+			int y_end = (y + height - 1) >> 1;
+			x >>= 1;
+			y >>= 1;
+			width = x_end - x + 1;
+			height = y_end - y + 1;
+			level_width >>= 1;
+			level_height >>= 1;
+		}
+
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+
+	/// <summary>
+	/// Compare every level of the normal map with the CPU reference (see terrainnormalmap.h), and print error and generation times to Output (on Debug mode)
+	/// </summary>
+	void ValidateNormalMap(double gpu_milliseconds)
+	{
+		float scale_x = heightmap_width_ / 128.0f;
+		float scale_z = heightmap_height_ / 128.0f;
+
+		// CPU reference: scalar and SSE level 0 (identical results), SSE mip chain
+		std::vector<float> scalar(2 * heightmap_width_ * heightmap_height_);
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		TerrainGradientsScalar(heightmap_.data(), heightmap_width_, heightmap_height_, scale_x, scale_z, scalar.data());
+		double scalar_milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		start = std::chrono::high_resolution_clock::now();
+		std::vector<std::vector<float>> reference = TerrainNormalMapSse(heightmap_.data(), heightmap_width_, heightmap_height_, scale_x, scale_z);
+		double sse_milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		GLuint mismatches = 0;
+		for (size_t i = 0; i < scalar.size(); i++)
+		{
+			mismatches += scalar[i] != reference[0][i] ? 1 : 0;
+		}
+
+		char output[256];
+		sprintf_s(output, sizeof(output), "Terrain normal map: %d x %d, %u levels; GPU %.3f ms; CPU scalar level 0 %.3f ms, SSE all levels %.3f ms (%u scalar / SSE mismatches).\n",
+			heightmap_width_, heightmap_height_, (GLuint)reference.size(), gpu_milliseconds, scalar_milliseconds, sse_milliseconds, mismatches);
+		OutputDebugStringA(output);
+
+		// GPU levels (half floats) against the reference: error relative to the steepest gradient
+		float max_gradient = 0.0f;
+		for (float g : reference[0])
+		{
+			max_gradient = fabsf(g) > max_gradient ? fabsf(g) : max_gradient;
+		}
+
+		for (size_t level = 0; level < reference.size(); level++)
+		{
+			std::vector<float> texels(reference[level].size());
+			glGetTextureImage(texture_2d_normal_, (GLint)level, GL_RG, GL_FLOAT, (GLsizei)(sizeof(float) * texels.size()), texels.data());
+
+			float max_error = 0.0f;
+			for (size_t i = 0; i < texels.size(); i++)
+			{
+				float error = fabsf(texels[i] - reference[level][i]);
+				max_error = error > max_error ? error : max_error;
+			}
+
+			sprintf_s(output, sizeof(output), "Terrain normal map: level %u: max error %.2e (%.3f%% of the steepest gradient).\n",
+				(GLuint)level, max_error, max_gradient > 0.0f ? 100.0f * max_error / max_gradient : 0.0f);
+			OutputDebugStringA(output);
+		}
+	}
+
+#pragma endregion
+
+#pragma region Height field
+
+	void InitializeHeightField()
+	{
+		// Same layout as the vertex shader grid: kGridSide world units centered on the origin
+		if (!terrain_height_field_.Build(heightmap_.data(), heightmap_width_, heightmap_height_, (float)kGridSide))
+		{
+			char output[256];
+			sprintf_s(output, sizeof(output), "Terrain height field: %d x %d heightmap is not power of two, no CPU height queries.\n", heightmap_width_, heightmap_height_);
+			OutputDebugStringA(output);
+		}
+
+		terrain_height_field_.SetMaxHeight(max_height_);
+	}
+
+	/// <summary>
+	/// Time batch height queries with every kernel and ray casts through the min/max pyramid (validated against ray marching), and print them to Output (on Debug mode)
+	/// </summary>
+	void BenchmarkHeightField()
+	{
+		if (terrain_height_field_.LevelTotal() == 0)
+		{
+			return;
+		}
+
+		char output[256];
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> position(-0.75f * kGridSide, 0.75f * kGridSide);  // Grid and its repeats around
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		// Height queries: same positions for every kernel
+		std::vector<float> x(kHeightQueryTotal);
+		std::vector<float> z(kHeightQueryTotal);
+		for (GLuint i = 0; i < kHeightQueryTotal; i++)
+		{
+			x[i] = position(random);
+			z[i] = position(random);
+		}
+
+		static const char* kKernelNames[kTerrainHeightKernelTotal] = { "scalar", "SSE4.1", "AVX2" };
+		std::vector<float> reference(kHeightQueryTotal);
+		std::vector<float> heights(kHeightQueryTotal);
+		for (int kernel = kTerrainHeightScalar; kernel <= TerrainHeightField::BestKernel(); kernel++)
+		{
+			std::vector<float>& kernel_heights = kernel == kTerrainHeightScalar ? reference : heights;
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			terrain_height_field_.Heights(x.data(), z.data(), kernel_heights.data(), kHeightQueryTotal, (TerrainHeightKernel)kernel);
+			double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+			float max_difference = 0.0f;
+			for (GLuint i = 0; i < kHeightQueryTotal; i++)
+			{
+				float difference = fabsf(kernel_heights[i] - reference[i]);
+				max_difference = difference > max_difference ? difference : max_difference;
+			}
+
+			sprintf_s(output, sizeof(output), "Terrain height field: %u height queries, %s: %.3f ms (%.1f M queries/s); max difference to scalar %.2e.\n",
+				kHeightQueryTotal, kKernelNames[kernel], milliseconds, kHeightQueryTotal / (milliseconds * 1000.0), max_difference);
+			OutputDebugStringA(output);
+		}
+
+		// Ray casts: from above the terrain, looking down at random angles
+		float max_distance = 2.0f * kGridSide;
+		std::vector<vmath::vec3> origins(kRayTotal);
+		std::vector<vmath::vec3> directions(kRayTotal);
+		for (GLuint i = 0; i < kRayTotal; i++)
+		{
+			origins[i] = vmath::vec3(position(random), fabsf(max_height_) * (1.2f + unit(random)), position(random));
+			directions[i] = vmath::normalize(vmath::vec3(unit(random) * 2.0f - 1.0f, -unit(random), unit(random) * 2.0f - 1.0f));
+		}
+
+		std::vector<TerrainRayHit> hits(kRayTotal);
+		std::vector<char> hit(kRayTotal);
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (GLuint i = 0; i < kRayTotal; i++)
+		{
+			hit[i] = terrain_height_field_.Raycast(origins[i], directions[i], max_distance, &hits[i]);
+		}
+		double pyramid_milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		// Reference on the first rays: a hit before the marched one is right too if it lies on the surface (marching steps over grazing hits)
+		GLuint mismatches = 0;
+		start = std::chrono::high_resolution_clock::now();
+		for (GLuint i = 0; i < kValidatedRayTotal; i++)
+		{
+			TerrainRayHit marched;
+			bool marched_hit = terrain_height_field_.RaycastMarching(origins[i], directions[i], max_distance, &marched);
+			bool same = (hit[i] != 0) == marched_hit && (!hit[i] || fabsf(hits[i].t - marched.t) < 1.0e-3f);
+			bool grazing = hit[i] && (!marched_hit || hits[i].t < marched.t) &&
+				fabsf(hits[i].position[1] - terrain_height_field_.Height(hits[i].position[0], hits[i].position[2])) < 1.0e-3f;
+			mismatches += same || grazing ? 0 : 1;
+		}
+		double marching_milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		GLuint hit_total = 0;
+		for (GLuint i = 0; i < kRayTotal; i++)
+		{
+			hit_total += hit[i] ? 1 : 0;
+		}
+
+		sprintf_s(output, sizeof(output), "Terrain height field: %u ray casts (%u hits), min/max pyramid (%d levels): %.3f ms (%.2f M rays/s); marching %.2f M rays/s, %u / %u mismatches.\n",
+			kRayTotal, hit_total, terrain_height_field_.LevelTotal(), pyramid_milliseconds, kRayTotal / (pyramid_milliseconds * 1000.0),
+			kValidatedRayTotal / (marching_milliseconds * 1000.0), mismatches, kValidatedRayTotal);
+		OutputDebugStringA(output);
+	}
+
+#pragma endregion
+
+#pragma region Patch culling
+
+	void InitializePatchCulling()
+	{
+		// Min/max height quadtree from the heightmap
+		terrain_quadtree_.Build(heightmap_.data(), heightmap_width_, heightmap_height_, kGridSide);
+
+		// Patch height bounds, for frustum rejection in the tess control shader (read by the vertex shader)
+		vmath::vec2* patch_bounds = new vmath::vec2[kPatchTotal];
+		for (int i = 0; i < kPatchTotal; i++)
+		{
+			patch_bounds[i] = terrain_quadtree_.PatchBounds(i % kGridSide, i / kGridSide);
+		}
+		glCreateBuffers(1, &patch_bounds_buffer_);
+		glNamedBufferStorage(patch_bounds_buffer_, sizeof(vmath::vec2) * kPatchTotal, patch_bounds, 0);
+		delete[] patch_bounds;
+
+		// Pipeline statistics queries (patches reaching the TCS, TES invocations): a ring, so results are read some frames later without stalling
+		glCreateQueries(GL_TESS_CONTROL_SHADER_PATCHES_ARB, kQueryRingSize, tcs_patch_queries_);
+		glCreateQueries(GL_TESS_EVALUATION_SHADER_INVOCATIONS_ARB, kQueryRingSize, tes_invocation_queries_);
+		glCreateQueries(GL_PRIMITIVES_GENERATED, kQueryRingSize, primitive_queries_);
+		glCreateQueries(GL_TIME_ELAPSED, kQueryRingSize, time_queries_);
+
+		// Visible patch indices: one per instance (see vertex shader)
+		visible_patches_ = new GLuint[kPatchTotal];
+		glCreateBuffers(1, &patch_buffer_);
+		glNamedBufferStorage(patch_buffer_, sizeof(GLuint) * kPatchTotal, NULL, GL_DYNAMIC_STORAGE_BIT);
+
+		glVertexArrayVertexBuffer(vao_, 0, patch_buffer_, 0, sizeof(GLuint));
+		glVertexArrayBindingDivisor(vao_, 0, 1);
+		glVertexArrayAttribIFormat(vao_, 0, 1, GL_INT, 0);
+		glVertexArrayAttribBinding(vao_, 0, 0);
+		glEnableVertexArrayAttrib(vao_, 0);
+	}
+
+	/// <summary>
+	/// Walk the quadtree against the view frustum and upload the visible patch indices; returns their number
+	/// </summary>
+	GLuint CullPatches()
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+		GLuint visible_patch_count;
+		if (patch_culling_)
+		{
+			// Model matrix is the identity: frustum planes in world space
+			vmath::vec4 planes[6];
+			ExtractFrustumPlanes(camera_projection_matrix_ * camera_view_matrix_, planes);
+			visible_patch_count = terrain_quadtree_.Cull(planes, max_height_, 1.0f, vmath::vec2(-32.0f), visible_patches_, &cull_stats_);
+		}
+		else
+		{
+			visible_patch_count = terrain_quadtree_.All(visible_patches_, &cull_stats_);
+		}
+
+		if (visible_patch_count > 0)
+		{
+			glNamedBufferSubData(patch_buffer_, 0, sizeof(GLuint) * visible_patch_count, visible_patches_);
+		}
+
+		cull_time_ = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		return visible_patch_count;
+	}
+
+	void BeginTessellationQueries()
+	{
+		GLuint slot = query_frame_ % kQueryRingSize;
+		glBeginQuery(GL_TESS_CONTROL_SHADER_PATCHES_ARB, tcs_patch_queries_[slot]);
+		glBeginQuery(GL_TESS_EVALUATION_SHADER_INVOCATIONS_ARB, tes_invocation_queries_[slot]);
+		glBeginQuery(GL_PRIMITIVES_GENERATED, primitive_queries_[slot]);
+		glBeginQuery(GL_TIME_ELAPSED, time_queries_[slot]);
+	}
+
+	void EndTessellationQueries()
+	{
+		glEndQuery(GL_TESS_CONTROL_SHADER_PATCHES_ARB);
+		glEndQuery(GL_TESS_EVALUATION_SHADER_INVOCATIONS_ARB);
+		glEndQuery(GL_PRIMITIVES_GENERATED);
+		glEndQuery(GL_TIME_ELAPSED);
+		query_frame_++;
+
+		// Oldest query of the ring (issued kQueryRingSize - 1 frames ago), if its result is already available
+		if (query_frame_ >= kQueryRingSize)
+		{
+			GLuint slot = query_frame_ % kQueryRingSize;
+			GLint available = 0;
+			glGetQueryObjectiv(time_queries_[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available)
+			{
+				glGetQueryObjectui64v(tcs_patch_queries_[slot], GL_QUERY_RESULT, &tcs_patches_);
+				glGetQueryObjectui64v(tes_invocation_queries_[slot], GL_QUERY_RESULT, &tes_invocations_);
+				glGetQueryObjectui64v(primitive_queries_[slot], GL_QUERY_RESULT, &triangles_);
+
+				GLuint64 nanoseconds = 0;
+				glGetQueryObjectui64v(time_queries_[slot], GL_QUERY_RESULT, &nanoseconds);
+				gpu_time_ = nanoseconds / 1.0e6;
+			}
+		}
+	}
+
+	void ExtractFrustumPlanes(const vmath::mat4& vp_matrix, vmath::vec4 planes[6])
+	{
+		// Note: vmath matrices are column-major, so row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+		vmath::vec4 rows[4];
+		for (int i = 0; i < 4; i++)
+		{
+			rows[i] = vmath::vec4(vp_matrix[0][i], vp_matrix[1][i], vp_matrix[2][i], vp_matrix[3][i]);
+		}
+
+		// Left, right, bottom, top, near and far; normals point inwards
+		planes[0] = rows[3] + rows[0];
+		planes[1] = rows[3] - rows[0];
+		planes[2] = rows[3] + rows[1];
+		planes[3] = rows[3] - rows[1];
+		planes[4] = rows[3] + rows[2];
+		planes[5] = rows[3] - rows[2];
+
+		for (int i = 0; i < 6; i++)
+		{
+			float length = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+			planes[i] = planes[i] / length;
+		}
+	}
+
+	/// <summary>
+	/// Print visible patch count (and culling cost) to Output (on Debug mode), once per report period
+	/// </summary>
+	void ReportPatchCulling(double current_time)
+	{
+		if (current_time - last_report_time_ < kReportPeriod)
+		{
+			return;
+		}
+		last_report_time_ = current_time;
+
+		char output[256];
+		if (render_program_index_ % kRenderProgramTotal == kCdlod)
+		{
+			sprintf_s(output, sizeof(output), "Terrain CDLOD (culling %s): %u nodes, %u quarter nodes; %u quadtree nodes visited in %.3f ms; %llu triangles; %.3f ms GPU.\n",
+				patch_culling_ ? "on" : "off", cdlod_stats_.nodes, cdlod_stats_.quarter_nodes, cdlod_stats_.visited_nodes, cdlod_time_,
+				(unsigned long long)triangles_, gpu_time_);
+			OutputDebugStringA(output);
+			return;
+		}
+
+		sprintf_s(output, sizeof(output), "Terrain patches (culling %s): %u / %u visible (%.1f%%); %u quadtree nodes visited in %.3f ms.\n",
+			patch_culling_ ? "on" : "off", cull_stats_.visible_patches, (GLuint)kPatchTotal, 100.0 * cull_stats_.visible_patches / kPatchTotal,
+			cull_stats_.visited_nodes, cull_time_);
+		OutputDebugStringA(output);
+
+		sprintf_s(output, sizeof(output), "Terrain tessellation (%s, TCS culling %s): %llu patches reached the TCS; %llu TES invocations; %llu triangles; %.3f ms GPU.\n",
+			kRenderProgramNames[render_program_index_ % kRenderProgramTotal], tcs_culling_ ? "on" : "off",
+			(unsigned long long)tcs_patches_, (unsigned long long)tes_invocations_, (unsigned long long)triangles_, gpu_time_);
+		OutputDebugStringA(output);
+
+		if (terrain_cache_)
+		{
+			const char* kCacheStateNames[] = { "stale", "capturing", "pending", "drawing captured triangles", "over budget" };
+			sprintf_s(output, sizeof(output), "Terrain cache: %s; %llu triangles captured (%.1f / %.1f MB).\n",
+				kCacheStateNames[cache_state_], (unsigned long long)cache_triangles_,
+				cache_triangles_ * 3.0 * kCacheVertexSize / 1048576.0, cache_capacity_ * 3.0 * kCacheVertexSize / 1048576.0);
+			OutputDebugStringA(output);
+		}
+	}
+
+#pragma endregion
+
+#pragma region Clipmap
+
+	void InitializeClipmap()
+	{
+		// World: 16 x 16 tiles of 256 x 256 texels (mips down to 16 x 16, one per clipmap level), baked once from the heightmap
+		// Base heightmap is mirrored (no seams), one base texel per level 0 texel, under a low frequency relief so hills do not repeat as they are
+		std::vector<float> base = heightmap_;
+		int width = heightmap_width_;
+		int height = heightmap_height_;
+		auto world_height = [base, width, height](int x, int z) -> float
+		{
+			int period_x = 2 * width;
+			int period_z = 2 * height;
+			int u = ((x % period_x) + period_x) % period_x;
+			int v = ((z % period_z) + period_z) % period_z;
+			u = u < width ? u : period_x - 1 - u;
+			v = v < height ? v : period_z - 1 - v;
+
+			float wx = x * kClipmapTexelSize;
+			float wz = z * kClipmapTexelSize;
+			float relief = 0.5f + 0.3f * sinf(wx * 0.021f) * cosf(wz * 0.017f) + 0.2f * sinf((wx + wz) * 0.008f);
+			return base[v * width + u] * (0.3f + 0.9f * relief);
+		};
+		terrain_pager_.Open("C:/workspace/sb7tutorials/resources/media/textures/terragen_world.bin", 256, 16, 16, kClipmapLevelTotal, world_height, kClipmapCacheBudget);
+		terrain_clipmap_.Initialize(&terrain_pager_);
+
+		// Patches of every level (instanced attribute), rebuilt every frame around the camera
+		clipmap_patches_ = new GLuint[kClipmapLevelTotal * kClipmapGridSide * kClipmapGridSide];
+		glCreateBuffers(1, &clipmap_patch_buffer_);
+		glNamedBufferStorage(clipmap_patch_buffer_, sizeof(GLuint) * kClipmapLevelTotal * kClipmapGridSide * kClipmapGridSide, NULL, GL_DYNAMIC_STORAGE_BIT);
+
+		glCreateVertexArrays(1, &clipmap_vao_);
+		glVertexArrayVertexBuffer(clipmap_vao_, 0, clipmap_patch_buffer_, 0, sizeof(GLuint));
+		glVertexArrayBindingDivisor(clipmap_vao_, 0, 1);
+		glVertexArrayAttribIFormat(clipmap_vao_, 0, 1, GL_INT, 0);
+		glVertexArrayAttribBinding(clipmap_vao_, 0, 0);
+		glEnableVertexArrayAttrib(clipmap_vao_, 0);
+
+		// Clipmap constants, shared by every stage
+		char defines[256];
+		sprintf_s(defines, sizeof(defines), "#version 450 core\n#define LEVEL_TOTAL %d\n#define GRID_SIDE %d\n#define PATCH_TEXELS %d\n#define TEXTURE_SIDE %d\n#define TEXEL_SIZE %f\n",
+			kClipmapLevelTotal, kClipmapGridSide, kClipmapPatchTexels, kClipmapTextureSide, kClipmapTexelSize);
+
+		// Vertex shader
+		const char* vertex_shader_source[] =
+		{
+			defines,
+			"out VERTEX_DATA																			\n"
+			"{																							\n"
+			"	vec2 texel;  // Level texel coordinates													\n"
+			"	float level;																			\n"
+			"} out_vdata;																				\n"
+			"																							\n"
+			"// Patch within the grid of its level: level << 16 | z << 8 | x (see BuildClipmapPatches)	\n"
+			"layout (location = 0) in int patch_code;													\n"
+			"																							\n"
+			"layout (location = 3) uniform ivec2 level_centers[LEVEL_TOTAL];  // Level texels			\n"
+			"																							\n"
+			"void main(void)																			\n"
+			"{																							\n"
+			"	// Same corners (and order) as the fixed grid patches									\n"
+			"	const vec2 corners[4] = vec2[4](vec2(0.0, 1.0), vec2(1.0, 1.0), vec2(0.0, 0.0), vec2(1.0, 0.0));\n"
+			"																							\n"
+			"	int level = patch_code >> 16;															\n"
+			"	ivec2 patch_coord = ivec2(patch_code & 0xFF, (patch_code >> 8) & 0xFF);					\n"
+			"																							\n"
+			"	// Grid of the level starts half of it before the level center							\n"
+			"	vec2 texel = vec2(level_centers[level] + (patch_coord - GRID_SIDE / 2) * PATCH_TEXELS) + corners[gl_VertexID] * float(PATCH_TEXELS);\n"
+			"	out_vdata.texel = texel;																\n"
+			"	out_vdata.level = float(level);															\n"
+			"																							\n"
+			"	vec2 world = texel * TEXEL_SIZE * float(1 << level);									\n"
+			"	gl_Position = vec4(world.x, 0.0, world.y, 1.0);											\n"
+			"}																							\n"
+		};
+
+		GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(vertex_shader, 2, vertex_shader_source, NULL);
+		glCompileShader(vertex_shader);
+
+		// Tess control shader
+		const char* tess_control_shader_source[] =
+		{
+			defines,
+			"layout (location = 3) uniform ivec2 level_centers[LEVEL_TOTAL];  // Level texels			\n"
+			"																							\n"
+			"in VERTEX_DATA																				\n"
+			"{																							\n"
+			"	vec2 texel;																				\n"
+			"	float level;																			\n"
+			"} in_vdata[];																				\n"
+			"																							\n"
+			"out VERTEX_DATA																			\n"
+			"{																							\n"
+			"	vec2 texel;																				\n"
+			"	float level;																			\n"
+			"} out_vdata[];																				\n"
+			"																							\n"
+			"layout (vertices = 4) out;																	\n"
+			"																							\n"
+			"// Outer level of the edge between vertices a and b: one segment per texel, or two where the edge lies\n"
+			"// on the hole of the level (two finer patches on the other side), so vertices on both sides match\n"
+			"float edgeLevel(int a, int b)																\n"
+			"{																							\n"
+			"	int level = int(in_vdata[0].level);														\n"
+			"	if (level > 0)																			\n"
+			"	{																						\n"
+			"		// Hole: window of the finer level, in texels of this level							\n"
+			"		vec2 middle = mix(in_vdata[a].texel, in_vdata[b].texel, 0.5);						\n"
+			"		vec2 d = abs(middle - vec2(level_centers[level - 1]) * 0.5);						\n"
+			"		float half_side = float(GRID_SIDE * PATCH_TEXELS) * 0.25;							\n"
+			"		if ((abs(d.x - half_side) < 0.01 && d.y < half_side) || (abs(d.y - half_side) < 0.01 && d.x < half_side))\n"
+			"		{																					\n"
+			"			return float(2 * PATCH_TEXELS);													\n"
+			"		}																					\n"
+			"	}																						\n"
+			"																							\n"
+			"	return float(PATCH_TEXELS);																\n"
+			"}																							\n"
+			"																							\n"
+			"void main(void)																			\n"
+			"{																							\n"
+			"	if (gl_InvocationID == 0)																\n"
+			"	{																						\n"
+			"		gl_TessLevelOuter[0] = edgeLevel(0, 2);												\n"
+			"		gl_TessLevelOuter[1] = edgeLevel(1, 0);												\n"
+			"		gl_TessLevelOuter[2] = edgeLevel(3, 1);												\n"
+			"		gl_TessLevelOuter[3] = edgeLevel(2, 3);												\n"
+			"		gl_TessLevelInner[0] = float(PATCH_TEXELS);											\n"
+			"		gl_TessLevelInner[1] = float(PATCH_TEXELS);											\n"
+			"	}																						\n"
+			"																							\n"
+			"	out_vdata[gl_InvocationID].texel = in_vdata[gl_InvocationID].texel;						\n"
+			"	out_vdata[gl_InvocationID].level = in_vdata[gl_InvocationID].level;						\n"
+			"	gl_out[gl_InvocationID].gl_Position = gl_in[gl_InvocationID].gl_Position;				\n"
+			"}																							\n"
+		};
+
+		GLuint tess_control_shader = glCreateShader(GL_TESS_CONTROL_SHADER);
+		glShaderSource(tess_control_shader, 2, tess_control_shader_source, NULL);
+		glCompileShader(tess_control_shader);
+
+		// Tess evaluation shader
+		const char* tess_evaluation_shader_source[] =
+		{
+			defines,
+			"layout (location = 0) uniform mat4 mv_matrix;												\n"
+			"layout (location = 1) uniform mat4 p_matrix;												\n"
+			"layout (location = 2) uniform float max_height;											\n"
+			"layout (location = 3) uniform ivec2 level_centers[LEVEL_TOTAL];  // Level texels			\n"
+			"																							\n"
+			"// One layer per level, updated toroidally (see TerrainClipmap)							\n"
+			"layout (binding = 3) uniform sampler2DArray tex_clipmap;									\n"
+			"																							\n"
+			"// Equal spacing: vertices of an edge split in 2 * PATCH_TEXELS segments match the ones of two finer patches\n"
+			"layout (quads, equal_spacing) in;															\n"
+			"																							\n"
+			"in VERTEX_DATA																				\n"
+			"{																							\n"
+			"	vec2 texel;																				\n"
+			"	float level;																			\n"
+			"} in_vdata[];																				\n"
+			"																							\n"
+			"out VERTEX_DATA																			\n"
+			"{																							\n"
+			"	float height;  // Normalized															\n"
+			"} out_vdata;																				\n"
+			"																							\n"
+			"float levelHeight(vec2 texel, int level)													\n"
+			"{																							\n"
+			"	return texture(tex_clipmap, vec3(texel / float(TEXTURE_SIDE), float(level))).r;			\n"
+			"}																							\n"
+			"																							\n"
+			"void main(void)																			\n"
+			"{																							\n"
+			"	vec2 texel1 = mix(in_vdata[0].texel, in_vdata[1].texel, gl_TessCoord.x);				\n"
+			"	vec2 texel2 = mix(in_vdata[2].texel, in_vdata[3].texel, gl_TessCoord.x);				\n"
+			"	vec2 texel = mix(texel1, texel2, gl_TessCoord.y);										\n"
+			"	int level = int(in_vdata[0].level);														\n"
+			"																							\n"
+			"	// Blend towards the next coarser level in the outer band of the window: at the window edge\n"
+			"	// heights are the coarser ones, as the ones of the coarser patches on the other side	\n"
+			"	float height = levelHeight(texel, level);												\n"
+			"	if (level < LEVEL_TOTAL - 1)															\n"
+			"	{																						\n"
+			"		vec2 d = abs(texel - vec2(level_centers[level]));									\n"
+			"		float half_side = float(GRID_SIDE * PATCH_TEXELS) * 0.5;							\n"
+			"		float band = float(2 * PATCH_TEXELS);												\n"
+			"		float alpha = clamp((max(d.x, d.y) - (half_side - band)) / band, 0.0, 1.0);			\n"
+			"		height = mix(height, levelHeight(texel * 0.5, level + 1), alpha);					\n"
+			"	}																						\n"
+			"																							\n"
+			"	vec4 p1 = mix(gl_in[0].gl_Position, gl_in[1].gl_Position, gl_TessCoord.x);				\n"
+			"	vec4 p2 = mix(gl_in[2].gl_Position, gl_in[3].gl_Position, gl_TessCoord.x);				\n"
+			"	vec4 p = mix(p1, p2, gl_TessCoord.y);													\n"
+			"	p.y = height * max_height;																\n"
+			"																							\n"
+			"	gl_Position = p_matrix * mv_matrix * p;													\n"
+			"	out_vdata.height = height;																\n"
+			"}																							\n"
+		};
+
+		GLuint tess_evaluation_shader = glCreateShader(GL_TESS_EVALUATION_SHADER);
+		glShaderSource(tess_evaluation_shader, 2, tess_evaluation_shader_source, NULL);
+		glCompileShader(tess_evaluation_shader);
+
+		// Fragment shader
+		const char* fragment_shader_source[] =
+		{
+			"#version 450 core																			\n"
+			"																							\n"
+			"in VERTEX_DATA																				\n"
+			"{																							\n"
+			"	float height;																			\n"
+			"} in_vdata;																				\n"
+			"																							\n"
+			"layout (location = 0) out vec4 color;														\n"
+			"																							\n"
+			"void main(void)																			\n"
+			"{																							\n"
+			"	// No color map covers the streamed world: grass, rock and snow by height				\n"
+			"	vec3 grass = vec3(0.22, 0.42, 0.15);													\n"
+			"	vec3 rock = vec3(0.45, 0.39, 0.31);														\n"
+			"	vec3 snow = vec3(0.92, 0.93, 0.95);														\n"
+			"	color = vec4(mix(mix(grass, rock, smoothstep(0.35, 0.6, in_vdata.height)), snow, smoothstep(0.75, 0.85, in_vdata.height)), 1.0);\n"
+			"}																							\n"
+		};
+
+		GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(fragment_shader, 1, fragment_shader_source, NULL);
+		glCompileShader(fragment_shader);
+
+		// Program
+		clipmap_program_ = glCreateProgram();
+		glAttachShader(clipmap_program_, vertex_shader);
+		glAttachShader(clipmap_program_, tess_control_shader);
+		glAttachShader(clipmap_program_, tess_evaluation_shader);
+		glAttachShader(clipmap_program_, fragment_shader);
+		glLinkProgram(clipmap_program_);
+
+		// Free resources
+		glDeleteShader(vertex_shader);
+		glDeleteShader(tess_control_shader);
+		glDeleteShader(tess_evaluation_shader);
+		glDeleteShader(fragment_shader);
+	}
+
+	void RenderClipmap(double current_time)
+	{
+		// Follow the camera; nothing to draw until the first windows are resident
+		if (!terrain_clipmap_.Update(camera_position_[0], camera_position_[2]))
+		{
+			return;
+		}
+
+		GLuint patch_count = BuildClipmapPatches();
+
+		glUseProgram(clipmap_program_);
+		glBindVertexArray(clipmap_vao_);
+
+		GLint centers[kClipmapLevelTotal * 2];
+		for (int level = 0; level < kClipmapLevelTotal; level++)
+		{
+			centers[level * 2] = terrain_clipmap_.Center(level)[0];
+			centers[level * 2 + 1] = terrain_clipmap_.Center(level)[1];
+		}
+
+		glUniformMatrix4fv(0, 1, GL_FALSE, camera_view_matrix_);
+		glUniformMatrix4fv(1, 1, GL_FALSE, camera_projection_matrix_);
+		glUniform1f(2, max_height_);
+		glUniform2iv(3, kClipmapLevelTotal, centers);
+		glBindTextureUnit(3, terrain_clipmap_.Texture());
+
+		glPatchParameteri(GL_PATCH_VERTICES, kPatchSize);
+
+		BeginTessellationQueries();
+		glDrawArraysInstanced(GL_PATCHES, 0, kPatchSize, patch_count);
+		EndTessellationQueries();
+
+		if (current_time - last_report_time_ >= kReportPeriod)
+		{
+			last_report_time_ = current_time;
+
+			char output[256];
+			sprintf_s(output, sizeof(output), "Terrain clipmap: %u / %u patches drawn (%d levels); %llu triangles; %u texels uploaded so far.\n",
+				patch_count, (GLuint)(kClipmapGridSide * kClipmapGridSide + (kClipmapLevelTotal - 1) * kClipmapGridSide * kClipmapGridSide * 3 / 4),
+				kClipmapLevelTotal, (unsigned long long)triangles_, terrain_clipmap_.UploadedTexels());
+			OutputDebugStringA(output);
+
+			sprintf_s(output, sizeof(output), "Terrain pager: %llu tiles loaded (%llu failed reads); %u pending; cache %.1f / %.1f MB.\n",
+				(unsigned long long)terrain_pager_.LoadedTiles(), (unsigned long long)terrain_pager_.FailedReads(), (GLuint)terrain_pager_.PendingTiles(),
+				terrain_pager_.CacheBytes() / 1048576.0, kClipmapCacheBudget / 1048576.0);
+			OutputDebugStringA(output);
+		}
+	}
+
+	/// <summary>
+	/// List the patches of every level around the committed centers (the finer level window is skipped) that are inside the view frustum; returns their number
+	/// </summary>
+	GLuint BuildClipmapPatches()
+	{
+		vmath::vec4 planes[6];
+		ExtractFrustumPlanes(camera_projection_matrix_ * camera_view_matrix_, planes);
+		float y0 = max_height_ < 0.0f ? max_height_ : 0.0f;
+		float y1 = max_height_ < 0.0f ? 0.0f : max_height_;
+
+		GLuint count = 0;
+		for (int level = 0; level < kClipmapLevelTotal; level++)
+		{
+			const int* center = terrain_clipmap_.Center(level);
+			float texel_size = kClipmapTexelSize * (float)(1 << level);
+
+			// Hole: window of the finer level (level texels)
+			int hole[4] = { 0, 0, 0, 0 };
+			if (level > 0)
+			{
+				const int* finer_center = terrain_clipmap_.Center(level - 1);
+				int half = kClipmapGridSide * kClipmapPatchTexels / 4;
+				hole[0] = finer_center[0] / 2 - half;
+				hole[1] = finer_center[1] / 2 - half;
+				hole[2] = finer_center[0] / 2 + half;
+				hole[3] = finer_center[1] / 2 + half;
+			}
+
+			for (int z = 0; z < kClipmapGridSide; z++)
+			{
+				for (int x = 0; x < kClipmapGridSide; x++)
+				{
+					int texel_x = center[0] + (x - kClipmapGridSide / 2) * kClipmapPatchTexels;
+					int texel_z = center[1] + (z - kClipmapGridSide / 2) * kClipmapPatchTexels;
+					if (level > 0 && texel_x >= hole[0] && texel_x + kClipmapPatchTexels <= hole[2] && texel_z >= hole[1] && texel_z + kClipmapPatchTexels <= hole[3])
+					{
+						continue;
+					}
+
+					vmath::vec3 box_min(texel_x * texel_size, y0, texel_z * texel_size);
+					vmath::vec3 box_max((texel_x + kClipmapPatchTexels) * texel_size, y1, (texel_z + kClipmapPatchTexels) * texel_size);
+					if (BoxOutsideFrustum(planes, box_min, box_max))
+					{
+						continue;
+					}
+
+					clipmap_patches_[count++] = (GLuint)(level << 16 | z << 8 | x);
+				}
+			}
+		}
+
+		if (count > 0)
+		{
+			glNamedBufferSubData(clipmap_patch_buffer_, 0, sizeof(GLuint) * count, clipmap_patches_);
+		}
+
+		return count;
+	}
+
+	bool BoxOutsideFrustum(const vmath::vec4 planes[6], const vmath::vec3& box_min, const vmath::vec3& box_max)
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			// Box corner farthest along the plane normal
+			float distance = planes[i][3];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				distance += planes[i][axis] * (planes[i][axis] >= 0.0f ? box_max[axis] : box_min[axis]);
+			}
+
+			if (distance < 0.0f)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void RemoveClipmap()
+	{
+		terrain_pager_.Close();
+		terrain_clipmap_.Remove();
+		glDeleteProgram(clipmap_program_);
+		glDeleteVertexArrays(1, &clipmap_vao_);
+		glDeleteBuffers(1, &clipmap_patch_buffer_);
+		delete[] clipmap_patches_;
+	}
+
+#pragma endregion
+
+#pragma region Procedural
+
+	void InitializeProcedural()
+	{
+		// Vertex shader
+		const char* vertex_shader_source[] =
+		{
+			"#version 450 core																			\n"
+			"																							\n"
+			"out VERTEX_DATA																			\n"
+			"{																							\n"
+			"	vec2 height_bounds;																		\n"
+			"} out_vdata;																				\n"
+			"																							\n"
+			"// Index of the patch within the grid (see CullProceduralPatches): one per instance		\n"
+			"layout (location = 0) in int patch_index;													\n"
+			"																							\n"
+			"void main(void)																			\n"
+			"{																							\n"
+			"	const vec4 vertices[4] = vec4[4](vec4( 0.0, 0.0, 1.0, 1.0),								\n"
+			"									 vec4( 1.0, 0.0, 1.0, 1.0),								\n"
+			"									 vec4( 0.0, 0.0, 0.0, 1.0),								\n"
+			"									 vec4( 1.0, 0.0, 0.0, 1.0));							\n"
+			"																							\n"
+			"	// Same grid as the texture based programs (64 x 64 patches of side 1, centered in the origin)\n"
+			"	vec2 grid_coord = vec2(patch_index & 0x3F, patch_index >> 6) + vec2(-32.0);				\n"
+			"																							\n"
+			"	// No per patch bounds: noise heights span the whole normalized range					\n"
+			"	out_vdata.height_bounds = vec2(0.0, 1.0);												\n"
+			"																							\n"
+			"	gl_Position = vertices[gl_VertexID] + vec4(grid_coord.x, 0.0, grid_coord.y, 0.0);		\n"
+			"}																							\n"
+		};
+
+		GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(vertex_shader, 1, vertex_shader_source, NULL);
+		glCompileShader(vertex_shader);
+
+		// Tess control shader
+		const char* tess_control_shader_source[] =
+		{
+			"#version 450 core																			\n"
+			"																							\n"
+			"layout (location = 0) uniform mat4 mv_matrix;												\n"
+			"layout (location = 1) uniform mat4 p_matrix;												\n"
+			"layout (location = 2) uniform float max_height;											\n"
+			"layout (location = 3) uniform bool frustum_culling;										\n"
+			"																							\n"
+			"in VERTEX_DATA																				\n"
+			"{																							\n"
+			"	vec2 height_bounds;																		\n"
+			"} in_vdata[];																				\n"
+			"																							\n"
+			"layout (vertices = 4) out;																	\n",
+			kPatchFrustumCullingGlsl,
+			"void main(void)																			\n"
+			"{																							\n"
+			"	if (gl_InvocationID == 0 && frustum_culling && patchOutsideFrustum())					\n"
+			"	{																						\n"
+			"		// Patch is discarded: no tessellation, so no noise evaluated at all				\n"
+			"		gl_TessLevelOuter[0] = 0.0;															\n"
+			"		gl_TessLevelOuter[1] = 0.0;															\n"
+			"		gl_TessLevelOuter[2] = 0.0;															\n"
+			"		gl_TessLevelOuter[3] = 0.0;															\n"
+			"		gl_TessLevelInner[0] = 0.0;															\n"
+			"		gl_TessLevelInner[1] = 0.0;															\n"
+			"	}																						\n"
+			"	else if (gl_InvocationID == 0)															\n"
+			"	{																						\n"
+			"		// Distance to camera levels, as the distance to camera program (same triangles, so only the height source differs)\n"
+			"		const float min_tess = 1.0;															\n"
+			"		const float max_tess = 16.0;														\n"
+			"		const float min_dist = 0.0;															\n"
+			"		const float max_dist = 48.0;														\n"
+			"																							\n"
+			"		vec4 p0 = mv_matrix * gl_in[0].gl_Position;											\n"
+			"		vec4 p1 = mv_matrix * gl_in[1].gl_Position;											\n"
+			"		vec4 p2 = mv_matrix * gl_in[2].gl_Position;											\n"
+			"		vec4 p3 = mv_matrix * gl_in[3].gl_Position;											\n"
+			"																							\n"
+			"		float tle0 = mix(max_tess, min_tess, clamp((length(mix(p0, p2, 0.5)) - min_dist) / (max_dist - min_dist), 0.0, 1.0));\n"
+			"		float tle1 = mix(max_tess, min_tess, clamp((length(mix(p1, p0, 0.5)) - min_dist) / (max_dist - min_dist), 0.0, 1.0));\n"
+			"		float tle2 = mix(max_tess, min_tess, clamp((length(mix(p3, p1, 0.5)) - min_dist) / (max_dist - min_dist), 0.0, 1.0));\n"
+			"		float tle3 = mix(max_tess, min_tess, clamp((length(mix(p2, p3, 0.5)) - min_dist) / (max_dist - min_dist), 0.0, 1.0));\n"
+			"																							\n"
+			"		gl_TessLevelOuter[0] = tle0;														\n"
+			"		gl_TessLevelOuter[1] = tle1;														\n"
+			"		gl_TessLevelOuter[2] = tle2;														\n"
+			"		gl_TessLevelOuter[3] = tle3;														\n"
+			"		gl_TessLevelInner[0] = max(tle1, tle3);												\n"
+			"		gl_TessLevelInner[1] = max(tle0, tle2);												\n"
+			"	}																						\n"
+			"																							\n"
+			"	gl_out[gl_InvocationID].gl_Position = gl_in[gl_InvocationID].gl_Position;				\n"
+			"}																							\n"
+		};
+
+		GLuint tess_control_shader = glCreateShader(GL_TESS_CONTROL_SHADER);
+		glShaderSource(tess_control_shader, sizeof(tess_control_shader_source) / sizeof(tess_control_shader_source[0]), tess_control_shader_source, NULL);
+		glCompileShader(tess_control_shader);
+
+		// Tess evaluation shader
+		const char* tess_evaluation_shader_source[] =
+		{
+			"#version 450 core																			\n"
+			"																							\n"
+			"layout (location = 0) uniform mat4 mv_matrix;												\n"
+			"layout (location = 1) uniform mat4 p_matrix;												\n"
+			"layout (location = 2) uniform float max_height;											\n"
+			"																							\n"
+			"layout (quads, fractional_odd_spacing) in;													\n"
+			"																							\n"
+			"out VERTEX_DATA																			\n"
+			"{																							\n"
+			"	float height;  // Normalized															\n"
+			"	vec3 normal;  // World space															\n"
+			"} out_vdata;																				\n"
+			"																							\n",
+			kProceduralNoiseGlsl,
+			"void main(void)																			\n"
+			"{																							\n"
+			"	vec4 p1 = mix(gl_in[0].gl_Position, gl_in[1].gl_Position, gl_TessCoord.x);				\n"
+			"	vec4 p2 = mix(gl_in[2].gl_Position, gl_in[3].gl_Position, gl_TessCoord.x);				\n"
+			"	vec4 p = mix(p1, p2, gl_TessCoord.y);													\n"
+			"																							\n"
+			"	// Height from noise (the texture fetch of the other programs)							\n"
+			"	float height = terrainHeight(p.xz);														\n"
+			"	p.y = height * max_height;																\n"
+			"																							\n"
+			"	// Normal from forward differences (a bit finer than the finest tessellation step)		\n"
+			"	const float delta = 1.0 / 32.0;															\n"
+			"	float dx = (terrainHeight(p.xz + vec2(delta, 0.0)) - height) * max_height;				\n"
+			"	float dz = (terrainHeight(p.xz + vec2(0.0, delta)) - height) * max_height;				\n"
+			"																							\n"
+			"	gl_Position = p_matrix * mv_matrix * p;													\n"
+			"	out_vdata.height = height;																\n"
+			"	out_vdata.normal = normalize(vec3(-dx, delta, -dz));									\n"
+			"}																							\n"
+		};
+
+		GLuint tess_evaluation_shader = glCreateShader(GL_TESS_EVALUATION_SHADER);
+		glShaderSource(tess_evaluation_shader, sizeof(tess_evaluation_shader_source) / sizeof(tess_evaluation_shader_source[0]), tess_evaluation_shader_source, NULL);
+		glCompileShader(tess_evaluation_shader);
+
+		// Fragment shader
+		const char* fragment_shader_source[] =
+		{
+			"#version 450 core																			\n"
+			"																							\n"
+			"in VERTEX_DATA																				\n"
+			"{																							\n"
+			"	float height;																			\n"
+			"	vec3 normal;																			\n"
+			"} in_vdata;																				\n"
+			"																							\n"
+			"layout (location = 0) out vec4 color;														\n"
+			"																							\n"
+			"void main(void)																			\n"
+			"{																							\n"
+			"	vec3 normal = normalize(in_vdata.normal);												\n"
+			"	float slope = 1.0 - normal.y;  // 0 flat, 1 vertical									\n"
+			"	float height = in_vdata.height;															\n"
+			"																							\n"
+			"	// No color map: sand, grass and rock by height, rock on steep slopes and snow on high flat ground\n"
+			"	vec3 sand = vec3(0.76, 0.70, 0.50);														\n"
+			"	vec3 grass = vec3(0.22, 0.42, 0.15);													\n"
+			"	vec3 rock = vec3(0.45, 0.39, 0.31);														\n"
+			"	vec3 snow = vec3(0.92, 0.93, 0.95);														\n"
+			"	vec3 albedo = mix(sand, grass, smoothstep(0.04, 0.1, height));							\n"
+			"	albedo = mix(albedo, rock, smoothstep(0.45, 0.7, height));								\n"
+			"	albedo = mix(albedo, rock, smoothstep(0.25, 0.45, slope));								\n"
+			"	albedo = mix(albedo, snow, smoothstep(0.72, 0.82, height) * (1.0 - smoothstep(0.3, 0.5, slope)));\n"
+			"																							\n"
+			"	// Fixed sun (diffuse plus ambient)														\n"
+			"	float diffuse = max(dot(normal, normalize(vec3(0.4, 0.8, 0.3))), 0.0);					\n"
+			"	color = vec4(albedo * (0.3 + 0.7 * diffuse), 1.0);										\n"
+			"}																							\n"
+		};
+
+		GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(fragment_shader, 1, fragment_shader_source, NULL);
+		glCompileShader(fragment_shader);
+
+		// Program
+		procedural_program_ = glCreateProgram();
+		glAttachShader(procedural_program_, vertex_shader);
+		glAttachShader(procedural_program_, tess_control_shader);
+		glAttachShader(procedural_program_, tess_evaluation_shader);
+		glAttachShader(procedural_program_, fragment_shader);
+		glLinkProgram(procedural_program_);
+
+		// Free resources
+		glDeleteShader(vertex_shader);
+		glDeleteShader(tess_control_shader);
+		glDeleteShader(tess_evaluation_shader);
+		glDeleteShader(fragment_shader);
+	}
+
+	void RenderProcedural(double current_time)
+	{
+		GLuint patch_count = CullProceduralPatches();
+
+		BeginTessellationQueries();
+		DrawProcedural(patch_count);
+		EndTessellationQueries();
+
+		if (current_time - last_report_time_ >= kReportPeriod)
+		{
+			last_report_time_ = current_time;
+
+			char output[256];
+			sprintf_s(output, sizeof(output), "Terrain procedural (culling %s, TCS culling %s): %u / %u patches drawn; %llu triangles; %.3f ms GPU.\n",
+				patch_culling_ ? "on" : "off", tcs_culling_ ? "on" : "off", patch_count, (GLuint)kPatchTotal, (unsigned long long)triangles_, gpu_time_);
+			OutputDebugStringA(output);
+		}
+	}
+
+	/// <summary>
+	/// Upload the indices of the patches whose box (full noise height range) is inside the view frustum; returns their number
+	/// Procedural heights are unknown before the TES runs, so there are no tighter bounds (and no quadtree) to cull with
+	/// </summary>
+	GLuint CullProceduralPatches()
+	{
+		GLuint count;
+		if (patch_culling_)
+		{
+			vmath::vec4 planes[6];
+			ExtractFrustumPlanes(camera_projection_matrix_ * camera_view_matrix_, planes);
+			float y0 = max_height_ < 0.0f ? max_height_ : 0.0f;
+			float y1 = max_height_ < 0.0f ? 0.0f : max_height_;
+
+			count = 0;
+			for (int i = 0; i < kPatchTotal; i++)
+			{
+				vmath::vec3 box_min((float)(i % kGridSide) - 32.0f, y0, (float)(i / kGridSide) - 32.0f);
+				vmath::vec3 box_max(box_min[0] + 1.0f, y1, box_min[2] + 1.0f);
+				if (!BoxOutsideFrustum(planes, box_min, box_max))
+				{
+					visible_patches_[count++] = (GLuint)i;
+				}
+			}
+		}
+		else
+		{
+			count = terrain_quadtree_.All(visible_patches_, NULL);
+		}
+
+		if (count > 0)
+		{
+			glNamedBufferSubData(patch_buffer_, 0, sizeof(GLuint) * count, visible_patches_);
+		}
+
+		return count;
+	}
+
+	/// <summary>
+	/// Draw the listed patches (see CullProceduralPatches) with the procedural program: no texture nor buffer is bound
+	/// </summary>
+	void DrawProcedural(GLuint patch_count)
+	{
+		glUseProgram(procedural_program_);
+
+		glBindVertexArray(vao_);
+
+		glUniformMatrix4fv(0, 1, GL_FALSE, camera_view_matrix_);
+		glUniformMatrix4fv(1, 1, GL_FALSE, camera_projection_matrix_);
+		glUniform1f(2, max_height_);
+		glUniform1i(3, tcs_culling_);
+
+		glPatchParameteri(GL_PATCH_VERTICES, kPatchSize);
+
+		glDrawArraysInstanced(GL_PATCHES, 0, kPatchSize, patch_count);
+	}
+
+	/// <summary>
+	/// Bytes of every level of a texture, from the internal format of each level
+	/// </summary>
+	GLuint64 TextureBytes(GLuint texture)
+	{
+		GLuint64 bytes = 0;
+		for (GLint level = 0; ; level++)
+		{
+			GLint width = 0, height = 0, depth = 0;
+			glGetTextureLevelParameteriv(texture, level, GL_TEXTURE_WIDTH, &width);
+			glGetTextureLevelParameteriv(texture, level, GL_TEXTURE_HEIGHT, &height);
+			glGetTextureLevelParameteriv(texture, level, GL_TEXTURE_DEPTH, &depth);
+			if (width == 0)
+			{
+				break;
+			}
+
+			GLint compressed = GL_FALSE;
+			glGetTextureLevelParameteriv(texture, level, GL_TEXTURE_COMPRESSED, &compressed);
+			if (compressed)
+			{
+				GLint size = 0;
+				glGetTextureLevelParameteriv(texture, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+				bytes += (GLuint64)size;
+				continue;
+			}
+
+			const GLenum kComponentSizes[] = { GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE, GL_TEXTURE_ALPHA_SIZE, GL_TEXTURE_DEPTH_SIZE, GL_TEXTURE_STENCIL_SIZE };
+			GLint bits = 0;
+			for (int i = 0; i < 6; i++)
+			{
+				GLint component_bits = 0;
+				glGetTextureLevelParameteriv(texture, level, kComponentSizes[i], &component_bits);
+				bits += component_bits;
+			}
+			bytes += (GLuint64)width * height * depth * bits / 8;
+		}
+
+		return bytes;
+	}
+
+	/// <summary>
+	/// Draw every patch with the distance to camera program (heights and colors from textures) and with the procedural one (from noise), and print
+	/// GPU time and memory of both to Output (on Debug mode): same tessellation levels, so only where heights and colors come from differs
+	/// Warning! Timer queries are read back right away (CPU-GPU synchronization): on demand only
+	/// </summary>
+	void CompareTerrainSources()
+	{
+		const int kRuns = 16;  // Draws timed per source (after a warm-up one)
+
+		GLuint patch_count = terrain_quadtree_.All(visible_patches_, NULL);
+		glNamedBufferSubData(patch_buffer_, 0, sizeof(GLuint) * patch_count, visible_patches_);
+
+		GLuint query;
+		glCreateQueries(GL_TIME_ELAPSED, 1, &query);
+
+		// Both sources compute edge levels in the TCS (the procedural program has no precomputed path)
+		bool precomputed_levels = precomputed_levels_;
+		precomputed_levels_ = false;
+
+		double milliseconds[2];
+		for (int source = 0; source < 2; source++)
+		{
+			for (int run = 0; run <= kRuns; run++)
+			{
+				if (run == 1)
+				{
+					glBeginQuery(GL_TIME_ELAPSED, query);
+				}
+
+				if (source == 0)
+				{
+					DrawTerrain(kDistanceToCamera, pixel_error_, patch_count);
+				}
+				else
+				{
+					DrawProcedural(patch_count);
+				}
+			}
+			glEndQuery(GL_TIME_ELAPSED);
+
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+			milliseconds[source] = nanoseconds / (1.0e6 * kRuns);
+		}
+		precomputed_levels_ = precomputed_levels;
+
+		glDeleteQueries(1, &query);
+
+		// Texture source: heightmap and color map, plus the patch bounds the vertex shader reads (procedural patches need neither)
+		GLuint64 heightmap_bytes = TextureBytes(texture_2d_heightmap);
+		GLuint64 color_bytes = TextureBytes(texture_2d_color);
+		GLuint64 bounds_bytes = sizeof(vmath::vec2) * kPatchTotal;
+
+		char output[256];
+		sprintf_s(output, sizeof(output), "Terrain source: textures: %.3f ms GPU; %.1f KB (heightmap %.1f KB, color map %.1f KB, patch bounds %.1f KB).\n",
+			milliseconds[0], (heightmap_bytes + color_bytes + bounds_bytes) / 1024.0, heightmap_bytes / 1024.0, color_bytes / 1024.0, bounds_bytes / 1024.0);
+		OutputDebugStringA(output);
+
+		sprintf_s(output, sizeof(output), "Terrain source: procedural: %.3f ms GPU; 0.0 KB (%.2fx the texture time).\n",
+			milliseconds[1], milliseconds[0] > 0.0 ? milliseconds[1] / milliseconds[0] : 0.0);
+		OutputDebugStringA(output);
+	}
+
+#pragma endregion
+
+#pragma region Tessellation cache
+
+	void InitializeTerrainCache()
+	{
+		// Capture buffer (grown on demand, see UpdateTerrainCache) and the transform feedback object that keeps its vertex count
+		glCreateTransformFeedbacks(1, &cache_feedback_);
+		glCreateQueries(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, 1, &cache_query_);
+
+		glCreateVertexArrays(1, &cache_vao_);
+		glVertexArrayAttribFormat(cache_vao_, 0, 4, GL_FLOAT, GL_FALSE, 0);
+		glVertexArrayAttribFormat(cache_vao_, 1, 2, GL_FLOAT, GL_FALSE, sizeof(vmath::vec4));
+		glVertexArrayAttribBinding(cache_vao_, 0, 0);
+		glVertexArrayAttribBinding(cache_vao_, 1, 0);
+		glEnableVertexArrayAttrib(cache_vao_, 0);
+		glEnableVertexArrayAttrib(cache_vao_, 1);
+
+		ResizeTerrainCache(kCacheInitialTriangles);
+
+		// Vertex shader
+		const char* vertex_shader_source[] =
+		{
+			"#version 450 core																			\n"
+			"																							\n"
+			"// Captured tessellated vertices (see BeginTerrainCapture): already in clip space			\n"
+			"layout (location = 0) in vec4 position;													\n"
+			"layout (location = 1) in vec2 tc;															\n"
+			"																							\n"
+			"out VERTEX_DATA																			\n"
+			"{																							\n"
+			"	vec2 tc;																				\n"
+			"} out_vdata;																				\n"
+			"																							\n"
+			"void main(void)																			\n"
+			"{																							\n"
+			"	out_vdata.tc = tc;																		\n"
+			"	gl_Position = position;																	\n"
+			"}																							\n"
+		};
+
+		GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(vertex_shader, 1, vertex_shader_source, NULL);
+		glCompileShader(vertex_shader);
+
+		// Fragment shader
+		const char* fragment_shader_source[] =
+		{
+			"#version 450 core																			\n"
+			"																							\n"
+			"layout (location = 2) uniform float max_height;											\n"
+			"layout (location = 7) uniform bool lighting;												\n"
+			"																							\n"
+			"layout (binding = 1) uniform sampler2D tex_color;											\n",
+			kTerrainLightingGlsl,
+			"in VERTEX_DATA																				\n"
+			"{																							\n"
+			"	vec2 tc;																				\n"
+			"} in_vdata;																				\n"
+			"																							\n"
+			"layout (location = 0) out vec4 color;														\n"
+			"																							\n"
+			"void main(void)																			\n"
+			"{																							\n"
+			"	color = texture(tex_color, in_vdata.tc);												\n"
+			"																							\n"
+			"	if (lighting)																			\n"
+			"	{																						\n"
+			"		color.rgb = terrainLighting(color.rgb, in_vdata.tc);								\n"
+			"	}																						\n"
+			"}																							\n"
+		};
+
+		GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(fragment_shader, sizeof(fragment_shader_source) / sizeof(fragment_shader_source[0]), fragment_shader_source, NULL);
+		glCompileShader(fragment_shader);
+
+		// Program
+		cache_program_ = glCreateProgram();
+		glAttachShader(cache_program_, vertex_shader);
+		glAttachShader(cache_program_, fragment_shader);
+		glLinkProgram(cache_program_);
+
+		// Free resources
+		glDeleteShader(vertex_shader);
+		glDeleteShader(fragment_shader);
+	}
+
+	/// <summary>
+	/// (Re)create the capture buffer with room for a number of triangles
+	/// </summary>
+	void ResizeTerrainCache(GLuint triangles)
+	{
+		glDeleteBuffers(1, &cache_buffer_);
+		cache_capacity_ = triangles;
+
+		glCreateBuffers(1, &cache_buffer_);
+		glNamedBufferStorage(cache_buffer_, (GLsizeiptr)kCacheVertexSize * 3 * triangles, NULL, 0);
+		glTransformFeedbackBufferBase(cache_feedback_, 0, cache_buffer_);
+		glVertexArrayVertexBuffer(cache_vao_, 0, cache_buffer_, 0, kCacheVertexSize);
+	}
+
+	/// <summary>
+	/// Advance the cache state for this frame; returns true if the captured triangles can be drawn instead of tessellating again
+	/// Any change of what the capture depends on (camera, height, program and its parameters, viewport) drops it, and a new one is taken
+	/// only once the view has been stationary for a frame, so a moving camera does not pay for capturing
+	/// </summary>
+	bool UpdateTerrainCache()
+	{
+		TerrainCacheKey key = { camera_position_, max_height_, render_program_index_ % kRenderProgramTotal, pixel_error_, tcs_culling_, precomputed_levels_, info.windowWidth, info.windowHeight };
+		bool unchanged = key.camera_position[0] == cache_key_.camera_position[0] && key.camera_position[1] == cache_key_.camera_position[1] &&
+			key.camera_position[2] == cache_key_.camera_position[2] && key.max_height == cache_key_.max_height && key.program == cache_key_.program &&
+			key.pixel_error == cache_key_.pixel_error && key.tcs_culling == cache_key_.tcs_culling && key.precomputed_levels == cache_key_.precomputed_levels &&
+			key.width == cache_key_.width && key.height == cache_key_.height;
+		cache_key_ = key;
+
+		if (!unchanged)
+		{
+			cache_state_ = kCacheStale;
+			return false;
+		}
+
+		switch (cache_state_)
+		{
+		case kCacheStale:
+			cache_state_ = kCacheCapture;  // Taken by this frame draw (see BeginTerrainCapture)
+			break;
+		case kCachePending:
+		{
+			// Written triangles of the capture, without stalling: the full pipeline keeps drawing until they are known
+			GLint available = 0;
+			glGetQueryObjectiv(cache_query_, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+			{
+				break;
+			}
+
+			GLuint64 written = 0;
+			glGetQueryObjectui64v(cache_query_, GL_QUERY_RESULT, &written);
+			if (written < cache_capacity_)
+			{
+				cache_triangles_ = written;
+				cache_state_ = kCacheReady;
+			}
+			else if (cache_capacity_ < kCacheMaxTriangles)
+			{
+				// Full buffer: some triangles may be missing, so capture again with twice the room
+				ResizeTerrainCache(cache_capacity_ * 2 < kCacheMaxTriangles ? cache_capacity_ * 2 : kCacheMaxTriangles);
+				cache_state_ = kCacheCapture;
+			}
+			else
+			{
+				cache_state_ = kCacheOverflow;  // Too many triangles for the budget: not cached until something changes
+			}
+			break;
+		}
+		default:
+			break;
+		}
+
+		return cache_state_ == kCacheReady;
+	}
+
+	/// <summary>
+	/// Capture the tessellated triangles of the following draws (rasterization stays on, so they are drawn as well)
+	/// Warning! The render program must be already in use: it cannot be changed while capturing
+	/// </summary>
+	void BeginTerrainCapture()
+	{
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, cache_feedback_);
+		glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, cache_query_);
+		glBeginTransformFeedback(GL_TRIANGLES);
+	}
+
+	void EndTerrainCapture()
+	{
+		glEndTransformFeedback();
+		glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+		cache_state_ = kCachePending;
+	}
+
+	/// <summary>
+	/// Draw the captured triangles: no tessellation nor heightmap fetch, only the color (and normal) map
+	/// </summary>
+	void DrawTerrainCache()
+	{
+		glUseProgram(cache_program_);
+		glBindVertexArray(cache_vao_);
+		glUniform1f(2, max_height_);
+		glUniform1i(7, lighting_);
+		glBindTextureUnit(1, texture_2d_color);
+		glBindTextureUnit(3, texture_2d_normal_);
+
+		// Vertex count is the one recorded by the transform feedback object (no read back)
+		glDrawTransformFeedback(GL_TRIANGLES, cache_feedback_);
+	}
+
+	void RemoveTerrainCache()
+	{
+		glDeleteProgram(cache_program_);
+		glDeleteVertexArrays(1, &cache_vao_);
+		glDeleteBuffers(1, &cache_buffer_);
+		glDeleteTransformFeedbacks(1, &cache_feedback_);
+		glDeleteQueries(1, &cache_query_);
+	}
+
+#pragma endregion
+
+#pragma region Edge levels
+
+	void InitializeEdgeLevels()
+	{
+		// One level per grid edge (65 rows of 64 along X, 64 rows of 65 along Z), read by the tess control shaders
+		glCreateBuffers(1, &edge_levels_buffer_);
+		glNamedBufferStorage(edge_levels_buffer_, sizeof(float) * kEdgeTotal, NULL, 0);
+
+		// View space and NDC position of every grid vertex (scratch of the first pass)
+		glCreateBuffers(1, &grid_vertices_buffer_);
+		glNamedBufferStorage(grid_vertices_buffer_, sizeof(float) * 8 * kGridVertexTotal, NULL, 0);
+
+		// Compute shader
+		const char* compute_shader_source[] =
+		{
+			"#version 450 core																			\n"
+			"																							\n"
+			"layout (local_size_x = 64) in;																\n"
+			"																							\n"
+			"layout (location = 0) uniform mat4 mv_matrix;												\n"
+			"layout (location = 1) uniform mat4 p_matrix;												\n"
+			"layout (location = 2) uniform float max_height;											\n"
+			"layout (location = 3) uniform int pass;  // 0: grid vertices; 1: edges						\n"
+			"layout (location = 4) uniform float viewport_height;  // Pixels							\n"
+			"layout (location = 5) uniform float pixel_error;  // Target (max) screen-space error, in pixels\n"
+			"layout (location = 6) uniform int render_program;  // Book sample, distance to camera or screen-space error\n"
+			"																							\n"
+			"// Height error of every patch (see InitializePatchErrorTexture)							\n"
+			"layout (binding = 2) uniform sampler2D tex_patch_error;									\n"
+			"																							\n"
+			"layout (binding = 1, std430) writeonly buffer edge_levels_block							\n"
+			"{																							\n"
+			"	float edge_levels[];																	\n"
+			"};																							\n"
+			"																							\n"
+			"// View space and NDC position of every grid vertex (65 x 65, row-major)					\n"
+			"layout (binding = 2, std430) buffer grid_vertices_block									\n"
+			"{																							\n"
+			"	vec4 grid_vertices[];																	\n"
+			"};																							\n"
+			"																							\n"
+			"// Height error of the patch containing a point (texture coordinate); none outside the grid\n"
+			"vec4 patchError(vec2 tc)																	\n"
+			"{																							\n"
+			"	ivec2 patch_coord = ivec2(floor(tc * 64.0));											\n"
+			"	if (any(lessThan(patch_coord, ivec2(0))) || any(greaterThanEqual(patch_coord, ivec2(64))))\n"
+			"	{																						\n"
+			"		return vec4(0.0);																	\n"
+			"	}																						\n"
+			"																							\n"
+			"	return texelFetch(tex_patch_error, patch_coord, 0);										\n"
+			"}																							\n"
+			"																							\n"
+			"// Same levels as the tess control shader of each program, for the edge between grid vertices a and b\n"
+			"float bookSampleLevel(vec4 ndc_a, vec4 ndc_b)												\n"
+			"{																							\n"
+			"	return length(ndc_a.xy - ndc_b.xy) * 16.0 + 1.0;										\n"
+			"}																							\n"
+			"																							\n"
+			"float distanceToCameraLevel(vec4 view_a, vec4 view_b)										\n"
+			"{																							\n"
+			"	const float min_tess = 1.0;																\n"
+			"	const float max_tess = 16.0;															\n"
+			"	const float min_dist = 0.0;																\n"
+			"	const float max_dist = 48.0;															\n"
+			"	return mix(max_tess, min_tess, clamp((length(mix(view_a, view_b, 0.5)) - min_dist) / (max_dist - min_dist), 0.0, 1.0));\n"
+			"}																							\n"
+			"																							\n"
+			"float screenSpaceErrorLevel(ivec2 a, ivec2 b, vec4 view_a, vec4 view_b)					\n"
+			"{																							\n"
+			"	vec2 tc_middle = vec2(a + b) * 0.5 / 64.0;												\n"
+			"	vec2 tc_edge = vec2(b - a) / 64.0;														\n"
+			"	vec2 tc_side = vec2(tc_edge.y, -tc_edge.x) * 0.5;										\n"
+			"	vec4 error = max(patchError(tc_middle + tc_side), patchError(tc_middle - tc_side));		\n"
+			"																							\n"
+			"	vec4 middle = mix(view_a, view_b, 0.5);													\n"
+			"	float pixels_per_unit = p_matrix[1][1] * 0.5 * viewport_height / max(length(middle.xyz), 0.001);\n"
+			"	vec4 pixels = error * abs(max_height) * pixels_per_unit;								\n"
+			"																							\n"
+			"	if (pixels.x <= pixel_error)															\n"
+			"	{																						\n"
+			"		return 1.0;																			\n"
+			"	}																						\n"
+			"	if (pixels.y <= pixel_error)															\n"
+			"	{																						\n"
+			"		return mix(1.0, 2.0, (pixels.x - pixel_error) / (pixels.x - pixels.y));				\n"
+			"	}																						\n"
+			"	if (pixels.z <= pixel_error)															\n"
+			"	{																						\n"
+			"		return mix(2.0, 4.0, (pixels.y - pixel_error) / (pixels.y - pixels.z));				\n"
+			"	}																						\n"
+			"	if (pixels.w <= pixel_error)															\n"
+			"	{																						\n"
+			"		return mix(4.0, 8.0, (pixels.z - pixel_error) / (pixels.z - pixels.w));				\n"
+			"	}																						\n"
+			"																							\n"
+			"	return min(8.0 * sqrt(pixels.w / pixel_error), 64.0);									\n"
+			"}																							\n"
+			"																							\n"
+			"void main(void)																			\n"
+			"{																							\n"
+			"	int id = int(gl_GlobalInvocationID.x);													\n"
+			"																							\n"
+			"	if (pass == 0)																			\n"
+			"	{																						\n"
+			"		// Every grid vertex transformed once (instead of once per patch around it)			\n"
+			"		if (id >= 65 * 65)																	\n"
+			"		{																					\n"
+			"			return;																			\n"
+			"		}																					\n"
+			"																							\n"
+			"		vec4 view = mv_matrix * vec4(float(id % 65) - 32.0, 0.0, float(id / 65) - 32.0, 1.0);\n"
+			"		vec4 clip = p_matrix * view;														\n"
+			"		grid_vertices[id * 2] = view;														\n"
+			"		grid_vertices[id * 2 + 1] = clip / clip.w;											\n"
+			"		return;																				\n"
+			"	}																						\n"
+			"																							\n"
+			"	// Every edge once (instead of once per patch at each side)								\n"
+			"	if (id >= 2 * 65 * 64)																	\n"
+			"	{																						\n"
+			"		return;																				\n"
+			"	}																						\n"
+			"																							\n"
+			"	ivec2 a;																				\n"
+			"	ivec2 b;																				\n"
+			"	if (id < 65 * 64)																		\n"
+			"	{																						\n"
+			"		a = ivec2(id % 64, id / 64);  // Along X											\n"
+			"		b = a + ivec2(1, 0);																\n"
+			"	}																						\n"
+			"	else																					\n"
+			"	{																						\n"
+			"		a = ivec2((id - 65 * 64) % 65, (id - 65 * 64) / 65);  // Along Z					\n"
+			"		b = a + ivec2(0, 1);																\n"
+			"	}																						\n"
+			"																							\n"
+			"	int index_a = a.y * 65 + a.x;															\n"
+			"	int index_b = b.y * 65 + b.x;															\n"
+			"	vec4 view_a = grid_vertices[index_a * 2];												\n"
+			"	vec4 view_b = grid_vertices[index_b * 2];												\n"
+			"																							\n"
+			"	float level;																			\n"
+			"	if (render_program == 0)																\n"
+			"	{																						\n"
+			"		level = bookSampleLevel(grid_vertices[index_a * 2 + 1], grid_vertices[index_b * 2 + 1]);\n"
+			"	}																						\n"
+			"	else if (render_program == 1)															\n"
+			"	{																						\n"
+			"		level = distanceToCameraLevel(view_a, view_b);										\n"
+			"	}																						\n"
+			"	else																					\n"
+			"	{																						\n"
+			"		level = screenSpaceErrorLevel(a, b, view_a, view_b);								\n"
+			"	}																						\n"
+			"																							\n"
+			"	edge_levels[id] = level;																\n"
+			"}																							\n"
+		};
+
+		GLuint compute_shader = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(compute_shader, 1, compute_shader_source, NULL);
+		glCompileShader(compute_shader);
+
+		// Program
+		edge_level_program_ = glCreateProgram();
+		glAttachShader(edge_level_program_, compute_shader);
+		glLinkProgram(edge_level_program_);
+
+		// Free resources
+		glDeleteShader(compute_shader);
+	}
+
+	/// <summary>
+	/// Compute the level of every grid edge for a render program (same values its tess control shader would): grid vertices are transformed
+	/// in a first pass, then each edge level is computed once from its two vertices, instead of once per patch sharing the edge
+	/// </summary>
+	void ComputeEdgeLevels(unsigned int program, float pixel_error)
+	{
+		glUseProgram(edge_level_program_);
+
+		glUniformMatrix4fv(0, 1, GL_FALSE, camera_view_matrix_);
+		glUniformMatrix4fv(1, 1, GL_FALSE, camera_projection_matrix_);
+		glUniform1f(2, max_height_);
+		glUniform1f(4, (float)info.windowHeight);
+		glUniform1f(5, pixel_error);
+		glUniform1i(6, (GLint)program);
+		glBindTextureUnit(2, texture_2d_patch_error_);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, edge_levels_buffer_);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, grid_vertices_buffer_);
+
+		// Grid vertices
+		glUniform1i(3, 0);
+		glDispatchCompute((kGridVertexTotal + 63) / 64, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		// Edges
+		glUniform1i(3, 1);
+		glDispatchCompute((kEdgeTotal + 63) / 64, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	/// <summary>
+	/// Draw the visible patches with every program, edge levels computed in the tess control shader and precomputed (compute pass included),
+	/// and print GPU time of both to Output (on Debug mode)
+	/// Warning! Timer queries are read back right away (CPU-GPU synchronization): on demand only
+	/// </summary>
+	void BenchmarkEdgeLevels(GLuint visible_patch_count)
+	{
+		const int kRuns = 16;  // Draws timed per configuration (after a warm-up one)
+
+		GLuint query;
+		glCreateQueries(GL_TIME_ELAPSED, 1, &query);
+
+		bool precomputed_levels = precomputed_levels_;
+		for (unsigned int program = 0; program < kCdlod; program++)
+		{
+			double milliseconds[2];  // Computed in the TCS, precomputed
+			for (int precomputed = 0; precomputed < 2; precomputed++)
+			{
+				precomputed_levels_ = precomputed != 0;
+				for (int run = 0; run <= kRuns; run++)
+				{
+					if (run == 1)
+					{
+						glBeginQuery(GL_TIME_ELAPSED, query);
+					}
+					DrawTerrain(program, pixel_error_, visible_patch_count);
+				}
+				glEndQuery(GL_TIME_ELAPSED);
+
+				GLuint64 nanoseconds = 0;
+				glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+				milliseconds[precomputed] = nanoseconds / (1.0e6 * kRuns);
+			}
+
+			// Work per draw: the TCS computes 4 edges (transforming 4 corners) of every visible patch; the compute pass every grid vertex and edge once
+			char output[256];
+			sprintf_s(output, sizeof(output), "Terrain edge levels (%s): TCS %.3f ms (%u edges); precomputed %.3f ms (%u vertices, %u edges); %.2fx.\n",
+				kRenderProgramNames[program], milliseconds[0], visible_patch_count * 4, milliseconds[1], (GLuint)kGridVertexTotal, (GLuint)kEdgeTotal,
+				milliseconds[1] > 0.0 ? milliseconds[0] / milliseconds[1] : 0.0);
+			OutputDebugStringA(output);
+		}
+		precomputed_levels_ = precomputed_levels;
+
+		glDeleteQueries(1, &query);
+	}
+
+	void RemoveEdgeLevels()
+	{
+		glDeleteProgram(edge_level_program_);
+		glDeleteBuffers(1, &edge_levels_buffer_);
+		glDeleteBuffers(1, &grid_vertices_buffer_);
+	}
+
+#pragma endregion
+
+#pragma region CDLOD
+
+	void InitializeCdlod()
+	{
+		// Grid meshes: kCdlodGridSide quads per side for whole nodes, half of them for quarter nodes (same vertex spacing as their level)
+		std::vector<vmath::vec2> vertices;
+		std::vector<GLushort> indices;
+		for (int mesh = 0; mesh < 2; mesh++)
+		{
+			int side = kCdlodGridSide >> mesh;
+			GLushort first = (GLushort)vertices.size();
+			cdlod_first_index_[mesh] = (GLuint)indices.size();
+
+			for (int j = 0; j <= side; j++)
+			{
+				for (int i = 0; i <= side; i++)
+				{
+					vertices.push_back(vmath::vec2((float)i / side, (float)j / side));
+				}
+			}
+
+			for (int j = 0; j < side; j++)
+			{
+				for (int i = 0; i < side; i++)
+				{
+					// Two triangles per quad, counter-clockwise seen from above
+					GLushort v00 = (GLushort)(first + j * (side + 1) + i);
+					GLushort v01 = (GLushort)(v00 + side + 1);
+					const GLushort quad[6] = { v00, v01, (GLushort)(v00 + 1), (GLushort)(v00 + 1), v01, (GLushort)(v01 + 1) };
+					indices.insert(indices.end(), quad, quad + 6);
+				}
+			}
+
+			cdlod_index_count_[mesh] = (GLuint)indices.size() - cdlod_first_index_[mesh];
+		}
+
+		glCreateBuffers(1, &cdlod_mesh_buffer_);
+		glNamedBufferStorage(cdlod_mesh_buffer_, sizeof(vmath::vec2) * vertices.size(), vertices.data(), 0);
+		glCreateBuffers(1, &cdlod_index_buffer_);
+		glNamedBufferStorage(cdlod_index_buffer_, sizeof(GLushort) * indices.size(), indices.data(), 0);
+
+		// Selected nodes: whole ones from the front, quarter ones from the back (see TerrainQuadtree::SelectLod)
+		cdlod_nodes_ = new TerrainLodNode[kPatchTotal];
+		glCreateBuffers(1, &cdlod_node_buffer_);
+		glNamedBufferStorage(cdlod_node_buffer_, sizeof(TerrainLodNode) * kPatchTotal, NULL, GL_DYNAMIC_STORAGE_BIT);
+
+		glCreateVertexArrays(1, &cdlod_vao_);
+		glVertexArrayVertexBuffer(cdlod_vao_, 0, cdlod_mesh_buffer_, 0, sizeof(vmath::vec2));
+		glVertexArrayAttribFormat(cdlod_vao_, 0, 2, GL_FLOAT, GL_FALSE, 0);
+		glVertexArrayAttribBinding(cdlod_vao_, 0, 0);
+		glEnableVertexArrayAttrib(cdlod_vao_, 0);
+		glVertexArrayVertexBuffer(cdlod_vao_, 1, cdlod_node_buffer_, 0, sizeof(TerrainLodNode));
+		glVertexArrayBindingDivisor(cdlod_vao_, 1, 1);
+		glVertexArrayAttribFormat(cdlod_vao_, 1, 4, GL_FLOAT, GL_FALSE, 0);
+		glVertexArrayAttribBinding(cdlod_vao_, 1, 1);
+		glEnableVertexArrayAttrib(cdlod_vao_, 1);
+		glVertexArrayElementBuffer(cdlod_vao_, cdlod_index_buffer_);
+
+		// Ranges double per level (as node sides do); the morph to the next level takes the last part of the band between the level range and the one below
+		float previous_range = 0.0f;
+		for (int level = 0; level < kCdlodMaxLevels; level++)
+		{
+			cdlod_ranges_[level] = kCdlodLeafRange * (float)(1 << level);
+			cdlod_morph_ranges_[level * 2] = previous_range + (cdlod_ranges_[level] - previous_range) * kCdlodMorphStart;
+			cdlod_morph_ranges_[level * 2 + 1] = cdlod_ranges_[level];
+			previous_range = cdlod_ranges_[level];
+		}
+
+		// Vertex shader
+		const char* vertex_shader_source[] =
+		{
+			"#version 450 core																			\n"
+			"																							\n"
+			"layout (location = 0) uniform mat4 mv_matrix;												\n"
+			"layout (location = 1) uniform mat4 p_matrix;												\n"
+			"layout (location = 2) uniform float max_height;											\n"
+			"layout (location = 8) uniform float grid_side;  // Quads per side of the mesh drawn		\n"
+			"layout (location = 9) uniform vec2 morph_ranges[8];  // Morph start and end distance per LOD level\n"
+			"																							\n"
+			"layout (binding = 0) uniform sampler2D tex_heightmap;										\n"
+			"																							\n"
+			"// Mesh vertex, in [0, 1] x [0, 1]															\n"
+			"layout (location = 0) in vec2 grid_position;												\n"
+			"																							\n"
+			"// Node: world corner (x, z), side and LOD level (see TerrainQuadtree::SelectLod): one per instance\n"
+			"layout (location = 1) in vec4 node;														\n"
+			"																							\n"
+			"out VERTEX_DATA																			\n"
+			"{																							\n"
+			"	vec2 tc;																				\n"
+			"} out_vdata;																				\n"
+			"																							\n"
+			"float terrainHeight(vec2 world)															\n"
+			"{																							\n"
+			"	// Same grid as the tessellated programs (64 x 64 patches of side 1, centered in the origin)\n"
+			"	return textureLod(tex_heightmap, (world + vec2(32.0)) / 64.0, 0.0).r * max_height;		\n"
+			"}																							\n"
+			"																							\n"
+			"void main(void)																			\n"
+			"{																							\n"
+			"	vec2 world = node.xy + grid_position * node.z;											\n"
+			"																							\n"
+			"	// Morph factor from the distance to the camera (eye space origin): 0 well within the level range, 1 at its end\n"
+			"	vec2 morph_range = morph_ranges[int(node.w)];											\n"
+			"	float distance = length((mv_matrix * vec4(world.x, terrainHeight(world), world.y, 1.0)).xyz);\n"
+			"	float morph = clamp((distance - morph_range.x) / (morph_range.y - morph_range.x), 0.0, 1.0);\n"
+			"																							\n"
+			"	// Odd vertices (per axis) slide onto their lower even neighbour: fully morphed, every vertex lies on the next level grid\n"
+			"	vec2 odd = fract(grid_position * grid_side * 0.5) * 2.0 / grid_side;					\n"
+			"	world -= odd * node.z * morph;															\n"
+			"																							\n"
+			"	gl_Position = p_matrix * mv_matrix * vec4(world.x, terrainHeight(world), world.y, 1.0);	\n"
+			"	out_vdata.tc = (world + vec2(32.0)) / 64.0;												\n"
+			"}																							\n"
+		};
+
+		GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(vertex_shader, 1, vertex_shader_source, NULL);
+		glCompileShader(vertex_shader);
+
+		// Fragment shader (same as the tessellated programs)
+		const char* fragment_shader_source[] =
+		{
+			"#version 450 core																			\n"
+			"																							\n"
+			"layout (location = 2) uniform float max_height;											\n"
+			"layout (location = 7) uniform bool lighting;												\n"
+			"																							\n"
+			"layout (binding = 1) uniform sampler2D tex_color;											\n",
+			kTerrainLightingGlsl,
+			"in VERTEX_DATA																				\n"
+			"{																							\n"
+			"	vec2 tc;																				\n"
+			"} in_vdata;																				\n"
+			"																							\n"
+			"layout (location = 0) out vec4 color;														\n"
+			"																							\n"
+			"void main(void)																			\n"
+			"{																							\n"
+			"	color = texture(tex_color, in_vdata.tc);												\n"
+			"																							\n"
+			"	if (lighting)																			\n"
+			"	{																						\n"
+			"		color.rgb = terrainLighting(color.rgb, in_vdata.tc);								\n"
+			"	}																						\n"
+			"}																							\n"
+		};
+
+		GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(fragment_shader, sizeof(fragment_shader_source) / sizeof(fragment_shader_source[0]), fragment_shader_source, NULL);
+		glCompileShader(fragment_shader);
+
+		// Program
+		render_program_[kCdlod] = glCreateProgram();
+		glAttachShader(render_program_[kCdlod], vertex_shader);
+		glAttachShader(render_program_[kCdlod], fragment_shader);
+		glLinkProgram(render_program_[kCdlod]);
+
+		// Free resources
+		glDeleteShader(vertex_shader);
+		glDeleteShader(fragment_shader);
+	}
+
+	/// <summary>
+	/// Select the CDLOD nodes for the current view (frustum culled if patch culling is on) and draw them: whole nodes, then quarter nodes
+	/// </summary>
+	void DrawCdlod()
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+		vmath::vec4 planes[6];
+		ExtractFrustumPlanes(camera_projection_matrix_ * camera_view_matrix_, planes);
+		GLuint node_count = terrain_quadtree_.SelectLod(patch_culling_ ? planes : NULL, camera_position_, cdlod_ranges_, max_height_, 1.0f, vmath::vec2(-32.0f),
+			cdlod_nodes_, &cdlod_stats_);
+		GLuint quarter_count = cdlod_stats_.quarter_nodes;
+
+		if (node_count > 0)
+		{
+			glNamedBufferSubData(cdlod_node_buffer_, 0, sizeof(TerrainLodNode) * node_count, cdlod_nodes_);
+		}
+		if (quarter_count > 0)
+		{
+			glNamedBufferSubData(cdlod_node_buffer_, sizeof(TerrainLodNode) * (kPatchTotal - quarter_count), sizeof(TerrainLodNode) * quarter_count,
+				cdlod_nodes_ + (kPatchTotal - quarter_count));
+		}
+
+		cdlod_time_ = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		glUseProgram(render_program_[kCdlod]);
+
+		glBindVertexArray(cdlod_vao_);
+
+		glUniformMatrix4fv(0, 1, GL_FALSE, camera_view_matrix_);
+		glUniformMatrix4fv(1, 1, GL_FALSE, camera_projection_matrix_);
+		glUniform1f(2, max_height_);
+		glUniform1i(7, lighting_);
+		glUniform2fv(9, kCdlodMaxLevels, cdlod_morph_ranges_);
+		glBindTextureUnit(0, texture_2d_heightmap);
+		glBindTextureUnit(1, texture_2d_color);
+		glBindTextureUnit(3, texture_2d_normal_);
+
+		glUniform1f(8, (float)kCdlodGridSide);
+		glDrawElementsInstancedBaseInstance(GL_TRIANGLES, cdlod_index_count_[0], GL_UNSIGNED_SHORT, (void*)(sizeof(GLushort) * cdlod_first_index_[0]), node_count, 0);
+
+		glUniform1f(8, (float)(kCdlodGridSide / 2));
+		glDrawElementsInstancedBaseInstance(GL_TRIANGLES, cdlod_index_count_[1], GL_UNSIGNED_SHORT, (void*)(sizeof(GLushort) * cdlod_first_index_[1]), quarter_count,
+			kPatchTotal - quarter_count);
+	}
+
+	/// <summary>
+	/// Fly the camera along a fixed path over the grid, drawing every frame with every program (tessellated ones over the visible patches),
+	/// and print GPU time, triangles and CPU culling / node selection time per frame to Output (on Debug mode)
+	/// Warning! Queries are read back right away (CPU-GPU synchronization): on demand only
+	/// </summary>
+	void BenchmarkCameraPath()
+	{
+		const int kPathFrames = 64;
+
+		GLuint queries[2];  // Time, triangles
+		glCreateQueries(GL_TIME_ELAPSED, 1, &queries[0]);
+		glCreateQueries(GL_PRIMITIVES_GENERATED, 1, &queries[1]);
+
+		vmath::vec3 camera_position = camera_position_;
+		for (unsigned int program = 0; program < kRenderProgramTotal; program++)
+		{
+			double gpu_milliseconds = 0.0;
+			double cpu_milliseconds = 0.0;
+			GLuint64 triangles = 0;
+			for (int frame = -1; frame < kPathFrames; frame++)  // Frame -1 warms up (first position)
+			{
+				// Across the grid (+Z to -Z), swaying sideways and up and down
+				float t = frame > 0 ? (float)frame / (kPathFrames - 1) : 0.0f;
+				camera_position_ = vmath::vec3(8.0f * sinf(t * 6.2831853f), 5.0f + 2.0f * sinf(t * 12.566371f), 32.0f - 64.0f * t);
+				UpdateCameraViewMatrix(camera_position_);
+
+				glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+				glBeginQuery(GL_PRIMITIVES_GENERATED, queries[1]);
+				GLuint visible_patch_count = program == kCdlod ? 0 : CullPatches();
+				DrawTerrain(program, pixel_error_, visible_patch_count);
+				glEndQuery(GL_TIME_ELAPSED);
+				glEndQuery(GL_PRIMITIVES_GENERATED);
+
+				GLuint64 nanoseconds = 0;
+				GLuint64 frame_triangles = 0;
+				glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &nanoseconds);
+				glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &frame_triangles);
+				if (frame >= 0)
+				{
+					gpu_milliseconds += nanoseconds / 1.0e6;
+					cpu_milliseconds += program == kCdlod ? cdlod_time_ : cull_time_;
+					triangles += frame_triangles;
+				}
+			}
+
+			char output[256];
+			sprintf_s(output, sizeof(output), "Terrain camera path (%s): %d frames; per frame %.3f ms GPU, %llu triangles, %.3f ms CPU (%s).\n",
+				kRenderProgramNames[program], kPathFrames, gpu_milliseconds / kPathFrames, (unsigned long long)(triangles / kPathFrames),
+				cpu_milliseconds / kPathFrames, program == kCdlod ? "node selection" : "patch culling");
+			OutputDebugStringA(output);
+		}
+
+		camera_position_ = camera_position;
+		UpdateCameraViewMatrix(camera_position_);
+
+		glDeleteQueries(2, queries);
+	}
+
+	void RemoveCdlod()
+	{
+		glDeleteVertexArrays(1, &cdlod_vao_);
+		glDeleteBuffers(1, &cdlod_mesh_buffer_);
+		glDeleteBuffers(1, &cdlod_index_buffer_);
+		glDeleteBuffers(1, &cdlod_node_buffer_);
+		delete[] cdlod_nodes_;
+	}
+
+#pragma endregion
+
+#pragma region Draw
+
+	/// <summary>
+	/// Draw the visible patches (see CullPatches) with a render program; pixel error is the target of the screen-space error program
+	/// Tessellated triangles are captured into the tessellation cache if requested; the CDLOD program selects and draws its own nodes
+	/// </summary>
+	void DrawTerrain(unsigned int program, float pixel_error, GLuint visible_patch_count, bool capture = false)
+	{
+		if (program == kCdlod)
+		{
+			DrawCdlod();  // Own node selection; not captured
+			return;
+		}
+
+		if (precomputed_levels_)
+		{
+			ComputeEdgeLevels(program, pixel_error);
+		}
+
+		glUseProgram(render_program_[program]);
+
+		glBindVertexArray(vao_);
+
+		glUniformMatrix4fv(0, 1, GL_FALSE, camera_view_matrix_);
+		glUniformMatrix4fv(1, 1, GL_FALSE, camera_projection_matrix_);
+		glUniform1f(2, max_height_);
+		glUniform1i(3, tcs_culling_);
+		if (program == kScreenSpaceError)
+		{
+			glUniform1f(4, (float)info.windowHeight);
+			glUniform1f(5, pixel_error);
+		}
+		glUniform1i(6, precomputed_levels_);
+		glUniform1i(7, lighting_);
+		glBindTextureUnit(0, texture_2d_heightmap);
+		glBindTextureUnit(1, texture_2d_color);
+		glBindTextureUnit(2, texture_2d_patch_error_);
+		glBindTextureUnit(3, texture_2d_normal_);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, patch_bounds_buffer_);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, edge_levels_buffer_);
+
+		glPatchParameteri(GL_PATCH_VERTICES, kPatchSize);
+
+		if (capture)
+		{
+			BeginTerrainCapture();
+		}
+		glDrawArraysInstanced(GL_PATCHES, 0, kPatchSize, visible_patch_count);
+		if (capture)
+		{
+			EndTerrainCapture();
+		}
+	}
+
+	/// <summary>
+	/// Draw the current view (filled) with every program into an offscreen framebuffer, and print triangles and image error against a reference to Output (on Debug mode)
+	/// Reference is the screen-space error program at a quarter of a pixel, close to the full heightmap resolution
+	/// Warning! Queries and pixels are read back right away (CPU-GPU synchronization): on demand only
+	/// </summary>
+	void CompareRenderPrograms(GLuint visible_patch_count)
+	{
+		struct Configuration
+		{
+			unsigned int program;
+			float pixel_error;
+		};
+		const Configuration kConfigurations[] =
+		{
+			{ kScreenSpaceError, 0.25f },  // Reference
+			{ kBookSample, 0.0f },
+			{ kDistanceToCamera, 0.0f },
+			{ kScreenSpaceError, 1.0f },
+			{ kScreenSpaceError, 2.0f },
+			{ kScreenSpaceError, 4.0f },
+			{ kScreenSpaceError, 8.0f },
+			{ kCdlod, 0.0f }
+		};
+		const int kConfigurationTotal = sizeof(kConfigurations) / sizeof(kConfigurations[0]);
+
+		GLsizei width = info.windowWidth;
+		GLsizei height = info.windowHeight;
+
+		GLuint framebuffer;
+		GLuint renderbuffers[2];  // Color, depth
+		glCreateFramebuffers(1, &framebuffer);
+		glCreateRenderbuffers(2, renderbuffers);
+		glNamedRenderbufferStorage(renderbuffers[0], GL_RGBA8, width, height);
+		glNamedRenderbufferStorage(renderbuffers[1], GL_DEPTH_COMPONENT32F, width, height);
+		glNamedFramebufferRenderbuffer(framebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+		glNamedFramebufferRenderbuffer(framebuffer, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+
+		GLuint query;
+		glCreateQueries(GL_PRIMITIVES_GENERATED, 1, &query);
+
+		std::vector<GLubyte> reference(width * height * 4);
+		std::vector<GLubyte> image(width * height * 4);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		glEnable(GL_DEPTH_TEST);
+
+		char output[256];
+		for (int i = 0; i < kConfigurationTotal; i++)
+		{
+			static const GLfloat kBlack[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+			glClearNamedFramebufferfv(framebuffer, GL_COLOR, 0, kBlack);
+			static const GLfloat kFarDepth = 1.0f;
+			glClearNamedFramebufferfv(framebuffer, GL_DEPTH, 0, &kFarDepth);
+
+			glBeginQuery(GL_PRIMITIVES_GENERATED, query);
+			DrawTerrain(kConfigurations[i].program, kConfigurations[i].pixel_error, visible_patch_count);
+			glEndQuery(GL_PRIMITIVES_GENERATED);
+
+			GLuint64 triangles = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &triangles);
+			glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, i == 0 ? reference.data() : image.data());
+
+			// Image error: PSNR over RGB, and share of pixels that differ noticeably (more than 8 / 255 in any channel)
+			double squared_error = 0.0;
+			GLuint differing_pixels = 0;
+			if (i > 0)
+			{
+				for (GLsizei pixel = 0; pixel < width * height; pixel++)
+				{
+					int max_difference = 0;
+					for (int channel = 0; channel < 3; channel++)
+					{
+						int difference = (int)image[pixel * 4 + channel] - (int)reference[pixel * 4 + channel];
+						squared_error += (double)(difference * difference);
+						max_difference = abs(difference) > max_difference ? abs(difference) : max_difference;
+					}
+					differing_pixels += max_difference > 8 ? 1 : 0;
+				}
+			}
+			double mse = squared_error / (3.0 * width * height);
+			double psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+
+			char name[64];
+			if (kConfigurations[i].program == kScreenSpaceError)
+			{
+				sprintf_s(name, sizeof(name), "%s (%.2f px)", kRenderProgramNames[kScreenSpaceError], kConfigurations[i].pixel_error);
+			}
+			else
+			{
+				sprintf_s(name, sizeof(name), "%s", kRenderProgramNames[kConfigurations[i].program]);
+			}
+
+			if (i == 0)
+			{
+				sprintf_s(output, sizeof(output), "Terrain comparison: %s [reference]: %llu triangles.\n", name, (unsigned long long)triangles);
+			}
+			else
+			{
+				sprintf_s(output, sizeof(output), "Terrain comparison: %s: %llu triangles; PSNR %.2f dB; %.2f%% pixels differ.\n",
+					name, (unsigned long long)triangles, psnr, 100.0 * differing_pixels / (width * height));
+			}
+			OutputDebugStringA(output);
+		}
+
+		glDisable(GL_DEPTH_TEST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-		texture_2d_heightmap = sb7::ktx::file::load("C:/workspace/sb7tutorials/resources/media/textures/terragen1.ktx");
-		texture_2d_color = sb7::ktx::file::load("C:/workspace/sb7tutorials/resources/media/textures/terragen_color.ktx");
+		glDeleteQueries(1, &query);
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteRenderbuffers(2, renderbuffers);
 	}
 
 #pragma endregion
@@ -196,8 +2718,18 @@ private:
 			"out VERTEX_DATA																			\n"
 			"{																							\n"
 			"	vec2 tc;																				\n"
+			"	vec2 height_bounds;																		\n"
 			"} out_vdata;																				\n"
 			"																							\n"
+			"// Index of the patch within the grid (see TerrainQuadtree): one per instance				\n"
+			"layout (location = 0) in int patch_index;													\n"
+			"																							\n"
+			"// Normalized height bounds (min, max) of every patch (see TerrainQuadtree)				\n"
+			"layout (binding = 0, std430) readonly buffer patch_bounds_block							\n"
+			"{																							\n"
+			"	vec2 patch_bounds[];																	\n"
+			"};																							\n"
+			"																							\n"
 			"void main(void)																			\n"
 			"{																							\n"
 			"	const vec4 vertices[4] = vec4[4](vec4( 0.0, 0.0, 1.0, 1.0),								\n"
@@ -206,16 +2738,17 @@ private:
 			"									 vec4( 1.0, 0.0, 0.0, 1.0));							\n"
 			"	const float patch_side = 1.0f;															\n"
 			"																							\n"
-			"	// Position of the patch within the grid (64 x 64) based on corresponding instance		\n"
-			"	// number gl_InstanceID range [0, patch_total) - where patch_total == 64 * 64 == 4096	\n"
+			"	// Position of the patch within the grid (64 x 64) based on corresponding patch			\n"
+			"	// index range [0, patch_total) - where patch_total == 64 * 64 == 4096					\n"
 			"	// Used mask (0x3F == 2**6 == 64) is the length (i.e. number of patches) of a grid row	\n"
 			"	// Using MSB for z-coordinate makes Z-axis to arrange patch arrays along X-axis  		\n"
-			"	int x = gl_InstanceID & 0x3F;  // From 6 LSBs (column)									\n"
-			"	int z = gl_InstanceID >> 6;  // From 6 MSBs (row) 										\n"
+			"	int x = patch_index & 0x3F;  // From 6 LSBs (column)									\n"
+			"	int z = patch_index >> 6;  // From 6 MSBs (row) 										\n"
 			"	vec2 grid_coord = vec2(x, z);															\n"
 			"																							\n"
 			"	// Texture coordinate (normalized along 64x64 grid) of the vertex						\n"
 			"	out_vdata.tc = (vertices[gl_VertexID].xz + grid_coord) / 64.0;							\n"
+			"	out_vdata.height_bounds = patch_bounds[patch_index];									\n"
 			"																							\n"
 			"	// Position of the vertex																\n"
 			"	// Before applying offset, the grid (and therefore patch position within it) must be	\n"
@@ -233,14 +2766,17 @@ private:
 		// Tess control shader
 		const char* tess_control_shader_source[] =
 		{
-			"#version 450 core																			\n"			
+			"#version 450 core																			\n"
 			"																							\n"
 			"layout (location = 0) uniform mat4 mv_matrix;												\n"
 			"layout (location = 1) uniform mat4 p_matrix;												\n"
+			"layout (location = 2) uniform float max_height;											\n"
+			"layout (location = 3) uniform bool frustum_culling;										\n"
 			"																							\n"
 			"in VERTEX_DATA																				\n"
 			"{																							\n"
 			"	vec2 tc;																				\n"
+			"	vec2 height_bounds;																		\n"
 			"} in_vdata[];																				\n"
 			"																							\n"
 			"out VERTEX_DATA																			\n"
@@ -248,11 +2784,33 @@ private:
 			"	vec2 tc;																				\n"
 			"} out_vdata[];																				\n"
 			"																							\n"
-			"layout (vertices = 4) out;																	\n"
-			"																							\n"
+			"layout (vertices = 4) out;																	\n",
+			kPatchFrustumCullingGlsl,
+			kPrecomputedEdgeLevelsGlsl,
 			"void main(void)																			\n"
 			"{																							\n"
-			"	if (gl_InvocationID == 0)																\n"
+			"	if (gl_InvocationID == 0 && frustum_culling && patchOutsideFrustum())					\n"
+			"	{																						\n"
+			"		// Patch is discarded: no tessellation, so no TES invocation at all					\n"
+			"		gl_TessLevelOuter[0] = 0.0;															\n"
+			"		gl_TessLevelOuter[1] = 0.0;															\n"
+			"		gl_TessLevelOuter[2] = 0.0;															\n"
+			"		gl_TessLevelOuter[3] = 0.0;															\n"
+			"		gl_TessLevelInner[0] = 0.0;															\n"
+			"		gl_TessLevelInner[1] = 0.0;															\n"
+			"	}																						\n"
+			"	else if (gl_InvocationID == 0 && precomputed_levels)									\n"
+			"	{																						\n"
+			"		// Edge levels computed once per grid edge (see ComputeEdgeLevels)					\n"
+			"		vec4 outer = precomputedOuterLevels();												\n"
+			"		gl_TessLevelOuter[0] = outer.x;														\n"
+			"		gl_TessLevelOuter[1] = outer.y;														\n"
+			"		gl_TessLevelOuter[2] = outer.z;														\n"
+			"		gl_TessLevelOuter[3] = outer.w;														\n"
+			"		gl_TessLevelInner[0] = min(outer.y, outer.w);										\n"
+			"		gl_TessLevelInner[1] = min(outer.x, outer.z);										\n"
+			"	}																						\n"
+			"	else if (gl_InvocationID == 0)															\n"
 			"	{																						\n"
 			"		// Get vertices NDC coordinates														\n"
 			"		vec4 p0 = p_matrix * mv_matrix * gl_in[0].gl_Position;								\n"
@@ -287,7 +2845,7 @@ private:
 		};
 
 		GLuint tess_control_shader = glCreateShader(GL_TESS_CONTROL_SHADER);
-		glShaderSource(tess_control_shader, 1, tess_control_shader_source, NULL);
+		glShaderSource(tess_control_shader, sizeof(tess_control_shader_source) / sizeof(tess_control_shader_source[0]), tess_control_shader_source, NULL);
 		glCompileShader(tess_control_shader);
 
 		// Tess evaluation shader
@@ -339,8 +2897,11 @@ private:
 		{
 			"#version 450 core																			\n"
 			"																							\n"
-			"layout (binding = 1) uniform sampler2D tex_color;											\n"
+			"layout (location = 2) uniform float max_height;											\n"
+			"layout (location = 7) uniform bool lighting;												\n"
 			"																							\n"
+			"layout (binding = 1) uniform sampler2D tex_color;											\n",
+			kTerrainLightingGlsl,
 			"in VERTEX_DATA																				\n"
 			"{																							\n"
 			"	vec2 tc;																				\n"
@@ -351,11 +2912,16 @@ private:
 			"void main(void)																			\n"
 			"{																							\n"
 			"	color = texture(tex_color, in_vdata.tc);												\n"
+			"																							\n"
+			"	if (lighting)																			\n"
+			"	{																						\n"
+			"		color.rgb = terrainLighting(color.rgb, in_vdata.tc);								\n"
+			"	}																						\n"
 			"}																							\n"
 		};
 
 		GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragment_shader, 1, fragment_shader_source, NULL);
+		glShaderSource(fragment_shader, sizeof(fragment_shader_source) / sizeof(fragment_shader_source[0]), fragment_shader_source, NULL);
 		glCompileShader(fragment_shader);
 
 		// Program
@@ -364,6 +2930,7 @@ private:
 		glAttachShader(render_program_[kBookSample], tess_control_shader);
 		glAttachShader(render_program_[kBookSample], tess_evaluation_shader);
 		glAttachShader(render_program_[kBookSample], fragment_shader);
+		glTransformFeedbackVaryings(render_program_[kBookSample], 2, kTerrainCacheVaryings, GL_INTERLEAVED_ATTRIBS);  // See BeginTerrainCapture
 		glLinkProgram(render_program_[kBookSample]);
 
 		// Free resources
@@ -383,8 +2950,18 @@ private:
 			"out VERTEX_DATA																			\n"
 			"{																							\n"
 			"	vec2 tc;																				\n"
+			"	vec2 height_bounds;																		\n"
 			"} out_vdata;																				\n"
 			"																							\n"
+			"// Index of the patch within the grid (see TerrainQuadtree): one per instance				\n"
+			"layout (location = 0) in int patch_index;													\n"
+			"																							\n"
+			"// Normalized height bounds (min, max) of every patch (see TerrainQuadtree)				\n"
+			"layout (binding = 0, std430) readonly buffer patch_bounds_block							\n"
+			"{																							\n"
+			"	vec2 patch_bounds[];																	\n"
+			"};																							\n"
+			"																							\n"
 			"void main(void)																			\n"
 			"{																							\n"
 			"	const vec4 vertices[4] = vec4[4](vec4( 0.0, 0.0, 1.0, 1.0),								\n"
@@ -393,16 +2970,17 @@ private:
 			"									 vec4( 1.0, 0.0, 0.0, 1.0));							\n"
 			"	const float patch_side = 1.0f;															\n"
 			"																							\n"
-			"	// Position of the patch within the grid (64 x 64) based on corresponding instance		\n"
-			"	// number gl_InstanceID range [0, patch_total) - where patch_total == 64 * 64 == 4096	\n"
+			"	// Position of the patch within the grid (64 x 64) based on corresponding patch			\n"
+			"	// index range [0, patch_total) - where patch_total == 64 * 64 == 4096					\n"
 			"	// Used mask (0x3F == 2**6 == 64) is the length (i.e. number of patches) of a grid row	\n"
 			"	// Using MSB for z-coordinate makes Z-axis to arrange patch arrays along X-axis  		\n"
-			"	int x = gl_InstanceID & 0x3F;  // From 6 LSBs (column)									\n"
-			"	int z = gl_InstanceID >> 6;  // From 6 MSBs (row) 										\n"
+			"	int x = patch_index & 0x3F;  // From 6 LSBs (column)									\n"
+			"	int z = patch_index >> 6;  // From 6 MSBs (row) 										\n"
 			"	vec2 grid_coord = vec2(x, z);															\n"
 			"																							\n"
 			"	// Texture coordinate (normalized along 64x64 grid) of the vertex						\n"
 			"	out_vdata.tc = (vertices[gl_VertexID].xz + grid_coord) / 64.0;							\n"
+			"	out_vdata.height_bounds = patch_bounds[patch_index];									\n"
 			"																							\n"
 			"	// Position of the vertex																\n"
 			"	// Before applying offset, the grid (and therefore patch position within it) must be	\n"
@@ -424,10 +3002,13 @@ private:
 			"																							\n"
 			"layout (location = 0) uniform mat4 mv_matrix;												\n"
 			"layout (location = 1) uniform mat4 p_matrix;												\n"
+			"layout (location = 2) uniform float max_height;											\n"
+			"layout (location = 3) uniform bool frustum_culling;										\n"
 			"																							\n"
 			"in VERTEX_DATA																				\n"
 			"{																							\n"
 			"	vec2 tc;																				\n"
+			"	vec2 height_bounds;																		\n"
 			"} in_vdata[];																				\n"
 			"																							\n"
 			"out VERTEX_DATA																			\n"
@@ -435,11 +3016,33 @@ private:
 			"	vec2 tc;																				\n"
 			"} out_vdata[];																				\n"
 			"																							\n"
-			"layout (vertices = 4) out;																	\n"
-			"																							\n"
+			"layout (vertices = 4) out;																	\n",
+			kPatchFrustumCullingGlsl,
+			kPrecomputedEdgeLevelsGlsl,
 			"void main(void)																			\n"
 			"{																							\n"
-			"	if (gl_InvocationID == 0)																\n"
+			"	if (gl_InvocationID == 0 && frustum_culling && patchOutsideFrustum())					\n"
+			"	{																						\n"
+			"		// Patch is discarded: no tessellation, so no TES invocation at all					\n"
+			"		gl_TessLevelOuter[0] = 0.0;															\n"
+			"		gl_TessLevelOuter[1] = 0.0;															\n"
+			"		gl_TessLevelOuter[2] = 0.0;															\n"
+			"		gl_TessLevelOuter[3] = 0.0;															\n"
+			"		gl_TessLevelInner[0] = 0.0;															\n"
+			"		gl_TessLevelInner[1] = 0.0;															\n"
+			"	}																						\n"
+			"	else if (gl_InvocationID == 0 && precomputed_levels)									\n"
+			"	{																						\n"
+			"		// Edge levels computed once per grid edge (see ComputeEdgeLevels)					\n"
+			"		vec4 outer = precomputedOuterLevels();												\n"
+			"		gl_TessLevelOuter[0] = outer.x;														\n"
+			"		gl_TessLevelOuter[1] = outer.y;														\n"
+			"		gl_TessLevelOuter[2] = outer.z;														\n"
+			"		gl_TessLevelOuter[3] = outer.w;														\n"
+			"		gl_TessLevelInner[0] = max(outer.y, outer.w);										\n"
+			"		gl_TessLevelInner[1] = max(outer.x, outer.z);										\n"
+			"	}																						\n"
+			"	else if (gl_InvocationID == 0)															\n"
 			"	{																						\n"
 			"		// Vertices position in view space													\n"
 			"		vec4 p0 = mv_matrix * gl_in[0].gl_Position;											\n"
@@ -490,7 +3093,7 @@ private:
 		};
 
 		GLuint tess_control_shader = glCreateShader(GL_TESS_CONTROL_SHADER);
-		glShaderSource(tess_control_shader, 1, tess_control_shader_source, NULL);
+		glShaderSource(tess_control_shader, sizeof(tess_control_shader_source) / sizeof(tess_control_shader_source[0]), tess_control_shader_source, NULL);
 		glCompileShader(tess_control_shader);
 
 		// Tess evaluation shader
@@ -542,8 +3145,11 @@ private:
 		{
 			"#version 450 core																			\n"
 			"																							\n"
-			"layout (binding = 1) uniform sampler2D tex_color;											\n"
+			"layout (location = 2) uniform float max_height;											\n"
+			"layout (location = 7) uniform bool lighting;												\n"
 			"																							\n"
+			"layout (binding = 1) uniform sampler2D tex_color;											\n",
+			kTerrainLightingGlsl,
 			"in VERTEX_DATA																				\n"
 			"{																							\n"
 			"	vec2 tc;																				\n"
@@ -554,11 +3160,16 @@ private:
 			"void main(void)																			\n"
 			"{																							\n"
 			"	color = texture(tex_color, in_vdata.tc);												\n"
+			"																							\n"
+			"	if (lighting)																			\n"
+			"	{																						\n"
+			"		color.rgb = terrainLighting(color.rgb, in_vdata.tc);								\n"
+			"	}																						\n"
 			"}																							\n"
 		};
 
 		GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragment_shader, 1, fragment_shader_source, NULL);
+		glShaderSource(fragment_shader, sizeof(fragment_shader_source) / sizeof(fragment_shader_source[0]), fragment_shader_source, NULL);
 		glCompileShader(fragment_shader);
 
 		// Program
@@ -567,6 +3178,7 @@ private:
 		glAttachShader(render_program_[kDistanceToCamera], tess_control_shader);
 		glAttachShader(render_program_[kDistanceToCamera], tess_evaluation_shader);
 		glAttachShader(render_program_[kDistanceToCamera], fragment_shader);
+		glTransformFeedbackVaryings(render_program_[kDistanceToCamera], 2, kTerrainCacheVaryings, GL_INTERLEAVED_ATTRIBS);  // See BeginTerrainCapture
 		glLinkProgram(render_program_[kDistanceToCamera]);
 
 		// Free resources
@@ -576,6 +3188,347 @@ private:
 		glDeleteShader(fragment_shader);
 	}
 
+	/// <summary>
+	/// Height error of every patch (RGBA: tessellation levels 1, 2, 4 and 8) used by the screen-space error program
+	/// Error of a level is the max distance between the filtered heightmap and the bilinear surface through the heights at the level grid vertices, in normalized height units
+	/// </summary>
+	void InitializePatchErrorTexture()
+	{
+		const int kLevels[4] = { 1, 2, 4, 8 };
+
+		// Samples per patch side: twice the heightmap texels, and a multiple of every level
+		int texels_per_patch = (heightmap_width_ > heightmap_height_ ? heightmap_width_ : heightmap_height_) / kGridSide;
+		int samples = 2 * texels_per_patch < 16 ? 16 : 2 * texels_per_patch;
+		samples = (samples + 7) / 8 * 8;
+
+		std::vector<float> heights((samples + 1) * (samples + 1));
+		std::vector<vmath::vec4> errors(kPatchTotal);
+		for (int z = 0; z < kGridSide; z++)
+		{
+			for (int x = 0; x < kGridSide; x++)
+			{
+				for (int j = 0; j <= samples; j++)
+				{
+					for (int i = 0; i <= samples; i++)
+					{
+						heights[j * (samples + 1) + i] = SampleHeightmap((x + (float)i / samples) / kGridSide, (z + (float)j / samples) / kGridSide);
+					}
+				}
+
+				vmath::vec4 error;
+				for (int l = 0; l < 4; l++)
+				{
+					int step = samples / kLevels[l];  // Samples between level grid vertices
+					float max_error = 0.0f;
+					for (int j = 0; j <= samples; j++)
+					{
+						for (int i = 0; i <= samples; i++)
+						{
+							// Level grid cell of the sample, and bilinear interpolation of its corners
+							int ci = i / step < kLevels[l] ? i / step : kLevels[l] - 1;
+							int cj = j / step < kLevels[l] ? j / step : kLevels[l] - 1;
+							float fi = (float)(i - ci * step) / step;
+							float fj = (float)(j - cj * step) / step;
+							float h00 = heights[(cj * step) * (samples + 1) + ci * step];
+							float h10 = heights[(cj * step) * (samples + 1) + (ci + 1) * step];
+							float h01 = heights[((cj + 1) * step) * (samples + 1) + ci * step];
+							float h11 = heights[((cj + 1) * step) * (samples + 1) + (ci + 1) * step];
+							float interpolated = (h00 * (1.0f - fi) + h10 * fi) * (1.0f - fj) + (h01 * (1.0f - fi) + h11 * fi) * fj;
+
+							float sample_error = fabsf(heights[j * (samples + 1) + i] - interpolated);
+							max_error = sample_error > max_error ? sample_error : max_error;
+						}
+					}
+
+					// Error never grows with the level (level selection relies on it)
+					error[l] = l > 0 && error[l - 1] < max_error ? error[l - 1] : max_error;
+				}
+
+				errors[z * kGridSide + x] = error;
+			}
+		}
+
+		glCreateTextures(GL_TEXTURE_2D, 1, &texture_2d_patch_error_);
+		glTextureStorage2D(texture_2d_patch_error_, 1, GL_RGBA32F, kGridSide, kGridSide);
+		glTextureSubImage2D(texture_2d_patch_error_, 0, 0, 0, kGridSide, kGridSide, GL_RGBA, GL_FLOAT, errors.data());
+	}
+
+	void InitializeProgram3()
+	{
+		// Vertex shader
+		const char* vertex_shader_source[] =
+		{
+			"#version 450 core																			\n"
+			"																							\n"
+			"out VERTEX_DATA																			\n"
+			"{																							\n"
+			"	vec2 tc;																				\n"
+			"	vec2 height_bounds;																		\n"
+			"} out_vdata;																				\n"
+			"																							\n"
+			"// Index of the patch within the grid (see TerrainQuadtree): one per instance				\n"
+			"layout (location = 0) in int patch_index;													\n"
+			"																							\n"
+			"// Normalized height bounds (min, max) of every patch (see TerrainQuadtree)				\n"
+			"layout (binding = 0, std430) readonly buffer patch_bounds_block							\n"
+			"{																							\n"
+			"	vec2 patch_bounds[];																	\n"
+			"};																							\n"
+			"																							\n"
+			"void main(void)																			\n"
+			"{																							\n"
+			"	const vec4 vertices[4] = vec4[4](vec4( 0.0, 0.0, 1.0, 1.0),								\n"
+			"									 vec4( 1.0, 0.0, 1.0, 1.0),								\n"
+			"									 vec4( 0.0, 0.0, 0.0, 1.0),								\n"
+			"									 vec4( 1.0, 0.0, 0.0, 1.0));							\n"
+			"	const float patch_side = 1.0f;															\n"
+			"																							\n"
+			"	// Position of the patch within the grid (64 x 64) based on corresponding patch			\n"
+			"	// index range [0, patch_total) - where patch_total == 64 * 64 == 4096					\n"
+			"	// Used mask (0x3F == 2**6 == 64) is the length (i.e. number of patches) of a grid row	\n"
+			"	// Using MSB for z-coordinate makes Z-axis to arrange patch arrays along X-axis  		\n"
+			"	int x = patch_index & 0x3F;  // From 6 LSBs (column)									\n"
+			"	int z = patch_index >> 6;  // From 6 MSBs (row) 										\n"
+			"	vec2 grid_coord = vec2(x, z);															\n"
+			"																							\n"
+			"	// Texture coordinate (normalized along 64x64 grid) of the vertex						\n"
+			"	out_vdata.tc = (vertices[gl_VertexID].xz + grid_coord) / 64.0;							\n"
+			"	out_vdata.height_bounds = patch_bounds[patch_index];									\n"
+			"																							\n"
+			"	// Position of the vertex																\n"
+			"	// Before applying offset, the grid (and therefore patch position within it) must be	\n"
+			"	// centered in the origin (substract half of the grid row length)						\n"
+			"	vec2 centered_grid_coord = grid_coord + vec2(-32.0); 									\n"
+			"	gl_Position = vertices[gl_VertexID] + vec4(centered_grid_coord.x, 0.0,					\n"
+			"											   centered_grid_coord.y, 0.0) * patch_side;	\n"
+			"}																							\n"
+		};
+
+		GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(vertex_shader, 1, vertex_shader_source, NULL);
+		glCompileShader(vertex_shader);
+
+		// Tess control shader
+		const char* tess_control_shader_source[] =
+		{
+			"#version 450 core																			\n"
+			"																							\n"
+			"layout (location = 0) uniform mat4 mv_matrix;												\n"
+			"layout (location = 1) uniform mat4 p_matrix;												\n"
+			"layout (location = 2) uniform float max_height;											\n"
+			"layout (location = 3) uniform bool frustum_culling;										\n"
+			"layout (location = 4) uniform float viewport_height;  // Pixels							\n"
+			"layout (location = 5) uniform float pixel_error;  // Target (max) screen-space error, in pixels\n"
+			"																							\n"
+			"// Height error of every patch (normalized) at tessellation levels 1, 2, 4 and 8 (see InitializePatchErrorTexture)\n"
+			"layout (binding = 2) uniform sampler2D tex_patch_error;									\n"
+			"																							\n"
+			"in VERTEX_DATA																				\n"
+			"{																							\n"
+			"	vec2 tc;																				\n"
+			"	vec2 height_bounds;																		\n"
+			"} in_vdata[];																				\n"
+			"																							\n"
+			"out VERTEX_DATA																			\n"
+			"{																							\n"
+			"	vec2 tc;																				\n"
+			"} out_vdata[];																				\n"
+			"																							\n"
+			"layout (vertices = 4) out;																	\n"
+			"																							\n",
+			kPatchFrustumCullingGlsl,
+			kPrecomputedEdgeLevelsGlsl,
+			"// Height error of the patch containing a point (texture coordinate); none outside the grid\n"
+			"vec4 patchError(vec2 tc)																	\n"
+			"{																							\n"
+			"	ivec2 patch_coord = ivec2(floor(tc * 64.0));											\n"
+			"	if (any(lessThan(patch_coord, ivec2(0))) || any(greaterThanEqual(patch_coord, ivec2(64))))\n"
+			"	{																						\n"
+			"		return vec4(0.0);																	\n"
+			"	}																						\n"
+			"																							\n"
+			"	return texelFetch(tex_patch_error, patch_coord, 0);										\n"
+			"}																							\n"
+			"																							\n"
+			"// Tessellation level of the edge between vertices a and b: lowest level whose height error,\n"
+			"// projected at the middle point of the edge, is within the target pixel error				\n"
+			"float edgeLevel(int a, int b)																\n"
+			"{																							\n"
+			"	// Worst error of both patches sharing the edge (centers of both, half a patch away from the\n"
+			"	// middle point), so both get the same level and no crack opens between them			\n"
+			"	vec2 tc_middle = mix(in_vdata[a].tc, in_vdata[b].tc, 0.5);								\n"
+			"	vec2 tc_edge = in_vdata[b].tc - in_vdata[a].tc;											\n"
+			"	vec2 tc_side = vec2(tc_edge.y, -tc_edge.x) * 0.5;										\n"
+			"	vec4 error = max(patchError(tc_middle + tc_side), patchError(tc_middle - tc_side));		\n"
+			"																							\n"
+			"	// World units to pixels at the distance of the middle point (p_matrix[1][1] == cot(fov / 2))\n"
+			"	vec4 middle = mv_matrix * mix(gl_in[a].gl_Position, gl_in[b].gl_Position, 0.5);			\n"
+			"	float pixels_per_unit = p_matrix[1][1] * 0.5 * viewport_height / max(length(middle.xyz), 0.001);\n"
+			"	vec4 pixels = error * abs(max_height) * pixels_per_unit;								\n"
+			"																							\n"
+			"	// Error decreases with the level: interpolate between the levels bracketing the target	\n"
+			"	if (pixels.x <= pixel_error)															\n"
+			"	{																						\n"
+			"		return 1.0;																			\n"
+			"	}																						\n"
+			"	if (pixels.y <= pixel_error)															\n"
+			"	{																						\n"
+			"		return mix(1.0, 2.0, (pixels.x - pixel_error) / (pixels.x - pixels.y));				\n"
+			"	}																						\n"
+			"	if (pixels.z <= pixel_error)															\n"
+			"	{																						\n"
+			"		return mix(2.0, 4.0, (pixels.y - pixel_error) / (pixels.y - pixels.z));				\n"
+			"	}																						\n"
+			"	if (pixels.w <= pixel_error)															\n"
+			"	{																						\n"
+			"		return mix(4.0, 8.0, (pixels.z - pixel_error) / (pixels.z - pixels.w));				\n"
+			"	}																						\n"
+			"																							\n"
+			"	// Beyond level 8 error is assumed to fall as 1 / level^2 (smooth surface between samples)\n"
+			"	return min(8.0 * sqrt(pixels.w / pixel_error), 64.0);									\n"
+			"}																							\n"
+			"																							\n"
+			"void main(void)																			\n"
+			"{																							\n"
+			"	if (gl_InvocationID == 0 && frustum_culling && patchOutsideFrustum())					\n"
+			"	{																						\n"
+			"		// Patch is discarded: no tessellation, so no TES invocation at all					\n"
+			"		gl_TessLevelOuter[0] = 0.0;															\n"
+			"		gl_TessLevelOuter[1] = 0.0;															\n"
+			"		gl_TessLevelOuter[2] = 0.0;															\n"
+			"		gl_TessLevelOuter[3] = 0.0;															\n"
+			"		gl_TessLevelInner[0] = 0.0;															\n"
+			"		gl_TessLevelInner[1] = 0.0;															\n"
+			"	}																						\n"
+			"	else if (gl_InvocationID == 0 && precomputed_levels)									\n"
+			"	{																						\n"
+			"		// Edge levels computed once per grid edge (see ComputeEdgeLevels)					\n"
+			"		vec4 outer = precomputedOuterLevels();												\n"
+			"		gl_TessLevelOuter[0] = outer.x;														\n"
+			"		gl_TessLevelOuter[1] = outer.y;														\n"
+			"		gl_TessLevelOuter[2] = outer.z;														\n"
+			"		gl_TessLevelOuter[3] = outer.w;														\n"
+			"		gl_TessLevelInner[0] = max(outer.y, outer.w);										\n"
+			"		gl_TessLevelInner[1] = max(outer.x, outer.z);										\n"
+			"	}																						\n"
+			"	else if (gl_InvocationID == 0)															\n"
+			"	{																						\n"
+			"		// Same edges as the other programs													\n"
+			"		float tle0 = edgeLevel(0, 2);														\n"
+			"		float tle1 = edgeLevel(1, 0);														\n"
+			"		float tle2 = edgeLevel(3, 1);														\n"
+			"		float tle3 = edgeLevel(2, 3);														\n"
+			"																							\n"
+			"		gl_TessLevelOuter[0] = tle0;														\n"
+			"		gl_TessLevelOuter[1] = tle1;														\n"
+			"		gl_TessLevelOuter[2] = tle2;														\n"
+			"		gl_TessLevelOuter[3] = tle3;														\n"
+			"		gl_TessLevelInner[0] = max(tle1, tle3);												\n"
+			"		gl_TessLevelInner[1] = max(tle0, tle2);												\n"
+			"	}																						\n"
+			"																							\n"
+			"	// Set output patch data																\n"
+			"	out_vdata[gl_InvocationID].tc = in_vdata[gl_InvocationID].tc;							\n"
+			"	gl_out[gl_InvocationID].gl_Position = gl_in[gl_InvocationID].gl_Position;				\n"
+			"}																							\n"
+		};
+
+		GLuint tess_control_shader = glCreateShader(GL_TESS_CONTROL_SHADER);
+		glShaderSource(tess_control_shader, sizeof(tess_control_shader_source) / sizeof(tess_control_shader_source[0]), tess_control_shader_source, NULL);
+		glCompileShader(tess_control_shader);
+
+		// Tess evaluation shader
+		const char* tess_evaluation_shader_source[] =
+		{
+			"#version 450 core																			\n"
+			"																							\n"
+			"layout (location = 0) uniform mat4 mv_matrix;												\n"
+			"layout (location = 1) uniform mat4 p_matrix;												\n"
+			"layout (location = 2) uniform float max_height;											\n"
+			"																							\n"
+			"layout (binding = 0) uniform sampler2D tex_heightmap;										\n"
+			"																							\n"
+			"layout (quads, fractional_odd_spacing) in;													\n"
+			"																							\n"
+			"in VERTEX_DATA																				\n"
+			"{																							\n"
+			"	vec2 tc;																				\n"
+			"} in_vdata[];																				\n"
+			"																							\n"
+			"out VERTEX_DATA																			\n"
+			"{																							\n"
+			"	vec2 tc;																				\n"
+			"} out_vdata;																				\n"
+			"																							\n"
+			"void main(void)																			\n"
+			"{																							\n"
+			"	vec2 tc1 = mix(in_vdata[0].tc, in_vdata[1].tc, gl_TessCoord.x);							\n"
+			"	vec2 tc2 = mix(in_vdata[2].tc, in_vdata[3].tc, gl_TessCoord.x);							\n"
+			"	vec2 tc = mix(tc1, tc2, gl_TessCoord.y);												\n"
+			"																							\n"
+			"	vec4 p1 = mix(gl_in[0].gl_Position, gl_in[1].gl_Position, gl_TessCoord.x);				\n"
+			"	vec4 p2 = mix(gl_in[2].gl_Position, gl_in[3].gl_Position, gl_TessCoord.x);				\n"
+			"	vec4 p = mix(p1, p2, gl_TessCoord.y);													\n"
+			"																							\n"
+			"	p.y += texture(tex_heightmap, tc).r * max_height;										\n"
+			"																							\n"
+			"	gl_Position = p_matrix * mv_matrix * p;													\n"
+			"	out_vdata.tc = tc;																		\n"
+			"}																							\n"
+		};
+
+		GLuint tess_evaluation_shader = glCreateShader(GL_TESS_EVALUATION_SHADER);
+		glShaderSource(tess_evaluation_shader, 1, tess_evaluation_shader_source, NULL);
+		glCompileShader(tess_evaluation_shader);
+
+		// Fragment shader
+		const char* fragment_shader_source[] =
+		{
+			"#version 450 core																			\n"
+			"																							\n"
+			"layout (location = 2) uniform float max_height;											\n"
+			"layout (location = 7) uniform bool lighting;												\n"
+			"																							\n"
+			"layout (binding = 1) uniform sampler2D tex_color;											\n",
+			kTerrainLightingGlsl,
+			"in VERTEX_DATA																				\n"
+			"{																							\n"
+			"	vec2 tc;																				\n"
+			"} in_vdata;																				\n"
+			"																							\n"
+			"layout (location = 0) out vec4 color;														\n"
+			"																							\n"
+			"void main(void)																			\n"
+			"{																							\n"
+			"	color = texture(tex_color, in_vdata.tc);												\n"
+			"																							\n"
+			"	if (lighting)																			\n"
+			"	{																						\n"
+			"		color.rgb = terrainLighting(color.rgb, in_vdata.tc);								\n"
+			"	}																						\n"
+			"}																							\n"
+		};
+
+		GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(fragment_shader, sizeof(fragment_shader_source) / sizeof(fragment_shader_source[0]), fragment_shader_source, NULL);
+		glCompileShader(fragment_shader);
+
+		// Program
+		render_program_[kScreenSpaceError] = glCreateProgram();
+		glAttachShader(render_program_[kScreenSpaceError], vertex_shader);
+		glAttachShader(render_program_[kScreenSpaceError], tess_control_shader);
+		glAttachShader(render_program_[kScreenSpaceError], tess_evaluation_shader);
+		glAttachShader(render_program_[kScreenSpaceError], fragment_shader);
+		glTransformFeedbackVaryings(render_program_[kScreenSpaceError], 2, kTerrainCacheVaryings, GL_INTERLEAVED_ATTRIBS);  // See BeginTerrainCapture
+		glLinkProgram(render_program_[kScreenSpaceError]);
+
+		// Free resources
+		glDeleteShader(vertex_shader);
+		glDeleteShader(tess_control_shader);
+		glDeleteShader(tess_evaluation_shader);
+		glDeleteShader(fragment_shader);
+	}
+
 #pragma endregion
 
 private:
@@ -587,11 +3540,136 @@ private:
 	GLuint texture_2d_heightmap;
 	GLuint texture_2d_color;
 
-	GLuint render_program_[2];
+	GLuint render_program_[kRenderProgramTotal];
 	unsigned int render_program_index_;
 	float max_height_;
 	float height_step_;
 	bool wireframe_mode_;
+
+	TerrainQuadtree terrain_quadtree_;
+	GLuint patch_buffer_;  // Visible patch indices (instanced vertex attribute)
+	GLuint* visible_patches_;
+	bool patch_culling_;
+	TerrainCullStats cull_stats_ = { 0, 0 };
+	double cull_time_ = 0.0;  // Milliseconds (CPU side)
+	GLuint patch_bounds_buffer_;  // Normalized height bounds per patch (TCS culling)
+	bool tcs_culling_;
+
+	// Pipeline statistics queries (ring of kQueryRingSize frames)
+	static const GLuint kQueryRingSize = 4;
+	GLuint tcs_patch_queries_[kQueryRingSize];
+	GLuint tes_invocation_queries_[kQueryRingSize];
+	GLuint query_frame_ = 0;
+	GLuint64 tcs_patches_ = 0;
+	GLuint64 tes_invocations_ = 0;
+	GLuint primitive_queries_[kQueryRingSize];
+	GLuint64 triangles_ = 0;
+	GLuint time_queries_[kQueryRingSize];
+	double gpu_time_ = 0.0;  // Milliseconds of the terrain draw
+
+	// CPU copy of the heightmap
+	std::vector<float> heightmap_;
+	GLint heightmap_width_ = 0;
+	GLint heightmap_height_ = 0;
+
+	// Normal map (height gradients, see terrainnormalmap.h)
+	GLuint texture_2d_normal_;
+	GLuint normal_map_program_;
+	bool lighting_ = true;
+
+	// CPU height field (height queries and ray casts, see terrainheightfield.h)
+	TerrainHeightField terrain_height_field_;
+	static const GLuint kHeightQueryTotal = 4 * 1024 * 1024;
+	static const GLuint kRayTotal = 64 * 1024;
+	static const GLuint kValidatedRayTotal = 4 * 1024;  // Also ray marched
+	bool benchmark_height_field_ = false;
+
+	// Screen-space error program
+	GLuint texture_2d_patch_error_;
+	const float kPixelErrors[5] = { 0.5f, 1.0f, 2.0f, 4.0f, 8.0f };
+	unsigned int pixel_error_index_ = 1;
+	float pixel_error_ = 1.0f;  // Pixels
+	bool compare_render_programs_ = false;
+	const char* kRenderProgramNames[kRenderProgramTotal] = { "book sample", "distance to camera", "screen-space error", "CDLOD" };
+
+	// Edge levels precomputed once per grid edge (compute pass), instead of per patch in the tess control shader
+	static const GLuint kGridVertexTotal = (kGridSide + 1) * (kGridSide + 1);
+	static const GLuint kEdgeTotal = 2 * (kGridSide + 1) * kGridSide;
+	GLuint edge_level_program_;
+	GLuint edge_levels_buffer_;
+	GLuint grid_vertices_buffer_;
+	bool precomputed_levels_ = true;
+	bool benchmark_edge_levels_ = false;
+
+	// CDLOD: grid meshes instanced over the quadtree nodes selected by distance (see TerrainQuadtree::SelectLod), for systems without fast tessellation
+	static const int kCdlodGridSide = 16;  // Quads per side of a whole node mesh (quarter nodes: half)
+	static const int kCdlodMaxLevels = 8;  // Uniform array size (quadtree levels: 7)
+	const float kCdlodLeafRange = 4.0f;  // World units up to which patch sized nodes are drawn; doubles per level
+	const float kCdlodMorphStart = 0.7f;  // Share of a level band after which vertices morph to the next level
+	GLuint cdlod_vao_;
+	GLuint cdlod_mesh_buffer_;
+	GLuint cdlod_index_buffer_;
+	GLuint cdlod_node_buffer_;  // Selected nodes (instanced attribute)
+	GLuint cdlod_first_index_[2];  // Whole, quarter node mesh
+	GLuint cdlod_index_count_[2];
+	TerrainLodNode* cdlod_nodes_;
+	float cdlod_ranges_[kCdlodMaxLevels];
+	GLfloat cdlod_morph_ranges_[2 * kCdlodMaxLevels];  // Start, end per level
+	TerrainLodStats cdlod_stats_ = { 0, 0, 0 };
+	double cdlod_time_ = 0.0;  // Milliseconds (CPU side)
+	bool benchmark_camera_path_ = false;
+
+	// Clipmap (streamed world)
+	unsigned int terrain_mode_ = kFixedGrid;
+	TerrainPager terrain_pager_;
+	TerrainClipmap terrain_clipmap_;
+	GLuint clipmap_program_;
+	GLuint clipmap_vao_;
+	GLuint clipmap_patch_buffer_;  // Patches drawn (instanced attribute)
+	GLuint* clipmap_patches_;
+	const size_t kClipmapCacheBudget = 16 * 1024 * 1024;  // Bytes of tiles kept in memory
+	const float kClipmapCameraSpeed = 8.0f;  // Camera step multiplier (the world is much bigger)
+
+	// Procedural terrain
+	GLuint procedural_program_;
+	bool compare_terrain_sources_ = false;
+
+	// Tessellation cache: triangles of the fixed grid captured with transform feedback, drawn again while nothing they depend on changes
+	struct TerrainCacheKey
+	{
+		vmath::vec3 camera_position;
+		float max_height;
+		unsigned int program;
+		float pixel_error;
+		bool tcs_culling;
+		bool precomputed_levels;
+		int width;
+		int height;
+	};
+	enum TerrainCacheState
+	{
+		kCacheStale,  // Something changed on this frame
+		kCacheCapture,  // Stationary: capture on this frame draw
+		kCachePending,  // Captured: waiting for the written triangle count
+		kCacheReady,  // Captured triangles are drawn
+		kCacheOverflow  // More triangles than kCacheMaxTriangles
+	};
+	static const GLuint kCacheVertexSize = 6 * sizeof(float);  // Clip space position, texture coordinate
+	static const GLuint kCacheInitialTriangles = 256 * 1024;  // 18 MB
+	static const GLuint kCacheMaxTriangles = 1024 * 1024;  // 72 MB
+	bool terrain_cache_ = true;
+	TerrainCacheKey cache_key_ = {};
+	unsigned int cache_state_ = kCacheStale;
+	GLuint cache_program_;
+	GLuint cache_vao_;
+	GLuint cache_buffer_ = 0;
+	GLuint cache_feedback_;
+	GLuint cache_query_;  // Triangles written by the capture
+	GLuint cache_capacity_ = 0;  // Triangles
+	GLuint64 cache_triangles_ = 0;
+
+	double last_report_time_ = 0.0;
+	const double kReportPeriod = 1.0;  // Seconds
 };
 
 // Our one and only instance of DECLARE_MAIN
@@ -0,0 +1,598 @@
+#pragma once
+
+/*
+	Geometry clipmap terrain streamed from disk: the world can be far bigger than GPU (and CPU) memory, and per-frame cost stays constant.
+
+	World: a grid of square height tiles (16 bit normalized heights) stored in one file, each tile with its mip chain (2x2 box filter). Texel size of mip 0 is kClipmapTexelSize world units; world is centered on the origin.
+	- TerrainPager reads tiles on a background thread (_fseeki64 / fread) and keeps the latest ones in a cache with a byte budget (least recently used are dropped).
+	  If the world file does not exist (or is incomplete), the same thread bakes it first (from a height function), then starts serving requests.
+	- TerrainClipmap keeps kClipmapLevelTotal nested levels centered on the camera; level l has 2^l times the texel size of level 0 and reads mip l of the tiles.
+	  Every level is a layer of a texture array updated toroidally: level texel (x, z) lives at (x mod N, z mod N), so when the camera moves only the new rows and columns are uploaded, and sampling with GL_REPEAT wraps exactly as the storage does.
+
+	Level centers snap to 2 patches of their own level, so the window of level l - 1 (the hole of level l) is always aligned to level l patches and at most one patch off its center.
+	Centers of all levels are committed together, and only once every tile they need is resident: until then the previous ones are kept (geometry and textures always agree).
+*/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+const int kClipmapLevelTotal = 5;
+const int kClipmapGridSide = 16;  // Patches per level side (level l > 0 skips the inner 8 x 8, covered by level l - 1)
+const int kClipmapPatchTexels = 8;  // Level texels per patch side
+const int kClipmapTextureMargin = 4;  // Resident texels around the patch window (bilinear footprint)
+const int kClipmapTextureSide = kClipmapGridSide * kClipmapPatchTexels + 2 * kClipmapTextureMargin;
+const float kClipmapTexelSize = 0.125f;  // World units per level 0 texel (so a level 0 patch is 1 unit, as the fixed grid ones)
+
+const uint32_t kTerrainWorldMagic = 0x57524554;  // "TERW"
+
+struct TerrainWorldHeader
+{
+	uint32_t magic;
+	uint32_t tile_side;  // Mip 0 texels
+	uint32_t tiles_x;
+	uint32_t tiles_z;
+	uint32_t mip_total;
+};
+
+class TerrainPager
+{
+public:
+
+	/// <summary>
+	/// Start the loading thread for a world file; if it does not exist, the thread bakes it first from height(x, z) (normalized height at mip 0 texel (x, z), world texel coordinates centered on the origin)
+	/// </summary>
+	void Open(const char* path, int tile_side, int tiles_x, int tiles_z, int mip_total, std::function<float(int, int)> height, size_t cache_budget)
+	{
+		path_ = path;
+		header_ = { kTerrainWorldMagic, (uint32_t)tile_side, (uint32_t)tiles_x, (uint32_t)tiles_z, (uint32_t)mip_total };
+		cache_budget_ = cache_budget;
+		quit_ = false;
+		ready_ = false;
+
+		worker_ = std::thread([this, height]() { Run(height); });
+	}
+
+	void Close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			quit_ = true;
+		}
+		condition_.notify_one();
+		if (worker_.joinable())
+		{
+			worker_.join();
+		}
+
+		cache_.clear();
+		lru_.clear();
+		cache_bytes_ = 0;
+	}
+
+	/// <summary>
+	/// Move loaded tiles into the cache (dropping the least recently used beyond the budget); call once per frame, before Tile
+	/// </summary>
+	void Collect()
+	{
+		std::deque<Load> loaded;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			loaded.swap(loaded_);
+		}
+
+		for (Load& load : loaded)
+		{
+			pending_.erase(load.key);
+			if (load.heights.empty())
+			{
+				failed_reads_++;
+				continue;
+			}
+			if (cache_.count(load.key) > 0)
+			{
+				continue;
+			}
+			cache_bytes_ += load.heights.size() * sizeof(uint16_t);
+			lru_.push_front(load.key);
+			cache_[load.key] = { std::move(load.heights), lru_.begin() };
+			loaded_tiles_++;
+		}
+
+		while (cache_bytes_ > cache_budget_ && !lru_.empty())
+		{
+			uint64_t key = lru_.back();
+			lru_.pop_back();
+			cache_bytes_ -= cache_[key].heights.size() * sizeof(uint16_t);
+			cache_.erase(key);
+		}
+	}
+
+	/// <summary>
+	/// Heights of a tile mip (row-major, (tile_side >> mip)^2), or NULL if it is not resident yet (then it is requested)
+	/// Note: Pointer is valid until next Collect
+	/// </summary>
+	const uint16_t* Tile(int tile_x, int tile_z, int mip)
+	{
+		uint64_t key = Key(tile_x, tile_z, mip);
+		auto it = cache_.find(key);
+		if (it != cache_.end())
+		{
+			lru_.splice(lru_.begin(), lru_, it->second.lru);
+			return it->second.heights.data();
+		}
+
+		Request(key);
+		return NULL;
+	}
+
+	/// <summary>
+	/// Ask for a tile mip without waiting for it (prefetch)
+	/// </summary>
+	void Prefetch(int tile_x, int tile_z, int mip)
+	{
+		uint64_t key = Key(tile_x, tile_z, mip);
+		if (cache_.find(key) == cache_.end())
+		{
+			Request(key);
+		}
+	}
+
+	bool Ready() const
+	{
+		return ready_;
+	}
+
+	int TileSide() const { return (int)header_.tile_side; }
+	int TilesX() const { return (int)header_.tiles_x; }
+	int TilesZ() const { return (int)header_.tiles_z; }
+	size_t CacheBytes() const { return cache_bytes_; }
+	size_t PendingTiles() const { return pending_.size(); }
+	uint64_t LoadedTiles() const { return loaded_tiles_; }
+	uint64_t FailedReads() const { return failed_reads_; }
+
+private:
+
+	struct Load
+	{
+		uint64_t key;
+		std::vector<uint16_t> heights;
+	};
+
+	struct Entry
+	{
+		std::vector<uint16_t> heights;
+		std::list<uint64_t>::iterator lru;
+	};
+
+	static uint64_t Key(int tile_x, int tile_z, int mip)
+	{
+		return ((uint64_t)(uint32_t)tile_z << 40) | ((uint64_t)(uint32_t)tile_x << 8) | (uint64_t)mip;
+	}
+
+	void Request(uint64_t key)
+	{
+		if (pending_.count(key) > 0)
+		{
+			return;
+		}
+		pending_.insert(key);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			requests_.push_back(key);
+		}
+		condition_.notify_one();
+	}
+
+	// Offset of a tile mip within the world file (64 bit: worlds beyond 2 GB; long is 32 bit on Windows)
+	int64_t Offset(int tile_x, int tile_z, int mip) const
+	{
+		int64_t tile_bytes = 0;
+		int64_t mip_offset = 0;
+		for (uint32_t m = 0; m < header_.mip_total; m++)
+		{
+			int64_t side = (int64_t)(header_.tile_side >> m);
+			mip_offset += (int)m < mip ? side * side * (int64_t)sizeof(uint16_t) : 0;
+			tile_bytes += side * side * (int64_t)sizeof(uint16_t);
+		}
+
+		return (int64_t)sizeof(TerrainWorldHeader) + ((int64_t)tile_z * header_.tiles_x + tile_x) * tile_bytes + mip_offset;
+	}
+
+	// Size of a complete world file: the offset one tile past the last one
+	int64_t FileBytes() const
+	{
+		return Offset(0, (int)header_.tiles_z, 0);
+	}
+
+	void Run(std::function<float(int, int)> height)
+	{
+		FILE* file = NULL;
+		if (fopen_s(&file, path_.c_str(), "rb") != 0 || !HeaderMatches(file) || !SizeMatches(file))
+		{
+			if (file != NULL)
+			{
+				fclose(file);
+			}
+			Bake(height);
+			fopen_s(&file, path_.c_str(), "rb");
+		}
+		ready_ = file != NULL;
+
+		while (true)
+		{
+			uint64_t key;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				condition_.wait(lock, [this]() { return quit_ || !requests_.empty(); });
+				if (quit_)
+				{
+					break;
+				}
+				key = requests_.front();
+				requests_.pop_front();
+			}
+
+			int mip = (int)(key & 0xFF);
+			int tile_x = (int)(uint32_t)((key >> 8) & 0xFFFFFFFF);
+			int tile_z = (int)(uint32_t)(key >> 40);
+			size_t side = header_.tile_side >> mip;
+
+			// A failed read is dropped (empty heights): the tile stays missing and is requested again, rather than uploaded partially filled
+			Load load = { key, std::vector<uint16_t>(side * side) };
+			if (file == NULL || _fseeki64(file, Offset(tile_x, tile_z, mip), SEEK_SET) != 0 ||
+				fread(load.heights.data(), sizeof(uint16_t), side * side, file) != side * side)
+			{
+				load.heights.clear();
+			}
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			loaded_.push_back(std::move(load));
+		}
+
+		if (file != NULL)
+		{
+			fclose(file);
+		}
+	}
+
+	bool HeaderMatches(FILE* file)
+	{
+		TerrainWorldHeader header;
+		return fread(&header, sizeof(header), 1, file) == 1 && memcmp(&header, &header_, sizeof(header)) == 0;
+	}
+
+	// A bake cut short (or a damaged file) has a valid header but is not complete
+	bool SizeMatches(FILE* file)
+	{
+		return _fseeki64(file, 0, SEEK_END) == 0 && _ftelli64(file) == FileBytes();
+	}
+
+	// Write the world file: tile after tile (row-major), each with its mip chain
+	// Baked into a temporary file, renamed into place only once complete (an interrupted bake never leaves a world file behind)
+	void Bake(std::function<float(int, int)> height)
+	{
+		std::string temporary_path = path_ + ".tmp";
+		FILE* file = NULL;
+		if (fopen_s(&file, temporary_path.c_str(), "wb") != 0)
+		{
+			return;
+		}
+		bool written = fwrite(&header_, sizeof(header_), 1, file) == 1;
+
+		int side = (int)header_.tile_side;
+		int half_x = (int)header_.tiles_x * side / 2;
+		int half_z = (int)header_.tiles_z * side / 2;
+		std::vector<float> mip(side * side);
+		std::vector<uint16_t> texels(side * side);
+		for (uint32_t tile_z = 0; tile_z < header_.tiles_z && written && !quit_; tile_z++)
+		{
+			for (uint32_t tile_x = 0; tile_x < header_.tiles_x; tile_x++)
+			{
+				for (int z = 0; z < side; z++)
+				{
+					for (int x = 0; x < side; x++)
+					{
+						float h = height((int)tile_x * side + x - half_x, (int)tile_z * side + z - half_z);
+						mip[z * side + x] = h < 0.0f ? 0.0f : (h > 1.0f ? 1.0f : h);
+					}
+				}
+
+				for (uint32_t m = 0, mip_side = side; m < header_.mip_total; m++, mip_side /= 2)
+				{
+					if (m > 0)
+					{
+						// 2x2 box filter of previous mip (in place: every texel is written after the ones it reads)
+						for (uint32_t z = 0; z < mip_side; z++)
+						{
+							for (uint32_t x = 0; x < mip_side; x++)
+							{
+								const float* row0 = &mip[(z * 2) * (mip_side * 2) + x * 2];
+								const float* row1 = row0 + mip_side * 2;
+								mip[z * mip_side + x] = 0.25f * (row0[0] + row0[1] + row1[0] + row1[1]);
+							}
+						}
+					}
+
+					for (uint32_t i = 0; i < mip_side * mip_side; i++)
+					{
+						texels[i] = (uint16_t)(mip[i] * 65535.0f + 0.5f);
+					}
+					written = fwrite(texels.data(), sizeof(uint16_t), mip_side * mip_side, file) == mip_side * mip_side && written;
+				}
+			}
+		}
+
+		written = fclose(file) == 0 && written;
+		if (!written || quit_)
+		{
+			remove(temporary_path.c_str());
+			return;
+		}
+
+		remove(path_.c_str());  // rename does not replace an existing file on Windows
+		rename(temporary_path.c_str(), path_.c_str());
+	}
+
+	std::string path_;
+	TerrainWorldHeader header_ = {};
+	std::thread worker_;
+	std::atomic<bool> ready_ { false };
+
+	// Shared with the loading thread
+	std::mutex mutex_;
+	std::condition_variable condition_;
+	std::deque<uint64_t> requests_;
+	std::deque<Load> loaded_;
+	std::atomic<bool> quit_ { false };
+
+	// Main thread only
+	std::unordered_map<uint64_t, Entry> cache_;
+	std::list<uint64_t> lru_;  // Most recently used first
+	std::unordered_set<uint64_t> pending_;  // Requested, not loaded yet
+	size_t cache_budget_ = 0;
+	size_t cache_bytes_ = 0;
+	uint64_t loaded_tiles_ = 0;
+	uint64_t failed_reads_ = 0;
+};
+
+class TerrainClipmap
+{
+public:
+
+	void Initialize(TerrainPager* pager)
+	{
+		pager_ = pager;
+		committed_ = false;
+
+		glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &texture_);
+		glTextureStorage3D(texture_, 1, GL_R16, kClipmapTextureSide, kClipmapTextureSide, kClipmapLevelTotal);
+		glTextureParameteri(texture_, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTextureParameteri(texture_, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTextureParameteri(texture_, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTextureParameteri(texture_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		staging_.resize(kClipmapTextureSide * kClipmapTextureSide);
+	}
+
+	void Remove()
+	{
+		glDeleteTextures(1, &texture_);
+	}
+
+	/// <summary>
+	/// Follow the camera (world x, z): centers of every level are moved (and the new texels uploaded) once all the tiles they need are resident; returns true if centers are committed (drawable)
+	/// </summary>
+	bool Update(float camera_x, float camera_z)
+	{
+		pager_->Collect();
+		if (!pager_->Ready())
+		{
+			return committed_;
+		}
+
+		// Desired centers (level texels), snapped to 2 patches of each level
+		int centers[kClipmapLevelTotal][2];
+		const int kSnap = 2 * kClipmapPatchTexels;
+		for (int level = 0; level < kClipmapLevelTotal; level++)
+		{
+			float texel_size = kClipmapTexelSize * (float)(1 << level);
+			centers[level][0] = (int)floorf(camera_x / texel_size / kSnap + 0.5f) * kSnap;
+			centers[level][1] = (int)floorf(camera_z / texel_size / kSnap + 0.5f) * kSnap;
+		}
+
+		if (committed_ && memcmp(centers, centers_, sizeof(centers)) == 0)
+		{
+			return true;
+		}
+
+		// Every tile of every new window must be resident (missing ones are requested); the next snap step around is prefetched
+		bool resident = true;
+		for (int level = 0; level < kClipmapLevelTotal; level++)
+		{
+			resident = TouchTiles(level, centers[level], kClipmapTextureSide / 2, true) && resident;
+			TouchTiles(level, centers[level], kClipmapTextureSide / 2 + kSnap, false);
+		}
+		if (!resident)
+		{
+			return committed_;
+		}
+
+		for (int level = 0; level < kClipmapLevelTotal; level++)
+		{
+			UpdateLevel(level, centers[level]);
+		}
+		memcpy(centers_, centers, sizeof(centers));
+		committed_ = true;
+
+		return true;
+	}
+
+	/// <summary>
+	/// Committed center of a level (level texels; world position is center * texel size of the level)
+	/// </summary>
+	const int* Center(int level) const
+	{
+		return centers_[level];
+	}
+
+	GLuint Texture() const
+	{
+		return texture_;
+	}
+
+	GLuint UploadedTexels() const
+	{
+		return uploaded_texels_;
+	}
+
+private:
+
+	// Origin (level texels) of the resident window of a level
+	static void WindowOrigin(const int center[2], int origin[2])
+	{
+		origin[0] = center[0] - kClipmapTextureSide / 2;
+		origin[1] = center[1] - kClipmapTextureSide / 2;
+	}
+
+	// Tiles (mip == level) overlapping the square of half side 'half' (level texels) around a center; returns true if all of them are resident
+	bool TouchTiles(int level, const int center[2], int half, bool required)
+	{
+		int tile_texels = pager_->TileSide() >> level;  // Level texels per tile
+		int half_x = pager_->TilesX() * tile_texels / 2;
+		int half_z = pager_->TilesZ() * tile_texels / 2;
+		int tile_x0 = FloorDiv(center[0] - half + half_x, tile_texels);
+		int tile_x1 = FloorDiv(center[0] + half - 1 + half_x, tile_texels);
+		int tile_z0 = FloorDiv(center[1] - half + half_z, tile_texels);
+		int tile_z1 = FloorDiv(center[1] + half - 1 + half_z, tile_texels);
+
+		bool resident = true;
+		for (int tile_z = tile_z0 > 0 ? tile_z0 : 0; tile_z <= tile_z1 && tile_z < pager_->TilesZ(); tile_z++)
+		{
+			for (int tile_x = tile_x0 > 0 ? tile_x0 : 0; tile_x <= tile_x1 && tile_x < pager_->TilesX(); tile_x++)
+			{
+				if (required)
+				{
+					resident = pager_->Tile(tile_x, tile_z, level) != NULL && resident;
+				}
+				else
+				{
+					pager_->Prefetch(tile_x, tile_z, level);
+				}
+			}
+		}
+
+		return resident;
+	}
+
+	// Upload the texels of a level that enter its window (all of them the first time, or after a jump longer than the window)
+	void UpdateLevel(int level, const int center[2])
+	{
+		int origin[2];
+		WindowOrigin(center, origin);
+		const int kSide = kClipmapTextureSide;
+
+		int old_origin[2];
+		WindowOrigin(centers_[level], old_origin);
+		int dx = origin[0] - old_origin[0];
+		int dz = origin[1] - old_origin[1];
+		if (!committed_ || abs(dx) >= kSide || abs(dz) >= kSide)
+		{
+			UploadRect(level, origin[0], origin[1], kSide, kSide);
+			return;
+		}
+
+		// New columns (whole window height) and new rows (whole window width)
+		if (dx != 0)
+		{
+			UploadRect(level, dx > 0 ? old_origin[0] + kSide : origin[0], origin[1], abs(dx), kSide);
+		}
+		if (dz != 0)
+		{
+			UploadRect(level, origin[0], dz > 0 ? old_origin[1] + kSide : origin[1], kSide, abs(dz));
+		}
+	}
+
+	// Gather a rectangle of level texels from the tiles and upload it where it lives in the toroidal layer (split in up to 4 pieces where it wraps)
+	void UploadRect(int level, int x0, int z0, int width, int height)
+	{
+		int tile_texels = pager_->TileSide() >> level;
+		int half_x = pager_->TilesX() * tile_texels / 2;
+		int half_z = pager_->TilesZ() * tile_texels / 2;
+		const uint16_t* tile = NULL;
+		int tile_x = INT32_MIN;
+		int tile_z = INT32_MIN;
+
+		for (int z = 0; z < height; z++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				// World texel to tile (outside the world: height 0)
+				int wx = x0 + x + half_x;
+				int wz = z0 + z + half_z;
+				int tx = FloorDiv(wx, tile_texels);
+				int tz = FloorDiv(wz, tile_texels);
+				if (tx != tile_x || tz != tile_z)
+				{
+					tile_x = tx;
+					tile_z = tz;
+					bool inside = tx >= 0 && tx < pager_->TilesX() && tz >= 0 && tz < pager_->TilesZ();
+					tile = inside ? pager_->Tile(tx, tz, level) : NULL;
+				}
+
+				staging_[z * width + x] = tile != NULL ? tile[(wz - tz * tile_texels) * tile_texels + (wx - tx * tile_texels)] : 0;
+			}
+		}
+
+		const int kSide = kClipmapTextureSide;
+		int storage_x = ((x0 % kSide) + kSide) % kSide;
+		int storage_z = ((z0 % kSide) + kSide) % kSide;
+		int first_width = width < kSide - storage_x ? width : kSide - storage_x;
+		int first_height = height < kSide - storage_z ? height : kSide - storage_z;
+
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+		for (int piece = 0; piece < 4; piece++)
+		{
+			int px = (piece & 1) ? first_width : 0;
+			int pz = (piece & 2) ? first_height : 0;
+			int pw = (piece & 1) ? width - first_width : first_width;
+			int ph = (piece & 2) ? height - first_height : first_height;
+			if (pw <= 0 || ph <= 0)
+			{
+				continue;
+			}
+
+			glTextureSubImage3D(texture_, 0, (storage_x + px) % kSide, (storage_z + pz) % kSide, level, pw, ph, 1,
+				GL_RED, GL_UNSIGNED_SHORT, &staging_[pz * width + px]);
+		}
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+		uploaded_texels_ += width * height;
+	}
+
+	static int FloorDiv(int a, int b)
+	{
+		return a >= 0 ? a / b : -((-a + b - 1) / b);
+	}
+
+	TerrainPager* pager_ = NULL;
+	GLuint texture_ = 0;  // One layer per level
+	int centers_[kClipmapLevelTotal][2] = {};
+	bool committed_ = false;
+	std::vector<uint16_t> staging_;
+	GLuint uploaded_texels_ = 0;
+};
@@ -0,0 +1,560 @@
+#pragma once
+
+/*
+	CPU height field of the terrain, for height queries and ray casts against the surface the GPU draws (gameplay, picking).
+
+	Laid out as the vertex shader grid: the heightmap spans the 64 x 64 world units centered on the origin (texture coordinate = (world + 32) / 64, along X and Z),
+	repeats beyond them (as the sampler does), and its normalized heights are scaled by max_height. Heights are bilinear, as the TES samples them (texel centers at
+	half texel offsets), so a bilinear cell (2 x 2 texels) is the exact surface between 4 neighbour texel centers.
+
+	Batch height queries run one of three kernels (same results up to rounding):
+	- Scalar: one query at a time
+	- SSE4.1: 4 queries at a time (4 texel fetches per query are scalar loads)
+	- AVX2: 8 queries at a time, texel fetches with gathers
+	Best instruction set supported by the CPU is selected at runtime; SIMD kernels need power of two heightmap sides (wrap with a mask).
+
+	Ray casts walk a min/max pyramid of the bilinear cells: level 0 holds the height range of every cell, and every upper level the range of 2 x 2 nodes below.
+	A node whose range lies below the ray over the whole node footprint is skipped at once; otherwise the walk goes down, up to the cell, where the ray is
+	intersected with the bilinear surface exactly (a quadratic along the ray).
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <utility>
+#include <vector>
+#include "vmath.h"
+#include <immintrin.h>
+#include "../ch07app04instancedgrass/cpufeatures.h"
+
+// Intrinsics for an instruction set not enabled at compile time (MSVC allows them anywhere)
+#if defined(_MSC_VER)
+#define TERRAIN_TARGET_SSE41
+#define TERRAIN_TARGET_AVX2
+#else
+#define TERRAIN_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TERRAIN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+enum TerrainHeightKernel { kTerrainHeightScalar, kTerrainHeightSse41, kTerrainHeightAvx2, kTerrainHeightKernelTotal };
+
+struct TerrainRayHit
+{
+	float t;  // Ray parameter (world units if the direction is unit length)
+	vmath::vec3 position;
+};
+
+class TerrainHeightField
+{
+public:
+
+	/// <summary>
+	/// Copy a width x height heightmap (normalized heights, row-major) and build the min/max pyramid of its bilinear cells; sides must be powers of two
+	/// </summary>
+	bool Build(const float* heights, int width, int height, float grid_side)
+	{
+		if (width <= 0 || height <= 0 || (width & (width - 1)) != 0 || (height & (height - 1)) != 0)
+		{
+			return false;
+		}
+
+		width_ = width;
+		height_ = height;
+		heights_.assign(heights, heights + (size_t)width * height);
+
+		// World to cell space (u = texture coordinate * width - 0.5, so texel centers are integers)
+		scale_u_ = width / grid_side;
+		scale_v_ = height / grid_side;
+		offset_u_ = grid_side * 0.5f * scale_u_ - 0.5f;
+		offset_v_ = grid_side * 0.5f * scale_v_ - 0.5f;
+
+		// Level 0: cell (i, j) spans texels (i, j) to (i + 1, j + 1), wrapped
+		levels_.assign(1, std::vector<vmath::vec2>((size_t)width * height));
+		level_sides_.assign(1, std::pair<int, int>(width, height));
+		for (int j = 0; j < height; j++)
+		{
+			for (int i = 0; i < width; i++)
+			{
+				float h00 = Texel(i, j);
+				float h10 = Texel(i + 1, j);
+				float h01 = Texel(i, j + 1);
+				float h11 = Texel(i + 1, j + 1);
+				levels_[0][(size_t)j * width + i] = vmath::vec2(fminf(fminf(h00, h10), fminf(h01, h11)), fmaxf(fmaxf(h00, h10), fmaxf(h01, h11)));
+			}
+		}
+
+		// Upper levels: range of the 2 x 2 nodes below (a 1 node wide side repeats its node)
+		while (level_sides_.back().first > 1 || level_sides_.back().second > 1)
+		{
+			int finer_width = level_sides_.back().first;
+			int finer_height = level_sides_.back().second;
+			int level_width = finer_width > 1 ? finer_width / 2 : 1;
+			int level_height = finer_height > 1 ? finer_height / 2 : 1;
+			const std::vector<vmath::vec2>& finer = levels_.back();
+
+			std::vector<vmath::vec2> level((size_t)level_width * level_height);
+			for (int j = 0; j < level_height; j++)
+			{
+				for (int i = 0; i < level_width; i++)
+				{
+					int i1 = finer_width > 1 ? i * 2 + 1 : i;
+					int j1 = finer_height > 1 ? j * 2 + 1 : j;
+					const vmath::vec2& c00 = finer[(size_t)(j1 & ~1) * finer_width + (i1 & ~1)];
+					const vmath::vec2& c10 = finer[(size_t)(j1 & ~1) * finer_width + i1];
+					const vmath::vec2& c01 = finer[(size_t)j1 * finer_width + (i1 & ~1)];
+					const vmath::vec2& c11 = finer[(size_t)j1 * finer_width + i1];
+					level[(size_t)j * level_width + i] = vmath::vec2(fminf(fminf(c00[0], c10[0]), fminf(c01[0], c11[0])),
+																	 fmaxf(fmaxf(c00[1], c10[1]), fmaxf(c01[1], c11[1])));
+				}
+			}
+
+			levels_.push_back(level);
+			level_sides_.push_back(std::pair<int, int>(level_width, level_height));
+		}
+
+		return true;
+	}
+
+	/// <summary>
+	/// Scale of the normalized heights (the max_height uniform)
+	/// </summary>
+	void SetMaxHeight(float max_height)
+	{
+		max_height_ = max_height;
+	}
+
+	/// <summary>
+	/// Surface height at a world position (X, Z)
+	/// </summary>
+	float Height(float x, float z) const
+	{
+		float u = x * scale_u_ + offset_u_;
+		float v = z * scale_v_ + offset_v_;
+		float u0 = floorf(u);
+		float v0 = floorf(v);
+		float fu = u - u0;
+		float fv = v - v0;
+		int i = (int)u0;
+		int j = (int)v0;
+
+		float h0 = Texel(i, j) + (Texel(i + 1, j) - Texel(i, j)) * fu;
+		float h1 = Texel(i, j + 1) + (Texel(i + 1, j + 1) - Texel(i, j + 1)) * fu;
+		return (h0 + (h1 - h0) * fv) * max_height_;
+	}
+
+	/// <summary>
+	/// heights[i] = Height(x[i], z[i]), for i in [0, count), with the given kernel (falls back to a supported one)
+	/// </summary>
+	void Heights(const float* x, const float* z, float* heights, size_t count, TerrainHeightKernel kernel = kTerrainHeightKernelTotal) const
+	{
+		TerrainHeightKernel best = BestKernel();
+		if (kernel > best)
+		{
+			kernel = best;
+		}
+
+		switch (kernel)
+		{
+		case kTerrainHeightAvx2:
+			HeightsAvx2(x, z, heights, count);
+			break;
+		case kTerrainHeightSse41:
+			HeightsSse41(x, z, heights, count);
+			break;
+		default:
+			HeightsScalar(x, z, heights, count);
+			break;
+		}
+	}
+
+	/// <summary>
+	/// First hit of a ray with the surface within max_distance (ray parameter); false if there is none
+	/// </summary>
+	bool Raycast(const vmath::vec3& origin, const vmath::vec3& direction, float max_distance, TerrainRayHit* hit) const
+	{
+		// Heights of the whole field (scaled)
+		const vmath::vec2& root = levels_.back()[0];
+		float field_bottom = fminf(root[0] * max_height_, root[1] * max_height_);
+		float field_top = fmaxf(root[0] * max_height_, root[1] * max_height_);
+
+		if (origin[1] <= field_bottom)
+		{
+			if (hit != NULL)
+			{
+				hit->t = 0.0f;  // Already below the surface
+				hit->position = origin;
+			}
+			return true;
+		}
+
+		// Start where the ray enters the height range of the field (and stop where it leaves it)
+		float t = 0.0f;
+		float t_end = max_distance;
+		if (direction[1] != 0.0f)
+		{
+			float t_top = (field_top - origin[1]) / direction[1];
+			float t_bottom = (field_bottom - origin[1]) / direction[1];
+			t = fmaxf(t, fminf(t_top, t_bottom));
+			t_end = fminf(t_end, fmaxf(t_top, t_bottom));
+		}
+		else if (origin[1] > field_top)
+		{
+			return false;
+		}
+
+		// Ray in cell space (heights stay in world units)
+		float u0 = origin[0] * scale_u_ + offset_u_;
+		float v0 = origin[2] * scale_v_ + offset_v_;
+		float du = direction[0] * scale_u_;
+		float dv = direction[2] * scale_v_;
+
+		// Cell of the ray (level 0 coordinates, not wrapped): stepped as integers across node boundaries, so rounding can never stall the walk
+		int ci = (int)floorf(u0 + du * t);
+		int cj = (int)floorf(v0 + dv * t);
+
+		int top_level = (int)levels_.size() - 1;
+		int level = top_level;
+		for (;;)
+		{
+			int node_i = ci >> level;  // Floor division (arithmetic shift)
+			int node_j = cj >> level;
+			int node_side = 1 << level;
+
+			// Where the ray leaves the node footprint, along each axis
+			float t_u = 1.0e30f;
+			float t_v = 1.0e30f;
+			if (du != 0.0f)
+			{
+				t_u = ((float)((du > 0.0f ? node_i + 1 : node_i) * node_side) - u0) / du;
+			}
+			if (dv != 0.0f)
+			{
+				t_v = ((float)((dv > 0.0f ? node_j + 1 : node_j) * node_side) - v0) / dv;
+			}
+			float t_exit = fmaxf(fminf(fminf(t_u, t_v), t_end), t);
+
+			// Ray over the node: lowest point of the segment (linear) above the highest point of the node
+			const std::pair<int, int>& side = level_sides_[level];
+			const vmath::vec2& range = levels_[level][(size_t)Wrap(node_j, side.second) * side.first + Wrap(node_i, side.first)];
+			float node_top = fmaxf(range[0] * max_height_, range[1] * max_height_);
+			float ray_low = fminf(origin[1] + direction[1] * t, origin[1] + direction[1] * t_exit);
+			if (ray_low <= node_top)
+			{
+				if (level > 0)
+				{
+					// Child under the ray: whether it crossed the node midlines by t (times computed as the exits are, so both always agree)
+					int half = node_side / 2;
+					ci = node_i * node_side + (ChildCrossed(node_i * node_side + half, u0, du, t) ? half : 0);
+					cj = node_j * node_side + (ChildCrossed(node_j * node_side + half, v0, dv, t) ? half : 0);
+					level--;
+					continue;
+				}
+
+				// Cell: exact intersection with the bilinear surface
+				float t_hit;
+				if (IntersectCell(ci, cj, u0 + du * t - ci, v0 + dv * t - cj, du, dv, origin[1] + direction[1] * t, direction[1], t_exit - t, &t_hit))
+				{
+					if (hit != NULL)
+					{
+						hit->t = t + t_hit;
+						hit->position = origin + direction * hit->t;
+					}
+					return true;
+				}
+			}
+
+			// Next node: step the axes whose boundary the ray crosses first, then try the coarser level again
+			if (t_exit >= t_end)
+			{
+				return false;
+			}
+
+			t = t_exit;
+			if (t_u <= t_v)
+			{
+				ci = du > 0.0f ? (node_i + 1) * node_side : node_i * node_side - 1;
+			}
+			if (t_v <= t_u)
+			{
+				cj = dv > 0.0f ? (node_j + 1) * node_side : node_j * node_side - 1;
+			}
+			level = level < top_level ? level + 1 : top_level;
+		}
+	}
+
+	/// <summary>
+	/// Same as Raycast, marching the ray in small steps (a fraction of a cell) with bisection at the first step below the surface: reference to validate it
+	/// </summary>
+	bool RaycastMarching(const vmath::vec3& origin, const vmath::vec3& direction, float max_distance, TerrainRayHit* hit, float cell_fraction = 0.125f) const
+	{
+		float dt = cell_fraction / fmaxf(fmaxf(fabsf(direction[0] * scale_u_), fabsf(direction[2] * scale_v_)), 1.0e-3f);
+		float previous_t = 0.0f;
+		float previous_f = origin[1] - Height(origin[0], origin[2]);
+		if (previous_f <= 0.0f)
+		{
+			if (hit != NULL)
+			{
+				hit->t = 0.0f;
+				hit->position = origin;
+			}
+			return true;
+		}
+
+		for (float t = dt; previous_t < max_distance; t += dt)
+		{
+			t = fminf(t, max_distance);
+			vmath::vec3 p = origin + direction * t;
+			float f = p[1] - Height(p[0], p[2]);
+			if (f <= 0.0f)
+			{
+				// Bisection between the last point above and the first one below
+				float a = previous_t;
+				float b = t;
+				for (int k = 0; k < 24; k++)
+				{
+					float m = (a + b) * 0.5f;
+					vmath::vec3 q = origin + direction * m;
+					if (q[1] - Height(q[0], q[2]) > 0.0f)
+					{
+						a = m;
+					}
+					else
+					{
+						b = m;
+					}
+				}
+
+				if (hit != NULL)
+				{
+					hit->t = b;
+					hit->position = origin + direction * b;
+				}
+				return true;
+			}
+
+			previous_t = t;
+		}
+
+		return false;
+	}
+
+	int LevelTotal() const
+	{
+		return (int)levels_.size();
+	}
+
+	/// <summary>
+	/// Best kernel supported by the CPU (checked once)
+	/// </summary>
+	static TerrainHeightKernel BestKernel()
+	{
+		const CpuFeatures& cpu = GetCpuFeatures();
+		return cpu.avx2 ? kTerrainHeightAvx2 : (cpu.sse41 ? kTerrainHeightSse41 : kTerrainHeightScalar);
+	}
+
+private:
+
+	static int Wrap(int i, int side)
+	{
+		return i & (side - 1);  // Power of two sides (negative indices too: two's complement)
+	}
+
+	float Texel(int i, int j) const
+	{
+		return heights_[(size_t)Wrap(j, height_) * width_ + Wrap(i, width_)];
+	}
+
+	/// <summary>
+	/// Whether a ray (cell coordinate c0 + dc * t along an axis) is past the midline of a node at t (upper child)
+	/// </summary>
+	static bool ChildCrossed(int midline, float c0, float dc, float t)
+	{
+		if (dc == 0.0f)
+		{
+			return c0 >= (float)midline;
+		}
+
+		float t_midline = ((float)midline - c0) / dc;
+		return dc > 0.0f ? t >= t_midline : t < t_midline;
+	}
+
+	/// <summary>
+	/// First hit within t in [0, length] of a ray segment starting at (s, r) of cell (i, j) (fractions of the cell), height y; false if there is none
+	/// </summary>
+	bool IntersectCell(int i, int j, float s, float r, float ds, float dr, float y, float dy, float length, float* t_hit) const
+	{
+		// Bilinear surface: h(s, r) = h00 + a * s + b * r + c * s * r
+		float h00 = Texel(i, j) * max_height_;
+		float a = Texel(i + 1, j) * max_height_ - h00;
+		float b = Texel(i, j + 1) * max_height_ - h00;
+		float c = (Texel(i + 1, j + 1) - Texel(i + 1, j) - Texel(i, j + 1) + Texel(i, j)) * max_height_;
+
+		// Ray height minus surface height along the segment: f(t) = qa * t^2 + qb * t + qc
+		float qa = -c * ds * dr;
+		float qb = dy - a * ds - b * dr - c * (s * dr + r * ds);
+		float qc = y - (h00 + a * s + b * r + c * s * r);
+
+		if (qc <= 0.0f)
+		{
+			*t_hit = 0.0f;  // Already below the surface
+			return true;
+		}
+
+		float roots[2];
+		int root_total = 0;
+		if (fabsf(qa) < 1.0e-12f)
+		{
+			if (qb < 0.0f)
+			{
+				roots[root_total++] = -qc / qb;
+			}
+		}
+		else
+		{
+			float discriminant = qb * qb - 4.0f * qa * qc;
+			if (discriminant >= 0.0f)
+			{
+				// Numerically stable roots
+				float q = -0.5f * (qb + (qb >= 0.0f ? sqrtf(discriminant) : -sqrtf(discriminant)));
+				roots[root_total++] = q / qa;
+				if (q != 0.0f)
+				{
+					roots[root_total++] = qc / q;
+				}
+			}
+		}
+
+		float first = length + 1.0f;
+		for (int k = 0; k < root_total; k++)
+		{
+			if (roots[k] >= 0.0f && roots[k] <= length && roots[k] < first)
+			{
+				first = roots[k];
+			}
+		}
+
+		if (first > length)
+		{
+			return false;
+		}
+
+		*t_hit = first;
+		return true;
+	}
+
+	void HeightsScalar(const float* x, const float* z, float* heights, size_t count) const
+	{
+		for (size_t k = 0; k < count; k++)
+		{
+			heights[k] = Height(x[k], z[k]);
+		}
+	}
+
+	TERRAIN_TARGET_SSE41 void HeightsSse41(const float* x, const float* z, float* heights, size_t count) const
+	{
+		const __m128 kScaleU = _mm_set1_ps(scale_u_);
+		const __m128 kScaleV = _mm_set1_ps(scale_v_);
+		const __m128 kOffsetU = _mm_set1_ps(offset_u_);
+		const __m128 kOffsetV = _mm_set1_ps(offset_v_);
+		const __m128 kMaxHeight = _mm_set1_ps(max_height_);
+		const __m128i kMaskU = _mm_set1_epi32(width_ - 1);
+		const __m128i kMaskV = _mm_set1_epi32(height_ - 1);
+		const __m128i kOne = _mm_set1_epi32(1);
+		const __m128i kWidth = _mm_set1_epi32(width_);
+		const float* texels = heights_.data();
+
+		size_t k = 0;
+		for (; k + 4 <= count; k += 4)
+		{
+			__m128 u = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x + k), kScaleU), kOffsetU);
+			__m128 v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(z + k), kScaleV), kOffsetV);
+			__m128 u0 = _mm_floor_ps(u);
+			__m128 v0 = _mm_floor_ps(v);
+			__m128 fu = _mm_sub_ps(u, u0);
+			__m128 fv = _mm_sub_ps(v, v0);
+
+			__m128i i0 = _mm_and_si128(_mm_cvttps_epi32(u0), kMaskU);
+			__m128i j0 = _mm_and_si128(_mm_cvttps_epi32(v0), kMaskV);
+			__m128i i1 = _mm_and_si128(_mm_add_epi32(i0, kOne), kMaskU);
+			__m128i j1 = _mm_and_si128(_mm_add_epi32(j0, kOne), kMaskV);
+			__m128i row0 = _mm_mullo_epi32(j0, kWidth);
+			__m128i row1 = _mm_mullo_epi32(j1, kWidth);
+
+			alignas(16) int32_t index[4][4];  // 00, 10, 01, 11
+			_mm_store_si128((__m128i*)index[0], _mm_add_epi32(row0, i0));
+			_mm_store_si128((__m128i*)index[1], _mm_add_epi32(row0, i1));
+			_mm_store_si128((__m128i*)index[2], _mm_add_epi32(row1, i0));
+			_mm_store_si128((__m128i*)index[3], _mm_add_epi32(row1, i1));
+
+			__m128 h00 = _mm_setr_ps(texels[index[0][0]], texels[index[0][1]], texels[index[0][2]], texels[index[0][3]]);
+			__m128 h10 = _mm_setr_ps(texels[index[1][0]], texels[index[1][1]], texels[index[1][2]], texels[index[1][3]]);
+			__m128 h01 = _mm_setr_ps(texels[index[2][0]], texels[index[2][1]], texels[index[2][2]], texels[index[2][3]]);
+			__m128 h11 = _mm_setr_ps(texels[index[3][0]], texels[index[3][1]], texels[index[3][2]], texels[index[3][3]]);
+
+			__m128 h0 = _mm_add_ps(h00, _mm_mul_ps(_mm_sub_ps(h10, h00), fu));
+			__m128 h1 = _mm_add_ps(h01, _mm_mul_ps(_mm_sub_ps(h11, h01), fu));
+			__m128 h = _mm_add_ps(h0, _mm_mul_ps(_mm_sub_ps(h1, h0), fv));
+			_mm_storeu_ps(heights + k, _mm_mul_ps(h, kMaxHeight));
+		}
+
+		// Remainder
+		HeightsScalar(x + k, z + k, heights + k, count - k);
+	}
+
+	TERRAIN_TARGET_AVX2 void HeightsAvx2(const float* x, const float* z, float* heights, size_t count) const
+	{
+		const __m256 kScaleU = _mm256_set1_ps(scale_u_);
+		const __m256 kScaleV = _mm256_set1_ps(scale_v_);
+		const __m256 kOffsetU = _mm256_set1_ps(offset_u_);
+		const __m256 kOffsetV = _mm256_set1_ps(offset_v_);
+		const __m256 kMaxHeight = _mm256_set1_ps(max_height_);
+		const __m256i kMaskU = _mm256_set1_epi32(width_ - 1);
+		const __m256i kMaskV = _mm256_set1_epi32(height_ - 1);
+		const __m256i kOne = _mm256_set1_epi32(1);
+		const __m256i kWidth = _mm256_set1_epi32(width_);
+		const float* texels = heights_.data();
+
+		size_t k = 0;
+		for (; k + 8 <= count; k += 8)
+		{
+			__m256 u = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(x + k), kScaleU), kOffsetU);
+			__m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(z + k), kScaleV), kOffsetV);
+			__m256 u0 = _mm256_floor_ps(u);
+			__m256 v0 = _mm256_floor_ps(v);
+			__m256 fu = _mm256_sub_ps(u, u0);
+			__m256 fv = _mm256_sub_ps(v, v0);
+
+			__m256i i0 = _mm256_and_si256(_mm256_cvttps_epi32(u0), kMaskU);
+			__m256i j0 = _mm256_and_si256(_mm256_cvttps_epi32(v0), kMaskV);
+			__m256i i1 = _mm256_and_si256(_mm256_add_epi32(i0, kOne), kMaskU);
+			__m256i j1 = _mm256_and_si256(_mm256_add_epi32(j0, kOne), kMaskV);
+			__m256i row0 = _mm256_mullo_epi32(j0, kWidth);
+			__m256i row1 = _mm256_mullo_epi32(j1, kWidth);
+
+			__m256 h00 = _mm256_i32gather_ps(texels, _mm256_add_epi32(row0, i0), 4);
+			__m256 h10 = _mm256_i32gather_ps(texels, _mm256_add_epi32(row0, i1), 4);
+			__m256 h01 = _mm256_i32gather_ps(texels, _mm256_add_epi32(row1, i0), 4);
+			__m256 h11 = _mm256_i32gather_ps(texels, _mm256_add_epi32(row1, i1), 4);
+
+			__m256 h0 = _mm256_add_ps(h00, _mm256_mul_ps(_mm256_sub_ps(h10, h00), fu));
+			__m256 h1 = _mm256_add_ps(h01, _mm256_mul_ps(_mm256_sub_ps(h11, h01), fu));
+			__m256 h = _mm256_add_ps(h0, _mm256_mul_ps(_mm256_sub_ps(h1, h0), fv));
+			_mm256_storeu_ps(heights + k, _mm256_mul_ps(h, kMaxHeight));
+		}
+
+		// Remainder
+		HeightsScalar(x + k, z + k, heights + k, count - k);
+	}
+
+	std::vector<float> heights_;  // Normalized, row-major
+	int width_ = 0;
+	int height_ = 0;
+	float scale_u_ = 1.0f;  // Cell space = world * scale + offset
+	float scale_v_ = 1.0f;
+	float offset_u_ = 0.0f;
+	float offset_v_ = 0.0f;
+	float max_height_ = 1.0f;
+
+	std::vector<std::vector<vmath::vec2>> levels_;  // Min/max pyramid (level 0 == cells), row-major (min, max) normalized heights
+	std::vector<std::pair<int, int>> level_sides_;  // Nodes per side (width, height) of every level
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+/*
+	CPU reference of the terrain normal map generated by the compute pass (see InitializeNormalMap), used to validate it.
+
+	The normal map stores the height gradient (dh/dx, dh/dz) of every texel rather than a unit normal: normalized height per world unit, from central differences
+	of the heightmap (which repeats). The normal for any height scale is then normalize(-dh/dx * max_height, 1, -dh/dz * max_height), so changing max_height
+	does not invalidate the map, and the mip chain is exact: the gradient of the box filtered heights is the box filtered gradient (2x2 average per level).
+
+	Two ways to generate level 0, with identical results:
+	- Scalar: one texel at a time
+	- SSE: 4 texels of a row at a time (SSE2 is part of x64, so no runtime check is needed); borders (wrapped neighbours) fall back to scalar
+*/
+
+#include <cstddef>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+
+/// <summary>
+/// Gradient of texel (x, y) of a width x height heightmap (row-major, repeating); scales are texels per world unit / 2, along X (width) and Z (height)
+/// </summary>
+inline void TerrainGradient(const float* heights, int width, int height, float scale_x, float scale_z, int x, int y, float* gradient)
+{
+	int x0 = (x + width - 1) % width;
+	int x1 = (x + 1) % width;
+	int y0 = (y + height - 1) % height;
+	int y1 = (y + 1) % height;
+	gradient[0] = (heights[y * width + x1] - heights[y * width + x0]) * scale_x;
+	gradient[1] = (heights[y1 * width + x] - heights[y0 * width + x]) * scale_z;
+}
+
+#pragma region Level 0 kernels
+
+/// <summary>
+/// Gradients (2 floats per texel, row-major) of the whole heightmap
+/// </summary>
+inline void TerrainGradientsScalar(const float* heights, int width, int height, float scale_x, float scale_z, float* gradients)
+{
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			TerrainGradient(heights, width, height, scale_x, scale_z, x, y, gradients + 2 * ((size_t)y * width + x));
+		}
+	}
+}
+
+inline void TerrainGradientsSse(const float* heights, int width, int height, float scale_x, float scale_z, float* gradients)
+{
+	const __m128 kScaleX = _mm_set1_ps(scale_x);
+	const __m128 kScaleZ = _mm_set1_ps(scale_z);
+
+	for (int y = 0; y < height; y++)
+	{
+		const float* row = heights + (size_t)y * width;
+		const float* row_above = heights + (size_t)((y + height - 1) % height) * width;
+		const float* row_below = heights + (size_t)((y + 1) % height) * width;
+		float* output = gradients + 2 * (size_t)y * width;
+
+		// First texel wraps to the last one of the row
+		TerrainGradient(heights, width, height, scale_x, scale_z, 0, y, output);
+
+		int x = 1;
+		for (; x + 4 < width; x += 4)
+		{
+			__m128 dx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(row + x + 1), _mm_loadu_ps(row + x - 1)), kScaleX);
+			__m128 dz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(row_below + x), _mm_loadu_ps(row_above + x)), kScaleZ);
+
+			// Interleave (dx, dz) per texel
+			_mm_storeu_ps(output + 2 * x, _mm_unpacklo_ps(dx, dz));
+			_mm_storeu_ps(output + 2 * x + 4, _mm_unpackhi_ps(dx, dz));
+		}
+
+		// Remainder (last texel wraps to the first one)
+		for (; x < width; x++)
+		{
+			TerrainGradient(heights, width, height, scale_x, scale_z, x, y, output + 2 * x);
+		}
+	}
+}
+
+#pragma endregion
+
+/// <summary>
+/// Next mip level of a gradient level (width x height, both even): average of every 2 x 2 texels
+/// </summary>
+inline void TerrainGradientMipSse(const float* finer, int width, int height, float* coarser)
+{
+	const __m128 kQuarter = _mm_set1_ps(0.25f);
+
+	for (int y = 0; y < height / 2; y++)
+	{
+		const float* row0 = finer + 2 * (size_t)(y * 2) * width;
+		const float* row1 = row0 + 2 * (size_t)width;
+		float* output = coarser + 2 * (size_t)y * (width / 2);
+
+		for (int x = 0; x < width / 2; x++)
+		{
+			// (dx, dz) of 2 texels per row: add rows, then both halves
+			__m128 sum = _mm_add_ps(_mm_loadu_ps(row0 + 4 * x), _mm_loadu_ps(row1 + 4 * x));
+			sum = _mm_mul_ps(_mm_add_ps(sum, _mm_movehl_ps(sum, sum)), kQuarter);
+			_mm_storel_pi((__m64*)(output + 2 * x), sum);
+		}
+	}
+}
+
+/// <summary>
+/// Every level of the normal map (level 0 first), down to 1 x 1; width and height are powers of two
+/// </summary>
+inline std::vector<std::vector<float>> TerrainNormalMapSse(const float* heights, int width, int height, float scale_x, float scale_z)
+{
+	std::vector<std::vector<float>> levels(1, std::vector<float>(2 * (size_t)width * height));
+	TerrainGradientsSse(heights, width, height, scale_x, scale_z, levels[0].data());
+
+	while (width > 1 || height > 1)
+	{
+		// Non-square maps: once a side is 1 texel, only the other one keeps halving (pairs of texels are averaged)
+		int next_width = width > 1 ? width / 2 : 1;
+		int next_height = height > 1 ? height / 2 : 1;
+		std::vector<float> next(2 * (size_t)next_width * next_height);
+		if (width > 1 && height > 1)
+		{
+			TerrainGradientMipSse(levels.back().data(), width, height, next.data());
+		}
+		else
+		{
+			const std::vector<float>& finer = levels.back();
+			for (size_t i = 0; i < next.size() / 2; i++)
+			{
+				size_t a = width > 1 ? 2 * i : i * 2 * width;
+				size_t b = width > 1 ? 2 * i + 1 : i * 2 * width + width;
+				next[2 * i] = (finer[2 * a] + finer[2 * b]) * 0.5f;
+				next[2 * i + 1] = (finer[2 * a + 1] + finer[2 * b + 1]) * 0.5f;
+			}
+		}
+
+		levels.push_back(next);
+		width = next_width;
+		height = next_height;
+	}
+
+	return levels;
+}
@@ -0,0 +1,382 @@
+#pragma once
+
+/*
+	Min/max height quadtree over a square grid of terrain patches (side is a power of two), used to cull the patches on the CPU before drawing.
+	Level 0 holds one node per patch, and every upper level halves the side (as a mip chain), up to the root (level log2(side), one node): each node keeps the min and max normalized height of its area.
+	Patch bounds are gathered from the heightmap texels the tessellation evaluation shader may sample within the patch (including the bilinear filter footprint; the heightmap repeats), so a patch box always encloses its displaced surface.
+
+	Culling walks the tree from the root against the frustum planes, testing the bounding box of every node (height scaled at cull time, so it can change every frame):
+	- Outside any plane: whole subtree is rejected
+	- Inside every plane: every patch of the subtree is emitted without further tests
+	- Otherwise: children are walked, testing only the planes the node box crosses
+	Emitted patch indices are the ones of the full grid draw (row-major; index = z * side + x), so the vertex shader only has to replace gl_InstanceID with the emitted index.
+
+	The same tree selects the nodes of the CDLOD renderer (continuous distance-dependent level of detail, no tessellation): every level has a range (distance
+	to the camera, doubling per level), and a node is drawn whole, as one grid mesh, once it lies beyond the range of the level below; children beyond their
+	own range are drawn as quarters of the node at its level (a mesh of half the resolution), so the detail always drops one level at a time.
+*/
+
+#include <vector>
+#include <cmath>
+#include "vmath.h"
+
+struct TerrainCullStats
+{
+	unsigned int visited_nodes;  // Nodes tested against the frustum
+	unsigned int visible_patches;
+};
+
+struct TerrainLodNode
+{
+	float x;  // World position of the node corner (min X, min Z)
+	float z;
+	float side;  // World units
+	float level;  // LOD level (0 == patch), whose range drives the morph
+};
+
+struct TerrainLodStats
+{
+	unsigned int visited_nodes;
+	unsigned int nodes;  // Whole nodes
+	unsigned int quarter_nodes;  // Quarters of a node drawn at its level
+};
+
+class TerrainQuadtree
+{
+public:
+
+	/// <summary>
+	/// Build the tree for a grid_side x grid_side patch grid covering the whole heightmap (width x height normalized heights, row-major)
+	/// </summary>
+	void Build(const float* heights, int width, int height, int grid_side)
+	{
+		grid_side_ = grid_side;
+		level_total_ = 1;
+		while ((1 << (level_total_ - 1)) < grid_side)
+		{
+			level_total_++;
+		}
+
+		levels_.assign(level_total_, std::vector<vmath::vec2>());
+
+		// Level 0: texels sampled within each patch, plus the neighbour texel on every side (bilinear filter)
+		levels_[0].resize(grid_side * grid_side);
+		for (int z = 0; z < grid_side; z++)
+		{
+			for (int x = 0; x < grid_side; x++)
+			{
+				int u0 = (x * width) / grid_side - 1;
+				int u1 = ((x + 1) * width + grid_side - 1) / grid_side;
+				int v0 = (z * height) / grid_side - 1;
+				int v1 = ((z + 1) * height + grid_side - 1) / grid_side;
+
+				float min_height = 1.0e30f;
+				float max_height = -1.0e30f;
+				for (int v = v0; v <= v1; v++)
+				{
+					const float* row = heights + ((v + height) % height) * width;
+					for (int u = u0; u <= u1; u++)
+					{
+						float h = row[(u + width) % width];
+						min_height = h < min_height ? h : min_height;
+						max_height = h > max_height ? h : max_height;
+					}
+				}
+
+				levels_[0][z * grid_side + x] = vmath::vec2(min_height, max_height);
+			}
+		}
+
+		// Upper levels: bounds of the 4 children
+		for (int level = 1; level < level_total_; level++)
+		{
+			int side = grid_side >> level;
+			const std::vector<vmath::vec2>& children = levels_[level - 1];
+			levels_[level].resize(side * side);
+			for (int z = 0; z < side; z++)
+			{
+				for (int x = 0; x < side; x++)
+				{
+					const vmath::vec2& c00 = children[(z * 2) * (side * 2) + x * 2];
+					const vmath::vec2& c10 = children[(z * 2) * (side * 2) + x * 2 + 1];
+					const vmath::vec2& c01 = children[(z * 2 + 1) * (side * 2) + x * 2];
+					const vmath::vec2& c11 = children[(z * 2 + 1) * (side * 2) + x * 2 + 1];
+					levels_[level][z * side + x] = vmath::vec2(fminf(fminf(c00[0], c10[0]), fminf(c01[0], c11[0])),
+															   fmaxf(fmaxf(c00[1], c10[1]), fmaxf(c01[1], c11[1])));
+				}
+			}
+		}
+	}
+
+	/// <summary>
+	/// Write the indices of the patches inside the frustum (world space planes, pointing inwards) into 'patches' (room for every patch); returns the number written
+	/// Patch (x, z) covers [origin.x + x * patch_side, origin.x + (x + 1) * patch_side] along X (same along Z), and its heights are scaled by max_height
+	/// </summary>
+	unsigned int Cull(const vmath::vec4 planes[6], float max_height, float patch_side, vmath::vec2 origin, unsigned int* patches, TerrainCullStats* stats)
+	{
+		planes_ = planes;
+		max_height_ = max_height;
+		patch_side_ = patch_side;
+		origin_ = origin;
+		patches_ = patches;
+		stats_ = { 0, 0 };
+
+		Walk(level_total_ - 1, 0, 0, 0x3F);
+
+		if (stats != NULL)
+		{
+			*stats = stats_;
+		}
+
+		return stats_.visible_patches;
+	}
+
+	/// <summary>
+	/// Write the indices of every patch (no culling); returns the number written
+	/// </summary>
+	unsigned int All(unsigned int* patches, TerrainCullStats* stats)
+	{
+		patches_ = patches;
+		stats_ = { 0, 0 };
+
+		Emit(level_total_ - 1, 0, 0);
+
+		if (stats != NULL)
+		{
+			*stats = stats_;
+		}
+
+		return stats_.visible_patches;
+	}
+
+	/// <summary>
+	/// Select the CDLOD nodes around the camera (ranges[level]: distance up to which a node of that level may be drawn; the root one covers the whole grid)
+	/// Whole nodes are written from the front of 'nodes' and quarter nodes from its back (room for every patch: together they tile the grid); returns the whole node count
+	/// Frustum planes may be NULL (no culling); same node layout as Cull
+	/// </summary>
+	unsigned int SelectLod(const vmath::vec4 planes[6], const vmath::vec3& camera, const float* ranges, float max_height, float patch_side, vmath::vec2 origin,
+		TerrainLodNode* nodes, TerrainLodStats* stats)
+	{
+		planes_ = planes;
+		camera_ = camera;
+		ranges_ = ranges;
+		max_height_ = max_height;
+		patch_side_ = patch_side;
+		origin_ = origin;
+		lod_nodes_ = nodes;
+		lod_stats_ = { 0, 0, 0 };
+
+		if (!LodWalk(level_total_ - 1, 0, 0, planes != NULL ? 0x3F : 0))
+		{
+			LodEmit(level_total_ - 1, 0, 0, level_total_ - 1);  // Root out of its range: drawn anyway
+		}
+
+		if (stats != NULL)
+		{
+			*stats = lod_stats_;
+		}
+
+		return lod_stats_.nodes;
+	}
+
+	/// <summary>
+	/// Normalized height bounds (min, max) of patch (x, z)
+	/// </summary>
+	vmath::vec2 PatchBounds(int x, int z) const
+	{
+		return levels_[0][z * grid_side_ + x];
+	}
+
+	/// <summary>
+	/// Normalized height bounds (min, max) of node (x, z) of a level (0 == patches; level_total - 1 == root)
+	/// </summary>
+	vmath::vec2 NodeBounds(int level, int x, int z) const
+	{
+		return levels_[level][z * (grid_side_ >> level) + x];
+	}
+
+	int GridSide() const
+	{
+		return grid_side_;
+	}
+
+	int LevelTotal() const
+	{
+		return level_total_;
+	}
+
+private:
+
+	// plane_mask: bit i set if plane i still has to be tested (the parent box crosses it)
+	void Walk(int level, int x, int z, unsigned int plane_mask)
+	{
+		stats_.visited_nodes++;
+
+		vmath::vec3 box_min;
+		vmath::vec3 box_max;
+		NodeBox(level, x, z, &box_min, &box_max);
+		if (!BoxInsidePlanes(box_min, box_max, &plane_mask))
+		{
+			return;
+		}
+
+		if (plane_mask == 0 || level == 0)
+		{
+			Emit(level, x, z);
+			return;
+		}
+
+		for (int child = 0; child < 4; child++)
+		{
+			Walk(level - 1, x * 2 + (child & 1), z * 2 + (child >> 1), plane_mask);
+		}
+	}
+
+	// Every patch under node (x, z) of a level
+	void Emit(int level, int x, int z)
+	{
+		int side = 1 << level;
+		for (int pz = z * side; pz < (z + 1) * side; pz++)
+		{
+			for (int px = x * side; px < (x + 1) * side; px++)
+			{
+				patches_[stats_.visible_patches++] = (unsigned int)(pz * grid_side_ + px);
+			}
+		}
+	}
+
+	// Node box (world space)
+	void NodeBox(int level, int x, int z, vmath::vec3* box_min, vmath::vec3* box_max) const
+	{
+		float node_side = (float)(1 << level) * patch_side_;
+		vmath::vec2 bounds = levels_[level][z * (grid_side_ >> level) + x];
+		float y0 = bounds[0] * max_height_;
+		float y1 = bounds[1] * max_height_;
+		*box_min = vmath::vec3(origin_[0] + x * node_side, fminf(y0, y1), origin_[1] + z * node_side);
+		*box_max = vmath::vec3((*box_min)[0] + node_side, fmaxf(y0, y1), (*box_min)[2] + node_side);
+	}
+
+	// False if the box is outside a plane of plane_mask; planes the box is fully inside are cleared from plane_mask
+	bool BoxInsidePlanes(const vmath::vec3& box_min, const vmath::vec3& box_max, unsigned int* plane_mask) const
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			if ((*plane_mask & (1u << i)) == 0)
+			{
+				continue;
+			}
+
+			// Box corners farthest along (positive vertex) and against (negative vertex) the plane normal
+			const vmath::vec4& plane = planes_[i];
+			float positive = plane[3];
+			float negative = plane[3];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				positive += plane[axis] * (plane[axis] >= 0.0f ? box_max[axis] : box_min[axis]);
+				negative += plane[axis] * (plane[axis] >= 0.0f ? box_min[axis] : box_max[axis]);
+			}
+
+			if (positive < 0.0f)
+			{
+				return false;  // Outside
+			}
+
+			if (negative >= 0.0f)
+			{
+				*plane_mask &= ~(1u << i);  // Inside: children do not need this plane
+			}
+		}
+
+		return true;
+	}
+
+	// Whether any point of the box is within a distance of the camera
+	bool BoxInRange(const vmath::vec3& box_min, const vmath::vec3& box_max, float range) const
+	{
+		float squared_distance = 0.0f;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float d = fmaxf(fmaxf(box_min[axis] - camera_[axis], camera_[axis] - box_max[axis]), 0.0f);
+			squared_distance += d * d;
+		}
+
+		return squared_distance <= range * range;
+	}
+
+	// False if the node is beyond its range (its parent draws the area); frustum culled nodes count as handled
+	bool LodWalk(int level, int x, int z, unsigned int plane_mask)
+	{
+		lod_stats_.visited_nodes++;
+
+		vmath::vec3 box_min;
+		vmath::vec3 box_max;
+		NodeBox(level, x, z, &box_min, &box_max);
+		if (!BoxInRange(box_min, box_max, ranges_[level]))
+		{
+			return false;
+		}
+
+		if (!BoxInsidePlanes(box_min, box_max, &plane_mask))
+		{
+			return true;
+		}
+
+		// Whole node if no part of it is close enough for the level below
+		if (level == 0 || !BoxInRange(box_min, box_max, ranges_[level - 1]))
+		{
+			LodEmit(level, x, z, level);
+			return true;
+		}
+
+		for (int child = 0; child < 4; child++)
+		{
+			int child_x = x * 2 + (child & 1);
+			int child_z = z * 2 + (child >> 1);
+			if (!LodWalk(level - 1, child_x, child_z, plane_mask))
+			{
+				// Child beyond its range: its area at this level, if visible
+				unsigned int child_mask = plane_mask;
+				NodeBox(level - 1, child_x, child_z, &box_min, &box_max);
+				if (BoxInsidePlanes(box_min, box_max, &child_mask))
+				{
+					LodEmit(level - 1, child_x, child_z, level);
+				}
+			}
+		}
+
+		return true;
+	}
+
+	// Node (x, z) of a level drawn at a LOD level: whole node if both match, quarter node otherwise (one level above)
+	void LodEmit(int level, int x, int z, int lod_level)
+	{
+		float node_side = (float)(1 << level) * patch_side_;
+		TerrainLodNode node = { origin_[0] + x * node_side, origin_[1] + z * node_side, node_side, (float)lod_level };
+		if (lod_level == level)
+		{
+			lod_nodes_[lod_stats_.nodes++] = node;
+		}
+		else
+		{
+			lod_nodes_[grid_side_ * grid_side_ - 1 - lod_stats_.quarter_nodes++] = node;
+		}
+	}
+
+	std::vector<std::vector<vmath::vec2>> levels_;  // Per level (0 == patches), row-major (min, max) normalized heights
+	int grid_side_ = 0;
+	int level_total_ = 0;
+
+	// Current walk
+	const vmath::vec4* planes_ = NULL;
+	float max_height_ = 0.0f;
+	float patch_side_ = 1.0f;
+	vmath::vec2 origin_;
+	unsigned int* patches_ = NULL;
+	TerrainCullStats stats_ = { 0, 0 };
+
+	// Current LOD selection
+	vmath::vec3 camera_;
+	const float* ranges_ = NULL;
+	TerrainLodNode* lod_nodes_ = NULL;
+	TerrainLodStats lod_stats_ = { 0, 0, 0 };
+};